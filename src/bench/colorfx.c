@@ -0,0 +1,289 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+// pixel kernel benchmark: times the kernels in pixels.c against the loops they
+// replaced in image.c, which walked each region column by column and transformed
+// every pixel with a scalar call.  both versions run on the same 1080p image and must
+// produce identical pixels.  before that, the color matrix kernel is checked against
+// color_transform() for a range of random matrices, since its SSE2 path does the math
+// in floating point and has to match the integer version bit for bit.
+
+#include "minisphere.h"
+#include "pixels.h"
+
+#include "bench.h"
+#include "xoroshiro.h"
+
+#define IMAGE_WIDTH  1920
+#define IMAGE_HEIGHT 1080
+#define NUM_MATRICES 1000
+#define NUM_PASSES   10
+
+static bool       check_color_fx    (xoro_t* xoro);
+static void       old_apply_fx      (color_t* pixels, int width, int height, color_fx_t matrix);
+static void       old_apply_fx_4    (color_t* pixels, int width, int height, color_fx_t ul_mat, color_fx_t ur_mat, color_fx_t ll_mat, color_fx_t lr_mat);
+static void       old_apply_lookup  (color_t* pixels, int width, int height, const uint8_t lu[256]);
+static void       old_replace_color (color_t* pixels, int width, int height, color_t color, color_t new_color);
+static color_fx_t random_matrix     (xoro_t* xoro, int max_value);
+
+int
+main(int argc, char* argv[])
+{
+	color_fx_t matrices[4];
+	uint8_t    lookup[256];
+	color_t    palette[8];
+	color_t*   pixels_a;
+	color_t*   pixels_b;
+	color_t*   source;
+	double     start_time;
+	double     time;
+	int        num_pixels;
+	xoro_t*    xoro;
+
+	int i, j;
+
+	xoro = xoro_new(812);
+	if (!check_color_fx(xoro))
+		return EXIT_FAILURE;
+
+	// a small palette makes sure there's something for replace_color to replace
+	num_pixels = IMAGE_WIDTH * IMAGE_HEIGHT;
+	for (i = 0; i < 8; ++i) {
+		palette[i] = mk_color((uint8_t)xoro_gen_uint(xoro), (uint8_t)xoro_gen_uint(xoro),
+			(uint8_t)xoro_gen_uint(xoro), (uint8_t)xoro_gen_uint(xoro));
+	}
+	source = malloc(num_pixels * sizeof(color_t));
+	pixels_a = malloc(num_pixels * sizeof(color_t));
+	pixels_b = malloc(num_pixels * sizeof(color_t));
+	for (i = 0; i < num_pixels; ++i)
+		source[i] = palette[xoro_gen_uint(xoro) % 8];
+	for (i = 0; i < 4; ++i)
+		matrices[i] = random_matrix(xoro, 512);
+	for (i = 0; i < 256; ++i)
+		lookup[i] = (uint8_t)(255 - i);
+
+	bench_header("pixel kernels - 1920x1080 (per pixel)");
+
+	memcpy(pixels_a, source, num_pixels * sizeof(color_t));
+	memcpy(pixels_b, source, num_pixels * sizeof(color_t));
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		old_apply_fx(pixels_a, IMAGE_WIDTH, IMAGE_HEIGHT, matrices[0]);
+	time = bench_now() - start_time;
+	bench_result("apply_color_fx, old", time, num_pixels * NUM_PASSES);
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		pixels_apply_color_fx(pixels_b, IMAGE_WIDTH, IMAGE_WIDTH, IMAGE_HEIGHT, matrices[0]);
+	time = bench_now() - start_time;
+	bench_result("apply_color_fx, pixels.c", time, num_pixels * NUM_PASSES);
+	if (memcmp(pixels_a, pixels_b, num_pixels * sizeof(color_t)) != 0) {
+		fprintf(stderr, "MISMATCH: pixels_apply_color_fx()\n");
+		return EXIT_FAILURE;
+	}
+
+	memcpy(pixels_a, source, num_pixels * sizeof(color_t));
+	memcpy(pixels_b, source, num_pixels * sizeof(color_t));
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		old_apply_fx_4(pixels_a, IMAGE_WIDTH, IMAGE_HEIGHT, matrices[0], matrices[1], matrices[2], matrices[3]);
+	time = bench_now() - start_time;
+	bench_result("apply_color_fx_4, old", time, num_pixels * NUM_PASSES);
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		pixels_apply_color_fx_4(pixels_b, IMAGE_WIDTH, IMAGE_WIDTH, IMAGE_HEIGHT, matrices[0], matrices[1], matrices[2], matrices[3]);
+	time = bench_now() - start_time;
+	bench_result("apply_color_fx_4, pixels.c", time, num_pixels * NUM_PASSES);
+	if (memcmp(pixels_a, pixels_b, num_pixels * sizeof(color_t)) != 0) {
+		fprintf(stderr, "MISMATCH: pixels_apply_color_fx_4()\n");
+		return EXIT_FAILURE;
+	}
+
+	memcpy(pixels_a, source, num_pixels * sizeof(color_t));
+	memcpy(pixels_b, source, num_pixels * sizeof(color_t));
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		old_apply_lookup(pixels_a, IMAGE_WIDTH, IMAGE_HEIGHT, lookup);
+	time = bench_now() - start_time;
+	bench_result("apply_lookup, old", time, num_pixels * NUM_PASSES);
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		pixels_apply_lookup(pixels_b, IMAGE_WIDTH, IMAGE_WIDTH, IMAGE_HEIGHT, lookup, lookup, lookup, lookup);
+	time = bench_now() - start_time;
+	bench_result("apply_lookup, pixels.c", time, num_pixels * NUM_PASSES);
+	if (memcmp(pixels_a, pixels_b, num_pixels * sizeof(color_t)) != 0) {
+		fprintf(stderr, "MISMATCH: pixels_apply_lookup()\n");
+		return EXIT_FAILURE;
+	}
+
+	// note: each pass swaps two palette colors back and forth, so there's always
+	//       something to replace.
+	memcpy(pixels_a, source, num_pixels * sizeof(color_t));
+	memcpy(pixels_b, source, num_pixels * sizeof(color_t));
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		old_replace_color(pixels_a, IMAGE_WIDTH, IMAGE_HEIGHT, palette[j % 2], palette[(j + 1) % 2]);
+	time = bench_now() - start_time;
+	bench_result("replace_color, old", time, num_pixels * NUM_PASSES);
+	start_time = bench_now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		pixels_replace_color(pixels_b, IMAGE_WIDTH, IMAGE_WIDTH, IMAGE_HEIGHT, palette[j % 2], palette[(j + 1) % 2]);
+	time = bench_now() - start_time;
+	bench_result("replace_color, pixels.c", time, num_pixels * NUM_PASSES);
+	if (memcmp(pixels_a, pixels_b, num_pixels * sizeof(color_t)) != 0) {
+		fprintf(stderr, "MISMATCH: pixels_replace_color()\n");
+		return EXIT_FAILURE;
+	}
+
+	free(source);
+	free(pixels_a);
+	free(pixels_b);
+	xoro_unref(xoro);
+	return EXIT_SUCCESS;
+}
+
+static bool
+check_color_fx(xoro_t* xoro)
+{
+	// note: the region is 37 pixels wide so that every row also has a scalar tail
+	//       after the last group of four.
+
+	color_fx_t matrix;
+	int        max_value;
+	color_t    expected;
+	color_t    pixels[37 * 8];
+	color_t    source[37 * 8];
+
+	int i, j;
+
+	for (i = 0; i < 37 * 8; ++i) {
+		source[i] = mk_color((uint8_t)xoro_gen_uint(xoro), (uint8_t)xoro_gen_uint(xoro),
+			(uint8_t)xoro_gen_uint(xoro), (uint8_t)xoro_gen_uint(xoro));
+	}
+	for (i = 0; i < NUM_MATRICES; ++i) {
+		// cover small matrices as well as ones near the limit of what the SSE2 path
+		// accepts, and a few beyond it which should take the scalar path.
+		max_value = i % 3 == 0 ? 512 : i % 3 == 1 ? 10922 : 40000;
+		matrix = random_matrix(xoro, max_value);
+		memcpy(pixels, source, sizeof pixels);
+		pixels_apply_color_fx(pixels, 37, 37, 8, matrix);
+		for (j = 0; j < 37 * 8; ++j) {
+			expected = color_transform(source[j], matrix);
+			if (memcmp(&pixels[j], &expected, sizeof(color_t)) != 0) {
+				fprintf(stderr, "MISMATCH: matrix #%d, pixel #%d\n", i, j);
+				return false;
+			}
+		}
+	}
+	printf("\npixels_apply_color_fx() matches color_transform() for %d matrices\n", NUM_MATRICES);
+	return true;
+}
+
+static void
+old_apply_fx(color_t* pixels, int width, int height, color_fx_t matrix)
+{
+	color_t* pixel;
+
+	int x, y;
+
+	for (x = 0; x < width; ++x) for (y = 0; y < height; ++y) {
+		pixel = &pixels[x + y * width];
+		*pixel = color_transform(*pixel, matrix);
+	}
+}
+
+static void
+old_apply_fx_4(color_t* pixels, int width, int height, color_fx_t ul_mat, color_fx_t ur_mat, color_fx_t ll_mat, color_fx_t lr_mat)
+{
+	color_fx_t mat_1, mat_2, mat_3;
+	color_t*   pixel;
+
+	int x, y;
+
+	for (y = 0; y < height; ++y) {
+		mat_1 = color_fx_mix(ul_mat, ll_mat, height - 1 - y, y);
+		mat_2 = color_fx_mix(ur_mat, lr_mat, height - 1 - y, y);
+		for (x = 0; x < width; ++x) {
+			mat_3 = color_fx_mix(mat_1, mat_2, width - 1 - x, x);
+			pixel = &pixels[x + y * width];
+			*pixel = color_transform(*pixel, mat_3);
+		}
+	}
+}
+
+static void
+old_apply_lookup(color_t* pixels, int width, int height, const uint8_t lu[256])
+{
+	uint8_t* pixel;
+
+	int x, y;
+
+	for (x = 0; x < width; ++x) for (y = 0; y < height; ++y) {
+		pixel = (uint8_t*)&pixels[x + y * width];
+		pixel[0] = lu[pixel[0]];
+		pixel[1] = lu[pixel[1]];
+		pixel[2] = lu[pixel[2]];
+		pixel[3] = lu[pixel[3]];
+	}
+}
+
+static void
+old_replace_color(color_t* pixels, int width, int height, color_t color, color_t new_color)
+{
+	uint8_t* pixel;
+
+	int x, y;
+
+	for (x = 0; x < width; ++x) for (y = 0; y < height; ++y) {
+		pixel = (uint8_t*)&pixels[x + y * width];
+		if (pixel[0] == color.r && pixel[1] == color.g && pixel[2] == color.b && pixel[3] == color.a) {
+			pixel[0] = new_color.r;
+			pixel[1] = new_color.g;
+			pixel[2] = new_color.b;
+			pixel[3] = new_color.a;
+		}
+	}
+}
+
+static color_fx_t
+random_matrix(xoro_t* xoro, int max_value)
+{
+	int values[12];
+
+	int i;
+
+	for (i = 0; i < 12; ++i)
+		values[i] = (int)(xoro_gen_double(xoro) * (2 * max_value + 1)) - max_value;
+	return mk_color_fx(
+		values[0], values[1], values[2], values[3],
+		values[4], values[5], values[6], values[7],
+		values[8], values[9], values[10], values[11]);
+}
@@ -0,0 +1,116 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+// module loading benchmark: evaluates a synthetic graph of ES modules, generated in
+// memory so that file I/O doesn't factor in.  module #i imports modules #i+1, #2i+1
+// and #3i+1 (where they exist), so most modules are imported several times and each
+// repeat import has to be found in the module cache by get_module_record().  with a
+// hashed cache the time per module should stay flat as the graph grows.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "jsal.h"
+
+static void handle_import (void);
+static void push_source   (int index);
+
+static int s_num_modules;
+
+int
+main(int argc, char* argv[])
+{
+	static const int SIZES[] = { 100, 1000, 4000 };
+
+	char   label[64];
+	double start_time;
+	double time;
+
+	int i;
+
+	bench_header("module loading - get_module_record()");
+	for (i = 0; i < sizeof SIZES / sizeof SIZES[0]; ++i) {
+		s_num_modules = SIZES[i];
+		if (!jsal_init()) {
+			fprintf(stderr, "couldn't initialize JSAL\n");
+			return EXIT_FAILURE;
+		}
+		jsal_on_import_module(handle_import);
+		start_time = bench_now();
+		push_source(0);
+		if (!jsal_try_eval_module("mod0.mjs", NULL)) {
+			fprintf(stderr, "ERROR: %s\n", jsal_to_string(-1));
+			return EXIT_FAILURE;
+		}
+		time = bench_now() - start_time;
+		jsal_pop(1);
+		jsal_uninit();
+		sprintf(label, "%d modules", s_num_modules);
+		bench_result(label, time, s_num_modules);
+	}
+	return EXIT_SUCCESS;
+}
+
+static void
+handle_import(void)
+{
+	/* [ module_name parent_specifier ] -> [ ... specifier url source ] */
+
+	int         index;
+	const char* specifier;
+
+	specifier = jsal_require_string(0);
+	if (sscanf(specifier, "mod%d.mjs", &index) != 1 || index < 0 || index >= s_num_modules)
+		jsal_error(JS_URI_ERROR, "Couldn't load JS module '%s'", specifier);
+	jsal_push_string(specifier);
+	jsal_push_string(specifier);
+	push_source(index);
+}
+
+static void
+push_source(int index)
+{
+	char  source[256];
+	char* p;
+
+	int i;
+
+	p = source;
+	for (i = 1; i <= 3; ++i) {
+		if (i * index + 1 < s_num_modules)
+			p += sprintf(p, "import \"mod%d.mjs\";\n", i * index + 1);
+	}
+	sprintf(p, "export default %d;\n", index);
+	jsal_push_string(source);
+}
@@ -0,0 +1,154 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+// obstruction map benchmark: compares the segment grid in obstruction.c against a
+// plain linear scan of every segment, which is what obsmap_test_rect() did before
+// the grid was added.  both must agree on every query.
+
+#include "minisphere.h"
+#include "obstruction.h"
+
+#include "bench.h"
+#include "xoroshiro.h"
+
+#define MAP_SIZE    4096
+#define NUM_QUERIES 20000
+
+static bool   linear_test_rect (const rect_t lines[], int num_lines, rect_t rect);
+static rect_t random_line      (xoro_t* xoro);
+static rect_t random_rect      (xoro_t* xoro);
+
+int
+main(int argc, char* argv[])
+{
+	static const int SIZES[] = { 16, 256, 1024, 4096 };
+
+	int       num_hits;
+	int       num_lines;
+	char      label[64];
+	rect_t*   lines;
+	obsmap_t* obsmap;
+	rect_t*   queries;
+	double    start_time;
+	double    time;
+	xoro_t*   xoro;
+
+	int i, j;
+
+	bench_header("obstruction map - obsmap_test_rect()");
+	for (i = 0; i < sizeof SIZES / sizeof SIZES[0]; ++i) {
+		num_lines = SIZES[i];
+		xoro = xoro_new(812);
+		lines = malloc(num_lines * sizeof(rect_t));
+		obsmap = obsmap_new();
+		for (j = 0; j < num_lines; ++j) {
+			lines[j] = random_line(xoro);
+			obsmap_add_line(obsmap, lines[j]);
+		}
+		queries = malloc(NUM_QUERIES * sizeof(rect_t));
+		for (j = 0; j < NUM_QUERIES; ++j)
+			queries[j] = random_rect(xoro);
+
+		// the first test builds the grid, so it's done outside the timed loop.
+		for (j = 0; j < NUM_QUERIES; ++j) {
+			if (obsmap_test_rect(obsmap, queries[j]) != linear_test_rect(lines, num_lines, queries[j])) {
+				fprintf(stderr, "MISMATCH: %d segments, query #%d\n", num_lines, j);
+				return EXIT_FAILURE;
+			}
+		}
+
+		num_hits = 0;
+		start_time = bench_now();
+		for (j = 0; j < NUM_QUERIES; ++j)
+			num_hits += linear_test_rect(lines, num_lines, queries[j]);
+		time = bench_now() - start_time;
+		sprintf(label, "linear scan, %d segments", num_lines);
+		bench_result(label, time, NUM_QUERIES);
+
+		start_time = bench_now();
+		for (j = 0; j < NUM_QUERIES; ++j)
+			num_hits -= obsmap_test_rect(obsmap, queries[j]);
+		time = bench_now() - start_time;
+		sprintf(label, "obsmap, %d segments", num_lines);
+		bench_result(label, time, NUM_QUERIES);
+
+		obsmap_free(obsmap);
+		free(queries);
+		free(lines);
+		xoro_unref(xoro);
+	}
+	return EXIT_SUCCESS;
+}
+
+static bool
+linear_test_rect(const rect_t lines[], int num_lines, rect_t rect)
+{
+	rect_t edges[4];
+
+	int i, j;
+
+	edges[0] = mk_rect(rect.x1, rect.y1, rect.x2, rect.y1);
+	edges[1] = mk_rect(rect.x2, rect.y1, rect.x2, rect.y2);
+	edges[2] = mk_rect(rect.x1, rect.y2, rect.x2, rect.y2);
+	edges[3] = mk_rect(rect.x1, rect.y1, rect.x1, rect.y2);
+	for (i = 0; i < num_lines; ++i) {
+		for (j = 0; j < 4; ++j) {
+			if (do_lines_overlap(edges[j], lines[i]))
+				return true;
+		}
+	}
+	return false;
+}
+
+static rect_t
+random_line(xoro_t* xoro)
+{
+	int x, y;
+
+	// short wall segments, like the ones generated from a tileset's obstruction data
+	x = (int)(xoro_gen_double(xoro) * MAP_SIZE);
+	y = (int)(xoro_gen_double(xoro) * MAP_SIZE);
+	return mk_rect(x, y,
+		x + (int)(xoro_gen_double(xoro) * 64) - 32,
+		y + (int)(xoro_gen_double(xoro) * 64) - 32);
+}
+
+static rect_t
+random_rect(xoro_t* xoro)
+{
+	int x, y;
+
+	// roughly the size of a person's base
+	x = (int)(xoro_gen_double(xoro) * MAP_SIZE);
+	y = (int)(xoro_gen_double(xoro) * MAP_SIZE);
+	return mk_rect(x, y, x + 16, y + 16);
+}
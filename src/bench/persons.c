@@ -0,0 +1,214 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+// person list benchmark: N persons wander around a map and the draw order is fixed
+// up after every frame, first the old way (a full qsort() that normalizes both
+// coordinates on every comparison) and then the way sort_persons() in map_engine.c
+// does it now (cache the normalized Y, then hand the list to sort_nearly_sorted(),
+// which is linked in from the engine).  the person struct and ordering rules here
+// mirror the map engine's; keep them in sync if those change.
+
+#include "minisphere.h"
+#include "sort.h"
+
+#include "bench.h"
+#include "xoroshiro.h"
+
+#define MAP_HEIGHT 4096
+#define NUM_FRAMES 1000
+
+typedef
+struct person
+{
+	int            id;
+	struct person* leader;
+	double         sort_y;
+	double         x;
+	double         y;
+} person_t;
+
+static int    compare_cached    (const void* a, const void* b);
+static int    compare_uncached  (const void* a, const void* b);
+static void   move_persons      (person_t* persons, int num_persons, xoro_t* xoro);
+static double normalize_y       (double y);
+static bool   person_following  (const person_t* person, const person_t* leader);
+static void   sort_incremental  (person_t* list[], int num_persons);
+
+int
+main(int argc, char* argv[])
+{
+	static const int SIZES[] = { 16, 128, 1024 };
+
+	char       label[64];
+	person_t** list_a;
+	person_t** list_b;
+	int        num_persons;
+	person_t*  persons;
+	double     qsort_time;
+	double     start_time;
+	double     isort_time;
+	xoro_t*    xoro;
+
+	int i, j, k;
+
+	bench_header("person list - sort per frame");
+	for (i = 0; i < sizeof SIZES / sizeof SIZES[0]; ++i) {
+		num_persons = SIZES[i];
+		xoro = xoro_new(812);
+		persons = calloc(num_persons, sizeof(person_t));
+		list_a = malloc(num_persons * sizeof(person_t*));
+		list_b = malloc(num_persons * sizeof(person_t*));
+		for (j = 0; j < num_persons; ++j) {
+			persons[j].id = j;
+			// note: positions are whole pixels.  compare_persons() truncates the Y
+			//       difference, which isn't a strict ordering for fractional positions,
+			//       and then the two sorts can legitimately disagree.
+			persons[j].x = floor(xoro_gen_double(xoro) * MAP_HEIGHT);
+			persons[j].y = floor(xoro_gen_double(xoro) * MAP_HEIGHT);
+
+			// every fourth person follows the one before it, like a party
+			persons[j].leader = j % 4 != 0 ? &persons[j - 1] : NULL;
+			list_a[j] = list_b[j] = &persons[j];
+		}
+		qsort_time = isort_time = 0.0;
+		for (j = 0; j < NUM_FRAMES; ++j) {
+			move_persons(persons, num_persons, xoro);
+			start_time = bench_now();
+			qsort(list_a, num_persons, sizeof(person_t*), compare_uncached);
+			qsort_time += bench_now() - start_time;
+			start_time = bench_now();
+			sort_incremental(list_b, num_persons);
+			isort_time += bench_now() - start_time;
+			for (k = 0; k < num_persons; ++k) {
+				if (list_a[k] != list_b[k]) {
+					fprintf(stderr, "MISMATCH: %d persons, frame %d, index %d\n", num_persons, j, k);
+					return EXIT_FAILURE;
+				}
+			}
+		}
+		sprintf(label, "qsort, %d persons", num_persons);
+		bench_result(label, qsort_time, NUM_FRAMES);
+		sprintf(label, "incremental, %d persons", num_persons);
+		bench_result(label, isort_time, NUM_FRAMES);
+		free(list_a);
+		free(list_b);
+		free(persons);
+		xoro_unref(xoro);
+	}
+	return EXIT_SUCCESS;
+}
+
+static int
+compare_cached(const void* a, const void* b)
+{
+	person_t* p1 = *(person_t**)a;
+	person_t* p2 = *(person_t**)b;
+
+	int y_delta;
+
+	y_delta = p1->sort_y - p2->sort_y;
+	if (y_delta != 0)
+		return y_delta;
+	else if (person_following(p1, p2))
+		return -1;
+	else if (person_following(p2, p1))
+		return 1;
+	else
+		return p1->id - p2->id;
+}
+
+static int
+compare_uncached(const void* a, const void* b)
+{
+	person_t* p1 = *(person_t**)a;
+	person_t* p2 = *(person_t**)b;
+
+	int y_delta;
+
+	y_delta = normalize_y(p1->y) - normalize_y(p2->y);
+	if (y_delta != 0)
+		return y_delta;
+	else if (person_following(p1, p2))
+		return -1;
+	else if (person_following(p2, p1))
+		return 1;
+	else
+		return p1->id - p2->id;
+}
+
+static void
+move_persons(person_t* persons, int num_persons, xoro_t* xoro)
+{
+	int i;
+
+	// persons walk at most a couple of pixels per frame; followers stay right behind
+	// their leaders.
+	for (i = 0; i < num_persons; ++i) {
+		if (persons[i].leader != NULL) {
+			persons[i].x = persons[i].leader->x;
+			persons[i].y = persons[i].leader->y - 1.0;
+		}
+		else {
+			persons[i].x += floor(xoro_gen_double(xoro) * 5.0) - 2.0;
+			persons[i].y += floor(xoro_gen_double(xoro) * 5.0) - 2.0;
+		}
+	}
+}
+
+static double
+normalize_y(double y)
+{
+	// the map wraps around, like a repeating map in the engine
+	y = fmod(y, MAP_HEIGHT);
+	return y < 0.0 ? y + MAP_HEIGHT : y;
+}
+
+static bool
+person_following(const person_t* person, const person_t* leader)
+{
+	const person_t* node;
+
+	node = person;
+	while ((node = node->leader))
+		if (node == leader) return true;
+	return false;
+}
+
+static void
+sort_incremental(person_t* list[], int num_persons)
+{
+	int i;
+
+	for (i = 0; i < num_persons; ++i)
+		list[i]->sort_y = normalize_y(list[i]->y);
+	sort_nearly_sorted((void**)list, num_persons, compare_cached);
+}
@@ -0,0 +1,118 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+// property access benchmark: reads and writes a handful of properties on an object
+// over and over, first with the names given as C strings (jsal_get_prop_string() and
+// friends, which use the interned property ID table in jsal.c) and then with each key
+// pushed as a JS string (jsal_get_prop() and jsal_put_prop(), which create a new
+// property ID on every call).  both ways must read back the same values.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "jsal.h"
+
+#define NUM_OPS 1000000
+
+static const char* const KEYS[] =
+{
+	"x", "y", "width", "height", "color", "direction", "frame", "visible",
+};
+
+#define NUM_KEYS (int)(sizeof KEYS / sizeof KEYS[0])
+
+int
+main(int argc, char* argv[])
+{
+	double start_time;
+	double sum_dynamic = 0.0;
+	double sum_interned = 0.0;
+	double time;
+
+	int i;
+
+	if (!jsal_init()) {
+		fprintf(stderr, "couldn't initialize JSAL\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_header("property access - jsal_{get,put}_prop*()");
+	jsal_push_new_object();
+
+	start_time = bench_now();
+	for (i = 0; i < NUM_OPS; ++i) {
+		jsal_push_int(i);
+		jsal_put_prop_string(-2, KEYS[i % NUM_KEYS]);
+	}
+	time = bench_now() - start_time;
+	bench_result("put, interned name", time, NUM_OPS);
+
+	start_time = bench_now();
+	for (i = 0; i < NUM_OPS; ++i) {
+		jsal_get_prop_string(-1, KEYS[i % NUM_KEYS]);
+		sum_interned += jsal_get_int(-1);
+		jsal_pop(1);
+	}
+	time = bench_now() - start_time;
+	bench_result("get, interned name", time, NUM_OPS);
+
+	start_time = bench_now();
+	for (i = 0; i < NUM_OPS; ++i) {
+		jsal_push_string(KEYS[i % NUM_KEYS]);
+		jsal_push_int(i);
+		jsal_put_prop(-3);
+	}
+	time = bench_now() - start_time;
+	bench_result("put, dynamic key", time, NUM_OPS);
+
+	start_time = bench_now();
+	for (i = 0; i < NUM_OPS; ++i) {
+		jsal_push_string(KEYS[i % NUM_KEYS]);
+		jsal_get_prop(-2);
+		sum_dynamic += jsal_get_int(-1);
+		jsal_pop(1);
+	}
+	time = bench_now() - start_time;
+	bench_result("get, dynamic key", time, NUM_OPS);
+
+	jsal_pop(1);
+	jsal_uninit();
+
+	if (sum_interned != sum_dynamic) {
+		fprintf(stderr, "MISMATCH: %.0f (interned) vs. %.0f (dynamic)\n",
+			sum_interned, sum_dynamic);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -37,6 +37,7 @@
 #include "compress.h"
 #include "encoding.h"
 #include "fs.h"
+#include "cache.h"
 #include "image.h"
 #include "spk_writer.h"
 #include "target.h"
@@ -48,8 +49,14 @@
 struct build
 {
 	vector_t*     artifacts;
+	path_t*       cache_path;
 	bool          crashed;
 	fs_t*         fs;
+	bool          is_reported;
+	vector_t*     modules;
+	int           num_errors_reported;
+	int           num_warns_reported;
+	char*         script_name;
 	vector_t*     targets;
 	time_t        timestamp;
 	visor_t*      visor;
@@ -134,12 +141,13 @@ static void js_TextDecoder_finalize     (void* host_ptr);
 static void js_TextEncoder_finalize     (void* host_ptr);
 static void js_Tool_finalize            (void* host_ptr);
 
+static void    add_module_file      (const char* filename);
 static void    cache_value_to_this  (const char* key);
 static void    clean_old_artifacts  (build_t* build, bool keep_targets);
 static bool    eval_module_file     (fs_t* fs, const char* filename);
 static path_t* find_module_file     (fs_t* fs, const char* id, const char* origin, const char* sys_origin);
 static void    handle_module_import (void);
-static bool    install_target       (int num_args, bool is_ctor, intptr_t magic);
+static bool    install_target       (const fs_t* fs, const path_t* out_path, const vector_t* in_paths);
 static path_t* load_package_json    (const char* filename);
 static void    make_file_targets    (fs_t* fs, const char* wildcard, const path_t* path, const path_t* subdir, vector_t* targets, bool recursive, time_t timestamp);
 static void    package_dir          (build_t* build, spk_writer_t* spk, const char* from_dirname, const char* to_dirname);
@@ -151,7 +159,7 @@ static build_t*     s_build;
 static unsigned int s_next_module_id = 1;
 
 build_t*
-build_new(const path_t* source_path, const path_t* out_path)
+build_new(const path_t* source_path, const path_t* out_path, const path_t* cache_path)
 {
 	vector_t*    artifacts;
 	build_t*     build;
@@ -257,9 +265,10 @@ build_new(const path_t* source_path, const path_t* out_path)
 	jsal_pop(1);
 
 	// create a Tool for the install() function to use
+	// note: installing is just a file copy, so it's done natively.  that way installs
+	//       don't need the JS engine and can run on a worker thread.
 	jsal_push_hidden_stash();
-	jsal_push_new_function(install_target, "doInstall", 0, 0);
-	jsal_push_class_obj(CELL_TOOL, tool_new("installing"), false);
+	jsal_push_class_obj(CELL_TOOL, tool_new_native("installing", install_target), false);
 	jsal_put_prop_string(-2, "installTool");
 	jsal_pop(1);
 
@@ -287,6 +296,9 @@ build_new(const path_t* source_path, const path_t* out_path)
 	build->visor = visor;
 	build->fs = fs;
 	build->artifacts = artifacts;
+	if (cache_path != NULL)
+		build->cache_path = path_dup(cache_path);
+	build->modules = vector_new(sizeof(char*));
 	build->targets = vector_new(sizeof(target_t*));
 	return build;
 }
@@ -299,24 +311,49 @@ build_free(build_t* build)
 	if (build == NULL)
 		return;
 
-	if (!build->crashed) {
-		printf("%d error(s), %d warning(s).\n",
-			visor_num_errors(build->visor),
-			visor_num_warns(build->visor));
-	}
+	if (!build->is_reported)
+		build_report(build);
 
 	iter = vector_enum(build->artifacts);
+	while (iter_next(&iter))
+		free(*(char**)iter.ptr);
+	iter = vector_enum(build->modules);
 	while (iter_next(&iter))
 		free(*(char**)iter.ptr);
 	iter = vector_enum(build->targets);
 	while (iter_next(&iter))
 		target_free(*(target_t**)iter.ptr);
 
+	vector_free(build->modules);
 	fs_free(build->fs);
 	visor_free(build->visor);
+	path_free(build->cache_path);
+	free(build->script_name);
 	free(build);
 }
 
+bool
+build_can_update(const build_t* build, vector_t* filenames)
+{
+	// note: targets are declared by the Cellscript, so if it or any module it loaded
+	//       has changed, the whole thing needs to be evaluated again.
+
+	path_t**     path_ptr;
+	const char** module_ptr;
+
+	iter_t iter, iter_j;
+
+	iter = vector_enum(filenames);
+	while ((path_ptr = iter_next(&iter))) {
+		iter_j = vector_enum(build->modules);
+		while ((module_ptr = iter_next(&iter_j))) {
+			if (strcmp(path_cstr(*path_ptr), *module_ptr) == 0)
+				return false;
+		}
+	}
+	return true;
+}
+
 bool
 build_eval(build_t* build, const char* filename)
 {
@@ -332,6 +369,8 @@ build_eval(build_t* build, const char* filename)
 
 	visor_begin_op(build->visor, "evaluating '%s'", filename);
 	build->timestamp = stats.st_mtime;
+	free(build->script_name);
+	build->script_name = strdup(filename);
 	if (!eval_module_file(build->fs, filename)) {
 		build->crashed = true;
 		is_ok = false;
@@ -372,23 +411,30 @@ build_clean(build_t* build)
 {
 	clean_old_artifacts(build, false);
 	fs_unlink(build->fs, "@/artifacts.json");
+	fs_unlink(build->fs, "@/.cell-cache");
 	return true;
 }
 
 bool
-build_package(build_t* build, const char* filename)
+build_package(build_t* build, const char* filename, int version, bool store_media, int num_jobs)
 {
 	const path_t* in_path;
 	path_t*       out_path;
 	spk_writer_t* spk;
+	bool          succeeded;
 	target_t**    target_ptr;
 
 	iter_t iter;
 
 	visor_begin_op(build->visor, "packaging game to '%s'", filename);
-	spk = spk_create(filename);
+	if (!(spk = spk_create(filename, version, store_media, num_jobs, build->visor))) {
+		visor_error(build->visor, "couldn't create package '%s'", filename);
+		visor_end_op(build->visor);
+		return false;
+	}
 	spk_add_file(spk, build->fs, "@/game.json", "game.json");
-	spk_add_file(spk, build->fs, "@/game.sgm", "game.sgm");
+	if (fs_fexist(build->fs, "@/game.sgm"))
+		spk_add_file(spk, build->fs, "@/game.sgm", "game.sgm");
 	package_dir(build, spk, "#/", "#/");
 	iter = vector_enum(build->targets);
 	while ((target_ptr = iter_next(&iter))) {
@@ -404,14 +450,31 @@ build_package(build_t* build, const char* filename)
 		path_free(out_path);
 		visor_end_op(build->visor);
 	}
-	spk_close(spk);
+	succeeded = spk_close(spk);
 	visor_end_op(build->visor);
-	return true;
+	return succeeded;
+}
+
+void
+build_report(build_t* build)
+{
+	// note: only errors and warnings since the last report are counted.  in watch mode
+	//       this gives each rebuild its own summary.
+
+	if (!build->crashed) {
+		printf("%d error(s), %d warning(s).\n",
+			visor_num_errors(build->visor) - build->num_errors_reported,
+			visor_num_warns(build->visor) - build->num_warns_reported);
+	}
+	build->num_errors_reported = visor_num_errors(build->visor);
+	build->num_warns_reported = visor_num_warns(build->visor);
+	build->is_reported = true;
 }
 
 bool
-build_run(build_t* build, bool want_debug, bool rebuild_all)
+build_run(build_t* build, bool want_debug, bool rebuild_all, int num_jobs)
 {
+	cache_t*      cache;
 	const char*   filename;
 	vector_t*     filenames;
 	const char*   json;
@@ -421,6 +484,7 @@ build_run(build_t* build, bool want_debug, bool rebuild_all)
 	const path_t* path;
 	const path_t* source_path;
 	vector_t*     sorted_targets;
+	vector_t*     targets;
 	target_t**    target_ptr;
 
 	iter_t iter;
@@ -453,13 +517,18 @@ build_run(build_t* build, bool want_debug, bool rebuild_all)
 	}
 
 	// build all relevant targets
+	targets = vector_new(sizeof(target_t*));
 	iter = vector_enum(build->targets);
 	while ((target_ptr = iter_next(&iter))) {
 		path = target_path(*target_ptr);
 		if (path_num_hops(path) == 0 || !path_hop_is(path, 0, "@"))
 			continue;
-		target_build(*target_ptr, build->visor, rebuild_all);
+		vector_push(targets, target_ptr);
 	}
+	cache = cache_open(build->fs, "@/.cell-cache", build->script_name, build->cache_path);
+	target_build(targets, build->visor, cache, rebuild_all, num_jobs);
+	cache_close(cache, false);
+	vector_free(targets);
 	visor_end_op(build->visor);
 
 	// add metadata
@@ -524,6 +593,59 @@ finished:
 	return visor_num_errors(build->visor) == 0;
 }
 
+bool
+build_update(build_t* build, vector_t* filenames, int num_jobs)
+{
+	// note: this is the fast path for watch mode.  the Cellscript isn't evaluated again,
+	//       only installed targets built from one of the changed files are rebuilt, and
+	//       the manifests are left alone as nothing they describe has changed.
+
+	cache_t*      cache;
+	int           num_errors;
+	const path_t* path;
+	vector_t*     targets;
+	target_t**    target_ptr;
+
+	iter_t iter;
+
+	num_errors = visor_num_errors(build->visor);
+	targets = vector_new(sizeof(target_t*));
+	iter = vector_enum(build->targets);
+	while ((target_ptr = iter_next(&iter))) {
+		path = target_path(*target_ptr);
+		if (path_num_hops(path) == 0 || !path_hop_is(path, 0, "@"))
+			continue;
+		if (target_depends_on(*target_ptr, filenames))
+			vector_push(targets, target_ptr);
+	}
+	if (vector_len(targets) > 0) {
+		visor_begin_op(build->visor, "rebuilding %d target(s)", vector_len(targets));
+		cache = cache_open(build->fs, "@/.cell-cache", build->script_name, build->cache_path);
+		target_build(targets, build->visor, cache, false, num_jobs);
+		cache_close(cache, true);
+		visor_end_op(build->visor);
+	}
+	vector_free(targets);
+
+	num_errors = visor_num_errors(build->visor) - num_errors;
+	if (num_errors > 0) {
+		// same as build_run(), don't leave behind a manifest for a broken build
+		fs_unlink(build->fs, "@/game.json");
+		fs_unlink(build->fs, "@/game.sgm");
+	}
+	build->is_reported = false;
+	return num_errors == 0;
+}
+
+static void
+add_module_file(const char* filename)
+{
+	char* filename_copy;
+
+	filename_copy = strdup(filename);
+	vector_push(s_build->modules, &filename_copy);
+}
+
 static void
 cache_value_to_this(const char* key)
 {
@@ -602,6 +724,7 @@ eval_module_file(fs_t* fs, const char* filename)
 		jsal_pop(3);
 	}
 
+	add_module_file(filename);
 	source = fs_fslurp(fs, filename, &source_size);
 	code_string = lstr_from_utf8(source, source_size, true);
 	free(source);
@@ -795,6 +918,7 @@ handle_module_import(void)
 		jsal_throw();
 	}
 	if (path_has_extension(path, ".mjs")) {
+		add_module_file(path_cstr(path));
 		source = fs_fslurp(s_build->fs, path_cstr(path), &source_len);
 		jsal_push_string(path_cstr(path));
 		jsal_dup(-1);
@@ -810,24 +934,19 @@ handle_module_import(void)
 }
 
 static bool
-install_target(int num_args, bool is_ctor, intptr_t magic)
+install_target(const fs_t* fs, const path_t* out_path, const vector_t* in_paths)
 {
 	// note: install targets never have more than one source because an individual
 	//       target is constructed for each file installed.
 
-	int         result;
-	const char* source_path;
-	const char* target_path;
+	const path_t* source_path;
 
-	target_path = jsal_require_string(0);
-	jsal_get_prop_index(1, 0);
-	source_path = jsal_require_string(-1);
+	source_path = *(path_t**)vector_get(in_paths, 0);
+	if (fs_fcopy(fs, path_cstr(out_path), path_cstr(source_path), true) != 0)
+		return false;
 
-	result = fs_fcopy(s_build->fs, target_path, source_path, true);
-	if (result == 0)
-		// touch file to prevent "target file unchanged" warning
-		fs_utime(s_build->fs, target_path, NULL);
-	jsal_push_boolean(result == 0);
+	// touch file to prevent "target file unchanged" warning
+	fs_utime(fs, path_cstr(out_path), NULL);
 	return true;
 }
 
@@ -47,11 +47,14 @@ enum cell_class
 
 typedef struct build build_t;
 
-build_t* build_new     (const path_t* source_path, const path_t* out_path);
-void     build_free    (build_t* build);
-bool     build_clean   (build_t* build);
-bool     build_eval    (build_t* build, const char* filename);
-bool     build_package (build_t* build, const char* filename);
-bool     build_run     (build_t* build, bool want_debug, bool rebuild_all);
+build_t* build_new        (const path_t* source_path, const path_t* out_path, const path_t* cache_path);
+void     build_free       (build_t* build);
+bool     build_can_update (const build_t* build, vector_t* filenames);
+bool     build_clean      (build_t* build);
+bool     build_eval       (build_t* build, const char* filename);
+bool     build_package    (build_t* build, const char* filename, int version, bool store_media, int num_jobs);
+void     build_report     (build_t* build);
+bool     build_run        (build_t* build, bool want_debug, bool rebuild_all, int num_jobs);
+bool     build_update     (build_t* build, vector_t* filenames, int num_jobs);
 
 #endif // SPHERE__BUILD_H__INCLUDED
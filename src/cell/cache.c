@@ -0,0 +1,507 @@
+/**
+ *  Cell, the Sphere packaging compiler
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "cell.h"
+#include "cache.h"
+
+#include "fs.h"
+#include "md5.h"
+#include "thread.h"
+
+// the build cache keeps track of what each target was last built from, so that targets
+// can be skipped when none of their inputs have changed, even if the timestamps have.
+// the key for a target is a hash of everything that goes into building it: the tool,
+// the Cellscript and the contents of each source file.
+
+#define CACHE_SIGNATURE "# Cell build cache v1"
+
+struct file_hash
+{
+	char*   filename;
+	char    hash[33];
+	bool    is_used;
+	time_t  mtime;
+	int64_t size;
+};
+
+struct record
+{
+	char* filename;
+	bool  is_used;
+	char  key[33];
+	char  out_hash[33];
+};
+
+struct name_slot
+{
+	const char* name;
+	uint32_t    hash;
+	int         index;
+};
+
+struct name_index
+{
+	int               num_slots;
+	int               num_used;
+	struct name_slot* slots;
+};
+
+struct cache
+{
+	char*             filename;
+	vector_t*         files;
+	struct name_index file_index;
+	const fs_t*       fs;
+	mutex_t*          mutex;
+	struct name_index record_index;
+	vector_t*         records;
+	char              salt[33];
+	path_t*           store_path;
+};
+
+static struct file_hash* find_file_hash (cache_t* cache, const char* filename);
+static struct record*    find_record    (cache_t* cache, const char* filename);
+static bool              hash_file      (cache_t* cache, const char* filename, char* out_hash);
+static void              hex_digest     (MD5_CTX* ctx, char* out_hash);
+static void              index_add      (struct name_index* index, const char* name, int value);
+static int               index_find     (const struct name_index* index, const char* name);
+static uint32_t          index_hash     (const char* name);
+static void              load_database  (cache_t* cache);
+static char*             store_filename (const cache_t* cache, const char* key);
+
+cache_t*
+cache_open(const fs_t* fs, const char* filename, const char* script_name, const path_t* store_path)
+{
+	cache_t* cache;
+	MD5_CTX  ctx;
+	char     script_hash[33] = "";
+
+	cache = calloc(1, sizeof(cache_t));
+	cache->fs = fs;
+	cache->filename = strdup(filename);
+	cache->files = vector_new(sizeof(struct file_hash));
+	cache->mutex = mutex_new();
+	cache->records = vector_new(sizeof(struct record));
+	if (store_path != NULL) {
+		cache->store_path = path_dup(store_path);
+		path_mkdir(cache->store_path);
+	}
+	load_database(cache);
+
+	// everything depends on the Cellscript, and on the version of Cell being used to
+	// run it.  a change to either one invalidates all targets.
+	if (script_name != NULL)
+		hash_file(cache, script_name, script_hash);
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, SPHERE_VERSION, (unsigned long)strlen(SPHERE_VERSION));
+	MD5_Update(&ctx, script_hash, (unsigned long)strlen(script_hash));
+	hex_digest(&ctx, cache->salt);
+	return cache;
+}
+
+void
+cache_close(cache_t* cache, bool keep_unused)
+{
+	struct file_hash* file;
+	FILE*             out_file;
+	struct record*    record;
+
+	iter_t iter;
+
+	if (cache == NULL)
+		return;
+
+	// only entries which were used during this build are written back, so files and
+	// targets which no longer exist drop out of the cache over time.  a partial build
+	// only touches some of the targets, so it keeps everything.
+	if ((out_file = fs_fopen(cache->fs, cache->filename, "wb"))) {
+		fprintf(out_file, "%s\n", CACHE_SIGNATURE);
+		iter = vector_enum(cache->files);
+		while ((file = iter_next(&iter))) {
+			if (file->is_used || keep_unused) {
+				fprintf(out_file, "F %s %lld %lld %s\n", file->hash,
+					(long long)file->size, (long long)file->mtime, file->filename);
+			}
+		}
+		iter = vector_enum(cache->records);
+		while ((record = iter_next(&iter))) {
+			if (record->is_used || keep_unused)
+				fprintf(out_file, "T %s %s %s\n", record->key, record->out_hash, record->filename);
+		}
+		fclose(out_file);
+	}
+
+	iter = vector_enum(cache->files);
+	while ((file = iter_next(&iter)))
+		free(file->filename);
+	iter = vector_enum(cache->records);
+	while ((record = iter_next(&iter)))
+		free(record->filename);
+	vector_free(cache->files);
+	vector_free(cache->records);
+	free(cache->file_index.slots);
+	free(cache->record_index.slots);
+	mutex_free(cache->mutex);
+	path_free(cache->store_path);
+	free(cache->filename);
+	free(cache);
+}
+
+char*
+cache_key(cache_t* cache, const char* tool_id, const path_t* out_path, vector_t* in_paths)
+{
+	MD5_CTX  ctx;
+	char     hash[33];
+	char*    key;
+	path_t** path_ptr;
+
+	iter_t iter;
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, cache->salt, 32);
+	MD5_Update(&ctx, tool_id, (unsigned long)strlen(tool_id) + 1);
+	MD5_Update(&ctx, path_cstr(out_path), (unsigned long)strlen(path_cstr(out_path)) + 1);
+	iter = vector_enum(in_paths);
+	while ((path_ptr = iter_next(&iter))) {
+		if (!hash_file(cache, path_cstr(*path_ptr), hash))
+			return NULL;
+		MD5_Update(&ctx, path_cstr(*path_ptr), (unsigned long)strlen(path_cstr(*path_ptr)) + 1);
+		MD5_Update(&ctx, hash, 32);
+	}
+	key = malloc(33);
+	hex_digest(&ctx, key);
+	return key;
+}
+
+bool
+cache_is_fresh(cache_t* cache, const path_t* out_path, const char* key)
+{
+	char           hash[33];
+	bool           is_fresh = false;
+	char           out_hash[33];
+	struct record* record;
+
+	mutex_lock(cache->mutex);
+	if ((record = find_record(cache, path_cstr(out_path)))) {
+		record->is_used = true;
+		is_fresh = strcmp(record->key, key) == 0;
+		strcpy(out_hash, record->out_hash);
+	}
+	mutex_unlock(cache->mutex);
+
+	// make sure the target file wasn't modified or deleted since it was built
+	if (is_fresh)
+		is_fresh = hash_file(cache, path_cstr(out_path), hash) && strcmp(hash, out_hash) == 0;
+	return is_fresh;
+}
+
+bool
+cache_restore(cache_t* cache, const path_t* out_path, const char* key)
+{
+	void*   data;
+	path_t* dir_path;
+	char*   filename;
+	size_t  size;
+
+	if (cache->store_path == NULL)
+		return false;
+	filename = store_filename(cache, key);
+	data = fslurp(filename, &size);
+	free(filename);
+	if (data == NULL)
+		return false;
+
+	dir_path = path_strip(path_dup(out_path));
+	fs_mkdir(cache->fs, path_cstr(dir_path));
+	path_free(dir_path);
+	if (!fs_fspew(cache->fs, path_cstr(out_path), data, size)) {
+		free(data);
+		return false;
+	}
+	free(data);
+	cache_update(cache, out_path, key);
+	return true;
+}
+
+void
+cache_update(cache_t* cache, const path_t* out_path, const char* key)
+{
+	void*          data;
+	char*          filename;
+	char           out_hash[33];
+	struct record* record;
+	struct record  new_record;
+	size_t         size;
+	char*          temp_filename;
+
+	if (!hash_file(cache, path_cstr(out_path), out_hash))
+		return;
+
+	mutex_lock(cache->mutex);
+	if (!(record = find_record(cache, path_cstr(out_path)))) {
+		memset(&new_record, 0, sizeof(struct record));
+		new_record.filename = strdup(path_cstr(out_path));
+		vector_push(cache->records, &new_record);
+		index_add(&cache->record_index, new_record.filename, vector_len(cache->records) - 1);
+		record = vector_get(cache->records, vector_len(cache->records) - 1);
+	}
+	record->is_used = true;
+	strcpy(record->key, key);
+	strcpy(record->out_hash, out_hash);
+	mutex_unlock(cache->mutex);
+
+	// put a copy of the target file in the store so it can be restored later without
+	// having to rebuild it.  it's written under a temporary name first so another Cell
+	// sharing the same store never sees a half-written file.
+	if (cache->store_path == NULL)
+		return;
+	filename = store_filename(cache, key);
+	if (!fexist(filename) && (data = fs_fslurp(cache->fs, path_cstr(out_path), &size))) {
+		temp_filename = strnewf("%s.tmp", filename);
+		if (fspew(data, size, temp_filename)) {
+			if (rename(temp_filename, filename) != 0)
+				remove(temp_filename);
+		}
+		free(temp_filename);
+		free(data);
+	}
+	free(filename);
+}
+
+static struct file_hash*
+find_file_hash(cache_t* cache, const char* filename)
+{
+	int index;
+
+	if ((index = index_find(&cache->file_index, filename)) < 0)
+		return NULL;
+	return vector_get(cache->files, index);
+}
+
+static struct record*
+find_record(cache_t* cache, const char* filename)
+{
+	int index;
+
+	if ((index = index_find(&cache->record_index, filename)) < 0)
+		return NULL;
+	return vector_get(cache->records, index);
+}
+
+static bool
+hash_file(cache_t* cache, const char* filename, char* out_hash)
+{
+	// note: hashing every input on every build would be slow, so the hash of each file
+	//       is remembered along with its size and timestamp.  the file is only hashed
+	//       again if either of those have changed.  timestamps only have a resolution
+	//       of one second, so if the file was modified within a second of being hashed
+	//       an edit could go unnoticed.  in that case no timestamp is remembered and
+	//       the file gets hashed again next time.
+
+	uint8_t           buffer[65536];
+	MD5_CTX           ctx;
+	struct file_hash* file;
+	FILE*             in_file;
+	struct file_hash  new_file;
+	size_t            num_bytes;
+	struct stat       sb;
+	time_t            time_hashed;
+
+	if (fs_stat(cache->fs, filename, &sb) != 0)
+		return false;
+	mutex_lock(cache->mutex);
+	if ((file = find_file_hash(cache, filename))) {
+		file->is_used = true;
+		if (file->size == (int64_t)sb.st_size && file->mtime == sb.st_mtime) {
+			strcpy(out_hash, file->hash);
+			mutex_unlock(cache->mutex);
+			return true;
+		}
+	}
+	mutex_unlock(cache->mutex);
+
+	time_hashed = time(NULL);
+	if (!(in_file = fs_fopen(cache->fs, filename, "rb")))
+		return false;
+	MD5_Init(&ctx);
+	while ((num_bytes = fread(buffer, 1, sizeof buffer, in_file)) > 0)
+		MD5_Update(&ctx, buffer, (unsigned long)num_bytes);
+	fclose(in_file);
+	hex_digest(&ctx, out_hash);
+
+	mutex_lock(cache->mutex);
+	if (!(file = find_file_hash(cache, filename))) {
+		memset(&new_file, 0, sizeof(struct file_hash));
+		new_file.filename = strdup(filename);
+		vector_push(cache->files, &new_file);
+		index_add(&cache->file_index, new_file.filename, vector_len(cache->files) - 1);
+		file = vector_get(cache->files, vector_len(cache->files) - 1);
+	}
+	strcpy(file->hash, out_hash);
+	file->is_used = true;
+	file->mtime = sb.st_mtime < time_hashed - 1 ? sb.st_mtime : (time_t)-1;
+	file->size = (int64_t)sb.st_size;
+	mutex_unlock(cache->mutex);
+	return true;
+}
+
+static void
+hex_digest(MD5_CTX* ctx, char* out_hash)
+{
+	uint8_t hash_bytes[16];
+
+	int i;
+
+	MD5_Final(hash_bytes, ctx);
+	for (i = 0; i < 16; ++i)
+		sprintf(&out_hash[i * 2], "%.2x", (int)hash_bytes[i]);
+}
+
+static void
+index_add(struct name_index* index, const char* name, int value)
+{
+	// note: the index maps filenames to positions in the files or records vector, so
+	//       looking up an entry doesn't mean scanning the whole cache.  entries are never
+	//       removed, so a simple open-addressed table with linear probing is enough.  the
+	//       name must outlive the index; it's always the entry's own copy of its filename.
+
+	uint32_t          hash;
+	struct name_slot* old_slots;
+	int               old_size;
+	struct name_slot* slot;
+
+	int i;
+
+	if (index_find(index, name) >= 0)
+		return;
+	if ((index->num_used + 1) * 4 > index->num_slots * 3) {
+		old_slots = index->slots;
+		old_size = index->num_slots;
+		index->num_slots = old_size > 0 ? old_size * 2 : 64;
+		index->num_used = 0;
+		index->slots = calloc(index->num_slots, sizeof(struct name_slot));
+		for (i = 0; i < old_size; ++i) {
+			if (old_slots[i].name != NULL)
+				index_add(index, old_slots[i].name, old_slots[i].index);
+		}
+		free(old_slots);
+	}
+	hash = index_hash(name);
+	slot = &index->slots[hash & (index->num_slots - 1)];
+	while (slot->name != NULL) {
+		if (++slot >= index->slots + index->num_slots)
+			slot = index->slots;
+	}
+	slot->name = name;
+	slot->hash = hash;
+	slot->index = value;
+	++index->num_used;
+}
+
+static int
+index_find(const struct name_index* index, const char* name)
+{
+	uint32_t          hash;
+	struct name_slot* slot;
+
+	if (index->num_slots == 0)
+		return -1;
+	hash = index_hash(name);
+	slot = &index->slots[hash & (index->num_slots - 1)];
+	while (slot->name != NULL) {
+		if (slot->hash == hash && strcmp(slot->name, name) == 0)
+			return slot->index;
+		if (++slot >= index->slots + index->num_slots)
+			slot = index->slots;
+	}
+	return -1;
+}
+
+static uint32_t
+index_hash(const char* name)
+{
+	uint32_t hash = 2166136261u;
+
+	// 32-bit FNV-1a
+	while (*name != '\0')
+		hash = (hash ^ (uint8_t)*name++) * 16777619u;
+	return hash;
+}
+
+static void
+load_database(cache_t* cache)
+{
+	struct file_hash file;
+	FILE*            in_file;
+	char             line[4096];
+	long long        mtime;
+	int              name_offset;
+	struct record    record;
+	long long        size;
+	char*            p;
+
+	if (!(in_file = fs_fopen(cache->fs, cache->filename, "rb")))
+		return;
+	if (!fgets(line, sizeof line, in_file) || strncmp(line, CACHE_SIGNATURE, strlen(CACHE_SIGNATURE)) != 0)
+		goto finished;
+	while (fgets(line, sizeof line, in_file)) {
+		if ((p = strpbrk(line, "\r\n")))
+			*p = '\0';
+		memset(&file, 0, sizeof(struct file_hash));
+		memset(&record, 0, sizeof(struct record));
+		if (sscanf(line, "F %32s %lld %lld %n", file.hash, &size, &mtime, &name_offset) == 3
+			&& strlen(file.hash) == 32 && line[name_offset] != '\0')
+		{
+			file.filename = strdup(&line[name_offset]);
+			file.mtime = (time_t)mtime;
+			file.size = (int64_t)size;
+			vector_push(cache->files, &file);
+			index_add(&cache->file_index, file.filename, vector_len(cache->files) - 1);
+		}
+		else if (sscanf(line, "T %32s %32s %n", record.key, record.out_hash, &name_offset) == 2
+			&& strlen(record.key) == 32 && strlen(record.out_hash) == 32 && line[name_offset] != '\0')
+		{
+			record.filename = strdup(&line[name_offset]);
+			vector_push(cache->records, &record);
+			index_add(&cache->record_index, record.filename, vector_len(cache->records) - 1);
+		}
+	}
+
+finished:
+	fclose(in_file);
+}
+
+static char*
+store_filename(const cache_t* cache, const char* key)
+{
+	return strnewf("%s%s", path_cstr(cache->store_path), key);
+}
@@ -36,18 +36,27 @@
 #include <zlib.h>
 #include "build.h"
 #include "jsal.h"
+#include "watcher.h"
 
 static bool parse_command_line (int argc, char* argv[]);
+static bool parse_num_jobs     (const char* option, const char* value);
 static void print_banner       (bool want_copyright, bool want_deps);
 static void print_cell_quote   (void);
 static void print_usage        (void);
+static bool run_build          (build_t* build, bool rebuild_all);
+static void watch_source       (build_t* build, bool is_ok);
 
+static path_t* s_cache_path;
 static bool    s_debug_build;
 static path_t* s_in_path;
+static int     s_num_jobs;
 static path_t* s_out_path;
 static path_t* s_package_path;
 static bool    s_want_clean;
 static bool    s_want_rebuild;
+static bool    s_want_raw_media;
+static bool    s_want_watch;
+static int     s_spk_version;
 
 int
 main(int argc, char* argv[])
@@ -65,21 +74,16 @@ main(int argc, char* argv[])
 	print_banner(true, false);
 	printf("\n");
 
-	build = build_new(s_in_path, s_out_path);
-	if (!build_eval(build, "$/Cellscript.mjs") && !build_eval(build, "$/Cellscript.js"))
+	build = build_new(s_in_path, s_out_path, s_cache_path);
+	if (s_want_watch)
+		watch_source(build, run_build(build, s_want_rebuild));  // doesn't return
+	if (!run_build(build, s_want_rebuild))
 		goto shutdown;
-	if (s_want_clean)
-		build_clean(build);
-	else {
-		if (!build_run(build, s_debug_build, s_want_rebuild))
-			goto shutdown;
-		if (s_package_path != NULL)
-			build_package(build, path_cstr(s_package_path));
-	}
 	retval = EXIT_SUCCESS;
 
 shutdown:
 	build_free(build);
+	path_free(s_cache_path);
 	path_free(s_in_path);
 	path_free(s_out_path);
 	jsal_uninit();
@@ -102,10 +106,15 @@ parse_command_line(int argc, char* argv[])
 	// establish default options
 	s_in_path = path_new("./");
 	s_out_path = NULL;
+	s_cache_path = NULL;
 	s_package_path = NULL;
 	s_want_clean = false;
 	s_want_rebuild = false;
+	s_want_raw_media = false;
+	s_want_watch = false;
+	s_spk_version = 1;
 	s_debug_build = false;
+	s_num_jobs = 0;
 
 	// validate and parse the command line
 	for (i = 1; i < argc; ++i) {
@@ -153,6 +162,12 @@ parse_command_line(int argc, char* argv[])
 				path_free(s_out_path);
 				s_out_path = path_new_dir(argv[i]);
 			}
+			else if (strcmp(argv[i], "--cache-dir") == 0) {
+				if (++i >= argc)
+					goto missing_argument;
+				path_free(s_cache_path);
+				s_cache_path = path_new_dir(argv[i]);
+			}
 			else if (strcmp(argv[i], "--debug") == 0) {
 				if (have_debug_flag && !s_debug_build) {
 					printf("cell: illegal command line, both '--debug' and '--release' specified\n");
@@ -171,6 +186,24 @@ parse_command_line(int argc, char* argv[])
 				have_debug_flag = true;
 				have_in_dir = true;
 			}
+			else if (strcmp(argv[i], "--jobs") == 0) {
+				if (++i >= argc)
+					goto missing_argument;
+				if (!parse_num_jobs(argv[i - 1], argv[i]))
+					return false;
+			}
+			else if (strcmp(argv[i], "--raw-media") == 0) {
+				s_want_raw_media = true;
+				have_in_dir = true;
+			}
+			else if (strcmp(argv[i], "--spk-v2") == 0) {
+				s_spk_version = 2;
+				have_in_dir = true;
+			}
+			else if (strcmp(argv[i], "--watch") == 0) {
+				s_want_watch = true;
+				have_in_dir = true;
+			}
 			else {
 				printf("cell: unknown option '%s'\n", argv[i]);
 				return false;
@@ -201,6 +234,11 @@ parse_command_line(int argc, char* argv[])
 					}
 					have_in_dir = true;
 					break;
+				case 'j':
+					if (++i >= argc) goto missing_argument;
+					if (!parse_num_jobs(short_args, argv[i]))
+						return false;
+					break;
 				case 'c':
 					s_want_clean = true;
 					have_in_dir = true;
@@ -238,6 +276,10 @@ parse_command_line(int argc, char* argv[])
 		s_out_path = path_new("dist/");
 	if (!have_debug_flag)
 		s_debug_build = s_package_path == NULL;
+	if (s_want_watch && s_want_clean) {
+		printf("cell: illegal command line, both '--watch' and '--clean' specified\n");
+		return false;
+	}
 
 	// check if a Cellscript exists
 	mjs_path = path_rebase(path_new("Cellscript.mjs"), s_in_path);
@@ -261,6 +303,21 @@ missing_argument:
 	return false;
 }
 
+static bool
+parse_num_jobs(const char* option, const char* value)
+{
+	char* p_end;
+	long  num_jobs;
+
+	num_jobs = strtol(value, &p_end, 10);
+	if (*value == '\0' || *p_end != '\0' || num_jobs < 1 || num_jobs > 256) {
+		printf("cell: '%s' requires a number of jobs between 1 and 256\n", option);
+		return false;
+	}
+	s_num_jobs = (int)num_jobs;
+	return true;
+}
+
 static void
 print_cell_quote(void)
 {
@@ -319,10 +376,75 @@ print_usage(void)
 	printf("   -i  --in-dir    Set the input directory (default is current working dir)  \n");
 	printf("   -o  --out-dir   Set the output directory (default is './dist')            \n");
 	printf("   -p  --package   Create an SPK game package with the result of the build   \n");
+	printf("   -j  --jobs      Number of threads to build and package with (default: all)\n");
+	printf("       --raw-media Package images and audio as-is, without recompressing them\n");
+	printf("       --spk-v2    Write the SPK v2 format, which older engines can't open   \n");
 	printf("   -r  --rebuild   Rebuild all targets, even those already up to date        \n");
+	printf("       --watch     Keep running and rebuild whenever a source file changes   \n");
+	printf("       --cache-dir Keep copies of built targets in this directory for reuse  \n");
 	printf("   -c  --clean     Clean up all artifacts from the previous build            \n");
 	printf("   -d  --debug     Include debugging information for use with SSj or SSj Blue\n");
 	printf("       --release   Build for distribution, without any debugging information \n");
 	printf("   -v  --version   Print the version number of Cell and its dependencies.    \n");
 	printf("       --help      Print this help text.                                     \n");
 }
+
+static bool
+run_build(build_t* build, bool rebuild_all)
+{
+	if (!build_eval(build, "$/Cellscript.mjs") && !build_eval(build, "$/Cellscript.js"))
+		return false;
+	if (s_want_clean)
+		return build_clean(build);
+	if (!build_run(build, s_debug_build, rebuild_all, s_num_jobs))
+		return false;
+	if (s_package_path != NULL) {
+		return build_package(build, path_cstr(s_package_path), s_spk_version, s_want_raw_media,
+			s_num_jobs);
+	}
+	return true;
+}
+
+static void
+watch_source(build_t* build, bool is_ok)
+{
+	// note: the build is kept around between changes along with the JS runtime, so
+	//       most of the time only the targets affected by a change need to be rebuilt.
+	//       the Cellscript is only evaluated again if it or one of its modules changed,
+	//       a file was added or removed, or the last build failed.
+
+	vector_t*   filenames;
+	bool        tree_changed;
+	watcher_t*  watcher;
+
+	iter_t iter;
+
+	watcher = watcher_new(s_in_path, s_out_path);
+	while (true) {
+		build_report(build);
+		printf("\nwatching for changes, press Ctrl+C to stop...\n");
+		fflush(stdout);
+		filenames = watcher_wait(watcher, &tree_changed);
+		printf("\n");
+		if (!is_ok || tree_changed || !build_can_update(build, filenames)) {
+			// note: ChakraCore caches ES module records for the life of the runtime,
+			//       so the runtime has to be torn down to pick up a modified Cellscript.
+			build_free(build);
+			jsal_uninit();
+			jsal_init();
+			build = build_new(s_in_path, s_out_path, s_cache_path);
+			is_ok = run_build(build, false);
+		}
+		else {
+			is_ok = build_update(build, filenames, s_num_jobs);
+			if (is_ok && s_package_path != NULL) {
+				is_ok = build_package(build, path_cstr(s_package_path), s_spk_version,
+					s_want_raw_media, s_num_jobs);
+			}
+		}
+		iter = vector_enum(filenames);
+		while (iter_next(&iter))
+			path_free(*(path_t**)iter.ptr);
+		vector_free(filenames);
+	}
+}
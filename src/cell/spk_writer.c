@@ -35,8 +35,15 @@
 
 #include "compress.h"
 #include "fs.h"
+#include "thread.h"
 #include "vector.h"
 
+#include <zlib.h>
+
+#define SPK_BLOCK_SIZE    65536
+#define SPK_ENTRY_BLOCKS  0x0001
+#define SPK_PAGE_SIZE     4096
+
 #pragma pack(push, 1)
 struct spk_header
 {
@@ -46,68 +53,205 @@ struct spk_header
 	uint32_t idx_offset;
 	uint8_t  reserved[2];
 };
+
+struct spk2_header
+{
+	char     magic[4];
+	uint16_t version;
+	uint16_t reserved_1;
+	uint32_t num_files;
+	uint32_t block_size;
+	uint64_t idx_offset;
+	uint8_t  reserved[40];
+};
+
+struct spk2_entry_hdr
+{
+	uint16_t filename_size;
+	uint16_t flags;
+	uint32_t name_hash;
+	uint32_t crc;
+	uint32_t num_blocks;
+	uint64_t offset;
+	uint64_t file_size;
+	uint64_t pack_size;
+};
 #pragma pack(pop)
 
 struct spk_entry
 {
 	char*    pathname;
-	uint32_t offset;
-	uint32_t file_size;
-	uint32_t pack_size;
+	uint32_t crc;
+	uint16_t flags;
+	uint32_t num_blocks;
+	uint64_t offset;
+	uint64_t file_size;
+	uint64_t pack_size;
+};
+
+struct spk_job
+{
+	struct spk_entry entry;
+	void*            file_data;
+	char*            filename;
+	const fs_t*      fs;
+	bool             is_done;
+	void*            pack_data;
+	const void*      out_data;
+	size_t           out_size;
+	bool             succeeded;
+	bool             want_stored;
 };
 
 struct spk_writer
 {
-	FILE*     file;
-	vector_t* index;
+	FILE*      file;
+	vector_t*  index;
+	cond_t*    job_done;
+	vector_t*  jobs;
+	int        max_pending;
+	mutex_t*   mutex;
+	int        next_job;
+	int        next_write;
+	int        num_errors;
+	int        num_threads;
+	bool       quitting;
+	bool       store_media;
+	thread_t** threads;
+	int        version;
+	visor_t*   visor;
+	cond_t*    work_ready;
 };
 
+static void     flush_jobs           (spk_writer_t* writer, bool wait_all);
+static uint32_t hash_name            (const char* name);
+static bool     is_compressed_format (const char* filename);
+static bool     pack_file_v1         (spk_writer_t* writer, struct spk_job* job, size_t file_size);
+static bool     pack_file_v2         (spk_writer_t* writer, struct spk_job* job, size_t file_size);
+static void     process_job          (spk_writer_t* writer, struct spk_job* job);
+static void     seek_file            (FILE* file, uint64_t offset);
+static uint64_t tell_file            (FILE* file);
+static void     worker_main          (void* udata);
+static void     write_job            (spk_writer_t* writer, struct spk_job* job);
+
 spk_writer_t*
-spk_create(const char* filename)
+spk_create(const char* filename, int version, bool store_media, int num_jobs, visor_t* visor)
 {
-	const uint16_t VERSION = 1;
-
 	spk_writer_t* writer;
 
+	int i;
+
 	writer = calloc(1, sizeof(spk_writer_t));
-	if (!(writer->file = fopen(filename, "wb")))
+	if (!(writer->file = fopen(filename, "wb"))) {
+		free(writer);
 		return NULL;
-	fseek(writer->file, sizeof(struct spk_header), SEEK_SET);
+	}
+	writer->store_media = store_media;
+	writer->version = version;
+	writer->visor = visor;
+	seek_file(writer->file, version >= 2 ? sizeof(struct spk2_header) : sizeof(struct spk_header));
 
 	writer->index = vector_new(sizeof(struct spk_entry));
+	writer->jobs = vector_new(sizeof(struct spk_job*));
+
+	// files are read and compressed on a pool of worker threads while the calling
+	// thread writes the results out in the order they were added.  that way the
+	// package comes out byte-for-byte the same no matter how many threads are used.
+	if (num_jobs <= 0)
+		num_jobs = thread_num_cpus();
+	if (num_jobs > 1) {
+		writer->mutex = mutex_new();
+		writer->job_done = cond_new();
+		writer->work_ready = cond_new();
+		writer->threads = calloc(num_jobs, sizeof(thread_t*));
+		for (i = 0; i < num_jobs; ++i) {
+			if (!(writer->threads[writer->num_threads] = thread_new(worker_main, writer)))
+				break;
+			++writer->num_threads;
+		}
+
+		// cap the number of finished jobs waiting to be written so memory use stays
+		// bounded when one large file holds up the queue.
+		writer->max_pending = writer->num_threads * 4;
+	}
 	return writer;
 }
 
-void
+bool
 spk_close(spk_writer_t* writer)
 {
+	// note: returns false if any file added to the package couldn't be packaged.  each
+	//       failure has already been reported through the visor.
+
 	const uint16_t VERSION = 1;
 
-	struct spk_entry* file_info;
-	struct spk_header hdr;
-	uint32_t          idx_offset;
-	uint16_t          path_size;
+	struct spk_entry*     file_info;
+	struct spk_header     hdr;
+	struct spk2_header    hdr2;
+	struct spk2_entry_hdr idx_entry;
+	uint64_t              idx_offset;
+	uint32_t              offset;
+	uint32_t              pack_size;
+	uint16_t              path_size;
+	uint32_t              file_size;
+
+	bool   succeeded;
 
 	iter_t iter;
+	int    i;
 
 	if (writer == NULL)
-		return;
+		return false;
+
+	// wait for the workers to finish up anything still in the queue
+	if (writer->num_threads > 0) {
+		flush_jobs(writer, true);
+		mutex_lock(writer->mutex);
+		writer->quitting = true;
+		cond_broadcast(writer->work_ready);
+		mutex_unlock(writer->mutex);
+		for (i = 0; i < writer->num_threads; ++i)
+			thread_join(writer->threads[i]);
+	}
+	free(writer->threads);
+	cond_free(writer->job_done);
+	cond_free(writer->work_ready);
+	mutex_free(writer->mutex);
+	vector_free(writer->jobs);
 
 	// write package index
-	idx_offset = ftell(writer->file);
+	idx_offset = tell_file(writer->file);
 	iter = vector_enum(writer->index);
 	while ((file_info = iter_next(&iter))) {
-		// for compatibility with Sphere 1.5, we have to include the NUL terminator
-		// in the filename. this, despite the fact that there is an explicit length
-		// field in the header...
-		path_size = (uint16_t)strlen(file_info->pathname) + 1;
-
-		fwrite(&VERSION, sizeof(uint16_t), 1, writer->file);
-		fwrite(&path_size, sizeof(uint16_t), 1, writer->file);
-		fwrite(&file_info->offset, sizeof(uint32_t), 1, writer->file);
-		fwrite(&file_info->file_size, sizeof(uint32_t), 1, writer->file);
-		fwrite(&file_info->pack_size, sizeof(uint32_t), 1, writer->file);
-		fwrite(file_info->pathname, 1, path_size, writer->file);
+		if (writer->version >= 2) {
+			// SPK v2 doesn't need the NUL terminator
+			idx_entry.filename_size = (uint16_t)strlen(file_info->pathname);
+			idx_entry.flags = file_info->flags;
+			idx_entry.name_hash = hash_name(file_info->pathname);
+			idx_entry.crc = file_info->crc;
+			idx_entry.num_blocks = file_info->num_blocks;
+			idx_entry.offset = file_info->offset;
+			idx_entry.file_size = file_info->file_size;
+			idx_entry.pack_size = file_info->pack_size;
+			fwrite(&idx_entry, sizeof(struct spk2_entry_hdr), 1, writer->file);
+			fwrite(file_info->pathname, 1, idx_entry.filename_size, writer->file);
+		}
+		else {
+			// for compatibility with Sphere 1.5, we have to include the NUL terminator
+			// in the filename. this, despite the fact that there is an explicit length
+			// field in the header...
+			path_size = (uint16_t)strlen(file_info->pathname) + 1;
+			offset = (uint32_t)file_info->offset;
+			file_size = (uint32_t)file_info->file_size;
+			pack_size = (uint32_t)file_info->pack_size;
+
+			fwrite(&VERSION, sizeof(uint16_t), 1, writer->file);
+			fwrite(&path_size, sizeof(uint16_t), 1, writer->file);
+			fwrite(&offset, sizeof(uint32_t), 1, writer->file);
+			fwrite(&file_size, sizeof(uint32_t), 1, writer->file);
+			fwrite(&pack_size, sizeof(uint32_t), 1, writer->file);
+			fwrite(file_info->pathname, 1, path_size, writer->file);
+		}
 
 		// free the pathname buffer now, we no longer need it and
 		// it saves us a few lines of code later.
@@ -116,51 +260,327 @@ spk_close(spk_writer_t* writer)
 
 	// write the SPK header
 	fseek(writer->file, 0, SEEK_SET);
-	memset(&hdr, 0, sizeof(struct spk_header));
-	memcpy(hdr.magic, ".spk", 4);
-	hdr.version = 1;
-	hdr.num_files = (uint32_t)vector_len(writer->index);
-	hdr.idx_offset = idx_offset;
-	fwrite(&hdr, sizeof(struct spk_header), 1, writer->file);
+	if (writer->version >= 2) {
+		memset(&hdr2, 0, sizeof(struct spk2_header));
+		memcpy(hdr2.magic, ".spk", 4);
+		hdr2.version = 2;
+		hdr2.num_files = (uint32_t)vector_len(writer->index);
+		hdr2.block_size = SPK_BLOCK_SIZE;
+		hdr2.idx_offset = idx_offset;
+		fwrite(&hdr2, sizeof(struct spk2_header), 1, writer->file);
+	}
+	else {
+		memset(&hdr, 0, sizeof(struct spk_header));
+		memcpy(hdr.magic, ".spk", 4);
+		hdr.version = 1;
+		hdr.num_files = (uint32_t)vector_len(writer->index);
+		hdr.idx_offset = (uint32_t)idx_offset;
+		fwrite(&hdr, sizeof(struct spk_header), 1, writer->file);
+	}
 
 	// finally, close the file
+	succeeded = writer->num_errors == 0;
 	fclose(writer->file);
 	vector_free(writer->index);
 	free(writer);
+	return succeeded;
 }
 
 bool
 spk_add_file(spk_writer_t* writer, fs_t* fs, const char* filename, const char* spk_pathname)
 {
-	struct spk_entry idx_entry;
-	void*            file_data = NULL;
-	size_t           file_size;
-	long             offset;
-	void*            pack_data = NULL;
-	size_t           pack_size;
+	struct spk_job* job;
+	bool            succeeded;
+
+	if (!(job = calloc(1, sizeof(struct spk_job))))
+		return false;
+	job->fs = fs;
+	job->filename = strdup(filename);
+	job->entry.pathname = strdup(spk_pathname);
+
+	// images and audio in formats like PNG and OGG are already compressed and deflating
+	// them again gains next to nothing.  storing them as-is lets the engine read them in
+	// place instead of unpacking them.
+	job->want_stored = writer->store_media && is_compressed_format(spk_pathname);
+
+	if (writer->num_threads == 0) {
+		process_job(writer, job);
+		succeeded = job->succeeded;
+		write_job(writer, job);
+		return succeeded;
+	}
+	else {
+		// note: when running threaded, a file that can't be read or compressed is
+		//       reported when its turn comes to be written, and spk_close() then
+		//       returns false.
+		mutex_lock(writer->mutex);
+		vector_push(writer->jobs, &job);
+		cond_signal(writer->work_ready);
+		mutex_unlock(writer->mutex);
+		flush_jobs(writer, false);
+		return true;
+	}
+}
+
+static void
+flush_jobs(spk_writer_t* writer, bool wait_all)
+{
+	struct spk_job* job;
+
+	mutex_lock(writer->mutex);
+	while (writer->next_write < vector_len(writer->jobs)) {
+		job = *(struct spk_job**)vector_get(writer->jobs, writer->next_write);
+		if (!job->is_done) {
+			if (!wait_all && vector_len(writer->jobs) - writer->next_write <= writer->max_pending)
+				break;
+			cond_wait(writer->job_done, writer->mutex);
+			continue;
+		}
+		++writer->next_write;
+		mutex_unlock(writer->mutex);
+		write_job(writer, job);
+		mutex_lock(writer->mutex);
+	}
+	mutex_unlock(writer->mutex);
+}
+
+static uint32_t
+hash_name(const char* name)
+{
+	// note: this must match the filename hash used by the engine, which is FNV-1a over
+	//       the filename with ASCII letters folded to lowercase.
+
+	uint8_t  ch;
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		ch = (uint8_t)*name++;
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		hash ^= ch;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool
+is_compressed_format(const char* filename)
+{
+	static const char* const EXTENSIONS[] =
+	{
+		".flac", ".gif", ".jpeg", ".jpg", ".mng", ".mp3", ".ogg", ".opus", ".png",
+	};
+
+	const char* extension;
+
+	int i;
+
+	if (!(extension = strrchr(filename, '.')))
+		return false;
+	for (i = 0; i < sizeof EXTENSIONS / sizeof EXTENSIONS[0]; ++i) {
+		if (strcasecmp(extension, EXTENSIONS[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool
+pack_file_v1(spk_writer_t* writer, struct spk_job* job, size_t file_size)
+{
+	void*  pack_data;
+	size_t pack_size;
 
-	if (!(file_data = fs_fslurp(fs, filename, &file_size)))
-		goto on_error;
 	if (file_size > UINT32_MAX)
+		return false;
+	job->out_data = job->file_data;
+	job->out_size = file_size;
+	if (!job->want_stored) {
+		if (!(pack_data = z_deflate(job->file_data, file_size, 9, &pack_size)))
+			return false;
+		job->pack_data = pack_data;
+
+		// note: the engine treats a file whose packed size is the same as its original
+		//       size as stored without compression.  so if compression doesn't help (or
+		//       if it comes out at exactly the same size), store the original instead.
+		if (pack_size != file_size && !(writer->store_media && pack_size > file_size)) {
+			job->out_data = pack_data;
+			job->out_size = pack_size;
+		}
+	}
+	if (job->out_size > UINT32_MAX)
+		return false;
+	job->entry.file_size = file_size;
+	job->entry.pack_size = job->out_size;
+	return true;
+}
+
+static bool
+pack_file_v2(spk_writer_t* writer, struct spk_job* job, size_t file_size)
+{
+	// files are split into blocks which are compressed separately, so the engine can
+	// seek within a file without having to inflate everything before the seek point.
+	// the block table (packed size of each block) goes in front of the block data.
+
+	const uint8_t* block_data;
+	size_t         block_size;
+	uint32_t*      block_sizes;
+	uLong          crc;
+	uint8_t*       out_ptr;
+	uint32_t       num_blocks;
+	void*          pack_data;
+	size_t         pack_size;
+	uint64_t       total_size;
+
+	uint32_t i;
+
+	num_blocks = (uint32_t)((file_size + SPK_BLOCK_SIZE - 1) / SPK_BLOCK_SIZE);
+	crc = crc32(0L, Z_NULL, 0);
+	for (i = 0; i < num_blocks; ++i) {
+		block_size = file_size - i * (size_t)SPK_BLOCK_SIZE;
+		crc = crc32(crc, (const uint8_t*)job->file_data + i * (size_t)SPK_BLOCK_SIZE,
+			(uInt)(block_size < SPK_BLOCK_SIZE ? block_size : SPK_BLOCK_SIZE));
+	}
+	job->entry.crc = (uint32_t)crc;
+	job->entry.file_size = file_size;
+	job->entry.flags = 0;
+	job->entry.num_blocks = 0;
+	job->entry.pack_size = file_size;
+	job->out_data = job->file_data;
+	job->out_size = file_size;
+
+	// the packed file can never be bigger than the original, since if compression doesn't
+	// gain anything overall the original is stored instead.  so give up as soon as the
+	// output stops fitting in the same amount of space.
+	total_size = num_blocks * sizeof(uint32_t);
+	if (job->want_stored || num_blocks == 0 || total_size >= file_size)
+		return true;
+	if (!(job->pack_data = malloc(file_size)))
+		return false;
+	block_sizes = job->pack_data;
+	out_ptr = (uint8_t*)job->pack_data + total_size;
+	for (i = 0; i < num_blocks; ++i) {
+		block_data = (const uint8_t*)job->file_data + i * (size_t)SPK_BLOCK_SIZE;
+		block_size = file_size - i * (size_t)SPK_BLOCK_SIZE;
+		if (block_size > SPK_BLOCK_SIZE)
+			block_size = SPK_BLOCK_SIZE;
+		if (!(pack_data = z_deflate(block_data, block_size, 9, &pack_size)))
+			return false;
+
+		// a block that doesn't get any smaller is stored as-is, the engine knows
+		// this because its packed size is the same as its real size.
+		if (pack_size >= block_size) {
+			free(pack_data);
+			pack_data = NULL;
+			pack_size = block_size;
+		}
+		if (total_size + pack_size >= file_size) {
+			free(pack_data);
+			return true;
+		}
+		memcpy(out_ptr, pack_data != NULL ? pack_data : block_data, pack_size);
+		free(pack_data);
+		out_ptr += pack_size;
+		block_sizes[i] = (uint32_t)pack_size;
+		total_size += pack_size;
+	}
+
+	job->entry.flags = SPK_ENTRY_BLOCKS;
+	job->entry.num_blocks = num_blocks;
+	job->entry.pack_size = total_size;
+	job->out_data = job->pack_data;
+	job->out_size = (size_t)total_size;
+	return true;
+}
+
+static void
+process_job(spk_writer_t* writer, struct spk_job* job)
+{
+	size_t file_size;
+
+	if (!(job->file_data = fs_fslurp(job->fs, job->filename, &file_size)))
+		return;
+	if (writer->version >= 2)
+		job->succeeded = pack_file_v2(writer, job, file_size);
+	else
+		job->succeeded = pack_file_v1(writer, job, file_size);
+}
+
+static void
+seek_file(FILE* file, uint64_t offset)
+{
+#if defined(_MSC_VER)
+	_fseeki64(file, (int64_t)offset, SEEK_SET);
+#else
+	fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static uint64_t
+tell_file(FILE* file)
+{
+#if defined(_MSC_VER)
+	return (uint64_t)_ftelli64(file);
+#else
+	return (uint64_t)ftello(file);
+#endif
+}
+
+static void
+worker_main(void* udata)
+{
+	struct spk_job* job;
+	spk_writer_t*   writer = udata;
+
+	mutex_lock(writer->mutex);
+	while (true) {
+		while (writer->next_job >= vector_len(writer->jobs) && !writer->quitting)
+			cond_wait(writer->work_ready, writer->mutex);
+		if (writer->next_job >= vector_len(writer->jobs))
+			break;
+		job = *(struct spk_job**)vector_get(writer->jobs, writer->next_job++);
+		mutex_unlock(writer->mutex);
+		process_job(writer, job);
+		mutex_lock(writer->mutex);
+		job->is_done = true;
+		cond_signal(writer->job_done);
+	}
+	mutex_unlock(writer->mutex);
+}
+
+static void
+write_job(spk_writer_t* writer, struct spk_job* job)
+{
+	static const uint8_t ZEROES[SPK_PAGE_SIZE] = { 0 };
+
+	uint64_t offset;
+	size_t   padding;
+
+	if (!job->succeeded)
 		goto on_error;
-	if (!(pack_data = z_deflate(file_data, file_size, 9, &pack_size)))
-		goto on_error;
-	if (pack_size > UINT32_MAX)
+	offset = tell_file(writer->file);
+	if (writer->version >= 2) {
+		// start each file on a page boundary so mapped files are page-aligned in memory
+		padding = (SPK_PAGE_SIZE - offset % SPK_PAGE_SIZE) % SPK_PAGE_SIZE;
+		fwrite(ZEROES, 1, padding, writer->file);
+		offset += padding;
+	}
+	else if (offset + job->out_size > UINT32_MAX) {
 		goto on_error;
-	offset = ftell(writer->file);
-	fwrite(pack_data, pack_size, 1, writer->file);
-	free(pack_data);
-	free(file_data);
-
-	idx_entry.pathname = strdup(spk_pathname);
-	idx_entry.file_size = (uint32_t)file_size;
-	idx_entry.pack_size = (uint32_t)pack_size;
-	idx_entry.offset = offset;
-	vector_push(writer->index, &idx_entry);
-	return true;
+	}
+	fwrite(job->out_data, 1, job->out_size, writer->file);
+	job->entry.offset = offset;
+	vector_push(writer->index, &job->entry);
+	job->entry.pathname = NULL;
+	goto finished;
 
 on_error:
-	free(pack_data);
-	free(file_data);
-	return false;
+	visor_error(writer->visor, "couldn't package '%s'", job->filename);
+	++writer->num_errors;
+
+finished:
+	free(job->entry.pathname);
+	free(job->file_data);
+	free(job->filename);
+	free(job->pack_data);
+	free(job);
 }
@@ -34,11 +34,12 @@
 #define SPHERE__SPK_WRITER_H__INCLUDED
 
 #include "fs.h"
+#include "visor.h"
 
 typedef struct spk_writer spk_writer_t;
 
-spk_writer_t* spk_create   (const char* filename);
-void          spk_close    (spk_writer_t* writer);
+spk_writer_t* spk_create   (const char* filename, int version, bool store_media, int num_jobs, visor_t* visor);
+bool          spk_close    (spk_writer_t* writer);
 bool          spk_add_file (spk_writer_t* writer, fs_t* fs, const char* filename, const char* spk_pathname);
 
 #endif // SPHERE__SPK_WRITER_H__INCLUDED
@@ -33,7 +33,9 @@
 #include "cell.h"
 #include "target.h"
 
+#include "cache.h"
 #include "fs.h"
+#include "thread.h"
 #include "tool.h"
 #include "visor.h"
 
@@ -47,8 +49,48 @@ struct target
 	time_t       timestamp;
 	tool_t*      tool;
 	bool         tracked;
+
+	// build state, set up when target_build() visits the target
+	unsigned int build_id;
+	vector_t*    dependents;
+	double       elapsed;
+	int          num_pending;
+	double       path_time;
+	target_t*    slowest_source;
+	bool         status;
+	bool         visiting;
+	bool         was_restored;
+	bool         was_run;
 };
 
+struct scheduler
+{
+	cache_t*   cache;
+	vector_t*  done;
+	bool       force_build;
+	cond_t*    job_done;
+	vector_t*  jobs;
+	mutex_t*   mutex;
+	int        next_job;
+	int        num_threads;
+	bool       quitting;
+	thread_t** threads;
+	cond_t*    work_ready;
+};
+
+static void      build_target    (target_t* target, visor_t* visor, cache_t* cache, bool force_build);
+static bool      collect_targets (target_t* target, unsigned int build_id, visor_t* visor, vector_t* nodes);
+static void      finish_target   (target_t* target, vector_t* ready);
+static void      free_in_paths   (vector_t* in_paths);
+static bool      is_outdated     (const target_t* target, vector_t* in_paths, cache_t* cache, const char* key, bool force_build);
+static vector_t* make_in_paths   (const target_t* target);
+static void      print_timings   (vector_t* nodes, visor_t* visor);
+static void      run_target      (target_t* target, visor_t* visor, cache_t* cache, bool force_build);
+static int       sort_by_elapsed (const void* in_a, const void* in_b);
+static void      worker_main     (void* udata);
+
+static unsigned int s_last_build_id = 0;
+
 target_t*
 target_new(const path_t* name, fs_t* fs, const path_t* path, tool_t* tool, time_t timestamp, bool tracked)
 {
@@ -123,59 +165,441 @@ target_add_source(target_t* target, target_t* source)
 }
 
 bool
-target_build(target_t* target, visor_t* visor, bool force_build)
+target_build(vector_t* targets, visor_t* visor, cache_t* cache, bool force_build, int num_jobs)
+{
+	// the targets make up a DAG, with each target depending on its sources.  every target
+	// is visited exactly once per build, no matter how many other targets use it.  targets
+	// built by native tools (e.g. installs) don't need the JS engine, so they're handed
+	// off to worker threads; everything else is built on the calling thread.
+
+	unsigned int      build_id;
+	vector_t*         finished;
+	int               next_ready = 0;
+	vector_t*         nodes;
+	int               num_finished = 0;
+	vector_t*         ready;
+	struct scheduler* sched = NULL;
+	bool              status = true;
+	target_t*         target;
+	target_t**        target_ptr;
+
+	iter_t iter;
+	int    i;
+
+	build_id = ++s_last_build_id;
+	nodes = vector_new(sizeof(target_t*));
+	iter = vector_enum(targets);
+	while ((target_ptr = iter_next(&iter))) {
+		if (!collect_targets(*target_ptr, build_id, visor, nodes)) {
+			// a target in a cycle would wait on itself forever, so don't even start.
+			status = false;
+			goto finished;
+		}
+	}
+
+	// targets which aren't waiting on anything can be built right away.  thanks to the
+	// order the targets were collected in, sources always come before their dependents.
+	ready = vector_new(sizeof(target_t*));
+	iter = vector_enum(nodes);
+	while ((target_ptr = iter_next(&iter))) {
+		if ((*target_ptr)->num_pending == 0)
+			vector_push(ready, target_ptr);
+	}
+
+	if (num_jobs <= 0)
+		num_jobs = thread_num_cpus();
+	if (num_jobs > 1) {
+		sched = calloc(1, sizeof(struct scheduler));
+		sched->cache = cache;
+		sched->done = vector_new(sizeof(target_t*));
+		sched->force_build = force_build;
+		sched->jobs = vector_new(sizeof(target_t*));
+		sched->job_done = cond_new();
+		sched->mutex = mutex_new();
+		sched->work_ready = cond_new();
+		sched->threads = calloc(num_jobs, sizeof(thread_t*));
+		for (i = 0; i < num_jobs; ++i) {
+			if (!(sched->threads[sched->num_threads] = thread_new(worker_main, sched)))
+				break;
+			++sched->num_threads;
+		}
+	}
+
+	finished = vector_new(sizeof(target_t*));
+	while (num_finished < vector_len(nodes)) {
+		// pick up whatever the workers have finished since the last pass.  if this thread
+		// has nothing else to do in the meantime, wait for them.
+		if (sched != NULL) {
+			mutex_lock(sched->mutex);
+			while (vector_len(sched->done) == 0 && next_ready >= vector_len(ready))
+				cond_wait(sched->job_done, sched->mutex);
+			vector_clear(finished);
+			iter = vector_enum(sched->done);
+			while ((target_ptr = iter_next(&iter)))
+				vector_push(finished, target_ptr);
+			vector_clear(sched->done);
+			mutex_unlock(sched->mutex);
+			iter = vector_enum(finished);
+			while ((target_ptr = iter_next(&iter))) {
+				target = *target_ptr;
+				if (target->was_restored) {
+					visor_begin_op(visor, "restoring '%s' from cache", path_cstr(target->path));
+					visor_end_op(visor);
+				}
+				else if (target->was_run) {
+					visor_begin_op(visor, "%s '%s'", tool_verb(target->tool), path_cstr(target->path));
+					if (!target->status)
+						visor_error(visor, "couldn't build target file");
+					visor_end_op(visor);
+				}
+				finish_target(target, ready);
+				++num_finished;
+			}
+		}
+
+		if (next_ready >= vector_len(ready))
+			continue;
+		target = *(target_t**)vector_get(ready, next_ready++);
+		if (sched != NULL && target->tool != NULL && tool_is_native(target->tool)
+			&& vector_len(target->sources) > 0)
+		{
+			mutex_lock(sched->mutex);
+			vector_push(sched->jobs, &target);
+			cond_signal(sched->work_ready);
+			mutex_unlock(sched->mutex);
+		}
+		else {
+			run_target(target, visor, cache, force_build);
+			finish_target(target, ready);
+			++num_finished;
+		}
+	}
+	vector_free(finished);
+	vector_free(ready);
+
+	if (sched != NULL) {
+		mutex_lock(sched->mutex);
+		sched->quitting = true;
+		cond_broadcast(sched->work_ready);
+		mutex_unlock(sched->mutex);
+		for (i = 0; i < sched->num_threads; ++i)
+			thread_join(sched->threads[i]);
+		cond_free(sched->job_done);
+		cond_free(sched->work_ready);
+		mutex_free(sched->mutex);
+		vector_free(sched->done);
+		vector_free(sched->jobs);
+		free(sched->threads);
+		free(sched);
+	}
+
+	print_timings(nodes, visor);
+
+finished:
+	iter = vector_enum(nodes);
+	while ((target_ptr = iter_next(&iter))) {
+		target = *target_ptr;
+		if (!target->status)
+			status = false;
+		vector_free(target->dependents);
+		target->dependents = NULL;
+	}
+	vector_free(nodes);
+	return status;
+}
+
+bool
+target_depends_on(const target_t* target, vector_t* filenames)
+{
+	// note: 'filenames' should be a vector_t initialized to sizeof(path_t*).
+
+	path_t**   path_ptr;
+	target_t** source_ptr;
+
+	iter_t iter;
+
+	iter = vector_enum(filenames);
+	while ((path_ptr = iter_next(&iter))) {
+		if (path_is(target->path, *path_ptr))
+			return true;
+	}
+	iter = vector_enum(target->sources);
+	while ((source_ptr = iter_next(&iter))) {
+		if (target_depends_on(*source_ptr, filenames))
+			return true;
+	}
+	return false;
+}
+
+static void
+build_target(target_t* target, visor_t* visor, cache_t* cache, bool force_build)
+{
+	// note: 'visor' is NULL when called from a worker thread.  in that case the target
+	//       is built using tool_exec() and the result gets reported once it's finished.
+
+	vector_t* in_paths;
+	char*     key = NULL;
+	double    start_time;
+
+	in_paths = make_in_paths(target);
+	if (cache != NULL)
+		key = cache_key(cache, tool_id(target->tool), target->path, in_paths);
+	target->status = true;
+	if (is_outdated(target, in_paths, cache, key, force_build)) {
+		start_time = wall_clock();
+		if (!force_build && key != NULL && cache_restore(cache, target->path, key)) {
+			target->was_restored = true;
+			if (visor != NULL) {
+				visor_begin_op(visor, "restoring '%s' from cache", path_cstr(target->path));
+				visor_end_op(visor);
+			}
+		}
+		else {
+			target->status = visor != NULL
+				? tool_run(target->tool, visor, target->fs, target->path, in_paths)
+				: tool_exec(target->tool, target->fs, target->path, in_paths);
+			target->was_run = true;
+			if (target->status && key != NULL)
+				cache_update(cache, target->path, key);
+		}
+		target->elapsed = wall_clock() - start_time;
+	}
+	free(key);
+	free_in_paths(in_paths);
+}
+
+static bool
+collect_targets(target_t* target, unsigned int build_id, visor_t* visor, vector_t* nodes)
+{
+	// note: returns false if the target depends on itself, directly or otherwise.
+	//       'visiting' is only set while the target's sources are being collected, so
+	//       running into it again before that's done means there's a cycle.
+
+	target_t** source_ptr;
+
+	iter_t iter;
+
+	if (target->build_id == build_id) {
+		if (target->visiting) {
+			visor_error(visor, "circular dependency on '%s'", path_cstr(target->path));
+			return false;
+		}
+		return true;  // already visited
+	}
+
+	target->build_id = build_id;
+	target->dependents = vector_new(sizeof(target_t*));
+	target->elapsed = 0.0;
+	target->num_pending = vector_len(target->sources);
+	target->path_time = 0.0;
+	target->slowest_source = NULL;
+	target->status = false;
+	target->visiting = true;
+	target->was_restored = false;
+	target->was_run = false;
+	iter = vector_enum(target->sources);
+	while ((source_ptr = iter_next(&iter))) {
+		if (!collect_targets(*source_ptr, build_id, visor, nodes)) {
+			target->visiting = false;
+			vector_push(nodes, &target);  // so it gets cleaned up
+			return false;
+		}
+		vector_push((*source_ptr)->dependents, &target);
+	}
+	target->visiting = false;
+	if (target->tracked)
+		visor_add_file(visor, path_cstr(target->path));
+	vector_push(nodes, &target);
+	return true;
+}
+
+static void
+finish_target(target_t* target, vector_t* ready)
+{
+	target_t*  dependent;
+	target_t** target_ptr;
+
+	iter_t iter;
+
+	// keep track of the slowest chain of targets leading up to this one.  that's
+	// what gets reported as the critical path at the end of the build.
+	iter = vector_enum(target->sources);
+	while ((target_ptr = iter_next(&iter))) {
+		if ((*target_ptr)->path_time > target->path_time) {
+			target->path_time = (*target_ptr)->path_time;
+			target->slowest_source = *target_ptr;
+		}
+	}
+	target->path_time += target->elapsed;
+
+	iter = vector_enum(target->dependents);
+	while ((target_ptr = iter_next(&iter))) {
+		dependent = *target_ptr;
+		if (--dependent->num_pending == 0)
+			vector_push(ready, &dependent);
+	}
+}
+
+static void
+free_in_paths(vector_t* in_paths)
+{
+	path_t** path_ptr;
+
+	iter_t iter;
+
+	iter = vector_enum(in_paths);
+	while ((path_ptr = iter_next(&iter)))
+		path_free(*path_ptr);
+	vector_free(in_paths);
+}
+
+static bool
+is_outdated(const target_t* target, vector_t* in_paths, cache_t* cache, const char* key, bool force_build)
 {
-	vector_t*   in_paths = NULL;
-	bool        is_outdated = false;
 	time_t      last_time = 0;
-	path_t*     path;
 	path_t**    path_ptr;
-	bool        status;
 	struct stat sb;
-	target_t**  target_ptr;
 
 	iter_t iter;
 
-	// build dependencies and add them to the source list
+	if (force_build)
+		return true;
+
+	// when there's a build cache, a target is up to date if it was last built from
+	// exactly the same inputs, regardless of timestamps.  without one, fall back on
+	// comparing the timestamp of the output file with those of its sources.
+	if (cache != NULL)
+		return key == NULL || !cache_is_fresh(cache, target->path, key);
+	if (fs_stat(target->fs, path_cstr(target->path), &sb) == 0)
+		last_time = sb.st_mtime;
+	if (target->timestamp > last_time)
+		return true;
+	iter = vector_enum(in_paths);
+	while ((path_ptr = iter_next(&iter))) {
+		fs_stat(target->fs, path_cstr(*path_ptr), &sb);
+		if (sb.st_mtime > last_time)
+			return true;
+	}
+	return false;
+}
+
+static vector_t*
+make_in_paths(const target_t* target)
+{
+	vector_t*  in_paths;
+	path_t*    path;
+	target_t** target_ptr;
+
+	iter_t iter;
+
 	in_paths = vector_new(sizeof(path_t*));
 	iter = vector_enum(target->sources);
 	while ((target_ptr = iter_next(&iter))) {
-		target_build(*target_ptr, visor, force_build);
 		path = path_dup(target_path(*target_ptr));
 		vector_push(in_paths, &path);
 	}
+	return in_paths;
+}
 
-	if (target->tracked)
-		visor_add_file(visor, path_cstr(target->path));
+static void
+print_timings(vector_t* nodes, visor_t* visor)
+{
+	vector_t*  chain;
+	target_t*  last_target = NULL;
+	vector_t*  run_targets;
+	target_t*  target;
+	target_t** target_ptr;
+
+	iter_t iter;
+
+	run_targets = vector_new(sizeof(target_t*));
+	iter = vector_enum(nodes);
+	while ((target_ptr = iter_next(&iter))) {
+		target = *target_ptr;
+		if (target->was_run)
+			vector_push(run_targets, &target);
+		if (last_target == NULL || target->path_time > last_target->path_time)
+			last_target = target;
+	}
+	if (vector_len(run_targets) == 0)
+		goto finished;
+
+	// the critical path is the slowest chain of targets which depend on each other.  no
+	// matter how many threads are thrown at it, the build can't finish any faster.
+	chain = vector_new(sizeof(target_t*));
+	for (target = last_target; target != NULL; target = target->slowest_source) {
+		if (target->was_run)
+			vector_insert(chain, 0, &target);
+	}
+	visor_print(visor, "critical path is %.3f s over %d target(s)",
+		last_target->path_time, vector_len(chain));
+	iter = vector_enum(chain);
+	while ((target_ptr = iter_next(&iter))) {
+		target = *target_ptr;
+		visor_print(visor, "   %7.3f s  %s '%s'", target->elapsed,
+			tool_verb(target->tool), path_cstr(target->path));
+	}
+	vector_free(chain);
 
+	vector_sort(run_targets, sort_by_elapsed);
+	visor_print(visor, "slowest targets:");
+	iter = vector_enum(run_targets);
+	while ((target_ptr = iter_next(&iter)) && iter.index < 5) {
+		target = *target_ptr;
+		visor_print(visor, "   %7.3f s  %s '%s'", target->elapsed,
+			tool_verb(target->tool), path_cstr(target->path));
+	}
+
+finished:
+	vector_free(run_targets);
+}
+
+static void
+run_target(target_t* target, visor_t* visor, cache_t* cache, bool force_build)
+{
 	if (target->tracked && vector_len(target->sources) == 0) {
 		visor_warn(visor, "always up-to-date: '%s' (no sources)", path_cstr(target->path));
-		return true;
+		target->status = true;
+		return;
 	}
 
-	// check whether the output file is out of date with respect to its sources.
-	// this is a simple timestamp comparison for now; it might be good to eventually
-	// switch to a hash-based solution like in SCons.
-	if (fs_stat(target->fs, path_cstr(target->path), &sb) == 0)
-		last_time = sb.st_mtime;
-	if (force_build || target->timestamp > last_time)
-		is_outdated = true;
-	else {
-		iter = vector_enum(in_paths);
-		while ((path_ptr = iter_next(&iter))) {
-			fs_stat(target->fs, path_cstr(*path_ptr), &sb);
-			if ((is_outdated = sb.st_mtime > last_time))
-				break;  // short circuit
-		}
+	// targets without a tool are plain files, there's nothing to build
+	if (target->tool == NULL) {
+		target->status = true;
+		return;
 	}
+	build_target(target, visor, cache, force_build);
+}
 
-	// build the target if it's out of date
-	status = is_outdated
-		? tool_run(target->tool, visor, target->fs, target->path, in_paths)
-		: true;
-	iter = vector_enum(in_paths);
-	while ((path_ptr = iter_next(&iter)))
-		path_free(*path_ptr);
-	vector_free(in_paths);
-	return status;
+static int
+sort_by_elapsed(const void* in_a, const void* in_b)
+{
+	const target_t* a = *(const target_t**)in_a;
+	const target_t* b = *(const target_t**)in_b;
+
+	return a->elapsed < b->elapsed ? 1
+		: a->elapsed > b->elapsed ? -1
+		: 0;
+}
+
+static void
+worker_main(void* udata)
+{
+	struct scheduler* sched = udata;
+	target_t*         target;
+
+	mutex_lock(sched->mutex);
+	while (true) {
+		while (sched->next_job >= vector_len(sched->jobs) && !sched->quitting)
+			cond_wait(sched->work_ready, sched->mutex);
+		if (sched->next_job >= vector_len(sched->jobs))
+			break;
+		target = *(target_t**)vector_get(sched->jobs, sched->next_job++);
+		mutex_unlock(sched->mutex);
+		build_target(target, NULL, sched->cache, sched->force_build);
+		mutex_lock(sched->mutex);
+		vector_push(sched->done, &target);
+		cond_signal(sched->job_done);
+	}
+	mutex_unlock(sched->mutex);
 }
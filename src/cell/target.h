@@ -33,6 +33,7 @@
 #ifndef SPHERE__TARGET_H__INCLUDED
 #define SPHERE__TARGET_H__INCLUDED
 
+#include "cache.h"
 #include "fs.h"
 #include "tool.h"
 #include "visor.h"
@@ -46,6 +47,7 @@ const path_t* target_name        (const target_t* target);
 const path_t* target_path        (const target_t* target);
 const path_t* target_source_path (const target_t* target);
 void          target_add_source  (target_t* target, target_t* source);
-bool          target_build       (target_t* target, visor_t* visor, bool force_build);
+bool          target_build       (vector_t* targets, visor_t* visor, cache_t* cache, bool force_build, int num_jobs);
+bool          target_depends_on  (const target_t* target, vector_t* filenames);
 
 #endif // SPHERE__TARGET_H__INCLUDED
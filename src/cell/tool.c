@@ -41,6 +41,8 @@ struct tool
 {
 	unsigned int refcount;
 	void*        callback_ptr;
+	char*        id;
+	tool_fn_t    native_fn;
 	char*        verb;
 };
 
@@ -48,17 +50,37 @@ tool_t*
 tool_new(const char* verb)
 {
 	js_ref_t* callback_ptr;
+	char*     id;
 	tool_t*   tool;
 
+	// the source code of the callback is used to identify the tool in the build
+	// cache.  if the tool's code changes, anything it built needs to be rebuilt.
+	jsal_dup(-1);
+	id = strnewf("%s\n%s", verb, jsal_to_string(-1));
+	jsal_pop(1);
+
 	callback_ptr = jsal_ref(-1);
 	jsal_pop(1);
 
 	tool = calloc(1, sizeof(tool_t));
 	tool->verb = strdup(verb);
+	tool->id = id;
 	tool->callback_ptr = callback_ptr;
 	return tool_ref(tool);
 }
 
+tool_t*
+tool_new_native(const char* verb, tool_fn_t fn)
+{
+	tool_t* tool;
+
+	tool = calloc(1, sizeof(tool_t));
+	tool->verb = strdup(verb);
+	tool->id = strdup(verb);
+	tool->native_fn = fn;
+	return tool_ref(tool);
+}
+
 tool_t*
 tool_ref(tool_t* tool)
 {
@@ -74,11 +96,54 @@ tool_unref(tool_t* tool)
 	if (tool == NULL || --tool->refcount > 0)
 		return;
 
-	jsal_unref(tool->callback_ptr);
+	if (tool->callback_ptr != NULL)
+		jsal_unref(tool->callback_ptr);
+	free(tool->id);
 	free(tool->verb);
 	free(tool);
 }
 
+const char*
+tool_id(const tool_t* tool)
+{
+	return tool->id;
+}
+
+bool
+tool_is_native(const tool_t* tool)
+{
+	return tool->native_fn != NULL;
+}
+
+const char*
+tool_verb(const tool_t* tool)
+{
+	return tool->verb;
+}
+
+bool
+tool_exec(tool_t* tool, const fs_t* fs, const path_t* out_path, vector_t* in_paths)
+{
+	// note: this is the headless version of tool_run() for native tools.  it doesn't
+	//       touch the JS engine or the visor, so it can be called from a worker thread.
+
+	path_t*     dir_path;
+	struct stat stats;
+
+	dir_path = path_strip(path_dup(out_path));
+	fs_mkdir(fs, path_cstr(dir_path));
+	path_free(dir_path);
+
+	if (!tool->native_fn(fs, out_path, in_paths)
+		|| fs_stat(fs, path_cstr(out_path), &stats) != 0)
+	{
+		// same as in tool_run(), don't leave a broken target file lying around
+		fs_unlink(fs, path_cstr(out_path));
+		return false;
+	}
+	return true;
+}
+
 bool
 tool_run(tool_t* tool, visor_t* visor, const fs_t* fs, const path_t* out_path, vector_t* in_paths)
 {
@@ -107,31 +172,39 @@ tool_run(tool_t* tool, visor_t* visor, const fs_t* fs, const path_t* out_path, v
 
 	if (fs_stat(fs, path_cstr(out_path), &stats) == 0)
 		last_mtime = stats.st_mtime;
-	jsal_push_ref_weak(tool->callback_ptr);
-	jsal_push_string(path_cstr(out_path));
-	jsal_push_new_array();
-	iter = vector_enum(in_paths);
-	while ((path_ptr = iter_next(&iter))) {
-		array_index = jsal_get_length(-1);
-		jsal_push_string(path_cstr(*path_ptr));
-		jsal_put_prop_index(-2, array_index);
+	if (tool->native_fn != NULL) {
+		if (!tool->native_fn(fs, out_path, in_paths)) {
+			visor_error(visor, "couldn't build target file");
+			result_ok = false;
+		}
 	}
-	num_errors = visor_num_errors(visor);
-	if (!jsal_try_call(2)) {
-		jsal_get_prop_string(-1, "fileName");
-		filename = jsal_to_string(-1);
-		jsal_get_prop_string(-2, "lineNumber");
-		line_number = jsal_get_int(-1);
-		jsal_dup(-3);
-		jsal_to_string(-1);
-		visor_error(visor, "%s", jsal_get_string(-1));
-		visor_print(visor, "@ [%s:%d]", filename, line_number);
-		jsal_pop(3);
-		result_ok = false;
+	else {
+		jsal_push_ref_weak(tool->callback_ptr);
+		jsal_push_string(path_cstr(out_path));
+		jsal_push_new_array();
+		iter = vector_enum(in_paths);
+		while ((path_ptr = iter_next(&iter))) {
+			array_index = jsal_get_length(-1);
+			jsal_push_string(path_cstr(*path_ptr));
+			jsal_put_prop_index(-2, array_index);
+		}
+		num_errors = visor_num_errors(visor);
+		if (!jsal_try_call(2)) {
+			jsal_get_prop_string(-1, "fileName");
+			filename = jsal_to_string(-1);
+			jsal_get_prop_string(-2, "lineNumber");
+			line_number = jsal_get_int(-1);
+			jsal_dup(-3);
+			jsal_to_string(-1);
+			visor_error(visor, "%s", jsal_get_string(-1));
+			visor_print(visor, "@ [%s:%d]", filename, line_number);
+			jsal_pop(3);
+			result_ok = false;
+		}
+		jsal_pop(1);
+		if (visor_num_errors(visor) > num_errors)
+			result_ok = false;
 	}
-	jsal_pop(1);
-	if (visor_num_errors(visor) > num_errors)
-		result_ok = false;
 
 	// verify that the tool actually did something.  if the target file doesn't exist,
 	// that's definitely an error.  if the target file does exist but the timestamp hasn't changed,
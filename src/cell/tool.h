@@ -38,9 +38,16 @@
 
 typedef struct tool tool_t;
 
-tool_t* tool_new   (const char* verb);
-tool_t* tool_ref   (tool_t* tool);
-void    tool_unref (tool_t* tool);
-bool    tool_run   (tool_t* tool, visor_t* visor, const fs_t* fs, const path_t* out_path, vector_t* in_paths);
+typedef bool (* tool_fn_t)(const fs_t* fs, const path_t* out_path, const vector_t* in_paths);
+
+tool_t*     tool_new        (const char* verb);
+tool_t*     tool_new_native (const char* verb, tool_fn_t fn);
+tool_t*     tool_ref        (tool_t* tool);
+void        tool_unref      (tool_t* tool);
+const char* tool_id         (const tool_t* tool);
+bool        tool_is_native  (const tool_t* tool);
+const char* tool_verb       (const tool_t* tool);
+bool        tool_exec       (tool_t* tool, const fs_t* fs, const path_t* out_path, vector_t* in_paths);
+bool        tool_run        (tool_t* tool, visor_t* visor, const fs_t* fs, const path_t* out_path, vector_t* in_paths);
 
 #endif // SPHERE__TOOL_H__INCLUDED
@@ -144,6 +144,15 @@ strnewf(const char* fmt, ...)
 	return buffer;
 }
 
+double
+wall_clock(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
 bool
 wildcmp(const char* filename, const char* pattern)
 {
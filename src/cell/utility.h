@@ -43,6 +43,7 @@ bool        fexist                 (const char* filename);
 void*       fslurp                 (const char* filename, size_t *out_size);
 bool        fspew                  (const void* buffer, size_t size, const char* filename);
 char*       strnewf                (const char* fmt, ...);
+double      wall_clock             (void);
 bool        wildcmp                (const char* filename, const char* pattern);
 
 #endif
@@ -0,0 +1,428 @@
+/**
+ *  Cell, the Sphere packaging compiler
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "cell.h"
+#include "watcher.h"
+
+#include "fs.h"
+#include "thread.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+// the watcher keeps track of the files in the source tree and reports when any of them
+// change.  on Linux this is done with inotify; elsewhere the tree is simply rescanned
+// a couple times a second.
+
+struct file_info
+{
+	char*   filename;
+	time_t  mtime;
+	int64_t size;
+};
+
+#if defined(__linux__)
+struct watch
+{
+	bool    is_live;
+	path_t* path;
+	int     wd;
+};
+#endif
+
+struct watcher
+{
+	vector_t* files;
+	fs_t*     fs;
+	path_t*   root_path;
+#if defined(__linux__)
+	int       fd;
+	vector_t* watches;
+#endif
+};
+
+static void              add_change  (vector_t* changes, const char* filename);
+static struct file_info* find_file   (vector_t* files, const char* filename);
+static void              free_files  (vector_t* files);
+static vector_t*         scan_tree   (watcher_t* watcher);
+static void              scan_dir    (watcher_t* watcher, const char* dirname, vector_t* files);
+#if defined(__linux__)
+static struct watch*     find_watch   (watcher_t* watcher, const path_t* path);
+static void              free_watches (watcher_t* watcher);
+#endif
+
+watcher_t*
+watcher_new(const path_t* source_path, const path_t* out_path)
+{
+	watcher_t* watcher;
+
+	watcher = calloc(1, sizeof(watcher_t));
+	watcher->fs = fs_new(path_cstr(source_path), path_cstr(out_path), NULL);
+	watcher->root_path = path_dup(source_path);
+#if defined(__linux__)
+	watcher->fd = inotify_init();
+	watcher->watches = vector_new(sizeof(struct watch));
+#endif
+	watcher->files = scan_tree(watcher);
+	return watcher;
+}
+
+void
+watcher_free(watcher_t* watcher)
+{
+	if (watcher == NULL)
+		return;
+#if defined(__linux__)
+	free_watches(watcher);
+	vector_free(watcher->watches);
+	if (watcher->fd >= 0)
+		close(watcher->fd);
+#endif
+	free_files(watcher->files);
+	path_free(watcher->root_path);
+	fs_free(watcher->fs);
+	free(watcher);
+}
+
+vector_t*
+watcher_wait(watcher_t* watcher, bool *out_tree_changed)
+{
+	// note: a file that's been modified is reported in the returned list.  if files
+	//       were added or removed instead, '*out_tree_changed' is set to true; the
+	//       caller then can't assume the list of files matched by wildcards is still
+	//       the same.
+
+	vector_t*         changes;
+	struct file_info* file;
+	vector_t*         files;
+	bool              in_new_tree;
+	bool              in_old_tree;
+	struct file_info* old_file;
+	bool              tree_changed = false;
+#if defined(__linux__)
+	char                        buffer[16384];
+	const struct inotify_event* event;
+	ssize_t                     num_bytes;
+	char*                       p;
+	path_t*                     path;
+	struct pollfd               poll_info;
+	int                         timeout = -1;
+	struct watch*               watch;
+
+	iter_t iter_j;
+#endif
+
+	iter_t iter;
+
+	changes = vector_new(sizeof(path_t*));
+#if defined(__linux__)
+	if (watcher->fd >= 0) {
+		poll_info.fd = watcher->fd;
+		poll_info.events = POLLIN;
+		while (vector_len(changes) == 0 && !tree_changed) {
+			// once something changes, keep reading until things settle down.  editors
+			// often save a file in several steps, e.g. write a new copy and rename it
+			// over the old one, and it should only trigger one rebuild.
+			timeout = -1;
+			while (poll(&poll_info, 1, timeout) > 0) {
+				timeout = 100;
+				if ((num_bytes = read(watcher->fd, buffer, sizeof buffer)) <= 0)
+					break;
+				for (p = buffer; p < buffer + num_bytes; p += sizeof(struct inotify_event) + event->len) {
+					event = (const struct inotify_event*)p;
+					iter_j = vector_enum(watcher->watches);
+					while ((watch = iter_next(&iter_j))) {
+						if (watch->wd == event->wd)
+							break;
+					}
+					if (watch == NULL)
+						continue;
+					if (event->mask & IN_IGNORED) {
+						// the kernel dropped the watch (its directory was deleted), so
+						// the next scan has to add a new one if the directory comes back.
+						watch->wd = -1;
+						continue;
+					}
+					if (event->len == 0 || event->name[0] == '.')
+						continue;
+					if (event->mask & IN_ISDIR) {
+						tree_changed = true;
+						continue;
+					}
+					path = path_rebase(path_new(event->name), watch->path);
+					add_change(changes, path_cstr(path));
+					path_free(path);
+				}
+			}
+			if (timeout < 0)
+				break;  // poll() failed, fall back on scanning
+
+			// see what actually changed.  a file that was deleted and then put back
+			// (like when it's saved by renaming a new copy over it) counts as modified.
+			// if nothing is left afterwards, go back to waiting rather than reporting an
+			// empty list, which would trigger a pointless rebuild.
+			files = scan_tree(watcher);
+			iter = vector_enum(changes);
+			while (iter_next(&iter)) {
+				path = *(path_t**)iter.ptr;
+				in_new_tree = find_file(files, path_cstr(path)) != NULL;
+				in_old_tree = find_file(watcher->files, path_cstr(path)) != NULL;
+				if (!in_new_tree || !in_old_tree) {
+					// note: a temporary file that came and went in the meantime
+					//       doesn't count as a change at all.
+					if (in_new_tree != in_old_tree)
+						tree_changed = true;
+					path_free(path);
+					iter_remove(&iter);
+				}
+			}
+			if (vector_len(files) != vector_len(watcher->files))
+				tree_changed = true;
+			free_files(watcher->files);
+			watcher->files = files;
+		}
+		if (timeout >= 0) {
+			*out_tree_changed = tree_changed;
+			return changes;
+		}
+	}
+#endif
+
+	// no change notifications available, look for changes by rescanning the tree
+	while (vector_len(changes) == 0 && !tree_changed) {
+		thread_sleep(0.5);
+		files = scan_tree(watcher);
+		iter = vector_enum(files);
+		while ((file = iter_next(&iter))) {
+			if (!(old_file = find_file(watcher->files, file->filename)))
+				tree_changed = true;
+			else if (file->mtime != old_file->mtime || file->size != old_file->size)
+				add_change(changes, file->filename);
+		}
+		if (vector_len(files) != vector_len(watcher->files))
+			tree_changed = true;
+		free_files(watcher->files);
+		watcher->files = files;
+	}
+	*out_tree_changed = tree_changed;
+	return changes;
+}
+
+static void
+add_change(vector_t* changes, const char* filename)
+{
+	path_t* path;
+
+	iter_t iter;
+
+	iter = vector_enum(changes);
+	while (iter_next(&iter)) {
+		if (strcmp(path_cstr(*(path_t**)iter.ptr), filename) == 0)
+			return;
+	}
+	path = path_new(filename);
+	vector_push(changes, &path);
+}
+
+static struct file_info*
+find_file(vector_t* files, const char* filename)
+{
+	struct file_info* file;
+
+	iter_t iter;
+
+	iter = vector_enum(files);
+	while ((file = iter_next(&iter))) {
+		if (strcmp(file->filename, filename) == 0)
+			return file;
+	}
+	return NULL;
+}
+
+static void
+free_files(vector_t* files)
+{
+	struct file_info* file;
+
+	iter_t iter;
+
+	iter = vector_enum(files);
+	while ((file = iter_next(&iter)))
+		free(file->filename);
+	vector_free(files);
+}
+
+#if defined(__linux__)
+static struct watch*
+find_watch(watcher_t* watcher, const path_t* path)
+{
+	struct watch* watch;
+
+	iter_t iter;
+
+	iter = vector_enum(watcher->watches);
+	while ((watch = iter_next(&iter))) {
+		if (path_is(watch->path, path))
+			return watch;
+	}
+	return NULL;
+}
+
+static void
+free_watches(watcher_t* watcher)
+{
+	struct watch* watch;
+
+	iter_t iter;
+
+	iter = vector_enum(watcher->watches);
+	while ((watch = iter_next(&iter))) {
+		if (watch->wd >= 0)
+			inotify_rm_watch(watcher->fd, watch->wd);
+		path_free(watch->path);
+	}
+	vector_clear(watcher->watches);
+}
+#endif
+
+static void
+scan_dir(watcher_t* watcher, const char* dirname, vector_t* files)
+{
+	struct file_info file;
+	vector_t*        list;
+	const char*      name;
+	path_t**         path_ptr;
+	struct stat      sb;
+#if defined(__linux__)
+	path_t*          dir_path;
+	path_t*          full_path;
+	struct watch     watch;
+	struct watch*    watch_ptr;
+#endif
+
+	iter_t iter;
+
+	if (!(list = fs_list_dir(watcher->fs, dirname)))
+		return;
+
+#if defined(__linux__)
+	if (watcher->fd >= 0) {
+		// note: directories which were already being watched keep their existing
+		//       watch, so a rescan only touches inotify when the set of directories
+		//       has actually changed.
+		dir_path = path_new_dir(dirname);
+		if ((watch_ptr = find_watch(watcher, dir_path)) && watch_ptr->wd >= 0) {
+			watch_ptr->is_live = true;
+			path_free(dir_path);
+		}
+		else {
+			full_path = path_dup(dir_path);
+			path_remove_hop(full_path, 0);
+			path_rebase(full_path, watcher->root_path);
+			watch.wd = inotify_add_watch(watcher->fd, path_cstr(full_path),
+				IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+			watch.path = dir_path;
+			watch.is_live = true;
+			if (watch.wd >= 0)
+				vector_push(watcher->watches, &watch);
+			else
+				path_free(watch.path);
+			path_free(full_path);
+		}
+	}
+#endif
+
+	iter = vector_enum(list);
+	while ((path_ptr = iter_next(&iter))) {
+		// skip hidden files and directories (.git and friends), as well as the output
+		// directory.  otherwise every build would trigger another one.
+		name = path_is_file(*path_ptr) ? path_filename(*path_ptr)
+			: path_hop(*path_ptr, path_num_hops(*path_ptr) - 1);
+		if (name[0] != '.') {
+			if (!path_is_file(*path_ptr)) {
+				if (!fs_is_game_dir(watcher->fs, path_cstr(*path_ptr)))
+					scan_dir(watcher, path_cstr(*path_ptr), files);
+			}
+			else if (fs_stat(watcher->fs, path_cstr(*path_ptr), &sb) == 0) {
+				file.filename = strdup(path_cstr(*path_ptr));
+				file.mtime = sb.st_mtime;
+				file.size = (int64_t)sb.st_size;
+				vector_push(files, &file);
+			}
+		}
+		path_free(*path_ptr);
+	}
+	vector_free(list);
+}
+
+static vector_t*
+scan_tree(watcher_t* watcher)
+{
+	vector_t*     files;
+#if defined(__linux__)
+	struct watch* watch;
+	struct watch* other;
+
+	iter_t iter, iter_j;
+#endif
+
+#if defined(__linux__)
+	iter = vector_enum(watcher->watches);
+	while ((watch = iter_next(&iter)))
+		watch->is_live = false;
+#endif
+	files = vector_new(sizeof(struct file_info));
+	scan_dir(watcher, "$/", files);
+#if defined(__linux__)
+	// drop the watches for directories that weren't seen this time around.  a directory
+	// that was moved keeps its watch descriptor under the new name, so only remove the
+	// kernel watch if no live entry is still using it.
+	iter = vector_enum(watcher->watches);
+	while ((watch = iter_next(&iter))) {
+		if (watch->is_live)
+			continue;
+		iter_j = vector_enum(watcher->watches);
+		while ((other = iter_next(&iter_j))) {
+			if (other->is_live && other->wd == watch->wd)
+				break;
+		}
+		if (other == NULL && watch->wd >= 0)
+			inotify_rm_watch(watcher->fd, watch->wd);
+		path_free(watch->path);
+		iter_remove(&iter);
+	}
+#endif
+	return files;
+}
@@ -207,7 +207,7 @@ mng_cb_getcanvasline(mng_handle stream, mng_uint32 line_num)
 static mng_uint32
 mng_cb_gettickcount(mng_handle stream)
 {
-	return al_get_time() * 1000;
+	return sphere_now() * 1000;
 }
 
 static mng_bool
@@ -0,0 +1,445 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "minisphere.h"
+#include "capture.h"
+
+#include "thread.h"
+#include "vector.h"
+
+#define MAX_POOLED_BUFFERS 4
+#define MAX_RECORDING_SIZE (256 * 1024 * 1024)
+#define NUM_PENDING_FRAMES 3
+
+struct frame
+{
+	int      width;
+	int      height;
+	color_t* pixels;
+};
+
+struct job
+{
+	char*        filename;
+	struct frame frame;
+};
+
+struct capture
+{
+	vector_t*     buffer_pool;
+	int           buffer_size;
+	vector_t*     jobs;
+	int           last_serial;
+	int           max_frames;
+	mutex_t*      mutex;
+	int           next_frame;
+	int           next_pending;
+	int           num_frames;
+	int           num_pending;
+	image_t*      pending[NUM_PENDING_FRAMES];
+	bool          quitting;
+	struct frame* ring;
+	thread_t*     thread;
+	cond_t*       work_ready;
+};
+
+static color_t* acquire_buffer   (capture_t* capture, int width, int height);
+static path_t*  make_output_path (capture_t* capture, const char* category, bool is_dir);
+static void     queue_job        (capture_t* capture, char* filename, struct frame frame);
+static void     release_buffer   (capture_t* capture, struct frame* frame);
+static void     retire_frame     (capture_t* capture, image_t* image);
+static void     worker_main      (void* udata);
+static bool     write_png        (const char* filename, const struct frame* frame);
+
+capture_t*
+capture_new(void)
+{
+	capture_t* capture;
+
+	capture = calloc(1, sizeof(capture_t));
+	capture->buffer_pool = vector_new(sizeof(color_t*));
+	capture->jobs = vector_new(sizeof(struct job));
+	capture->mutex = mutex_new();
+	capture->work_ready = cond_new();
+
+	// note: if the worker can't be started, captures are still saved, they just
+	//       get written out on the calling thread.
+	if (!(capture->thread = thread_new(worker_main, capture)))
+		console_log(1, "couldn't start capture thread, captures will be synchronous");
+	return capture;
+}
+
+void
+capture_free(capture_t* it)
+{
+	color_t* pixels;
+
+	iter_t iter;
+	int    i;
+
+	if (it == NULL)
+		return;
+
+	if (it->ring != NULL) {
+		for (i = 0; i < it->max_frames; ++i)
+			free(it->ring[i].pixels);
+		free(it->ring);
+	}
+	for (i = 0; i < NUM_PENDING_FRAMES; ++i)
+		image_unref(it->pending[i]);
+
+	// let the worker finish writing out anything still queued, otherwise we'd
+	// lose screenshots taken just before the engine shut down.
+	if (it->thread != NULL) {
+		mutex_lock(it->mutex);
+		if (vector_len(it->jobs) > 0)
+			console_log(1, "waiting for %d queued capture(s) to be saved", vector_len(it->jobs));
+		it->quitting = true;
+		cond_signal(it->work_ready);
+		mutex_unlock(it->mutex);
+		thread_join(it->thread);
+	}
+	iter = vector_enum(it->buffer_pool);
+	while (iter_next(&iter)) {
+		pixels = *(color_t**)iter.ptr;
+		free(pixels);
+	}
+	vector_free(it->buffer_pool);
+	vector_free(it->jobs);
+	cond_free(it->work_ready);
+	mutex_free(it->mutex);
+	free(it);
+}
+
+bool
+capture_recording(const capture_t* it)
+{
+	return it->ring != NULL;
+}
+
+void
+capture_add_frame(capture_t* it, image_t* image)
+{
+	// note: reading the backbuffer back right away would make the CPU wait for the
+	//       GPU to finish drawing the frame, stalling the render loop every frame.
+	//       instead, the frame is copied to a spare image on the GPU, which doesn't
+	//       wait on anything, and only read back NUM_PENDING_FRAMES frames later when
+	//       that copy has long since finished.  what's left is the cost of the
+	//       readback itself: width * height * 4 bytes per frame, about 8 MB at 1080p.
+
+	int       height;
+	image_t** slot;
+	int       width;
+
+	if (it->ring == NULL)
+		return;
+
+	width = image_width(image);
+	height = image_height(image);
+	slot = &it->pending[it->next_pending];
+	if (it->num_pending == NUM_PENDING_FRAMES) {
+		retire_frame(it, *slot);
+		--it->num_pending;
+	}
+	if (*slot != NULL && (image_width(*slot) != width || image_height(*slot) != height)) {
+		image_unref(*slot);
+		*slot = NULL;
+	}
+	if (*slot == NULL && !(*slot = image_new(width, height, NULL)))
+		return;
+	image_blit(image, *slot, 0, 0);
+	it->next_pending = (it->next_pending + 1) % NUM_PENDING_FRAMES;
+	++it->num_pending;
+}
+
+void
+capture_screenshot(capture_t* it, image_t* image)
+{
+	struct frame frame;
+	path_t*      path;
+
+	// only the readback happens here; encoding the PNG and writing it to disk is
+	// what takes the most time and that's done in the background.
+	frame.width = image_width(image);
+	frame.height = image_height(image);
+	if (!(frame.pixels = acquire_buffer(it, frame.width, frame.height)))
+		return;
+	if (!image_download(image, frame.pixels)) {
+		release_buffer(it, &frame);
+		return;
+	}
+	path = make_output_path(it, "Screenshots", false);
+	console_log(1, "saving screenshot as '%s'", path_cstr(path));
+	queue_job(it, strdup(path_cstr(path)), frame);
+	path_free(path);
+}
+
+bool
+capture_start(capture_t* it, int max_frames, int width, int height)
+{
+	size_t frame_size;
+
+	if (it->ring != NULL)
+		return true;
+
+	// cap the size of the ring so a long recording at a high resolution can't
+	// eat all available memory.
+	frame_size = (size_t)width * height * sizeof(color_t);
+	if ((size_t)max_frames * frame_size > MAX_RECORDING_SIZE)
+		max_frames = (int)(MAX_RECORDING_SIZE / frame_size);
+	if (max_frames < 1)
+		return false;
+	if (!(it->ring = calloc(max_frames, sizeof(struct frame))))
+		return false;
+	it->max_frames = max_frames;
+	it->next_frame = 0;
+	it->next_pending = 0;
+	it->num_frames = 0;
+	it->num_pending = 0;
+	console_log(1, "recording the last %d frames", max_frames);
+	return true;
+}
+
+void
+capture_stop(capture_t* it)
+{
+	char*         filename;
+	struct frame* frame;
+	int           first_frame;
+	path_t*       path;
+
+	int i;
+
+	if (it->ring == NULL)
+		return;
+
+	// read back the frames still waiting on the GPU, then free the spare images
+	for (i = it->num_pending; i > 0; --i)
+		retire_frame(it, it->pending[(it->next_pending - i + NUM_PENDING_FRAMES) % NUM_PENDING_FRAMES]);
+	for (i = 0; i < NUM_PENDING_FRAMES; ++i) {
+		image_unref(it->pending[i]);
+		it->pending[i] = NULL;
+	}
+	it->num_pending = 0;
+
+	// hand the frames over to the worker oldest first, numbering them so they
+	// sort in playback order.
+	path = make_output_path(it, "Recordings", true);
+	console_log(1, "saving %d recorded frames to '%s'", it->num_frames, path_cstr(path));
+	first_frame = it->num_frames < it->max_frames ? 0 : it->next_frame;
+	for (i = 0; i < it->num_frames; ++i) {
+		frame = &it->ring[(first_frame + i) % it->max_frames];
+		filename = strnewf("%s%05d.png", path_cstr(path), i + 1);
+		queue_job(it, filename, *frame);
+		frame->pixels = NULL;
+	}
+	for (i = 0; i < it->max_frames; ++i)
+		release_buffer(it, &it->ring[i]);
+	path_free(path);
+	free(it->ring);
+	it->ring = NULL;
+}
+
+static color_t*
+acquire_buffer(capture_t* capture, int width, int height)
+{
+	color_t* pixels = NULL;
+
+	mutex_lock(capture->mutex);
+	if (capture->buffer_size == width * height && vector_len(capture->buffer_pool) > 0) {
+		pixels = *(color_t**)vector_get(capture->buffer_pool, vector_len(capture->buffer_pool) - 1);
+		vector_pop(capture->buffer_pool, 1);
+	}
+	mutex_unlock(capture->mutex);
+	if (pixels == NULL)
+		pixels = malloc((size_t)width * height * sizeof(color_t));
+	return pixels;
+}
+
+static path_t*
+make_output_path(capture_t* capture, const char* category, bool is_dir)
+{
+	time_t        datetime;
+	const char*   game_filename;
+	const path_t* game_root;
+	char*         pathname;
+	path_t*       path = NULL;
+	int           serial;
+	char          timestamp[100];
+
+	game_root = game_path(g_game);
+	game_filename = path_is_file(game_root)
+		? path_filename(game_root)
+		: path_hop(game_root, path_num_hops(game_root) - 1);
+	time(&datetime);
+	strftime(timestamp, 100, "%Y%m%d", localtime(&datetime));
+
+	// note: captures queued earlier may not have hit the disk yet, so checking
+	//       whether a file exists isn't enough to avoid handing out the same name
+	//       twice.  the last serial number used is remembered for that reason.
+	for (serial = capture->last_serial + 1;; ++serial) {
+		path_free(path);
+		pathname = strnewf("miniSphere/%s/%s-%s-%d%s", category, game_filename, timestamp, serial,
+			is_dir ? "/" : ".png");
+		path = path_rebase(path_new(pathname), home_path());
+		free(pathname);
+		if (!al_filename_exists(path_cstr(path)))
+			break;
+	}
+	capture->last_serial = serial;
+	path_mkdir(path);
+	return path;
+}
+
+static void
+queue_job(capture_t* capture, char* filename, struct frame frame)
+{
+	struct job job;
+
+	job.filename = filename;
+	job.frame = frame;
+	if (capture->thread == NULL) {
+		write_png(job.filename, &job.frame);
+		release_buffer(capture, &job.frame);
+		free(job.filename);
+		return;
+	}
+	mutex_lock(capture->mutex);
+	vector_push(capture->jobs, &job);
+	cond_signal(capture->work_ready);
+	mutex_unlock(capture->mutex);
+}
+
+static void
+release_buffer(capture_t* capture, struct frame* frame)
+{
+	if (frame->pixels == NULL)
+		return;
+
+	// buffers are pooled so that taking screenshots back-to-back (or recording)
+	// doesn't allocate a new framebuffer-sized chunk of memory every time.
+	mutex_lock(capture->mutex);
+	if (vector_len(capture->buffer_pool) == 0)
+		capture->buffer_size = frame->width * frame->height;
+	if (capture->buffer_size == frame->width * frame->height
+		&& vector_len(capture->buffer_pool) < MAX_POOLED_BUFFERS)
+	{
+		vector_push(capture->buffer_pool, &frame->pixels);
+		frame->pixels = NULL;
+	}
+	mutex_unlock(capture->mutex);
+	free(frame->pixels);
+	frame->pixels = NULL;
+}
+
+static void
+retire_frame(capture_t* capture, image_t* image)
+{
+	struct frame* frame;
+	int           height;
+	int           width;
+
+	// the ring always holds the most recent `max_frames` frames; once it fills
+	// up, each new frame overwrites the oldest one.
+	width = image_width(image);
+	height = image_height(image);
+	frame = &capture->ring[capture->next_frame];
+	if (frame->pixels != NULL && (frame->width != width || frame->height != height))
+		release_buffer(capture, frame);
+	if (frame->pixels == NULL) {
+		if (!(frame->pixels = acquire_buffer(capture, width, height)))
+			return;
+		frame->width = width;
+		frame->height = height;
+	}
+	if (!image_download(image, frame->pixels))
+		return;
+	capture->next_frame = (capture->next_frame + 1) % capture->max_frames;
+	if (capture->num_frames < capture->max_frames)
+		++capture->num_frames;
+}
+
+static void
+worker_main(void* udata)
+{
+	capture_t* capture = udata;
+	struct job job;
+
+	for (;;) {
+		mutex_lock(capture->mutex);
+		while (vector_len(capture->jobs) == 0 && !capture->quitting)
+			cond_wait(capture->work_ready, capture->mutex);
+		if (vector_len(capture->jobs) == 0) {
+			// queue is drained and we've been asked to quit
+			mutex_unlock(capture->mutex);
+			break;
+		}
+		job = *(struct job*)vector_get(capture->jobs, 0);
+		vector_remove(capture->jobs, 0);
+		mutex_unlock(capture->mutex);
+
+		if (!write_png(job.filename, &job.frame))
+			fprintf(stderr, "couldn't save capture '%s'\n", job.filename);
+		release_buffer(capture, &job.frame);
+		free(job.filename);
+	}
+}
+
+static bool
+write_png(const char* filename, const struct frame* frame)
+{
+	ALLEGRO_BITMAP*        bitmap;
+	ALLEGRO_LOCKED_REGION* lock;
+	bool                   retval;
+
+	int y;
+
+	// note: new bitmap parameters are per-thread in Allegro, so this doesn't
+	//       affect bitmaps created by the main thread.  the backbuffer has no alpha
+	//       channel, so neither does the saved image.
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+	al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_24_NO_ALPHA);
+	if (!(bitmap = al_create_bitmap(frame->width, frame->height)))
+		return false;
+	if (!(lock = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY))) {
+		al_destroy_bitmap(bitmap);
+		return false;
+	}
+	for (y = 0; y < frame->height; ++y) {
+		memcpy((uint8_t*)lock->data + y * lock->pitch, frame->pixels + y * frame->width,
+			frame->width * sizeof(color_t));
+	}
+	al_unlock_bitmap(bitmap);
+	retval = al_save_bitmap(filename, bitmap);
+	al_destroy_bitmap(bitmap);
+	return retval;
+}
@@ -333,7 +333,6 @@ font_draw_text(font_t* it, int x, int y, text_align_t alignment, const char* tex
 		x -= font_get_width(it, text);
 
 	tab_width = it->glyphs[' '].width * 3;
-	al_hold_bitmap_drawing(true);
 	utf8 = utf8_decode_start(true);
 	do {
 		while ((ret = utf8_decode_next(utf8, *text++, &cp)) == UTF8_CONTINUE);
@@ -378,7 +377,6 @@ font_draw_text(font_t* it, int x, int y, text_align_t alignment, const char* tex
 		}
 	} while (cp != '\0');
 	utf8_decode_end(utf8);
-	al_hold_bitmap_drawing(false);
 }
 
 void
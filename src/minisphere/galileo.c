@@ -36,11 +36,13 @@
 #include "color.h"
 #include "vector.h"
 
-static void free_cached_uniform (shader_t* shader, const char* name);
-static void render_shape        (shape_t* shape);
+#define MAX_BATCH_VERTICES  6144
+#define UNIFORM_NO_LOCATION -2
+#define VBO_RING_SIZE       3
 
 enum uniform_type
 {
+	UNIFORM_NONE,
 	UNIFORM_BOOL,
 	UNIFORM_INT,
 	UNIFORM_INT_ARR,
@@ -50,9 +52,13 @@ enum uniform_type
 	UNIFORM_FLOAT_VEC,
 	UNIFORM_MATRIX,
 };
+
 struct uniform
 {
-	char              name[256];
+	char*             name;
+	bool              dirty;
+	uint32_t          hash;
+	GLint             location;
 	enum uniform_type type;
 	int               num_values;
 	union {
@@ -67,11 +73,26 @@ struct uniform
 	};
 };
 
+static ALLEGRO_VERTEX* begin_batch           (ALLEGRO_BITMAP* texture, int num_vertices);
+static void            copy_vertices         (ALLEGRO_VERTEX* entries, const float* data, int num_vertices, const vertex_layout_t* layout);
+static bool            create_vertex_buffers (vbo_t* vbo, int num_vertices);
+static void            free_vertex_buffers   (vbo_t* vbo);
+static struct uniform* get_uniform           (shader_t* shader, const char* name);
+static uint32_t        hash_uniform_name     (const char* name);
+static ALLEGRO_VERTEX* lock_vertices         (vbo_t* vbo, int offset, int num_vertices);
+static void            put_uniform           (shader_t* shader, const char* name, enum uniform_type type, const void* data, int num_values);
+static void            render_shape          (shape_t* shape);
+static bool            unlock_vertices       (vbo_t* vbo, int offset, int num_vertices);
+static void            upload_uniform        (shader_t* shader, struct uniform* uniform);
+
 struct ibo
 {
 	unsigned int          refcount;
 	ALLEGRO_INDEX_BUFFER* buffer;
 	vector_t*             indices;
+	int                   max_index;
+	int                   num_indices;
+	int*                  shadow;
 };
 
 struct model
@@ -88,8 +109,10 @@ struct shader
 	unsigned int    id;
 	unsigned int    refcount;
 	char*           fragment_path;
+	int             max_uniforms;
+	int             num_uniforms;
 	ALLEGRO_SHADER* program;
-	vector_t*       uniforms;
+	struct uniform* uniforms;
 	char*           vertex_path;
 };
 
@@ -106,20 +129,37 @@ struct shape
 struct vbo
 {
 	unsigned int           refcount;
-	ALLEGRO_VERTEX_BUFFER* buffer;
+	ALLEGRO_VERTEX_BUFFER* buffers[VBO_RING_SIZE];
+	int                    dirty_end[VBO_RING_SIZE];
+	int                    dirty_start[VBO_RING_SIZE];
+	unsigned int           frame_id;
+	int                    num_buffers;
+	int                    num_vertices;
+	int                    ring_index;
+	ALLEGRO_VERTEX*        shadow;
+	vbo_usage_t            usage;
 	vector_t*              vertices;
 };
 
-static shader_t*    s_def_shader;
-static shader_t*    s_last_shader;
-static unsigned int s_next_model_id = 1;
-static unsigned int s_next_shader_id = 1;
-static unsigned int s_next_shape_id = 1;
+static ALLEGRO_BITMAP* s_batch_target;
+static ALLEGRO_BITMAP* s_batch_texture;
+static ALLEGRO_VERTEX* s_batch_vertices;
+static int             s_batch_size = 0;
+static shader_t*       s_def_shader;
+static unsigned int    s_frame_id = 0;
+static shader_t*       s_last_shader;
+static unsigned int    s_next_model_id = 1;
+static unsigned int    s_next_shader_id = 1;
+static unsigned int    s_next_shape_id = 1;
+static int             s_num_batches = 0;
+static int             s_num_draws = 0;
 
 void
 galileo_init(void)
 {
 	console_log(1, "initializing Galileo subsystem");
+	s_batch_vertices = malloc(MAX_BATCH_VERTICES * sizeof(ALLEGRO_VERTEX));
+	s_batch_size = 0;
 	s_def_shader = NULL;
 	s_last_shader = NULL;
 }
@@ -128,9 +168,144 @@ void
 galileo_uninit(void)
 {
 	console_log(1, "shutting down Galileo subsystem");
+	galileo_flush();
+	free(s_batch_vertices);
 	shader_unref(s_def_shader);
 }
 
+void
+galileo_draw_prim(ALLEGRO_BITMAP* texture, const ALLEGRO_VERTEX vertices[], int num_vertices, ALLEGRO_PRIM_TYPE type)
+{
+	// note: triangle strips and fans are converted to lists so they can be merged into
+	//       the current batch.  anything else, or anything using a subimage as its
+	//       texture, is drawn immediately.
+
+	ALLEGRO_VERTEX* batch;
+	int             num_triangles;
+
+	int i;
+
+	++s_num_draws;
+	num_triangles = type == ALLEGRO_PRIM_TRIANGLE_LIST ? num_vertices / 3
+		: num_vertices - 2;
+	if ((type != ALLEGRO_PRIM_TRIANGLE_LIST && type != ALLEGRO_PRIM_TRIANGLE_STRIP && type != ALLEGRO_PRIM_TRIANGLE_FAN)
+		|| (texture != NULL && al_is_sub_bitmap(texture))
+		|| num_triangles <= 0 || num_triangles * 3 > MAX_BATCH_VERTICES)
+	{
+		galileo_flush();
+		al_draw_prim(vertices, NULL, texture, 0, num_vertices, type);
+		++s_num_batches;
+		return;
+	}
+
+	batch = begin_batch(texture, num_triangles * 3);
+	if (type == ALLEGRO_PRIM_TRIANGLE_LIST) {
+		memcpy(batch, vertices, num_triangles * 3 * sizeof(ALLEGRO_VERTEX));
+	}
+	else if (type == ALLEGRO_PRIM_TRIANGLE_STRIP) {
+		// every other triangle in a strip has reversed winding, so swap the first two
+		// vertices of those to keep it consistent.
+		for (i = 0; i < num_triangles; ++i) {
+			batch[i * 3 + 0] = vertices[i % 2 == 0 ? i : i + 1];
+			batch[i * 3 + 1] = vertices[i % 2 == 0 ? i + 1 : i];
+			batch[i * 3 + 2] = vertices[i + 2];
+		}
+	}
+	else {
+		for (i = 0; i < num_triangles; ++i) {
+			batch[i * 3 + 0] = vertices[0];
+			batch[i * 3 + 1] = vertices[i + 1];
+			batch[i * 3 + 2] = vertices[i + 2];
+		}
+	}
+}
+
+void
+galileo_draw_quad(ALLEGRO_BITMAP* texture, ALLEGRO_COLOR color, float sx, float sy, float sw, float sh, const float corners[8])
+{
+	// note: 'corners' is the destination of the top-left, top-right, bottom-right and
+	//       bottom-left corners of the source rectangle, in that order.  the source
+	//       rectangle is given in pixels relative to 'texture', which can be a subimage;
+	//       quads cut from the same atlas all go into the same batch.
+
+	ALLEGRO_VERTEX* batch;
+	ALLEGRO_BITMAP* parent;
+	int             texture_h;
+	int             texture_w;
+	float           u1, v1, u2, v2;
+
+	++s_num_draws;
+	u1 = sx;
+	v1 = sy;
+	if ((parent = al_get_parent_bitmap(texture)) != NULL) {
+		u1 += al_get_bitmap_x(texture);
+		v1 += al_get_bitmap_y(texture);
+		texture = parent;
+	}
+	u2 = u1 + sw;
+	v2 = v1 + sh;
+	if (s_last_shader != NULL) {
+		// Galileo shaders use normalized texture coordinates as-is, while Allegro's
+		// default shader does the conversion itself.  OpenGL textures are also stored
+		// upside down and may be padded.
+		if (!al_get_opengl_texture_size(texture, &texture_w, &texture_h)) {
+			texture_w = al_get_bitmap_width(texture);
+			texture_h = al_get_bitmap_height(texture);
+		}
+		u1 /= texture_w;
+		u2 /= texture_w;
+		v1 = (al_get_bitmap_height(texture) - v1) / texture_h;
+		v2 = (al_get_bitmap_height(texture) - v2) / texture_h;
+	}
+
+	batch = begin_batch(texture, 6);
+	batch[0].x = corners[0]; batch[0].y = corners[1]; batch[0].u = u1; batch[0].v = v1;
+	batch[1].x = corners[2]; batch[1].y = corners[3]; batch[1].u = u2; batch[1].v = v1;
+	batch[2].x = corners[4]; batch[2].y = corners[5]; batch[2].u = u2; batch[2].v = v2;
+	batch[5].x = corners[6]; batch[5].y = corners[7]; batch[5].u = u1; batch[5].v = v2;
+	batch[0].z = batch[1].z = batch[2].z = batch[5].z = 0.0f;
+	batch[0].color = batch[1].color = batch[2].color = batch[5].color = color;
+	batch[3] = batch[0];
+	batch[4] = batch[2];
+}
+
+void
+galileo_flush(void)
+{
+	ALLEGRO_BITMAP* old_target;
+
+	if (s_batch_size == 0)
+		return;
+
+	// note: everything that changes render state is supposed to flush first, but just in
+	//       case something slipped through, make sure the batch goes where it was meant to.
+	old_target = al_get_target_bitmap();
+	if (old_target != s_batch_target)
+		al_set_target_bitmap(s_batch_target);
+	al_draw_prim(s_batch_vertices, NULL, s_batch_texture, 0, s_batch_size, ALLEGRO_PRIM_TRIANGLE_LIST);
+	if (old_target != s_batch_target)
+		al_set_target_bitmap(old_target);
+	s_batch_size = 0;
+	++s_num_batches;
+}
+
+void
+galileo_get_stats(int *out_num_draws, int *out_num_batches)
+{
+	*out_num_draws = s_num_draws;
+	*out_num_batches = s_num_batches;
+}
+
+void
+galileo_reset_stats(void)
+{
+	// note: this is called once per flip, so it also marks the start of a new frame
+	//       for the stream buffer ring.
+	s_num_batches = 0;
+	s_num_draws = 0;
+	++s_frame_id;
+}
+
 shader_t*
 galileo_shader(void)
 {
@@ -149,7 +324,9 @@ galileo_reset(void)
 	// note: this resets internal render state to the default settings for Sphere v1.
 	//       Sv1 APIs should call this before drawing anything; doing so avoids Galileo
 	//       having to undo its own state changes all the time, keeping things snappy.
+	//       Sv1 primitives are drawn directly, so anything batched has to go out first.
 
+	galileo_flush();
 	image_render_to(screen_backbuffer(g_screen), NULL);
 	shader_use(NULL, false);
 }
@@ -161,6 +338,7 @@ ibo_new(void)
 
 	ibo = calloc(1, sizeof(ibo_t));
 	ibo->indices = vector_new(sizeof(uint16_t));
+	ibo->max_index = -1;
 	return ibo_ref(ibo);
 }
 
@@ -181,6 +359,7 @@ ibo_unref(ibo_t* it)
 	if (it->buffer != NULL)
 		al_destroy_index_buffer(it->buffer);
 	vector_free(it->indices);
+	free(it->shadow);
 	free(it);
 }
 
@@ -194,15 +373,27 @@ int
 ibo_len(const ibo_t* it)
 {
 	if (it != NULL)
-		return vector_len(it->indices);
+		return it->num_indices;
 	else
 		return 0;
 }
 
+int
+ibo_max_index(const ibo_t* it)
+{
+	// note: this is -1 for an empty list.  a shape can only be drawn safely if its
+	//       vertex list has more than this many vertices; the software path used
+	//       without a display doesn't do any bounds checking of its own.
+	return it->max_index;
+}
+
 void
 ibo_add_index(ibo_t* it, uint16_t index)
 {
 	vector_push(it->indices, &index);
+	if (index > it->max_index)
+		it->max_index = index;
+	++it->num_indices;
 }
 
 bool
@@ -217,6 +408,19 @@ ibo_upload(ibo_t* it)
 		al_destroy_index_buffer(it->buffer);
 		it->buffer = NULL;
 	}
+	free(it->shadow);
+	it->shadow = NULL;
+
+	// without a display, there's no GPU to upload to.  keep the indices in system
+	// memory instead so the shape can still be drawn in software.
+	if (al_get_current_display() == NULL) {
+		if (!(it->shadow = malloc(vector_len(it->indices) * sizeof(int))))
+			return false;
+		iter = vector_enum(it->indices);
+		while (iter_next(&iter))
+			it->shadow[iter.index] = *(uint16_t*)iter.ptr;
+		return true;
+	}
 
 	// create the index buffer object
 	if (!(buffer = al_create_index_buffer(2, NULL, vector_len(it->indices), ALLEGRO_PRIM_BUFFER_STATIC)))
@@ -236,6 +440,60 @@ ibo_upload(ibo_t* it)
 	return true;
 }
 
+bool
+ibo_upload_array(ibo_t* it, const void* data, int num_indices, int index_size)
+{
+	// note: unlike ibo_upload(), this copies the indices straight from the caller's
+	//       buffer into the GPU buffer.  'index_size' must be either 2 or 4.
+
+	ALLEGRO_INDEX_BUFFER* buffer;
+	void*                 entries;
+	uint32_t              index;
+	uint32_t              max_index = 0;
+
+	int i;
+
+	if (it->buffer != NULL) {
+		al_destroy_index_buffer(it->buffer);
+		it->buffer = NULL;
+	}
+	free(it->shadow);
+	it->shadow = NULL;
+
+	for (i = 0; i < num_indices; ++i) {
+		index = index_size == 2 ? ((const uint16_t*)data)[i] : ((const uint32_t*)data)[i];
+		if (index > max_index)
+			max_index = index;
+	}
+	it->max_index = num_indices > 0 ? (int)(max_index < INT_MAX ? max_index : INT_MAX) : -1;
+
+	if (al_get_current_display() == NULL) {
+		if (!(it->shadow = malloc(num_indices * sizeof(int))))
+			return false;
+		for (i = 0; i < num_indices; ++i) {
+			it->shadow[i] = index_size == 2 ? ((const uint16_t*)data)[i]
+				: (int)((const uint32_t*)data)[i];
+		}
+		vector_clear(it->indices);
+		it->num_indices = num_indices;
+		return true;
+	}
+
+	if (!(buffer = al_create_index_buffer(index_size, NULL, num_indices, ALLEGRO_PRIM_BUFFER_STATIC)))
+		return false;
+	if (!(entries = al_lock_index_buffer(buffer, 0, num_indices, ALLEGRO_LOCK_WRITEONLY))) {
+		al_destroy_index_buffer(buffer);
+		return false;
+	}
+	memcpy(entries, data, (size_t)num_indices * index_size);
+	al_unlock_index_buffer(buffer);
+
+	vector_clear(it->indices);
+	it->buffer = buffer;
+	it->num_indices = num_indices;
+	return true;
+}
+
 model_t*
 model_new(shader_t* shader)
 {
@@ -351,19 +609,27 @@ shader_new(const char* vert_filename, const char* frag_filename)
 		goto on_error;
 	if (!(frag_source = game_read_file(g_game, frag_filename, NULL)))
 		goto on_error;
-	if (!(shader->program = al_create_shader(ALLEGRO_SHADER_GLSL)))
-		goto on_error;
-	if (!al_attach_shader_source(shader->program, ALLEGRO_VERTEX_SHADER, vert_source)) {
-		fprintf(stderr, "\nvertex shader compile log:\n%s\n", al_get_shader_log(shader->program));
-		goto on_error;
-	}
-	if (!al_attach_shader_source(shader->program, ALLEGRO_PIXEL_SHADER, frag_source)) {
-		fprintf(stderr, "\nfragment shader compile log:\n%s\n", al_get_shader_log(shader->program));
-		goto on_error;
+	if (al_get_current_display() != NULL) {
+		if (!(shader->program = al_create_shader(ALLEGRO_SHADER_GLSL)))
+			goto on_error;
+		if (!al_attach_shader_source(shader->program, ALLEGRO_VERTEX_SHADER, vert_source)) {
+			fprintf(stderr, "\nvertex shader compile log:\n%s\n", al_get_shader_log(shader->program));
+			goto on_error;
+		}
+		if (!al_attach_shader_source(shader->program, ALLEGRO_PIXEL_SHADER, frag_source)) {
+			fprintf(stderr, "\nfragment shader compile log:\n%s\n", al_get_shader_log(shader->program));
+			goto on_error;
+		}
+		if (!al_build_shader(shader->program)) {
+			fprintf(stderr, "\nerror building shader program:\n%s\n", al_get_shader_log(shader->program));
+			goto on_error;
+		}
 	}
-	if (!al_build_shader(shader->program)) {
-		fprintf(stderr, "\nerror building shader program:\n%s\n", al_get_shader_log(shader->program));
-		goto on_error;
+	else {
+		// note: a shader program can't be built without a display (i.e. headless mode).
+		//       the shader is still created so games work as usual, but since it never
+		//       becomes active, things drawn with it use Allegro's built-in shaders.
+		console_log(2, "    no display available, not compiling shader program");
 	}
 	free(vert_source);
 	free(frag_source);
@@ -371,7 +637,8 @@ shader_new(const char* vert_filename, const char* frag_filename)
 	shader->id = s_next_shader_id++;
 	shader->fragment_path = strdup(frag_filename);
 	shader->vertex_path = strdup(vert_filename);
-	shader->uniforms = vector_new(sizeof(struct uniform));
+	shader->max_uniforms = 16;
+	shader->uniforms = calloc(shader->max_uniforms, sizeof(struct uniform));
 	return shader_ref(shader);
 
 on_error:
@@ -404,12 +671,27 @@ shader_ref(shader_t* it)
 void
 shader_unref(shader_t* it)
 {
+	struct uniform* uniform;
+
+	int i;
+
 	if (it == NULL || --it->refcount > 0)
 		return;
 
 	console_log(3, "disposing shader program #%u no longer in use", it->id);
-	al_destroy_shader(it->program);
-	vector_free(it->uniforms);
+	if (it->program != NULL)
+		al_destroy_shader(it->program);
+	for (i = 0; i < it->max_uniforms; ++i) {
+		uniform = &it->uniforms[i];
+		if (uniform->type == UNIFORM_FLOAT_ARR)
+			free(uniform->float_list);
+		else if (uniform->type == UNIFORM_INT_ARR)
+			free(uniform->int_list);
+		free(uniform->name);
+	}
+	free(it->uniforms);
+	free(it->fragment_path);
+	free(it->vertex_path);
 	free(it);
 }
 
@@ -422,164 +704,63 @@ shader_program(const shader_t* it)
 void
 shader_put_bool(shader_t* it, const char* name, bool value)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_bool(name, value);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_BOOL;
-		unif.bool_value = value;
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_BOOL, &value, 1);
 }
 
 void
 shader_put_float(shader_t* it, const char* name, float value)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_float(name, value);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_FLOAT;
-		unif.float_value = value;
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_FLOAT, &value, 1);
 }
 
 void
 shader_put_float_array(shader_t* it, const char* name, float values[], int size)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_float_vector(name, 1, values, size);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_FLOAT_ARR;
-		unif.float_list = malloc(size * sizeof(float));
-		unif.num_values = size;
-		memcpy(unif.float_list, values, size * sizeof(float));
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_FLOAT_ARR, values, size);
 }
 
 void
 shader_put_float_vector(shader_t* it, const char* name, float values[], int size)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_float_vector(name, size, values, 1);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_FLOAT_VEC;
-		unif.num_values = size;
-		memcpy(unif.float_vec, values, sizeof(float) * size);
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_FLOAT_VEC, values, size);
 }
 
 void
 shader_put_int(shader_t* it, const char* name, int value)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_int(name, value);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_INT;
-		unif.int_value = value;
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_INT, &value, 1);
 }
 
 void
 shader_put_int_array(shader_t* it, const char* name, int values[], int size)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_int_vector(name, 1, values, size);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_INT_ARR;
-		unif.int_list = malloc(size * sizeof(int));
-		unif.num_values = size;
-		memcpy(unif.int_list, values, size * sizeof(int));
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_INT_ARR, values, size);
 }
 
 void
 shader_put_int_vector(shader_t* it, const char* name, int values[], int size)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_int_vector(name, size, values, 1);
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_INT_VEC;
-		unif.num_values = size;
-		memcpy(unif.int_vec, values, sizeof(int) * size);
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_INT_VEC, values, size);
 }
 
 void
 shader_put_matrix(shader_t* it, const char* name, const transform_t* matrix)
 {
-	struct uniform unif;
-
-	if (s_last_shader == it) {
-		al_set_shader_matrix(name, transform_matrix(matrix));
-	}
-	else {
-		free_cached_uniform(it, name);
-		strncpy(unif.name, name, 255);
-		unif.name[255] = '\0';
-		unif.type = UNIFORM_MATRIX;
-		al_copy_transform(&unif.mat_value, transform_matrix(matrix));
-		vector_push(it->uniforms, &unif);
-	}
+	put_uniform(it, name, UNIFORM_MATRIX, transform_matrix(matrix), 1);
 }
 
 bool
 shader_use(shader_t* it, bool force_set)
 {
 	ALLEGRO_SHADER* al_shader;
-	struct uniform* uniform;
 
-	iter_t iter;
+	int i;
 
 	if (it == s_last_shader && !force_set)
 		return true;
 
+	galileo_flush();
+
 	if (it != NULL)
 		console_log(4, "activating shader program #%u", it->id);
 	else
@@ -589,43 +770,18 @@ shader_use(shader_t* it, bool force_set)
 	if (!al_use_shader(al_shader))
 		return false;
 
-	// set any uniforms defined while we were inactive
-	if (it != NULL) {
-		iter = vector_enum(it->uniforms);
-		while ((uniform = iter_next(&iter))) {
-			switch (uniform->type) {
-			case UNIFORM_BOOL:
-				al_set_shader_bool(uniform->name, uniform->bool_value);
-				break;
-			case UNIFORM_FLOAT:
-				al_set_shader_float(uniform->name, uniform->float_value);
-				break;
-			case UNIFORM_FLOAT_ARR:
-				al_set_shader_float_vector(uniform->name, 1, uniform->float_list, uniform->num_values);
-				free(uniform->float_list);
-				break;
-			case UNIFORM_FLOAT_VEC:
-				al_set_shader_float_vector(uniform->name, uniform->num_values, uniform->float_vec, 1);
-				break;
-			case UNIFORM_INT:
-				al_set_shader_int(uniform->name, uniform->int_value);
-				break;
-			case UNIFORM_INT_ARR:
-				al_set_shader_int_vector(uniform->name, 1, uniform->int_list, uniform->num_values);
-				free(uniform->int_list);
-				break;
-			case UNIFORM_INT_VEC:
-				al_set_shader_int_vector(uniform->name, uniform->num_values, uniform->int_vec, 1);
-				break;
-			case UNIFORM_MATRIX:
-				al_set_shader_matrix(uniform->name, &uniform->mat_value);
-				break;
-			}
+	// upload any uniforms changed while we were inactive.  values which haven't
+	// changed since the last upload are still live in the GL program object.
+	if (it != NULL && it->program != NULL) {
+		for (i = 0; i < it->max_uniforms; ++i) {
+			if (it->uniforms[i].dirty)
+				upload_uniform(it, &it->uniforms[i]);
 		}
-		vector_clear(it->uniforms);
 	}
 
-	s_last_shader = it;
+	// a shader without a program object (e.g. headless) leaves Allegro's default
+	// pipeline in charge, so don't treat it as the active Galileo shader.
+	s_last_shader = it != NULL && it->program != NULL ? it : NULL;
 	return true;
 }
 
@@ -731,11 +887,12 @@ shape_draw(shape_t* it, image_t* surface, transform_t* transform)
 }
 
 vbo_t*
-vbo_new(void)
+vbo_new(vbo_usage_t usage)
 {
 	vbo_t* vbo;
 
 	vbo = calloc(1, sizeof(vbo_t));
+	vbo->usage = usage;
 	vbo->vertices = vector_new(sizeof(vertex_t));
 	return vbo_ref(vbo);
 }
@@ -752,8 +909,7 @@ vbo_unref(vbo_t* it)
 {
 	if (it == NULL || --it->refcount > 0)
 		return;
-	if (it->buffer != NULL)
-		al_destroy_vertex_buffer(it->buffer);
+	free_vertex_buffers(it);
 	vector_free(it->vertices);
 	free(it);
 }
@@ -761,42 +917,76 @@ vbo_unref(vbo_t* it)
 ALLEGRO_VERTEX_BUFFER*
 vbo_buffer(const vbo_t* it)
 {
-	return it->buffer;
+	return it->buffers[it->ring_index];
+}
+
+void
+vbo_draw(const vbo_t* it, const ibo_t* indices, ALLEGRO_BITMAP* texture, int num_entries, ALLEGRO_PRIM_TYPE type)
+{
+	// note: if the vertices are only in system memory (no display), they have to be
+	//       drawn through the software renderer.
+	if (it->num_buffers > 0 && indices != NULL)
+		al_draw_indexed_buffer(vbo_buffer(it), texture, indices->buffer, 0, num_entries, type);
+	else if (it->num_buffers > 0)
+		al_draw_vertex_buffer(vbo_buffer(it), texture, 0, num_entries, type);
+	else if (indices != NULL)
+		al_draw_indexed_prim(it->shadow, NULL, texture, indices->shadow, num_entries, type);
+	else
+		al_draw_prim(it->shadow, NULL, texture, 0, num_entries, type);
 }
 
 int
 vbo_len(const vbo_t* it)
 {
-	return vector_len(it->vertices);
+	return it->num_vertices;
+}
+
+vbo_usage_t
+vbo_usage(const vbo_t* it)
+{
+	return it->usage;
 }
 
 void
 vbo_add_vertex(vbo_t* it, vertex_t vertex)
 {
 	vector_push(it->vertices, &vertex);
+	++it->num_vertices;
+}
+
+bool
+vbo_update(vbo_t* it, int offset, const float* data, int num_vertices, const vertex_layout_t* layout)
+{
+	ALLEGRO_VERTEX* entries;
+
+	if (it->usage == VBO_STATIC || (it->buffers[0] == NULL && it->shadow == NULL))
+		return false;
+	if (offset < 0 || num_vertices < 0 || offset + num_vertices > it->num_vertices)
+		return false;
+	if (num_vertices == 0)
+		return true;
+
+	if (!(entries = lock_vertices(it, offset, num_vertices)))
+		return false;
+	copy_vertices(entries, data, num_vertices, layout);
+	return unlock_vertices(it, offset, num_vertices);
 }
 
 bool
 vbo_upload(vbo_t* it)
 {
-	ALLEGRO_VERTEX_BUFFER* buffer;
-	ALLEGRO_VERTEX*        entries;
-	vertex_t*              vertex;
+	ALLEGRO_VERTEX* entries;
+	vertex_t*       vertex;
 
 	iter_t iter;
 
-	if (it->buffer != NULL) {
-		al_destroy_vertex_buffer(it->buffer);
-		it->buffer = NULL;
-	}
-
 	// create the vertex buffer object
-	if (!(buffer = al_create_vertex_buffer(NULL, NULL, vector_len(it->vertices), ALLEGRO_PRIM_BUFFER_STATIC)))
+	if (!create_vertex_buffers(it, vector_len(it->vertices)))
 		return false;
 
 	// upload indices to the GPU
-	if (!(entries = al_lock_vertex_buffer(buffer, 0, vector_len(it->vertices), ALLEGRO_LOCK_WRITEONLY))) {
-		al_destroy_vertex_buffer(buffer);
+	if (!(entries = lock_vertices(it, 0, it->num_vertices))) {
+		free_vertex_buffers(it);
 		return false;
 	}
 	iter = vector_enum(it->vertices);
@@ -809,24 +999,312 @@ vbo_upload(vbo_t* it)
 		entries[iter.index].v = vertex->v;
 		entries[iter.index].color = nativecolor(vertex->color);
 	}
-	al_unlock_vertex_buffer(buffer);
+	return unlock_vertices(it, 0, it->num_vertices);
+}
 
-	it->buffer = buffer;
+bool
+vbo_upload_array(vbo_t* it, const float* data, int num_vertices, const vertex_layout_t* layout)
+{
+	// note: vertices are read directly from the caller's buffer without building a
+	//       list of vertex_t first.  if the layout matches ALLEGRO_VERTEX exactly, the
+	//       whole thing is uploaded with a single memcpy().
+
+	ALLEGRO_VERTEX* entries;
+
+	vector_clear(it->vertices);
+	if (!create_vertex_buffers(it, num_vertices))
+		return false;
+	if (!(entries = lock_vertices(it, 0, num_vertices))) {
+		free_vertex_buffers(it);
+		return false;
+	}
+	copy_vertices(entries, data, num_vertices, layout);
+	return unlock_vertices(it, 0, num_vertices);
+}
+
+static ALLEGRO_VERTEX*
+begin_batch(ALLEGRO_BITMAP* texture, int num_vertices)
+{
+	ALLEGRO_BITMAP* target;
+	ALLEGRO_VERTEX* vertices;
+
+	target = al_get_target_bitmap();
+	if (s_batch_size > 0) {
+		if (texture != s_batch_texture || target != s_batch_target
+			|| s_batch_size + num_vertices > MAX_BATCH_VERTICES)
+		{
+			galileo_flush();
+		}
+	}
+	s_batch_target = target;
+	s_batch_texture = texture;
+	vertices = s_batch_vertices + s_batch_size;
+	s_batch_size += num_vertices;
+	return vertices;
+}
+
+static void
+copy_vertices(ALLEGRO_VERTEX* entries, const float* data, int num_vertices, const vertex_layout_t* layout)
+{
+	const float* p_vertex;
+
+	int i;
+
+	if (sizeof(ALLEGRO_VERTEX) == 9 * sizeof(float) && layout->stride == 9
+		&& layout->x == 0 && layout->y == 1 && layout->z == 2
+		&& layout->u == 3 && layout->v == 4 && layout->color == 5)
+	{
+		memcpy(entries, data, (size_t)num_vertices * sizeof(ALLEGRO_VERTEX));
+	}
+	else {
+		p_vertex = data;
+		for (i = 0; i < num_vertices; ++i) {
+			entries[i].x = layout->x >= 0 ? p_vertex[layout->x] : 0.0f;
+			entries[i].y = layout->y >= 0 ? p_vertex[layout->y] : 0.0f;
+			entries[i].z = layout->z >= 0 ? p_vertex[layout->z] : 0.0f;
+			entries[i].u = layout->u >= 0 ? p_vertex[layout->u] : 0.0f;
+			entries[i].v = layout->v >= 0 ? p_vertex[layout->v] : 0.0f;
+			entries[i].color = layout->color >= 0
+				? al_map_rgba_f(p_vertex[layout->color], p_vertex[layout->color + 1],
+					p_vertex[layout->color + 2], p_vertex[layout->color + 3])
+				: al_map_rgba_f(1.0f, 1.0f, 1.0f, 1.0f);
+			p_vertex += layout->stride;
+		}
+	}
+}
+
+static bool
+create_vertex_buffers(vbo_t* vbo, int num_vertices)
+{
+	// note: stream buffers get a ring of GPU buffers which are written round-robin,
+	//       so that an update never has to wait on a buffer the GPU may still be
+	//       drawing from.  this is the same idea as orphaning the buffer in OpenGL,
+	//       which Allegro doesn't let us do directly.
+
+	int flags;
+	int num_buffers;
+
+	int i;
+
+	free_vertex_buffers(vbo);
+	if (al_get_current_display() == NULL) {
+		// no display means no vertex buffers: keep the vertices in system memory
+		// and draw them in software.
+		if (!(vbo->shadow = malloc(num_vertices * sizeof(ALLEGRO_VERTEX))))
+			return false;
+		vbo->num_vertices = num_vertices;
+		return true;
+	}
+	flags = vbo->usage == VBO_STREAM ? ALLEGRO_PRIM_BUFFER_STREAM
+		: vbo->usage == VBO_DYNAMIC ? ALLEGRO_PRIM_BUFFER_DYNAMIC
+		: ALLEGRO_PRIM_BUFFER_STATIC;
+	num_buffers = vbo->usage == VBO_STREAM ? VBO_RING_SIZE : 1;
+	if (vbo->usage == VBO_STREAM) {
+		if (!(vbo->shadow = malloc(num_vertices * sizeof(ALLEGRO_VERTEX))))
+			return false;
+	}
+	for (i = 0; i < num_buffers; ++i) {
+		if (!(vbo->buffers[i] = al_create_vertex_buffer(NULL, NULL, num_vertices, flags))) {
+			free_vertex_buffers(vbo);
+			return false;
+		}
+		vbo->dirty_start[i] = num_vertices;
+		vbo->dirty_end[i] = 0;
+	}
+	vbo->frame_id = s_frame_id;
+	vbo->num_buffers = num_buffers;
+	vbo->num_vertices = num_vertices;
 	return true;
 }
 
 static void
-free_cached_uniform(shader_t* shader, const char* name)
+free_vertex_buffers(vbo_t* vbo)
 {
+	int i;
+
+	for (i = 0; i < VBO_RING_SIZE; ++i) {
+		if (vbo->buffers[i] != NULL)
+			al_destroy_vertex_buffer(vbo->buffers[i]);
+		vbo->buffers[i] = NULL;
+	}
+	free(vbo->shadow);
+	vbo->shadow = NULL;
+	vbo->num_buffers = 0;
+	vbo->ring_index = 0;
+}
+
+static struct uniform*
+get_uniform(shader_t* shader, const char* name)
+{
+	uint32_t        hash;
+	int             max_uniforms;
+	struct uniform* new_table;
+	struct uniform* old_table;
+	int             slot;
 	struct uniform* uniform;
 
-	iter_t iter;
+	int i;
+
+	// note: uniforms are kept in an open-addressed hash table keyed on name, so
+	//       that setting a uniform by name doesn't require a linear scan.
+	hash = hash_uniform_name(name);
+	slot = hash & (shader->max_uniforms - 1);
+	while (shader->uniforms[slot].name != NULL) {
+		uniform = &shader->uniforms[slot];
+		if (uniform->hash == hash && strcmp(uniform->name, name) == 0)
+			return uniform;
+		slot = (slot + 1) & (shader->max_uniforms - 1);
+	}
 
-	iter = vector_enum(shader->uniforms);
-	while ((uniform = iter_next(&iter))) {
-		if (strcmp(uniform->name, name) == 0)
-			iter_remove(&iter);
+	// not seen yet, add a new entry.  keep the load factor under 3/4 so probe
+	// sequences stay short.
+	if ((shader->num_uniforms + 1) * 4 > shader->max_uniforms * 3) {
+		max_uniforms = shader->max_uniforms * 2;
+		old_table = shader->uniforms;
+		new_table = calloc(max_uniforms, sizeof(struct uniform));
+		for (i = 0; i < shader->max_uniforms; ++i) {
+			if (old_table[i].name == NULL)
+				continue;
+			slot = old_table[i].hash & (max_uniforms - 1);
+			while (new_table[slot].name != NULL)
+				slot = (slot + 1) & (max_uniforms - 1);
+			new_table[slot] = old_table[i];
+		}
+		free(old_table);
+		shader->uniforms = new_table;
+		shader->max_uniforms = max_uniforms;
+		slot = hash & (shader->max_uniforms - 1);
+		while (shader->uniforms[slot].name != NULL)
+			slot = (slot + 1) & (shader->max_uniforms - 1);
 	}
+	uniform = &shader->uniforms[slot];
+	uniform->name = strdup(name);
+	uniform->hash = hash;
+	uniform->location = UNIFORM_NO_LOCATION;
+	uniform->type = UNIFORM_NONE;
+	++shader->num_uniforms;
+	return uniform;
+}
+
+static uint32_t
+hash_uniform_name(const char* name)
+{
+	uint32_t hash = 2166136261u;
+
+	// 32-bit FNV-1a
+	while (*name != '\0') {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static ALLEGRO_VERTEX*
+lock_vertices(vbo_t* vbo, int offset, int num_vertices)
+{
+	// note: stream buffers are edited in system memory and copied to the GPU when
+	//       unlocked, since the buffers in the ring don't all have the same contents.
+	if (vbo->usage == VBO_STREAM || vbo->num_buffers == 0)
+		return vbo->shadow + offset;
+	else
+		return al_lock_vertex_buffer(vbo->buffers[0], offset, num_vertices, ALLEGRO_LOCK_WRITEONLY);
+}
+
+static void
+put_uniform(shader_t* shader, const char* name, enum uniform_type type, const void* data, int num_values)
+{
+	size_t          size;
+	void*           storage;
+	struct uniform* uniform;
+
+	size = type == UNIFORM_BOOL ? sizeof(bool)
+		: type == UNIFORM_MATRIX ? sizeof(ALLEGRO_TRANSFORM)
+		: type == UNIFORM_FLOAT || type == UNIFORM_FLOAT_ARR || type == UNIFORM_FLOAT_VEC
+			? num_values * sizeof(float)
+		: num_values * sizeof(int);
+
+	uniform = get_uniform(shader, name);
+	if (uniform->type == type && uniform->num_values == num_values) {
+		storage = type == UNIFORM_FLOAT_ARR ? (void*)uniform->float_list
+			: type == UNIFORM_INT_ARR ? (void*)uniform->int_list
+			: (void*)&uniform->mat_value;
+		if (memcmp(storage, data, size) == 0)
+			return;  // value hasn't changed, nothing to upload
+	}
+	else {
+		if (uniform->type == UNIFORM_FLOAT_ARR)
+			free(uniform->float_list);
+		else if (uniform->type == UNIFORM_INT_ARR)
+			free(uniform->int_list);
+		if (type == UNIFORM_FLOAT_ARR)
+			uniform->float_list = malloc(size);
+		else if (type == UNIFORM_INT_ARR)
+			uniform->int_list = malloc(size);
+		storage = type == UNIFORM_FLOAT_ARR ? (void*)uniform->float_list
+			: type == UNIFORM_INT_ARR ? (void*)uniform->int_list
+			: (void*)&uniform->mat_value;
+		uniform->type = type;
+		uniform->num_values = num_values;
+	}
+	memcpy(storage, data, size);
+
+	// if the shader is active the new value can go straight to the GPU, otherwise
+	// it's uploaded the next time the shader is activated.  anything still batched
+	// was drawn with the old value, so it has to be flushed first.
+	if (s_last_shader == shader) {
+		galileo_flush();
+		upload_uniform(shader, uniform);
+	}
+	else {
+		uniform->dirty = true;
+	}
+}
+
+static bool
+unlock_vertices(vbo_t* vbo, int offset, int num_vertices)
+{
+	// note: each buffer in the ring keeps track of the range of vertices it's missing,
+	//       and only that range is uploaded.  the ring moves on to the next buffer at
+	//       most once per frame; the buffer drawn from last frame may still be in use
+	//       by the GPU, but one already updated this frame can be updated again.
+
+	ALLEGRO_VERTEX_BUFFER* buffer;
+	void*                  entries;
+	int                    num_dirty;
+	int                    start;
+
+	int i;
+
+	if (vbo->num_buffers == 0)
+		return true;  // software vertices, nothing to upload
+	if (vbo->usage != VBO_STREAM) {
+		al_unlock_vertex_buffer(vbo->buffers[0]);
+		return true;
+	}
+
+	for (i = 0; i < vbo->num_buffers; ++i) {
+		if (offset < vbo->dirty_start[i])
+			vbo->dirty_start[i] = offset;
+		if (offset + num_vertices > vbo->dirty_end[i])
+			vbo->dirty_end[i] = offset + num_vertices;
+	}
+	if (vbo->frame_id != s_frame_id) {
+		vbo->ring_index = (vbo->ring_index + 1) % vbo->num_buffers;
+		vbo->frame_id = s_frame_id;
+	}
+	i = vbo->ring_index;
+	buffer = vbo->buffers[i];
+	start = vbo->dirty_start[i];
+	num_dirty = vbo->dirty_end[i] - start;
+	if (num_dirty <= 0)
+		return true;
+	if (!(entries = al_lock_vertex_buffer(buffer, start, num_dirty, ALLEGRO_LOCK_WRITEONLY)))
+		return false;
+	memcpy(entries, vbo->shadow + start, num_dirty * sizeof(ALLEGRO_VERTEX));
+	al_unlock_vertex_buffer(buffer);
+	vbo->dirty_start[i] = vbo->num_vertices;
+	vbo->dirty_end[i] = 0;
+	return true;
 }
 
 static void
@@ -851,8 +1329,69 @@ render_shape(shape_t* shape)
 		: ALLEGRO_PRIM_POINT_LIST;
 
 	bitmap = shape->texture != NULL ? image_bitmap(shape->texture) : NULL;
-	if (shape->ibo != NULL)
-		al_draw_indexed_buffer(vbo_buffer(shape->vbo), bitmap, ibo_buffer(shape->ibo), 0, num_indices, draw_mode);
-	else
-		al_draw_vertex_buffer(vbo_buffer(shape->vbo), bitmap, 0, num_vertices, draw_mode);
+	galileo_flush();
+	++s_num_draws;
+	++s_num_batches;
+	vbo_draw(shape->vbo, shape->ibo, bitmap, shape->ibo != NULL ? num_indices : num_vertices, draw_mode);
+}
+
+static void
+upload_uniform(shader_t* shader, struct uniform* uniform)
+{
+	GLint location;
+
+	// note: Allegro's al_set_shader_*() functions look up the uniform location by
+	//       name on every call.  we only do it once per uniform and talk to GL
+	//       directly from then on.
+	if (shader->program == NULL)
+		return;  // no GL program to upload to, keep the value dirty
+	if (uniform->location == UNIFORM_NO_LOCATION) {
+		uniform->location = glGetUniformLocation(
+			al_get_opengl_program_object(shader->program), uniform->name);
+	}
+	uniform->dirty = false;
+	if ((location = uniform->location) < 0)
+		return;  // not an active uniform in this program
+	switch (uniform->type) {
+	case UNIFORM_NONE:
+		break;
+	case UNIFORM_BOOL:
+		glUniform1i(location, uniform->bool_value);
+		break;
+	case UNIFORM_FLOAT:
+		glUniform1f(location, uniform->float_value);
+		break;
+	case UNIFORM_FLOAT_ARR:
+		glUniform1fv(location, uniform->num_values, uniform->float_list);
+		break;
+	case UNIFORM_FLOAT_VEC:
+		if (uniform->num_values == 2)
+			glUniform2fv(location, 1, uniform->float_vec);
+		else if (uniform->num_values == 3)
+			glUniform3fv(location, 1, uniform->float_vec);
+		else if (uniform->num_values == 4)
+			glUniform4fv(location, 1, uniform->float_vec);
+		else
+			glUniform1fv(location, 1, uniform->float_vec);
+		break;
+	case UNIFORM_INT:
+		glUniform1i(location, uniform->int_value);
+		break;
+	case UNIFORM_INT_ARR:
+		glUniform1iv(location, uniform->num_values, uniform->int_list);
+		break;
+	case UNIFORM_INT_VEC:
+		if (uniform->num_values == 2)
+			glUniform2iv(location, 1, uniform->int_vec);
+		else if (uniform->num_values == 3)
+			glUniform3iv(location, 1, uniform->int_vec);
+		else if (uniform->num_values == 4)
+			glUniform4iv(location, 1, uniform->int_vec);
+		else
+			glUniform1iv(location, 1, uniform->int_vec);
+		break;
+	case UNIFORM_MATRIX:
+		glUniformMatrix4fv(location, 1, GL_FALSE, (const GLfloat*)uniform->mat_value.m);
+		break;
+	}
 }
@@ -60,6 +60,14 @@ enum shape_type
 	SHAPE_MAX
 } shape_type_t;
 
+typedef
+enum vbo_usage
+{
+	VBO_STATIC,
+	VBO_DYNAMIC,
+	VBO_STREAM
+} vbo_usage_t;
+
 typedef
 struct vertex
 {
@@ -68,17 +76,33 @@ struct vertex
 	color_t color;
 } vertex_t;
 
+typedef
+struct vertex_layout
+{
+	int stride;     // in floats
+	int x, y, z;    // offset of each attribute in floats, or -1 if not present
+	int u, v;
+	int color;      // 4 floats: RGBA, from 0.0 to 1.0
+} vertex_layout_t;
+
 void                   galileo_init            (void);
 void                   galileo_uninit          (void);
 shader_t*              galileo_shader          (void);
+void                   galileo_draw_prim       (ALLEGRO_BITMAP* texture, const ALLEGRO_VERTEX vertices[], int num_vertices, ALLEGRO_PRIM_TYPE type);
+void                   galileo_draw_quad       (ALLEGRO_BITMAP* texture, ALLEGRO_COLOR color, float sx, float sy, float sw, float sh, const float corners[8]);
+void                   galileo_flush           (void);
+void                   galileo_get_stats       (int *out_num_draws, int *out_num_batches);
 void                   galileo_reset           (void);
+void                   galileo_reset_stats     (void);
 ibo_t*                 ibo_new                 (void);
 ibo_t*                 ibo_ref                 (ibo_t* it);
 void                   ibo_unref               (ibo_t* it);
 ALLEGRO_INDEX_BUFFER*  ibo_buffer              (const ibo_t* it);
 int                    ibo_len                 (const ibo_t* it);
+int                    ibo_max_index           (const ibo_t* it);
 void                   ibo_add_index           (ibo_t* it, uint16_t index);
 bool                   ibo_upload              (ibo_t* it);
+bool                   ibo_upload_array        (ibo_t* it, const void* data, int num_indices, int index_size);
 model_t*               model_new               (shader_t* shader);
 model_t*               model_ref               (model_t* it);
 void                   model_unref             (model_t* it);
@@ -112,12 +136,16 @@ void                   shape_set_ibo           (shape_t* it, ibo_t* ibo);
 void                   shape_set_texture       (shape_t* it, image_t* texture);
 void                   shape_set_vbo           (shape_t* it, vbo_t* vbo);
 void                   shape_draw              (shape_t* it, image_t* surface, transform_t* transform);
-vbo_t*                 vbo_new                 (void);
+vbo_t*                 vbo_new                 (vbo_usage_t usage);
 vbo_t*                 vbo_ref                 (vbo_t* it);
 void                   vbo_unref               (vbo_t* it);
 ALLEGRO_VERTEX_BUFFER* vbo_buffer              (const vbo_t* it);
+void                   vbo_draw                (const vbo_t* it, const ibo_t* indices, ALLEGRO_BITMAP* texture, int num_entries, ALLEGRO_PRIM_TYPE type);
 int                    vbo_len                 (const vbo_t* it);
+vbo_usage_t            vbo_usage               (const vbo_t* it);
 void                   vbo_add_vertex          (vbo_t* it, vertex_t vertex);
+bool                   vbo_update              (vbo_t* it, int offset, const float* data, int num_vertices, const vertex_layout_t* layout);
 bool                   vbo_upload              (vbo_t* it);
+bool                   vbo_upload_array        (vbo_t* it, const float* data, int num_vertices, const vertex_layout_t* layout);
 
 #endif // SPHERE__GALILEO_H__INCLUDED
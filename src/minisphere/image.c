@@ -35,6 +35,7 @@
 
 #include "color.h"
 #include "galileo.h"
+#include "pixels.h"
 #include "transform.h"
 
 struct image
@@ -59,6 +60,7 @@ struct image
 
 static void apply_blend_mode (blend_mode_t mode);
 static void cache_pixels     (image_t* image);
+static void draw_quad        (image_t* image, ALLEGRO_COLOR color, float sx, float sy, float sw, float sh, float x, float y, float width, float height);
 static void uncache_pixels   (image_t* image);
 
 static image_t*     s_last_image = NULL;
@@ -125,6 +127,7 @@ image_dup(const image_t* it)
 	console_log(3, "cloning image #%u from source image #%u",
 		s_next_image_id, it->id);
 
+	galileo_flush();
 	image = calloc(1, sizeof(image_t));
 	if (!(image->bitmap = al_clone_bitmap(it->bitmap)))
 		goto on_error;
@@ -212,6 +215,7 @@ image_unref(image_t* it)
 
 	console_log(3, "disposing image #%u no longer in use",
 		it->id);
+	galileo_flush();
 	uncache_pixels(it);
 	al_destroy_bitmap(it->bitmap);
 	image_unref(it->parent);
@@ -267,16 +271,20 @@ void
 image_set_blend_mode(image_t* it, blend_mode_t mode)
 {
 	it->blend_mode = mode;
-	if (it == s_last_image)
+	if (it == s_last_image) {
+		galileo_flush();
 		apply_blend_mode(mode);
+	}
 }
 
 void
 image_set_scissor(image_t* it, rect_t value)
 {
 	it->scissor_box = value;
-	if (it == s_last_image)
+	if (it == s_last_image) {
+		galileo_flush();
 		al_set_clipping_rectangle(value.x1, value.y1, value.x2 - value.x1, value.y2 - value.y1);
+	}
 	else
 		it->clipping_set = false;
 }
@@ -295,17 +303,11 @@ bool
 image_apply_color_fx(image_t* it, color_fx_t matrix, int x, int y, int width, int height)
 {
 	image_lock_t* lock;
-	color_t*      pixel;
-
-	int i_x, i_y;
 
 	if (!(lock = image_lock(it, true, true)))
 		return false;
 	uncache_pixels(it);
-	for (i_x = x; i_x < x + width; ++i_x) for (i_y = y; i_y < y + height; ++i_y) {
-		pixel = &lock->pixels[i_x + i_y * lock->pitch];
-		*pixel = color_transform(*pixel, matrix);
-	}
+	pixels_apply_color_fx(&lock->pixels[x + y * lock->pitch], lock->pitch, width, height, matrix);
 	image_unlock(it, lock);
 	return true;
 }
@@ -313,40 +315,12 @@ image_apply_color_fx(image_t* it, color_fx_t matrix, int x, int y, int width, in
 bool
 image_apply_color_fx_4(image_t* it, color_fx_t ul_mat, color_fx_t ur_mat, color_fx_t ll_mat, color_fx_t lr_mat, int x, int y, int w, int h)
 {
-	// this function might be difficult to understand at first. the implementation
-	// is, however, much easier to follow than the one in Sphere. basically what it
-	// boils down to is bilinear interpolation, but with matrices. it's much more
-	// straightforward than it sounds.
-
-	int           i1, i2;
 	image_lock_t* lock;
-	color_fx_t mat_1, mat_2, mat_3;
-	color_t*      pixel;
-
-	int i_x, i_y;
 
 	if (!(lock = image_lock(it, true, true)))
 		return false;
 	uncache_pixels(it);
-	for (i_y = y; i_y < y + h; ++i_y) {
-		// thankfully, we don't have to do a full bilinear interpolation every frame.
-		// two thirds of the work is done in the outer loop, giving us two color matrices
-		// which we then use in the inner loop to calculate the transforms for individual
-		// pixels.
-		i1 = y + h - 1 - i_y;
-		i2 = i_y - y;
-		mat_1 = color_fx_mix(ul_mat, ll_mat, i1, i2);
-		mat_2 = color_fx_mix(ur_mat, lr_mat, i1, i2);
-		for (i_x = x; i_x < x + w; ++i_x) {
-			// calculate the final matrix for this pixel and transform it
-			i1 = x + w - 1 - i_x;
-			i2 = i_x - x;
-			mat_3 = color_fx_mix(mat_1, mat_2, i1, i2);
-			pixel = &lock->pixels[i_x + i_y * lock->pitch];
-			*pixel = color_transform(*pixel, mat_3);
-
-		}
-	}
+	pixels_apply_color_fx_4(&lock->pixels[x + y * lock->pitch], lock->pitch, w, h, ul_mat, ur_mat, ll_mat, lr_mat);
 	image_unlock(it, lock);
 	return true;
 }
@@ -355,21 +329,15 @@ bool
 image_apply_lookup(image_t* it, int x, int y, int width, int height, uint8_t red_lu[256], uint8_t green_lu[256], uint8_t blue_lu[256], uint8_t alpha_lu[256])
 {
 	ALLEGRO_BITMAP*        bitmap = image_bitmap(it);
-	uint8_t*               pixel;
 	ALLEGRO_LOCKED_REGION* lock;
+	color_t*               pixels;
 
-	int i_x, i_y;
-
+	galileo_flush();
 	if ((lock = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_READWRITE)) == NULL)
 		return false;
 	uncache_pixels(it);
-	for (i_x = x; i_x < x + width; ++i_x) for (i_y = y; i_y < y + height; ++i_y) {
-		pixel = (uint8_t*)lock->data + i_x * 4 + i_y * lock->pitch;
-		pixel[0] = red_lu[pixel[0]];
-		pixel[1] = green_lu[pixel[1]];
-		pixel[2] = blue_lu[pixel[2]];
-		pixel[3] = alpha_lu[pixel[3]];
-	}
+	pixels = (color_t*)((uint8_t*)lock->data + x * 4 + y * lock->pitch);
+	pixels_apply_lookup(pixels, lock->pitch / 4, width, height, red_lu, green_lu, blue_lu, alpha_lu);
 	al_unlock_bitmap(bitmap);
 	return true;
 }
@@ -382,6 +350,7 @@ image_blit(image_t* it, image_t* target_image, int x, int y)
 	int             blend_op;
 	ALLEGRO_BITMAP* old_target;
 
+	galileo_flush();
 	old_target = al_get_target_bitmap();
 	al_set_target_bitmap(image_bitmap(target_image));
 	al_get_blender(&blend_op, &blend_mode_src, &blend_mode_dest);
@@ -426,29 +395,33 @@ on_error:
 void
 image_draw(image_t* it, int x, int y)
 {
-	al_draw_bitmap(it->bitmap, x, y, 0x0);
+	draw_quad(it, al_map_rgba_f(1.0f, 1.0f, 1.0f, 1.0f),
+		0, 0, it->width, it->height,
+		x, y, it->width, it->height);
 }
 
 void
 image_draw_masked(image_t* it, color_t mask, int x, int y)
 {
-	al_draw_tinted_bitmap(it->bitmap, nativecolor(mask), x, y, 0x0);
+	draw_quad(it, nativecolor(mask),
+		0, 0, it->width, it->height,
+		x, y, it->width, it->height);
 }
 
 void
 image_draw_scaled(image_t* it, int x, int y, int width, int height)
 {
-	al_draw_scaled_bitmap(it->bitmap,
-		0, 0, al_get_bitmap_width(it->bitmap), al_get_bitmap_height(it->bitmap),
-		x, y, width, height, 0x0);
+	draw_quad(it, al_map_rgba_f(1.0f, 1.0f, 1.0f, 1.0f),
+		0, 0, it->width, it->height,
+		x, y, width, height);
 }
 
 void
 image_draw_scaled_masked(image_t* it, color_t mask, int x, int y, int width, int height)
 {
-	al_draw_tinted_scaled_bitmap(it->bitmap, nativecolor(mask),
-		0, 0, al_get_bitmap_width(it->bitmap), al_get_bitmap_height(it->bitmap),
-		x, y, width, height, 0x0);
+	draw_quad(it, nativecolor(mask),
+		0, 0, it->width, it->height,
+		x, y, width, height);
 }
 
 void
@@ -462,7 +435,6 @@ image_draw_tiled_masked(image_t* it, color_t mask, int x, int y, int width, int
 {
 	ALLEGRO_COLOR native_mask = nativecolor(mask);
 	int           img_w, img_h;
-	bool          is_drawing_held;
 	int           tile_w, tile_h;
 
 	int i_x, i_y;
@@ -476,20 +448,17 @@ image_draw_tiled_masked(image_t* it, color_t mask, int x, int y, int width, int
 			{ x, y + height, 0, 0, height, native_mask },
 			{ x + width, y + height, 0, width, height, native_mask }
 		};
-		al_draw_prim(vbuf, NULL, it->bitmap, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
+		galileo_draw_prim(it->bitmap, vbuf, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 	}
 	else {
 		// texture smaller than 16x16, tile it in software (Allegro pads it)
-		is_drawing_held = al_is_bitmap_drawing_held();
-		al_hold_bitmap_drawing(true);
 		for (i_x = width / img_w; i_x >= 0; --i_x) for (i_y = height / img_h; i_y >= 0; --i_y) {
 			tile_w = i_x == width / img_w ? width % img_w : img_w;
 			tile_h = i_y == height / img_h ? height % img_h : img_h;
-			al_draw_tinted_bitmap_region(it->bitmap, native_mask,
+			draw_quad(it, native_mask,
 				0, 0, tile_w, tile_h,
-				x + i_x * img_w, y + i_y * img_h, 0x0);
+				x + i_x * img_w, y + i_y * img_h, tile_w, tile_h);
 		}
-		al_hold_bitmap_drawing(is_drawing_held);
 	}
 }
 
@@ -502,6 +471,7 @@ image_fill(image_t* it, color_t color)
 	int             clip_y;
 	ALLEGRO_BITMAP* old_target;
 
+	galileo_flush();
 	uncache_pixels(it);
 	al_get_clipping_rectangle(&clip_x, &clip_y, &clip_width, &clip_height);
 	al_reset_clipping_rectangle();
@@ -521,6 +491,7 @@ image_flip(image_t* it, bool is_h_flip, bool is_v_flip)
 
 	if (!is_h_flip && !is_v_flip)  // this really shouldn't happen...
 		return true;
+	galileo_flush();
 	uncache_pixels(it);
 	if (!(new_bitmap = al_create_bitmap(it->width, it->height)))
 		return false;
@@ -556,6 +527,7 @@ image_lock(image_t* it, bool uploading, bool downloading)
 	int                    lock_flag;
 
 	if (it->lock_count == 0) {
+		galileo_flush();
 		lock_flag = downloading && uploading ? ALLEGRO_LOCK_READWRITE
 			: downloading ? ALLEGRO_LOCK_READONLY
 			: uploading ? ALLEGRO_LOCK_WRITEONLY
@@ -578,19 +550,23 @@ image_render_to(image_t* it, transform_t* transform)
 	rect_t            scissor;
 
 	if (it != s_last_image) {
+		galileo_flush();
 		al_set_target_bitmap(it->bitmap);
 		shader_use(NULL, true);
 	}
 	scissor = it->scissor_box;
 	if (!it->clipping_set) {
+		galileo_flush();
 		al_set_clipping_rectangle(scissor.x1, scissor.y1, scissor.x2 - scissor.x1, scissor.y2 - scissor.y1);
 		it->clipping_set = true;
 	}
 	if (transform_dirty(it->transform)) {
+		galileo_flush();
 		al_use_projection_transform(transform_matrix(it->transform));
 		transform_make_clean(it->transform);
 	}
 	if (transform != it->modelview || transform_dirty(transform)) {
+		galileo_flush();
 		if (transform != NULL) {
 			al_use_transform(transform_matrix(transform));
 		}
@@ -610,31 +586,17 @@ bool
 image_replace_color(image_t* it, color_t color, color_t new_color)
 {
 	ALLEGRO_BITMAP*        bitmap;
-	uint8_t*               pixel;
 	ALLEGRO_LOCKED_REGION* lock;
 	int                    w, h;
 
-	int i_x, i_y;
-
+	galileo_flush();
 	bitmap = image_bitmap(it);
 	if ((lock = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_READWRITE)) == NULL)
 		return false;
 	uncache_pixels(it);
 	w = al_get_bitmap_width(bitmap);
 	h = al_get_bitmap_height(bitmap);
-	for (i_x = 0; i_x < w; ++i_x) for (i_y = 0; i_y < h; ++i_y) {
-		pixel = (uint8_t*)lock->data + i_x * 4 + i_y * lock->pitch;
-		if (pixel[0] == color.r &&
-		    pixel[1] == color.g &&
-		    pixel[2] == color.b &&
-		    pixel[3] == color.a)
-		{
-			pixel[0] = new_color.r;
-			pixel[1] = new_color.g;
-			pixel[2] = new_color.b;
-			pixel[3] = new_color.a;
-		}
-	}
+	pixels_replace_color(lock->data, lock->pitch / 4, w, h, color, new_color);
 	al_unlock_bitmap(bitmap);
 	return true;
 }
@@ -649,6 +611,7 @@ image_rescale(image_t* it, int width, int height)
 		return true;
 	if (!(new_bitmap = al_create_bitmap(width, height)))
 		return false;
+	galileo_flush();
 	uncache_pixels(it);
 	old_target = al_get_target_bitmap();
 	al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
@@ -673,6 +636,7 @@ image_save(image_t* it, const char* filename)
 	size_t        next_buf_size;
 	bool          result;
 
+	galileo_flush();
 	next_buf_size = 65536;
 	do {
 		buffer = realloc(buffer, next_buf_size);
@@ -693,6 +657,7 @@ image_set_pixel(image_t* it, int x, int y, color_t color)
 {
 	ALLEGRO_BITMAP* old_target;
 
+	galileo_flush();
 	uncache_pixels(it);
 	old_target = al_get_target_bitmap();
 	al_set_target_bitmap(it->bitmap);
@@ -812,6 +777,18 @@ on_error:
 		al_unlock_bitmap(image->bitmap);
 }
 
+static void
+draw_quad(image_t* image, ALLEGRO_COLOR color, float sx, float sy, float sw, float sh, float x, float y, float width, float height)
+{
+	float corners[8];
+
+	corners[0] = x;         corners[1] = y;
+	corners[2] = x + width; corners[3] = y;
+	corners[4] = x + width; corners[5] = y + height;
+	corners[6] = x;         corners[7] = y + height;
+	galileo_draw_quad(image->bitmap, color, sx, sy, sw, sh, corners);
+}
+
 static void
 uncache_pixels(image_t* image)
 {
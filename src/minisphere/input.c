@@ -36,6 +36,7 @@
 #include "debugger.h"
 #include "jsal.h"
 #include "kev_file.h"
+#include "replay.h"
 #include "script.h"
 #include "vector.h"
 
@@ -45,22 +46,29 @@ struct key_queue
 	int keys[255];
 };
 
+static void handle_event      (const ALLEGRO_EVENT* event);
 static void queue_key         (int keycode);
 static void queue_mouse_event (mouse_key_t key, int x, int y);
+static bool read_mouse        (ALLEGRO_MOUSE_STATE* out_state);
 
 static vector_t*            s_bound_buttons;
 static vector_t*            s_bound_keys;
 static int                  s_default_key_map[4][PLAYER_KEY_MAX];
 static ALLEGRO_EVENT_QUEUE* s_event_queue;
 static bool                 s_have_joystick;
+static bool                 s_have_keyboard;
 static bool                 s_have_mouse;
 static ALLEGRO_JOYSTICK*    s_joy_handles[MAX_JOYSTICKS];
 static int                  s_key_map[4][PLAYER_KEY_MAX];
 static struct key_queue     s_key_queue;
 static bool                 s_key_state[ALLEGRO_KEY_MAX];
 static int                  s_keymod_state;
+static int                  s_last_input_frame = -1;
+static int                  s_last_input_poll = -1;
 static int                  s_last_wheel_pos = 0;
+static bool                 s_mouse_in_window = false;
 static mouse_event_t        s_mouse_queue[255];
+static ALLEGRO_MOUSE_STATE  s_mouse_state;
 static int                  s_num_joysticks = 0;
 static int                  s_num_mouse_events = 0;
 static bool                 s_has_keymap_changed = false;
@@ -89,16 +97,32 @@ initialize_input(void)
 
 	console_log(1, "initializing input subsystem");
 
-	al_install_keyboard();
+	if (!(s_have_keyboard = al_install_keyboard()))
+		console_log(1, "  keyboard initialization failed");
 	if (!(s_have_mouse = al_install_mouse()))
 		console_log(1, "  mouse initialization failed");
-	if (!(s_have_joystick = al_install_joystick()))
+	if (replay_mode() != REPLAY_OFF) {
+		// note: joysticks are polled directly rather than generating events, so they
+		//       can't be recorded or replayed.  disable them for consistency.
+		console_log(1, "  joysticks disabled while recording or replaying");
+		s_have_joystick = false;
+	}
+	else if (!(s_have_joystick = al_install_joystick())) {
 		console_log(1, "  joystick initialization failed");
+	}
 
 	memset(s_key_state, 0, sizeof s_key_state);
+	s_key_queue.num_keys = 0;
+	s_keymod_state = 0;
+	s_last_input_frame = -1;
+	s_last_input_poll = -1;
+	s_last_wheel_pos = 0;
+	s_mouse_in_window = false;
+	s_num_mouse_events = 0;
 
 	s_event_queue = al_create_event_queue();
-	al_register_event_source(s_event_queue, al_get_keyboard_event_source());
+	if (s_have_keyboard)
+		al_register_event_source(s_event_queue, al_get_keyboard_event_source());
 	if (s_have_mouse)
 		al_register_event_source(s_event_queue, al_get_mouse_event_source());
 	if (s_have_joystick)
@@ -466,15 +490,24 @@ mouse_get_event(void)
 	return event;
 }
 
+bool
+mouse_get_state(ALLEGRO_MOUSE_STATE* out_state)
+{
+	// note: while a session is being recorded or replayed, the mouse is only sampled once
+	//       per frame (by update_input()) and that snapshot is what the game sees.
+	if (replay_mode() != REPLAY_OFF) {
+		*out_state = s_mouse_state;
+		return s_mouse_in_window;
+	}
+	return read_mouse(out_state);
+}
+
 bool
 mouse_is_key_down(mouse_key_t key)
 {
-	ALLEGRO_DISPLAY*    display;
 	ALLEGRO_MOUSE_STATE state;
 
-	display = screen_display(g_screen);
-	al_get_mouse_state(&state);
-	if (state.display != display)
+	if (!mouse_get_state(&state))
 		return false;
 	switch (key) {
 	case MOUSE_KEY_LEFT:
@@ -545,89 +578,59 @@ update_bound_keys(bool use_map_keys)
 void
 update_input(void)
 {
-	ALLEGRO_EVENT          event;
-	int                    keycode;
-	ALLEGRO_MOUSE_STATE    mouse_state;
-
-	// process Allegro input events
-	while (al_get_next_event(s_event_queue, &event)) {
-		switch (event.type) {
-		case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
-			// Alt+Tabbing out can cause keys to get "stuck", this works around it
-			// by clearing the states when switching away.
-			memset(s_key_state, 0, ALLEGRO_KEY_MAX * sizeof(bool));
-			break;
-		case ALLEGRO_EVENT_KEY_DOWN:
-			keycode = event.keyboard.keycode;
-			s_key_state[keycode] = true;
-
-			// queue Ctrl/Alt/Shift keys (Sphere compatibility hack)
-			if (keycode == ALLEGRO_KEY_LCTRL || keycode == ALLEGRO_KEY_RCTRL
-				|| keycode == ALLEGRO_KEY_ALT || keycode == ALLEGRO_KEY_ALTGR
-				|| keycode == ALLEGRO_KEY_LSHIFT || keycode == ALLEGRO_KEY_RSHIFT)
-			{
-				if (keycode == ALLEGRO_KEY_LCTRL || keycode == ALLEGRO_KEY_RCTRL)
-					queue_key(ALLEGRO_KEY_LCTRL);
-				if (keycode == ALLEGRO_KEY_ALT || keycode == ALLEGRO_KEY_ALTGR)
-					queue_key(ALLEGRO_KEY_ALT);
-				if (keycode == ALLEGRO_KEY_LSHIFT || keycode == ALLEGRO_KEY_RSHIFT)
-					queue_key(ALLEGRO_KEY_LSHIFT);
-			}
-
-			break;
-		case ALLEGRO_EVENT_KEY_UP:
-			s_key_state[event.keyboard.keycode] = false;
+	ALLEGRO_EVENT       event;
+	bool                in_window;
+	bool                is_new_poll;
+	ALLEGRO_MOUSE_STATE mouse_state;
+
+	// while a session is being recorded or replayed, input is only taken once each time
+	// the engine flips a frame or waits (see replay_next_poll()), so that it always lands
+	// at the same point in the game.  during replay, live input is thrown away in favor
+	// of the recording.
+	is_new_poll = replay_frame() != s_last_input_frame
+		|| replay_poll() != s_last_input_poll;
+	s_last_input_frame = replay_frame();
+	s_last_input_poll = replay_poll();
+	switch (replay_mode()) {
+	case REPLAY_OFF:
+		while (al_get_next_event(s_event_queue, &event))
+			handle_event(&event);
+		break;
+	case REPLAY_RECORD:
+		if (!is_new_poll)
 			break;
-		case ALLEGRO_EVENT_KEY_CHAR:
-			s_keymod_state = event.keyboard.modifiers;
-			switch (event.keyboard.keycode) {
-			case ALLEGRO_KEY_ENTER:
-				if (event.keyboard.modifiers & ALLEGRO_KEYMOD_ALT
-				 || event.keyboard.modifiers & ALLEGRO_KEYMOD_ALTGR)
-				{
-					screen_toggle_fullscreen(g_screen);
-				}
-				else {
-					queue_key(event.keyboard.keycode);
-				}
-				break;
-			case ALLEGRO_KEY_F10:
-				screen_toggle_fullscreen(g_screen);
-				break;
-			case ALLEGRO_KEY_F11:
-				screen_toggle_fps(g_screen);
-				break;
-			case ALLEGRO_KEY_F12:
-				if (!debugger_attached())
-					screen_queue_screenshot(g_screen);
-				else
-					jsal_debug_breakpoint_inject();
-				break;
-			default:
-				queue_key(event.keyboard.keycode);
-				break;
-			}
+		while (al_get_next_event(s_event_queue, &event)) {
+			replay_put_event(&event);
+			handle_event(&event);
 		}
+		s_mouse_in_window = read_mouse(&s_mouse_state);
+		replay_put_mouse(&s_mouse_state, s_mouse_in_window);
+		break;
+	case REPLAY_PLAY:
+		while (al_get_next_event(s_event_queue, &event));
+		while (replay_get_event(&event))
+			handle_event(&event);
+		if (is_new_poll)
+			s_mouse_in_window = replay_get_mouse(&s_mouse_state);
+		break;
 	}
 
-	if (s_have_mouse) {
-		// check for mouse wheel movement
-		al_get_mouse_state(&mouse_state);
-		if (mouse_state.z > s_last_wheel_pos)
-			queue_mouse_event(MOUSE_KEY_WHEEL_UP, mouse_state.x, mouse_state.y);
-		if (mouse_state.z < s_last_wheel_pos)
-			queue_mouse_event(MOUSE_KEY_WHEEL_DOWN, mouse_state.x, mouse_state.y);
-		s_last_wheel_pos = mouse_state.z;
-
-		// check for mouse clicks.  clicks are queued in order of left->right->middle.
-		if (mouse_state.display == screen_display(g_screen)) {
-			if (al_mouse_button_down(&mouse_state, 1))
-				queue_mouse_event(MOUSE_KEY_LEFT, mouse_state.x, mouse_state.y);
-			if (al_mouse_button_down(&mouse_state, 2))
-				queue_mouse_event(MOUSE_KEY_RIGHT, mouse_state.x, mouse_state.y);
-			if (al_mouse_button_down(&mouse_state, 3))
-				queue_mouse_event(MOUSE_KEY_MIDDLE, mouse_state.x, mouse_state.y);
-		}
+	// check for mouse wheel movement
+	in_window = mouse_get_state(&mouse_state);
+	if (mouse_state.z > s_last_wheel_pos)
+		queue_mouse_event(MOUSE_KEY_WHEEL_UP, mouse_state.x, mouse_state.y);
+	if (mouse_state.z < s_last_wheel_pos)
+		queue_mouse_event(MOUSE_KEY_WHEEL_DOWN, mouse_state.x, mouse_state.y);
+	s_last_wheel_pos = mouse_state.z;
+
+	// check for mouse clicks.  clicks are queued in order of left->right->middle.
+	if (in_window) {
+		if (al_mouse_button_down(&mouse_state, 1))
+			queue_mouse_event(MOUSE_KEY_LEFT, mouse_state.x, mouse_state.y);
+		if (al_mouse_button_down(&mouse_state, 2))
+			queue_mouse_event(MOUSE_KEY_RIGHT, mouse_state.x, mouse_state.y);
+		if (al_mouse_button_down(&mouse_state, 3))
+			queue_mouse_event(MOUSE_KEY_MIDDLE, mouse_state.x, mouse_state.y);
 	}
 }
 
@@ -664,6 +667,72 @@ kb_bind_key(int keycode, script_t* on_down_script, script_t* on_up_script)
 		vector_push(s_bound_keys, &new_binding);
 }
 
+static void
+handle_event(const ALLEGRO_EVENT* event)
+{
+	int keycode;
+
+	switch (event->type) {
+	case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
+		// Alt+Tabbing out can cause keys to get "stuck", this works around it
+		// by clearing the states when switching away.
+		memset(s_key_state, 0, ALLEGRO_KEY_MAX * sizeof(bool));
+		break;
+	case ALLEGRO_EVENT_KEY_DOWN:
+		keycode = event->keyboard.keycode;
+		s_key_state[keycode] = true;
+
+		// queue Ctrl/Alt/Shift keys (Sphere compatibility hack)
+		if (keycode == ALLEGRO_KEY_LCTRL || keycode == ALLEGRO_KEY_RCTRL
+			|| keycode == ALLEGRO_KEY_ALT || keycode == ALLEGRO_KEY_ALTGR
+			|| keycode == ALLEGRO_KEY_LSHIFT || keycode == ALLEGRO_KEY_RSHIFT)
+		{
+			if (keycode == ALLEGRO_KEY_LCTRL || keycode == ALLEGRO_KEY_RCTRL)
+				queue_key(ALLEGRO_KEY_LCTRL);
+			if (keycode == ALLEGRO_KEY_ALT || keycode == ALLEGRO_KEY_ALTGR)
+				queue_key(ALLEGRO_KEY_ALT);
+			if (keycode == ALLEGRO_KEY_LSHIFT || keycode == ALLEGRO_KEY_RSHIFT)
+				queue_key(ALLEGRO_KEY_LSHIFT);
+		}
+
+		break;
+	case ALLEGRO_EVENT_KEY_UP:
+		s_key_state[event->keyboard.keycode] = false;
+		break;
+	case ALLEGRO_EVENT_KEY_CHAR:
+		s_keymod_state = event->keyboard.modifiers;
+		switch (event->keyboard.keycode) {
+		case ALLEGRO_KEY_ENTER:
+			if (event->keyboard.modifiers & ALLEGRO_KEYMOD_ALT
+			 || event->keyboard.modifiers & ALLEGRO_KEYMOD_ALTGR)
+			{
+				screen_toggle_fullscreen(g_screen);
+			}
+			else {
+				queue_key(event->keyboard.keycode);
+			}
+			break;
+		case ALLEGRO_KEY_F10:
+			screen_toggle_fullscreen(g_screen);
+			break;
+		case ALLEGRO_KEY_F11:
+			screen_toggle_fps(g_screen);
+			break;
+		case ALLEGRO_KEY_F12:
+			if (debugger_attached())
+				jsal_debug_breakpoint_inject();
+			else if (event->keyboard.modifiers & ALLEGRO_KEYMOD_SHIFT)
+				screen_set_recording(g_screen, !screen_get_recording(g_screen));
+			else
+				screen_queue_screenshot(g_screen);
+			break;
+		default:
+			queue_key(event->keyboard.keycode);
+			break;
+		}
+	}
+}
+
 static void
 queue_key(int keycode)
 {
@@ -689,3 +758,22 @@ queue_mouse_event(mouse_key_t key, int x, int y)
 		++s_num_mouse_events;
 	}
 }
+
+static bool
+read_mouse(ALLEGRO_MOUSE_STATE* out_state)
+{
+	ALLEGRO_DISPLAY* display;
+
+	// note: the position is converted to game coordinates right away, so that
+	//       everything downstream, including recorded replays, is independent of
+	//       the window size.  a replay made in a scaled window then plays back
+	//       the same way headless or at any other scale.
+
+	memset(out_state, 0, sizeof(ALLEGRO_MOUSE_STATE));
+	display = screen_display(g_screen);
+	if (!s_have_mouse || display == NULL)
+		return false;
+	al_get_mouse_state(out_state);
+	screen_to_game_xy(g_screen, &out_state->x, &out_state->y);
+	return out_state->display == display;
+}
@@ -100,6 +100,7 @@ void          kb_clear_queue     (void);
 int           kb_get_key         (void);
 void          kb_load_keymap     (void);
 void          kb_save_keymap     (void);
+bool          mouse_get_state    (ALLEGRO_MOUSE_STATE* out_state);
 bool          mouse_is_key_down  (mouse_key_t key);
 int           mouse_queue_len    (void);
 void          mouse_clear_queue  (void);
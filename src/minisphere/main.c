@@ -45,6 +45,7 @@
 #include "map_engine.h"
 #include "pegasus.h"
 #include "profiler.h"
+#include "replay.h"
 #include "sockets.h"
 #include "spriteset.h"
 #include "vanilla.h"
@@ -78,17 +79,21 @@ static void on_socket_idle      (void);
 static bool initialize_engine   (void);
 static void shutdown_engine     (void);
 static bool find_startup_game   (path_t* *out_path);
-static bool parse_command_line  (int argc, char* argv[], path_t* *out_game_path, int *out_fullscreen, int *out_frameskip, int *out_verbosity, ssj_mode_t *out_ssj_mode, bool *out_retro_mode, int *out_extras_offset);
+static bool parse_command_line  (int argc, char* argv[], path_t* *out_game_path, int *out_fullscreen, int *out_frameskip, int *out_verbosity, ssj_mode_t *out_ssj_mode, bool *out_retro_mode, bool *out_headless, replay_mode_t *out_replay_mode, const char* *out_replay_file, int *out_bench_runs, int *out_extras_offset);
 static void print_banner        (bool want_copyright, bool want_deps);
 static void print_usage         (void);
 static void report_error        (const char* fmt, ...);
 static void show_error_screen   (const char* message);
 
+static double               s_clock_origin = 0.0;
 static int                  s_event_loop_version;
 static ALLEGRO_EVENT_QUEUE* s_event_queue = NULL;
 static path_t*              s_game_path = NULL;
+static bool                 s_headless = false;
 static path_t*              s_last_game_path = NULL;
 static bool                 s_restart_game = false;
+static bool                 s_virtual_clock = false;
+static double               s_virtual_time = 0.0;
 
 static const char* const ERROR_TEXT[][2] =
 {
@@ -118,6 +123,7 @@ main(int argc, char* argv[])
 
 	int                  api_level;
 	int                  api_version;
+	int                  bench_runs;
 	bool                 eval_succeeded;
 	lstring_t*           dialog_name;
 	int                  error_column;
@@ -132,6 +138,8 @@ main(int argc, char* argv[])
 	int                  game_args_offset;
 	path_t*              games_path;
 	image_t*             icon;
+	const char*          replay_file;
+	replay_mode_t        replay_mode;
 	size2_t              resolution;
 	jmp_buf              restart_label;
 	bool                 retro_mode;
@@ -145,7 +153,7 @@ main(int argc, char* argv[])
 	// parse the command line
 	if (parse_command_line(argc, argv, &s_game_path,
 		&fullscreen_mode, &use_frameskip, &use_verbosity, &ssj_mode, &retro_mode,
-		&game_args_offset))
+		&s_headless, &replay_mode, &replay_file, &bench_runs, &game_args_offset))
 	{
 		if (ssj_mode == SSJ_ACTIVE)
 			fullscreen_mode = FULLSCREEN_OFF;
@@ -173,9 +181,22 @@ main(int argc, char* argv[])
 		ssj_mode == SSJ_ACTIVE ? "active"
 			: ssj_mode == SSJ_PASSIVE ? "passive"
 			: "disabled");
+	console_log(1, "    headless: %s", s_headless ? "yes" : "no");
+	console_log(1, "    session replay: %s",
+		replay_mode == REPLAY_RECORD ? "recording"
+			: replay_mode == REPLAY_PLAY ? "playing"
+			: "off");
+	if (bench_runs > 0)
+		console_log(1, "    benchmark: %d runs", bench_runs);
 #endif
 	console_log(1, "");
 
+	// recording or replaying a session requires fixed timesteps, otherwise the game
+	// would see different times on each run and go off script.
+	s_virtual_clock = s_headless || replay_mode != REPLAY_OFF;
+	if (!replay_init(replay_mode, replay_file, bench_runs > 0 ? bench_runs : 1))
+		return EXIT_FAILURE;
+
 	if (!initialize_engine())
 		return EXIT_FAILURE;
 
@@ -196,7 +217,16 @@ main(int argc, char* argv[])
 			s_game_path = s_last_game_path;
 			s_last_game_path = NULL;
 		}
+		else if (replay_next_run()) {
+			// benchmarking a replay: start over from the top for the next run
+			console_log(1, "\nrestarting to replay session again");
+			g_tick_count = 0;
+			s_virtual_time = 0.0;
+			if (!initialize_engine())
+				return EXIT_FAILURE;
+		}
 		else {
+			replay_uninit();
 			return EXIT_SUCCESS;
 		}
 	}
@@ -276,7 +306,8 @@ main(int argc, char* argv[])
 	resolution = game_resolution(g_game);
 	if (!(icon = image_load("@/icon.png")))
 		icon = image_load("#/icon.png");
-	g_screen = screen_new(game_name(g_game), icon, resolution, use_frameskip, game_default_font(g_game));
+	g_screen = screen_new(game_name(g_game), icon, resolution, use_frameskip, game_default_font(g_game),
+		s_headless);
 	if (g_screen == NULL) {
 		al_show_native_message_box(NULL, "Unable to Create Render Context", "miniSphere couldn't create a render context.",
 			"Your hardware may be too old to run miniSphere, or there could be a problem with the drivers on this system.  Check that your graphics drivers in particular are fully installed and up-to-date.",
@@ -286,9 +317,11 @@ main(int argc, char* argv[])
 
 	al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
 	s_event_queue = al_create_event_queue();
-	al_register_event_source(s_event_queue,
-		al_get_display_event_source(screen_display(g_screen)));
-	attach_input_display();
+	if (!s_headless) {
+		al_register_event_source(s_event_queue,
+			al_get_display_event_source(screen_display(g_screen)));
+		attach_input_display();
+	}
 	kb_load_keymap();
 	
 	// in retrograde mode, only provide access to functions up to the targeted
@@ -314,7 +347,7 @@ main(int argc, char* argv[])
 
 	// enable the SSj debug server, wait for a connection if requested.
 #if defined(MINISPHERE_SPHERUN)
-	if (ssj_mode == SSJ_ACTIVE) {
+	if (ssj_mode == SSJ_ACTIVE && !s_headless) {
 		al_clear_to_color(al_map_rgba(0, 0, 0, 255));
 		screen_draw_status(g_screen, "waiting for debugger...", mk_color(255, 255, 255, 255));
 		al_flip_display();
@@ -332,14 +365,17 @@ main(int argc, char* argv[])
 	// evaluate the main script (v1) or module (v2)
 	script_path = game_script_path(g_game);
 	api_version = game_version(g_game);
+	profiler_enter_phase("main", true);
 	eval_succeeded = api_version >= 2
 		? pegasus_eval_module(path_cstr(script_path))
 		: script_eval(path_cstr(script_path));
+	profiler_leave_phase();
 	if (!eval_succeeded)
 		goto on_js_error;
 
 	// in Sphere v2 mode, the main script is loaded as a module (either CommonJS or mJS).
 	// check for a default export and `new` it if possible, then call newObj.start().
+	profiler_enter_phase("main", true);
 	if (api_version >= 2 && jsal_is_object(-1)) {
 		jsal_get_prop_string(-1, "default");
 		if (jsal_is_async_function(-1)) {
@@ -377,6 +413,7 @@ main(int argc, char* argv[])
 		}
 		jsal_pop(2);
 	}
+	profiler_leave_phase();
 
 	// start up the event loop.  we can do this even in compatibility mode:
 	// the event loop terminates when there are no pending jobs or promises to settle,
@@ -395,6 +432,10 @@ main(int argc, char* argv[])
 	longjmp(exit_label, 1);
 
 on_js_error:
+#if defined(MINISPHERE_SPHERUN)
+	if (ssj_mode == SSJ_OFF)
+		profiler_uninit();
+#endif
 	jsal_dup(-1);
 	error_text = jsal_to_string(-1);
 	screen_show_mouse(g_screen, true);
@@ -444,12 +485,25 @@ sphere_abort(const char* message)
 	//       disables the JavaScript VM so that control will fall through the event
 	//       loop naturally.
 
-	if (message != NULL)
+	if (message != NULL) {
+		if (s_headless)
+			fprintf(stderr, "GAME ABORTED: %s\n", message);
 		show_error_screen(message);
+	}
 	dispatch_cancel_all(true, true);
 	jsal_enable_vm(false);
 }
 
+void
+sphere_advance_clock(double time)
+{
+	// note: this moves the virtual clock forward without waiting, for frames which
+	//       aren't throttled.  with the real clock it does nothing since time passes
+	//       on its own.
+	if (s_virtual_clock && time > 0.0)
+		s_virtual_time += time;
+}
+
 void
 sphere_change_game(const char* pathname)
 {
@@ -495,7 +549,9 @@ sphere_heartbeat(bool in_event_loop, int api_version)
 		debugger_update();
 #endif
 		s_event_loop_version = api_version;
+		profiler_enter_phase("jobs", true);
 		jsal_update(true);
+		profiler_leave_phase();
 	}
 
 	update_input();
@@ -519,6 +575,16 @@ sphere_heartbeat(bool in_event_loop, int api_version)
 #endif
 }
 
+double
+sphere_now(void)
+{
+	// note: in headless mode and when recording or replaying a session, the clock is
+	//       virtual.  it only moves forward when the engine sleeps or flips an
+	//       unthrottled frame, so each frame takes exactly as long as the framerate
+	//       says it should, no matter how long it really took.
+	return s_virtual_clock ? s_virtual_time : al_get_time();
+}
+
 void
 sphere_restart(void)
 {
@@ -532,6 +598,21 @@ sphere_sleep(double time)
 	double end_time;
 	double time_left;
 
+	replay_next_poll();
+	if (s_virtual_clock) {
+		if (time > 0.0)
+			s_virtual_time += time;
+		if (s_headless) {
+			sphere_heartbeat(false, 0);
+			return;
+		}
+
+		// someone's watching, so don't let virtual time get ahead of real time.  this
+		// also means a slow frame doesn't cause any frames to be skipped.
+		time = s_virtual_time - (al_get_time() - s_clock_origin);
+	}
+
+	profiler_enter_phase("idle", false);
 	end_time = al_get_time() + time;
 	do {
 		time_left = end_time - al_get_time();
@@ -539,22 +620,30 @@ sphere_sleep(double time)
 			al_wait_for_event_timed(s_event_queue, NULL, time_left);
 		sphere_heartbeat(false, 0);
 	} while (al_get_time() < end_time);
+	profiler_leave_phase();
 }
 
 void
 sphere_tick(int api_version, bool clear_screen, int framerate)
 {
+	bool succeeded;
+
 	sphere_heartbeat(true, api_version);
 	if (!screen_skipping_frame(g_screen)) {
-		if (!dispatch_run(JOB_ON_RENDER))
+		profiler_enter_phase("render", true);
+		succeeded = dispatch_run(JOB_ON_RENDER);
+		profiler_leave_phase();
+		if (!succeeded)
 			return;
 	}
 	screen_flip(g_screen, framerate, clear_screen);
 	if (api_version >= 2)
 		image_set_scissor(screen_backbuffer(g_screen), screen_bounds(g_screen));
-	if (!dispatch_run(JOB_ON_UPDATE))
-		return;
-	if (!dispatch_run(JOB_ON_TICK))
+	profiler_enter_phase("update", true);
+	succeeded = dispatch_run(JOB_ON_UPDATE)
+		&& dispatch_run(JOB_ON_TICK);
+	profiler_leave_phase();
+	if (!succeeded)
 		return;
 	++g_tick_count;
 }
@@ -640,6 +729,9 @@ initialize_engine(void)
 	if (!al_init_image_addon())
 		goto on_error;
 
+	// keep the virtual clock in step with real time across engine restarts
+	s_clock_origin = al_get_time() - s_virtual_time;
+
 	// initialize networking
 	console_log(1, "initializing Dyad %s", dyad_getVersion());
 	dyad_init();
@@ -775,9 +867,14 @@ parse_command_line(
 	int argc, char* argv[],
 	path_t* *out_game_path, int *out_fullscreen, int *out_frameskip,
 	int *out_verbosity, ssj_mode_t *out_ssj_mode, bool *out_retro_mode,
-	int *out_extras_offset)
+	bool *out_headless, replay_mode_t *out_replay_mode, const char* *out_replay_file,
+	int *out_bench_runs, int *out_extras_offset)
 {
 	bool parse_options = true;
+#if defined(MINISPHERE_SPHERUN)
+	int  num_runs = 5;
+	bool want_bench = false;
+#endif
 
 	int i, j;
 
@@ -786,6 +883,10 @@ parse_command_line(
 	*out_fullscreen = FULLSCREEN_AUTO;
 	*out_frameskip = 20;
 	*out_game_path = NULL;
+	*out_bench_runs = 0;
+	*out_headless = false;
+	*out_replay_file = NULL;
+	*out_replay_mode = REPLAY_OFF;
 	*out_retro_mode = false;
 	*out_ssj_mode = SSJ_PASSIVE;
 	*out_verbosity = 0;
@@ -818,6 +919,29 @@ parse_command_line(
 			else if (strcmp(argv[i], "--debug") == 0) {
 				*out_ssj_mode = SSJ_ACTIVE;
 			}
+			else if (strcmp(argv[i], "--headless") == 0) {
+				*out_headless = true;
+			}
+			else if (strcmp(argv[i], "--record") == 0) {
+				if (++i >= argc)
+					goto missing_argument;
+				*out_replay_mode = REPLAY_RECORD;
+				*out_replay_file = argv[i];
+			}
+			else if (strcmp(argv[i], "--replay") == 0) {
+				if (++i >= argc)
+					goto missing_argument;
+				*out_replay_mode = REPLAY_PLAY;
+				*out_replay_file = argv[i];
+			}
+			else if (strcmp(argv[i], "--bench") == 0) {
+				want_bench = true;
+			}
+			else if (strcmp(argv[i], "--runs") == 0) {
+				if (++i >= argc)
+					goto missing_argument;
+				num_runs = atoi(argv[i]);
+			}
 			else if (strcmp(argv[i], "--retro") == 0) {
 				*out_retro_mode = true;
 			}
@@ -883,6 +1007,21 @@ parse_command_line(
 		print_usage();
 		return false;
 	}
+	if (want_bench) {
+		if (*out_replay_mode != REPLAY_PLAY) {
+			report_error("--bench requires a session to replay (use --replay)\n");
+			return false;
+		}
+		if (num_runs < 1) {
+			report_error("number of benchmark runs must be at least 1\n");
+			return false;
+		}
+
+		// benchmarks always run headless so that presenting frames to a window doesn't
+		// skew the results.
+		*out_bench_runs = num_runs;
+		*out_headless = true;
+	}
 #endif
 
 	return true;
@@ -922,7 +1061,8 @@ print_usage(void)
 	printf("\n");
 	printf("USAGE:\n");
 	printf("   spherun [--fullscreen | --windowed] [--frameskip <n>] [--debug | --profile]\n");
-	printf("           [--retro] [--verbose <n>] <game_path> [<game_args>]                \n");
+	printf("           [--retro] [--headless] [--record <file> | --replay <file> [--bench]]\n");
+	printf("           [--runs <n>] [--verbose <n>] <game_path> [<game_args>]             \n");
 	printf("\n");
 	printf("OPTIONS:\n");
 	printf("       --fullscreen   Start the game in fullscreen mode                       \n");
@@ -931,6 +1071,13 @@ print_usage(void)
 	printf("   -d  --debug        Wait 30 seconds for an SSj/Ki debugger to connect       \n");
 	printf("   -p  --profile      Enable the profiler for this session (disables debugger)\n");
 	printf("   -r  --retro        Emulate the game's targeted API level (retrograde mode) \n");
+	printf("       --headless     Run without a display as fast as possible; print frame  \n");
+	printf("                      timing statistics on exit                               \n");
+	printf("       --record       Record keyboard/mouse input to a file for later replay  \n");
+	printf("       --replay       Play back a session recorded with --record              \n");
+	printf("       --bench        Benchmark a replay, headless; reports p50/p95/p99 frame \n");
+	printf("                      times                                                   \n");
+	printf("       --runs         Set the number of times to run a benchmark (default: 5) \n");
 	printf("       --verbose      Set the engine's verbosity level from 0 to 4            \n");
 	printf("   -v  --version      Show which version of miniSphere is installed           \n");
 	printf("       --help         Show this help text                                     \n");
@@ -979,6 +1126,12 @@ show_error_screen(const char* message)
 
 	int i;
 
+	if (s_headless) {
+		// there's no display to show the error on and nobody around to dismiss it.
+		// the error has already been reported on stderr, so don't wait around.
+		return;
+	}
+
 	title_index = rand() % (sizeof ERROR_TEXT / sizeof(const char*) / 2);
 	title = ERROR_TEXT[title_index][0];
 	subtitle = ERROR_TEXT[title_index][1];
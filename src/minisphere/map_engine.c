@@ -37,17 +37,38 @@
 #include "audio.h"
 #include "color.h"
 #include "dispatch.h"
+#include "galileo.h"
 #include "geometry.h"
 #include "image.h"
 #include "input.h"
 #include "jsal.h"
 #include "obstruction.h"
 #include "script.h"
+#include "sort.h"
 #include "spriteset.h"
 #include "tileset.h"
 #include "vanilla.h"
 #include "vector.h"
 
+// persons are filed into a hash of square cells by their sprite base so that obstruction
+// checks only need to consider their immediate neighbors.  persons whose base covers more
+// than PERSON_CELL_MAX cells are kept on a separate list which is always checked.
+#define PERSON_CELL_SHIFT 5
+#define PERSON_CELL_MAX   16
+#define PERSON_HASH_SIZE  1024
+
+// triggers and zones are indexed the same way, by the cells covered by their bounds.  a
+// lookup only has to look at the one cell containing the point being tested plus the
+// list of oversized items.
+#define INDEX_CELL_SHIFT  6
+#define INDEX_CELL_MAX    64
+#define INDEX_HASH_SIZE   256
+
+// layers are rendered in square chunks of this many tiles, each of which keeps its tiles
+// in a vertex buffer.  a chunk is only rebuilt when one of its tiles changes, so drawing a
+// layer costs a handful of draw calls rather than one per tile.
+#define CHUNK_SIZE        16
+
 static const person_t*     s_acting_person;
 static mixer_t*            s_bgm_mixer = NULL;
 static person_t*           s_camera_person = NULL;
@@ -77,8 +98,12 @@ static unsigned int        s_next_person_id = 0;
 static int                 s_num_deferreds = 0;
 static int                 s_num_persons = 0;
 static struct map_trigger* s_on_trigger = NULL;
-static unsigned int        s_queued_id = 0;
+static vector_t*           s_oversized_persons = NULL;
+static vector_t*           s_person_buckets[PERSON_HASH_SIZE];
+static bool                s_person_buckets_dirty = false;
 static vector_t*           s_person_list = NULL;
+static unsigned int        s_person_stamp = 0;
+static unsigned int        s_queued_id = 0;
 static struct player*      s_players;
 static script_t*           s_render_script = NULL;
 static int                 s_talk_button = 0;
@@ -87,6 +112,13 @@ static script_t*           s_update_script = NULL;
 static struct deferred     *s_deferreds = NULL;
 static person_t*           *s_persons = NULL;
 
+struct map_index
+{
+	bool      is_dirty;
+	vector_t* buckets[INDEX_HASH_SIZE];
+	vector_t* oversized;
+};
+
 struct deferred
 {
 	script_t* script;
@@ -103,6 +135,8 @@ struct map
 	tileset_t*         tileset;
 	vector_t*          triggers;
 	vector_t*          zones;
+	struct map_index   trigger_index;
+	struct map_index   zone_index;
 	int                num_layers;
 	int                num_persons;
 	struct map_layer   *layers;
@@ -112,6 +146,10 @@ struct map
 struct map_layer
 {
 	lstring_t*       name;
+	color_t          chunk_mask;
+	struct chunk*    chunks;
+	int              num_chunks_x;
+	int              num_chunks_y;
 	bool             is_parallax;
 	bool             is_reflective;
 	bool             is_visible;
@@ -127,6 +165,13 @@ struct map_layer
 	int              width;
 };
 
+struct chunk
+{
+	vector_t* anim_tiles;
+	bool      is_dirty;
+	vbo_t*    vbo;
+};
+
 struct map_person
 {
 	lstring_t* name;
@@ -166,23 +211,29 @@ struct person
 	unsigned int    id;
 	char*           name;
 	int             anim_frames;
+	int             bucket_layer;
+	rect_t          bucket_span;
 	char*           direction;
 	int             follow_distance;
 	int             frame;
 	bool            ignore_all_persons;
 	bool            ignore_all_tiles;
 	vector_t*       ignore_list;
+	bool            is_bucketed;
 	bool            is_persistent;
 	bool            is_visible;
 	int             layer;
 	person_t*       leader;
 	color_t         mask;
 	int             mv_x, mv_y;
+	unsigned int    hit_stamp;
+	unsigned int    query_stamp;
 	int             revert_delay;
 	int             revert_frames;
 	double          scale_x;
 	double          scale_y;
 	script_t*       scripts[PERSON_SCRIPT_MAX];
+	double          sort_y;
 	double          speed_x, speed_y;
 	spriteset_t*    sprite;
 	double          theta;
@@ -270,25 +321,43 @@ struct rmp_zone_header
 };
 #pragma pack(pop)
 
+static void                add_to_index         (struct map_index* index, int item, rect_t area);
+static void                bucket_person        (person_t* person);
+static bool                build_chunk          (int layer, int chunk_x, int chunk_y);
 static bool                change_map           (const char* filename, bool preserve_persons);
 static void                command_person       (person_t* person, int command);
 static int                 compare_persons      (const void* a, const void* b);
 static void                detach_person        (const person_t* person);
 static bool                does_person_exist    (const person_t* person);
+static void                draw_chunks          (int layer, int off_x, int off_y);
 static void                draw_persons         (int layer, bool is_flipped, int cam_x, int cam_y);
 static bool                enlarge_step_history (person_t* person, int new_size);
+static void                free_chunks          (struct map_layer* layer);
+static void                free_index           (struct map_index* index);
 static void                free_map             (struct map* map);
 static void                free_person          (person_t* person);
 static struct map_trigger* get_trigger_at       (int x, int y, int layer, int* out_index);
 static struct map_zone*    get_zone_at          (int x, int y, int layer, int which, int* out_index);
+static unsigned int        hash_cell            (int x, int y, int layer);
+static void                invalidate_chunk     (int layer, int x, int y);
+static bool                insert_sorted        (vector_t** p_list, int value);
 static struct map*         load_map             (const char* path);
+static int                 next_in_index        (const struct map_index* index, int x, int y, int after);
 static void                map_screen_to_layer  (int layer, int camera_x, int camera_y, int* inout_x, int* inout_y);
 static void                map_screen_to_map    (int camera_x, int camera_y, int* inout_x, int* inout_y);
+static bool                obstructs_person     (const person_t* person, const person_t* other, rect_t base, int layer);
 static void                process_map_input    (void);
+static void                rebuild_person_index (void);
+static void                rebuild_trigger_index (void);
+static void                rebuild_zone_index   (void);
 static void                record_step          (person_t* person);
+static void                remove_from_index    (struct map_index* index, int item, rect_t area);
+static void                remove_sorted        (vector_t* list, int value);
 static void                reset_persons        (bool keep_existing);
 static void                set_person_name      (person_t* person, const char* name);
 static void                sort_persons         (void);
+static rect_t              trigger_bounds       (const struct map_trigger* trigger);
+static void                unbucket_person      (person_t* person);
 static void                update_map_engine    (bool is_main_loop);
 static void                update_person        (person_t* person, bool* out_has_moved);
 
@@ -351,6 +420,9 @@ map_engine_uninit(void)
 	for (i = 0; i < PERSON_SCRIPT_MAX; ++i)
 		script_unref(s_def_person_scripts[i]);
 	free(s_persons);
+	for (i = 0; i < PERSON_HASH_SIZE; ++i)
+		vector_free(s_person_buckets[i]);
+	vector_free(s_oversized_persons);
 
 	mixer_unref(s_bgm_mixer);
 
@@ -538,16 +610,11 @@ void
 map_engine_draw_map(void)
 {
 	bool              is_repeating;
-	int               cell_x;
-	int               cell_y;
-	int               first_cell_x;
-	int               first_cell_y;
 	struct map_layer* layer;
 	int               layer_height;
 	int               layer_width;
 	size2_t           resolution;
 	int               tile_height;
-	int               tile_index;
 	int               tile_width;
 	int               off_x;
 	int               off_y;
@@ -571,7 +638,6 @@ map_engine_draw_map(void)
 		map_screen_to_layer(z, s_camera_x, s_camera_y, &off_x, &off_y);
 
 		// render person reflections if layer is reflective
-		al_hold_bitmap_drawing(true);
 		if (layer->is_reflective) {
 			if (is_repeating) {  // for small repeating maps, persons need to be repeated as well
 				for (y = 0; y < resolution.height / layer_height + 2; ++y) for (x = 0; x < resolution.width / layer_width + 2; ++x)
@@ -583,18 +649,8 @@ map_engine_draw_map(void)
 		}
 
 		// render tiles, but only if the layer is visible
-		if (layer->is_visible) {
-			first_cell_x = off_x / tile_width;
-			first_cell_y = off_y / tile_height;
-			for (y = 0; y < resolution.height / tile_height + 2; ++y) for (x = 0; x < resolution.width / tile_width + 2; ++x) {
-				cell_x = is_repeating ? (x + first_cell_x) % layer->width : x + first_cell_x;
-				cell_y = is_repeating ? (y + first_cell_y) % layer->height : y + first_cell_y;
-				if (cell_x < 0 || cell_x >= layer->width || cell_y < 0 || cell_y >= layer->height)
-					continue;
-				tile_index = layer->tilemap[cell_x + cell_y * layer->width].tile_index;
-				tileset_draw(s_map->tileset, layer->color_mask, x * tile_width - off_x % tile_width, y * tile_height - off_y % tile_height, tile_index);
-			}
-		}
+		if (layer->is_visible)
+			draw_chunks(z, off_x, off_y);
 
 		// render persons
 		if (is_repeating) {  // for small repeating maps, persons need to be repeated as well
@@ -604,11 +660,13 @@ map_engine_draw_map(void)
 		else {
 			draw_persons(z, false, off_x, off_y);
 		}
-		al_hold_bitmap_drawing(false);
 
 		script_run(layer->render_script, false);
 	}
 
+	// the color mask is drawn directly, so flush any batched sprites first or they'd
+	// end up on top of it.
+	galileo_flush();
 	al_draw_filled_rectangle(0, 0, resolution.width, resolution.height, nativecolor(s_color_mask));
 	script_run(s_render_script, false);
 }
@@ -643,6 +701,7 @@ map_engine_start(const char* filename, int framerate)
 	s_color_mask = mk_color(0, 0, 0, 0);
 	s_fade_color_to = s_fade_color_from = s_color_mask;
 	s_fade_progress = s_fade_frames = 0;
+	galileo_flush();
 	al_clear_to_color(al_map_rgba(0, 0, 0, 255));
 	s_frame_rate = framerate;
 	if (!change_map(filename, true))
@@ -777,25 +836,11 @@ map_tileset(void)
 int
 map_trigger_at(int x, int y, int layer)
 {
-	rect_t              bounds;
-	int                 tile_w, tile_h;
-	struct map_trigger* trigger;
-
-	iter_t iter;
+	int index;
 
-	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
-	iter = vector_enum(s_map->triggers);
-	while ((trigger = iter_next(&iter))) {
-		if (trigger->z != layer && false)  // layer ignored for compatibility
-			continue;
-		bounds.x1 = trigger->x - tile_w / 2;
-		bounds.y1 = trigger->y - tile_h / 2;
-		bounds.x2 = bounds.x1 + tile_w;
-		bounds.y2 = bounds.y1 + tile_h;
-		if (is_point_in_rect(x, y, bounds))
-			return iter.index;
-	}
-	return -1;
+	if (get_trigger_at(x, y, layer, &index) == NULL)
+		return -1;
+	return index;
 }
 
 point2_t
@@ -813,18 +858,13 @@ map_xy_from_screen(point2_t screen_xy)
 int
 map_zone_at(int x, int y, int layer, int which)
 {
-	struct map_zone* zone;
-
-	iter_t iter;
+	int index;
 
-	iter = vector_enum(s_map->zones);
-	while ((zone = iter_next(&iter))) {
-		if (zone->layer != layer && false)  // layer ignored for compatibility
-			continue;
-		if (is_point_in_rect(x, y, zone->bounds) && --which < 0)
-			return iter.index;
-	}
-	return -1;
+	if (which < 0)
+		which = 0;
+	if (get_zone_at(x, y, layer, which, &index) == NULL)
+		return -1;
+	return index;
 }
 
 point2_t
@@ -861,6 +901,7 @@ map_add_trigger(int x, int y, int layer, script_t* script)
 	trigger.script = script_ref(script);
 	if (!vector_push(s_map->triggers, &trigger))
 		return false;
+	add_to_index(&s_map->trigger_index, vector_len(s_map->triggers) - 1, trigger_bounds(&trigger));
 	return true;
 }
 
@@ -880,6 +921,7 @@ map_add_zone(rect_t bounds, int layer, script_t* script, int steps)
 	zone.steps_left = 0;
 	if (!vector_push(s_map->zones, &zone))
 		return false;
+	add_to_index(&s_map->zone_index, vector_len(s_map->zones) - 1, zone.bounds);
 	return true;
 }
 
@@ -911,13 +953,16 @@ map_normalize_xy(double* inout_x, double* inout_y, int layer)
 void
 map_remove_trigger(int trigger_index)
 {
+	// removing an item renumbers everything after it, so just rebuild the index
 	vector_remove(s_map->triggers, trigger_index);
+	s_map->trigger_index.is_dirty = true;
 }
 
 void
 map_remove_zone(int zone_index)
 {
 	vector_remove(s_map->zones, zone_index);
+	s_map->zone_index.is_dirty = true;
 }
 
 void
@@ -999,6 +1044,7 @@ layer_set_tile(int layer, int x, int y, int tile_index)
 	tile = &s_map->layers[layer].tilemap[x + y * width];
 	tile->tile_index = tile_index;
 	tile->frames_left = tileset_get_delay(s_map->tileset, tile_index);
+	invalidate_chunk(layer, x, y);
 }
 
 void
@@ -1020,8 +1066,10 @@ layer_replace_tiles(int layer, int old_index, int new_index)
 	layer_h = s_map->layers[layer].height;
 	for (i_x = 0; i_x < layer_w; ++i_x) for (i_y = 0; i_y < layer_h; ++i_y) {
 		tile = &s_map->layers[layer].tilemap[i_x + i_y * layer_w];
-		if (tile->tile_index == old_index)
+		if (tile->tile_index == old_index) {
 			tile->tile_index = new_index;
+			invalidate_chunk(layer, i_x, i_y);
+		}
 	}
 }
 
@@ -1059,11 +1107,17 @@ layer_resize(int layer, int x_size, int y_size)
 		}
 	}
 
-	// free the old tilemap and substitute the new one
+	// free the old tilemap and substitute the new one.  the chunk grid no longer matches
+	// the layer dimensions, so it has to go too; it will be rebuilt on the next render.
 	free(s_map->layers[layer].tilemap);
 	s_map->layers[layer].tilemap = tilemap;
 	s_map->layers[layer].width = x_size;
 	s_map->layers[layer].height = y_size;
+	free_chunks(&s_map->layers[layer]);
+
+	// wraparound for repeating and parallax layers depends on the layer size, so the
+	// person index needs to be rebuilt.
+	s_person_buckets_dirty = true;
 
 	// if we resize the largest layer, the overall map size will change.
 	// recalcuate it.
@@ -1095,6 +1149,8 @@ layer_resize(int layer, int x_size, int y_size)
 		if (trigger->x >= s_map->width || trigger->y >= s_map->height)
 			vector_remove(s_map->triggers, i);
 	}
+	s_map->trigger_index.is_dirty = true;
+	s_map->zone_index.is_dirty = true;
 
 	return true;
 }
@@ -1124,6 +1180,7 @@ person_new(const char* name, spriteset_t* spriteset, bool is_persistent, script_
 	person->anim_frames = spriteset_frame_delay(person->sprite, person->direction, 0);
 	person->mask = mk_color(255, 255, 255, 255);
 	person->scale_x = person->scale_y = 1.0;
+	bucket_person(person);
 	person->scripts[PERSON_SCRIPT_ON_CREATE] = create_script;
 	person_activate(person, PERSON_SCRIPT_ON_CREATE, NULL, true);
 	sort_persons();
@@ -1245,14 +1302,20 @@ person_obstructed_at(const person_t* person, double x, double y, person_t** out_
 {
 	rect_t           area;
 	rect_t           base, my_base;
+	vector_t*        bucket;
 	double           cur_x, cur_y;
 	bool             is_obstructed = false;
 	int              layer;
+	int              num_hits = 0;
 	const obsmap_t*  obsmap;
+	person_t*        obstructing_person = NULL;
+	person_t*        other;
+	person_t*        *p_other;
 	int              tile_w, tile_h;
 	const tileset_t* tileset;
 
-	int i, i_x, i_y;
+	iter_t iter;
+	int    i, i_x, i_y;
 
 	map_normalize_xy(&x, &y, person->layer);
 	person_get_xyz(person, &cur_x, &cur_y, &layer, true);
@@ -1263,20 +1326,68 @@ person_obstructed_at(const person_t* person, double x, double y, person_t** out_
 		*out_tile_index = -1;
 
 	// check for obstructing persons
+	// note: only persons filed under the cells covered by our base can possibly overlap
+	//       it.  if more than one of them does, the first in sort order wins; that's the
+	//       one a linear scan over all persons would find.
 	if (!person->ignore_all_persons) {
-		for (i = 0; i < s_num_persons; ++i) {
-			if (s_persons[i] == person)  // these persons aren't going to obstruct themselves!
-				continue;
-			if (s_persons[i]->layer != layer)
-				continue;  // ignore persons not on the same layer
-			if (person_following(s_persons[i], person))
-				continue;  // ignore own followers
-			base = person_base(s_persons[i]);
-			if (do_rects_overlap(my_base, base) && !person_ignored_by(person, s_persons[i])) {
+		if (s_person_buckets_dirty)
+			rebuild_person_index();
+		area = my_base;
+		rect_normalize(&area);
+		area.x1 >>= PERSON_CELL_SHIFT; area.y1 >>= PERSON_CELL_SHIFT;
+		area.x2 >>= PERSON_CELL_SHIFT; area.y2 >>= PERSON_CELL_SHIFT;
+		if ((area.x2 - area.x1 + 1) * (area.y2 - area.y1 + 1) <= PERSON_CELL_MAX) {
+			++s_person_stamp;
+			for (i_y = area.y1; i_y <= area.y2; ++i_y) for (i_x = area.x1; i_x <= area.x2; ++i_x) {
+				if (!(bucket = s_person_buckets[hash_cell(i_x, i_y, layer) & (PERSON_HASH_SIZE - 1)]))
+					continue;
+				iter = vector_enum(bucket);
+				while ((p_other = iter_next(&iter))) {
+					other = *p_other;
+					if (other->query_stamp == s_person_stamp)
+						continue;  // already checked this one
+					other->query_stamp = s_person_stamp;
+					if (obstructs_person(person, other, my_base, layer)) {
+						other->hit_stamp = s_person_stamp;
+						obstructing_person = other;
+						++num_hits;
+					}
+				}
+			}
+			if (s_oversized_persons != NULL) {
+				iter = vector_enum(s_oversized_persons);
+				while ((p_other = iter_next(&iter))) {
+					other = *p_other;
+					if (obstructs_person(person, other, my_base, layer)) {
+						other->hit_stamp = s_person_stamp;
+						obstructing_person = other;
+						++num_hits;
+					}
+				}
+			}
+			if (num_hits > 1 && out_obstructing_person != NULL) {
+				for (i = 0; i < s_num_persons; ++i) {
+					if (s_persons[i]->hit_stamp == s_person_stamp) {
+						obstructing_person = s_persons[i];
+						break;
+					}
+				}
+			}
+			if (num_hits > 0) {
 				is_obstructed = true;
-				if (out_obstructing_person)
-					*out_obstructing_person = s_persons[i];
-				break;
+				if (out_obstructing_person != NULL)
+					*out_obstructing_person = obstructing_person;
+			}
+		}
+		else {
+			// our base is huge, just check everyone
+			for (i = 0; i < s_num_persons; ++i) {
+				if (obstructs_person(person, s_persons[i], my_base, layer)) {
+					is_obstructed = true;
+					if (out_obstructing_person)
+						*out_obstructing_person = s_persons[i];
+					break;
+				}
 			}
 		}
 	}
@@ -1477,6 +1588,7 @@ void
 person_set_layer(person_t* person, int layer)
 {
 	person->layer = layer;
+	bucket_person(person);
 }
 
 bool
@@ -1530,6 +1642,7 @@ person_set_scale(person_t* person, double scale_x, double scale_y)
 {
 	person->scale_x = scale_x;
 	person->scale_y = scale_y;
+	bucket_person(person);
 }
 
 void
@@ -1549,6 +1662,7 @@ person_set_spriteset(person_t* person, spriteset_t* spriteset)
 	person->anim_frames = spriteset_frame_delay(person->sprite, person->direction, 0);
 	person->frame = 0;
 	spriteset_unref(old_spriteset);
+	bucket_person(person);
 }
 
 void
@@ -1570,6 +1684,7 @@ person_set_xyz(person_t* person, double x, double y, int layer)
 	person->x = x;
 	person->y = y;
 	person->layer = layer;
+	bucket_person(person);
 	sort_persons();
 }
 
@@ -1781,8 +1896,10 @@ trigger_set_xy(int trigger_index, int x, int y)
 	struct map_trigger* trigger;
 
 	trigger = vector_get(s_map->triggers, trigger_index);
+	remove_from_index(&s_map->trigger_index, trigger_index, trigger_bounds(trigger));
 	trigger->x = x;
 	trigger->y = y;
+	add_to_index(&s_map->trigger_index, trigger_index, trigger_bounds(trigger));
 }
 
 void
@@ -1832,7 +1949,9 @@ zone_set_bounds(int zone_index, rect_t bounds)
 
 	zone = vector_get(s_map->zones, zone_index);
 	rect_normalize(&bounds);
+	remove_from_index(&s_map->zone_index, zone_index, zone->bounds);
 	zone->bounds = bounds;
+	add_to_index(&s_map->zone_index, zone_index, zone->bounds);
 }
 
 void
@@ -1879,6 +1998,152 @@ zone_activate(int zone_index)
 	s_current_zone = last_zone;
 }
 
+static void
+add_to_index(struct map_index* index, int item, rect_t area)
+{
+	unsigned int hash;
+	rect_t       span;
+
+	int x, y;
+
+	// note: 'area' is treated as half-open, like is_point_in_rect().  an empty area
+	//       can't contain any points, so there's no need to file it anywhere.
+	if (index->is_dirty || area.x2 <= area.x1 || area.y2 <= area.y1)
+		return;
+	span.x1 = area.x1 >> INDEX_CELL_SHIFT;
+	span.y1 = area.y1 >> INDEX_CELL_SHIFT;
+	span.x2 = (area.x2 - 1) >> INDEX_CELL_SHIFT;
+	span.y2 = (area.y2 - 1) >> INDEX_CELL_SHIFT;
+	if ((double)(span.x2 - span.x1 + 1) * (span.y2 - span.y1 + 1) > INDEX_CELL_MAX) {
+		if (!insert_sorted(&index->oversized, item))
+			index->is_dirty = true;
+		return;
+	}
+	for (y = span.y1; y <= span.y2; ++y) for (x = span.x1; x <= span.x2; ++x) {
+		hash = hash_cell(x, y, 0) & (INDEX_HASH_SIZE - 1);
+		if (!insert_sorted(&index->buckets[hash], item))
+			index->is_dirty = true;
+	}
+}
+
+static void
+bucket_person(person_t* person)
+{
+	rect_t       base;
+	vector_t*    bucket;
+	unsigned int hash;
+	rect_t       span;
+
+	int x, y;
+
+	base = person_base(person);
+	rect_normalize(&base);
+	span.x1 = base.x1 >> PERSON_CELL_SHIFT;
+	span.y1 = base.y1 >> PERSON_CELL_SHIFT;
+	span.x2 = base.x2 >> PERSON_CELL_SHIFT;
+	span.y2 = base.y2 >> PERSON_CELL_SHIFT;
+	if (person->is_bucketed && person->bucket_layer == person->layer
+		&& memcmp(&span, &person->bucket_span, sizeof(rect_t)) == 0)
+	{
+		return;  // still in the same cells, nothing to do
+	}
+
+	unbucket_person(person);
+	person->bucket_layer = person->layer;
+	person->bucket_span = span;
+	person->is_bucketed = true;
+	if ((span.x2 - span.x1 + 1) * (span.y2 - span.y1 + 1) > PERSON_CELL_MAX) {
+		if (s_oversized_persons == NULL)
+			s_oversized_persons = vector_new(sizeof(person_t*));
+		vector_push(s_oversized_persons, &person);
+		return;
+	}
+	for (y = span.y1; y <= span.y2; ++y) for (x = span.x1; x <= span.x2; ++x) {
+		hash = hash_cell(x, y, person->layer) & (PERSON_HASH_SIZE - 1);
+		if (!(bucket = s_person_buckets[hash]))
+			bucket = s_person_buckets[hash] = vector_new(sizeof(person_t*));
+		vector_push(bucket, &person);
+	}
+}
+
+static bool
+build_chunk(int layer, int chunk_x, int chunk_y)
+{
+	struct chunk*     chunk;
+	struct map_layer* layer_data;
+	int               tile_h;
+	int               tile_index;
+	int               tile_w;
+	rect_t            uv;
+	vbo_t*            vbo;
+	vertex_t          vertices[6];
+	int               x1, y1, x2, y2;
+
+	iter_t iter;
+	int    i;
+	int*   p_index;
+	int    x, y;
+
+	layer_data = &s_map->layers[layer];
+	chunk = &layer_data->chunks[chunk_x + chunk_y * layer_data->num_chunks_x];
+	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
+	if (!(vbo = vbo_new(VBO_STATIC)))
+		return false;
+	if (chunk->anim_tiles == NULL && !(chunk->anim_tiles = vector_new(sizeof(int)))) {
+		vbo_unref(vbo);
+		return false;
+	}
+	vector_clear(chunk->anim_tiles);
+	for (i = 0; i < 6; ++i) {
+		vertices[i].z = 0.0f;
+		vertices[i].color = layer_data->color_mask;
+	}
+	x1 = chunk_x * CHUNK_SIZE;
+	y1 = chunk_y * CHUNK_SIZE;
+	x2 = x1 + CHUNK_SIZE < layer_data->width ? x1 + CHUNK_SIZE : layer_data->width;
+	y2 = y1 + CHUNK_SIZE < layer_data->height ? y1 + CHUNK_SIZE : layer_data->height;
+	for (y = y1; y < y2; ++y) for (x = x1; x < x2; ++x) {
+		tile_index = layer_data->tilemap[x + y * layer_data->width].tile_index;
+		if (tile_index < 0 || tile_index >= tileset_len(s_map->tileset))
+			continue;
+		if (tileset_animated(s_map->tileset, tile_index)) {
+			// keep track of which animated tiles the chunk shows, so it only needs to be
+			// rebuilt when one of them actually changes.
+			iter = vector_enum(chunk->anim_tiles);
+			while ((p_index = iter_next(&iter))) {
+				if (*p_index == tile_index)
+					break;
+			}
+			if (p_index == NULL)
+				vector_push(chunk->anim_tiles, &tile_index);
+		}
+
+		// two triangles per tile, positioned in layer space.  the layer offset is
+		// applied as a transform when drawing.
+		uv = tileset_uv(s_map->tileset, tile_index);
+		vertices[0].x = x * tile_w; vertices[0].y = y * tile_h;
+		vertices[0].u = uv.x1; vertices[0].v = uv.y1;
+		vertices[1].x = (x + 1) * tile_w; vertices[1].y = y * tile_h;
+		vertices[1].u = uv.x2; vertices[1].v = uv.y1;
+		vertices[2].x = x * tile_w; vertices[2].y = (y + 1) * tile_h;
+		vertices[2].u = uv.x1; vertices[2].v = uv.y2;
+		vertices[3] = vertices[1];
+		vertices[4].x = (x + 1) * tile_w; vertices[4].y = (y + 1) * tile_h;
+		vertices[4].u = uv.x2; vertices[4].v = uv.y2;
+		vertices[5] = vertices[2];
+		for (i = 0; i < 6; ++i)
+			vbo_add_vertex(vbo, vertices[i]);
+	}
+	if (vbo_len(vbo) > 0 && !vbo_upload(vbo)) {
+		vbo_unref(vbo);
+		return false;
+	}
+	vbo_unref(chunk->vbo);
+	chunk->vbo = vbo;
+	chunk->is_dirty = false;
+	return true;
+}
+
 static bool
 change_map(const char* filename, bool preserve_persons)
 {
@@ -1909,6 +2174,7 @@ change_map(const char* filename, bool preserve_persons)
 		script_unref(s_deferreds[i].script);
 	s_num_deferreds = 0;
 	s_map = map; s_map_filename = strdup(filename);
+	s_person_buckets_dirty = true;
 	reset_persons(preserve_persons);
 
 	// populate persons
@@ -2035,6 +2301,7 @@ command_person(person_t* person, int command)
 				person->mv_y = new_y > person->y ? 1 : -1;
 			person->x = new_x;
 			person->y = new_y;
+			bucket_person(person);
 		}
 		else {
 			// if not, and we collided with a person, call that person's touch script
@@ -2047,15 +2314,15 @@ command_person(person_t* person, int command)
 static int
 compare_persons(const void* a, const void* b)
 {
+	// note: this uses the normalized Y coordinates cached by sort_persons(), which
+	//       must be called first to refresh them.
+
 	person_t* p1 = *(person_t**)a;
 	person_t* p2 = *(person_t**)b;
 
-	double x, y_p1, y_p2;
-	int    y_delta;
+	int y_delta;
 
-	person_get_xy(p1, &x, &y_p1, true);
-	person_get_xy(p2, &x, &y_p2, true);
-	y_delta = y_p1 - y_p2;
+	y_delta = p1->sort_y - p2->sort_y;
 	if (y_delta != 0)
 		return y_delta;
 	else if (person_following(p1, p2))
@@ -2089,6 +2356,101 @@ does_person_exist(const person_t* person)
 	return false;
 }
 
+static void
+draw_chunks(int layer, int off_x, int off_y)
+{
+	ALLEGRO_BITMAP*    bitmap;
+	struct chunk*      chunk;
+	int                chunk_h;
+	int                chunk_w;
+	int                copy_x1, copy_y1;
+	int                copy_x2, copy_y2;
+	int                cx1, cy1, cx2, cy2;
+	bool               is_repeating;
+	struct map_layer*  layer_data;
+	int                layer_h;
+	int                layer_w;
+	ALLEGRO_TRANSFORM  matrix;
+	ALLEGRO_TRANSFORM  old_matrix;
+	size2_t            resolution;
+	int                tile_h;
+	int                tile_w;
+	int                view_x, view_y;
+
+	int i;
+	int x, y;
+	int cx, cy;
+
+	layer_data = &s_map->layers[layer];
+	resolution = screen_size(g_screen);
+	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
+	layer_w = layer_data->width * tile_w;
+	layer_h = layer_data->height * tile_h;
+	chunk_w = CHUNK_SIZE * tile_w;
+	chunk_h = CHUNK_SIZE * tile_h;
+	is_repeating = s_map->is_repeating || layer_data->is_parallax;
+	if (layer_w <= 0 || layer_h <= 0)
+		return;
+
+	// allocate the chunk grid on first use.  the chunks themselves are built lazily as
+	// they come into view.
+	if (layer_data->chunks == NULL) {
+		layer_data->num_chunks_x = (layer_data->width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		layer_data->num_chunks_y = (layer_data->height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		layer_data->chunks = calloc(layer_data->num_chunks_x * layer_data->num_chunks_y, sizeof(struct chunk));
+		if (layer_data->chunks == NULL)
+			return;
+		for (i = 0; i < layer_data->num_chunks_x * layer_data->num_chunks_y; ++i)
+			layer_data->chunks[i].is_dirty = true;
+		layer_data->chunk_mask = layer_data->color_mask;
+	}
+
+	// the layer's color mask is baked into the vertices
+	if (memcmp(&layer_data->chunk_mask, &layer_data->color_mask, sizeof(color_t)) != 0) {
+		for (i = 0; i < layer_data->num_chunks_x * layer_data->num_chunks_y; ++i)
+			layer_data->chunks[i].is_dirty = true;
+		layer_data->chunk_mask = layer_data->color_mask;
+	}
+
+	// for repeating layers, the visible area may span several copies of the layer.  figure
+	// out which ones, then draw the visible chunks of each.
+	copy_x1 = copy_y1 = copy_x2 = copy_y2 = 0;
+	if (is_repeating) {
+		copy_x1 = off_x >= 0 ? off_x / layer_w : (off_x - layer_w + 1) / layer_w;
+		copy_y1 = off_y >= 0 ? off_y / layer_h : (off_y - layer_h + 1) / layer_h;
+		copy_x2 = (off_x + resolution.width - 1) / layer_w;
+		copy_y2 = (off_y + resolution.height - 1) / layer_h;
+	}
+	bitmap = image_bitmap(tileset_texture(s_map->tileset));
+	galileo_flush();
+	al_copy_transform(&old_matrix, al_get_current_transform());
+	for (y = copy_y1; y <= copy_y2; ++y) for (x = copy_x1; x <= copy_x2; ++x) {
+		view_x = off_x - x * layer_w;
+		view_y = off_y - y * layer_h;
+		cx1 = view_x > 0 ? view_x / chunk_w : 0;
+		cy1 = view_y > 0 ? view_y / chunk_h : 0;
+		cx2 = view_x + resolution.width > 0 ? (view_x + resolution.width - 1) / chunk_w : -1;
+		cy2 = view_y + resolution.height > 0 ? (view_y + resolution.height - 1) / chunk_h : -1;
+		if (cx2 >= layer_data->num_chunks_x)
+			cx2 = layer_data->num_chunks_x - 1;
+		if (cy2 >= layer_data->num_chunks_y)
+			cy2 = layer_data->num_chunks_y - 1;
+		al_identity_transform(&matrix);
+		al_translate_transform(&matrix, -view_x, -view_y);
+		al_compose_transform(&matrix, &old_matrix);
+		al_use_transform(&matrix);
+		for (cy = cy1; cy <= cy2; ++cy) for (cx = cx1; cx <= cx2; ++cx) {
+			chunk = &layer_data->chunks[cx + cy * layer_data->num_chunks_x];
+			if (chunk->is_dirty && !build_chunk(layer, cx, cy))
+				continue;
+			if (chunk->vbo == NULL)
+				continue;  // chunk is empty
+			vbo_draw(chunk->vbo, NULL, bitmap, vbo_len(chunk->vbo), ALLEGRO_PRIM_TRIANGLE_LIST);
+		}
+	}
+	al_use_transform(&old_matrix);
+}
+
 void
 draw_persons(int layer, bool is_flipped, int cam_x, int cam_y)
 {
@@ -2143,6 +2505,33 @@ enlarge_step_history(person_t* person, int new_size)
 	return true;
 }
 
+static void
+free_chunks(struct map_layer* layer)
+{
+	int i;
+
+	if (layer->chunks == NULL)
+		return;
+	for (i = 0; i < layer->num_chunks_x * layer->num_chunks_y; ++i) {
+		vector_free(layer->chunks[i].anim_tiles);
+		vbo_unref(layer->chunks[i].vbo);
+	}
+	free(layer->chunks);
+	layer->chunks = NULL;
+	layer->num_chunks_x = 0;
+	layer->num_chunks_y = 0;
+}
+
+static void
+free_index(struct map_index* index)
+{
+	int i;
+
+	for (i = 0; i < INDEX_HASH_SIZE; ++i)
+		vector_free(index->buckets[i]);
+	vector_free(index->oversized);
+}
+
 static void
 free_map(struct map* map)
 {
@@ -2161,6 +2550,7 @@ free_map(struct map* map)
 		lstr_free(map->layers[i].name);
 		free(map->layers[i].tilemap);
 		obsmap_free(map->layers[i].obsmap);
+		free_chunks(&map->layers[i]);
 	}
 	for (i = 0; i < map->num_persons; ++i) {
 		lstr_free(map->persons[i].name);
@@ -2183,6 +2573,8 @@ free_map(struct map* map)
 	free(map->persons);
 	vector_free(map->triggers);
 	vector_free(map->zones);
+	free_index(&map->trigger_index);
+	free_index(&map->zone_index);
 	free(map);
 }
 
@@ -2191,6 +2583,7 @@ free_person(person_t* person)
 {
 	int i;
 
+	unbucket_person(person);
 	free(person->steps);
 	for (i = 0; i < PERSON_SCRIPT_MAX; ++i)
 		script_unref(person->scripts[i]);
@@ -2204,26 +2597,20 @@ free_person(person_t* person)
 static struct map_trigger*
 get_trigger_at(int x, int y, int layer, int* out_index)
 {
-	rect_t              bounds;
 	struct map_trigger* found_item = NULL;
-	int                 tile_w, tile_h;
+	int                 index = -1;
 	struct map_trigger* trigger;
 
-	iter_t iter;
-
-	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
-	iter = vector_enum(s_map->triggers);
-	while ((trigger = iter_next(&iter))) {
+	if (s_map->trigger_index.is_dirty)
+		rebuild_trigger_index();
+	while ((index = next_in_index(&s_map->trigger_index, x, y, index)) >= 0) {
+		trigger = vector_get(s_map->triggers, index);
 		if (trigger->z != layer && false)  // layer ignored for compatibility reasons
 			continue;
-		bounds.x1 = trigger->x - tile_w / 2;
-		bounds.y1 = trigger->y - tile_h / 2;
-		bounds.x2 = bounds.x1 + tile_w;
-		bounds.y2 = bounds.y1 + tile_h;
-		if (is_point_in_rect(x, y, bounds)) {
+		if (is_point_in_rect(x, y, trigger_bounds(trigger))) {
 			found_item = trigger;
 			if (out_index != NULL)
-				*out_index = (int)iter.index;
+				*out_index = index;
 			break;
 		}
 	}
@@ -2234,24 +2621,68 @@ static struct map_zone*
 get_zone_at(int x, int y, int layer, int which, int* out_index)
 {
 	struct map_zone* found_item = NULL;
+	int              index = -1;
 	struct map_zone* zone;
 
-	iter_t iter;
-	int    i;
-
-	iter = vector_enum(s_map->zones); i = -1;
-	while ((zone = iter_next(&iter))) {
+	if (s_map->zone_index.is_dirty)
+		rebuild_zone_index();
+	while ((index = next_in_index(&s_map->zone_index, x, y, index)) >= 0) {
+		zone = vector_get(s_map->zones, index);
 		if (zone->layer != layer && false)  // layer ignored for compatibility
 			continue;
 		if (is_point_in_rect(x, y, zone->bounds) && which-- == 0) {
 			found_item = zone;
-			if (out_index) *out_index = (int)iter.index;
+			if (out_index) *out_index = index;
 			break;
 		}
 	}
 	return found_item;
 }
 
+static unsigned int
+hash_cell(int x, int y, int layer)
+{
+	return (unsigned int)x * 73856093U ^ (unsigned int)y * 19349663U ^ (unsigned int)layer * 83492791U;
+}
+
+static bool
+insert_sorted(vector_t** p_list, int value)
+{
+	int  hi;
+	int  lo;
+	int  mid;
+	int* p_value;
+
+	if (*p_list == NULL && !(*p_list = vector_new(sizeof(int))))
+		return false;
+	lo = 0;
+	hi = vector_len(*p_list);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p_value = vector_get(*p_list, mid);
+		if (*p_value == value)
+			return true;  // already there
+		else if (*p_value < value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return vector_insert(*p_list, lo, &value);
+}
+
+static void
+invalidate_chunk(int layer, int x, int y)
+{
+	struct map_layer* layer_data;
+
+	layer_data = &s_map->layers[layer];
+	if (layer_data->chunks == NULL)
+		return;
+	x /= CHUNK_SIZE;
+	y /= CHUNK_SIZE;
+	layer_data->chunks[x + y * layer_data->num_chunks_x].is_dirty = true;
+}
+
 static struct map*
 load_map(const char* filename)
 {
@@ -2315,6 +2746,8 @@ load_map(const char* filename)
 		map->persons = calloc(rmp.num_entities, sizeof(struct map_person));
 		map->triggers = vector_new(sizeof(struct map_trigger));
 		map->zones = vector_new(sizeof(struct map_zone));
+		map->trigger_index.is_dirty = true;
+		map->zone_index.is_dirty = true;
 
 		// load layers
 		for (i = 0; i < rmp.num_layers; ++i) {
@@ -2618,6 +3051,58 @@ map_screen_to_map(int camera_x, int camera_y, int* inout_x, int* inout_y)
 	}
 }
 
+static int
+next_in_index(const struct map_index* index, int x, int y, int after)
+{
+	// returns the lowest item number greater than 'after' which might contain the point
+	// (x,y), or -1 if there are no more candidates.  callers still need to check the
+	// actual bounds.
+
+	const vector_t* lists[2];
+	int             hi;
+	int             lo;
+	int             mid;
+	int             next_item = -1;
+	int             value;
+
+	int i;
+
+	lists[0] = index->buckets[hash_cell(x >> INDEX_CELL_SHIFT, y >> INDEX_CELL_SHIFT, 0) & (INDEX_HASH_SIZE - 1)];
+	lists[1] = index->oversized;
+	for (i = 0; i < 2; ++i) {
+		if (lists[i] == NULL)
+			continue;
+		lo = 0;
+		hi = vector_len(lists[i]);
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (*(int*)vector_get(lists[i], mid) <= after)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < vector_len(lists[i])) {
+			value = *(int*)vector_get(lists[i], lo);
+			if (next_item < 0 || value < next_item)
+				next_item = value;
+		}
+	}
+	return next_item;
+}
+
+static bool
+obstructs_person(const person_t* person, const person_t* other, rect_t base, int layer)
+{
+	if (other == person)  // these persons aren't going to obstruct themselves!
+		return false;
+	if (other->layer != layer)
+		return false;  // ignore persons not on the same layer
+	if (person_following(other, person))
+		return false;  // ignore own followers
+	return do_rects_overlap(base, person_base(other))
+		&& !person_ignored_by(person, other);
+}
+
 static void
 process_map_input(void)
 {
@@ -2706,6 +3191,68 @@ process_map_input(void)
 	update_bound_keys(true);
 }
 
+static void
+rebuild_person_index(void)
+{
+	int i;
+
+	for (i = 0; i < PERSON_HASH_SIZE; ++i) {
+		if (s_person_buckets[i] != NULL)
+			vector_clear(s_person_buckets[i]);
+	}
+	if (s_oversized_persons != NULL)
+		vector_clear(s_oversized_persons);
+	for (i = 0; i < s_num_persons; ++i) {
+		s_persons[i]->is_bucketed = false;
+		bucket_person(s_persons[i]);
+	}
+	s_person_buckets_dirty = false;
+}
+
+static void
+rebuild_trigger_index(void)
+{
+	struct map_index*   index;
+	struct map_trigger* trigger;
+
+	iter_t iter;
+	int    i;
+
+	index = &s_map->trigger_index;
+	for (i = 0; i < INDEX_HASH_SIZE; ++i) {
+		if (index->buckets[i] != NULL)
+			vector_clear(index->buckets[i]);
+	}
+	if (index->oversized != NULL)
+		vector_clear(index->oversized);
+	index->is_dirty = false;
+	iter = vector_enum(s_map->triggers);
+	while ((trigger = iter_next(&iter)))
+		add_to_index(index, iter.index, trigger_bounds(trigger));
+}
+
+static void
+rebuild_zone_index(void)
+{
+	struct map_index* index;
+	struct map_zone*  zone;
+
+	iter_t iter;
+	int    i;
+
+	index = &s_map->zone_index;
+	for (i = 0; i < INDEX_HASH_SIZE; ++i) {
+		if (index->buckets[i] != NULL)
+			vector_clear(index->buckets[i]);
+	}
+	if (index->oversized != NULL)
+		vector_clear(index->oversized);
+	index->is_dirty = false;
+	iter = vector_enum(s_map->zones);
+	while ((zone = iter_next(&iter)))
+		add_to_index(index, iter.index, zone->bounds);
+}
+
 static void
 record_step(person_t* person)
 {
@@ -2719,6 +3266,52 @@ record_step(person_t* person)
 	p_step->y = person->y;
 }
 
+static void
+remove_from_index(struct map_index* index, int item, rect_t area)
+{
+	unsigned int hash;
+	rect_t       span;
+
+	int x, y;
+
+	if (index->is_dirty || area.x2 <= area.x1 || area.y2 <= area.y1)
+		return;
+	span.x1 = area.x1 >> INDEX_CELL_SHIFT;
+	span.y1 = area.y1 >> INDEX_CELL_SHIFT;
+	span.x2 = (area.x2 - 1) >> INDEX_CELL_SHIFT;
+	span.y2 = (area.y2 - 1) >> INDEX_CELL_SHIFT;
+	if ((double)(span.x2 - span.x1 + 1) * (span.y2 - span.y1 + 1) > INDEX_CELL_MAX) {
+		remove_sorted(index->oversized, item);
+		return;
+	}
+	for (y = span.y1; y <= span.y2; ++y) for (x = span.x1; x <= span.x2; ++x) {
+		hash = hash_cell(x, y, 0) & (INDEX_HASH_SIZE - 1);
+		remove_sorted(index->buckets[hash], item);
+	}
+}
+
+static void
+remove_sorted(vector_t* list, int value)
+{
+	int hi;
+	int lo;
+	int mid;
+
+	if (list == NULL)
+		return;
+	lo = 0;
+	hi = vector_len(list);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (*(int*)vector_get(list, mid) < value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < vector_len(list) && *(int*)vector_get(list, lo) == value)
+		vector_remove(list, lo);
+}
+
 void
 reset_persons(bool keep_existing)
 {
@@ -2738,6 +3331,7 @@ reset_persons(bool keep_existing)
 			person->x = origin.x;
 			person->y = origin.y;
 			person->layer = origin.z;
+			s_person_buckets_dirty = true;
 		}
 		else {
 			person_activate(person, PERSON_SCRIPT_ON_DESTROY, NULL, true);
@@ -2761,20 +3355,83 @@ set_person_name(person_t* person, const char* name)
 static void
 sort_persons(void)
 {
-	qsort(s_persons, s_num_persons, sizeof(person_t*), compare_persons);
+	// persons only move a few pixels per frame, so from one sort to the next the list
+	// is usually already in order or very close to it.
+
+	double x;
+
+	int i;
+
+	for (i = 0; i < s_num_persons; ++i)
+		person_get_xy(s_persons[i], &x, &s_persons[i]->sort_y, true);
+	sort_nearly_sorted((void**)s_persons, s_num_persons, compare_persons);
+}
+
+static rect_t
+trigger_bounds(const struct map_trigger* trigger)
+{
+	rect_t bounds;
+	int    tile_w, tile_h;
+
+	tileset_get_size(s_map->tileset, &tile_w, &tile_h);
+	bounds.x1 = trigger->x - tile_w / 2;
+	bounds.y1 = trigger->y - tile_h / 2;
+	bounds.x2 = bounds.x1 + tile_w;
+	bounds.y2 = bounds.y1 + tile_h;
+	return bounds;
+}
+
+static void
+unbucket_person(person_t* person)
+{
+	vector_t*    bucket;
+	unsigned int hash;
+	rect_t       span;
+
+	int i;
+	int x, y;
+
+	if (!person->is_bucketed)
+		return;
+	person->is_bucketed = false;
+	span = person->bucket_span;
+	if ((span.x2 - span.x1 + 1) * (span.y2 - span.y1 + 1) > PERSON_CELL_MAX) {
+		bucket = s_oversized_persons;
+		for (i = 0; i < vector_len(bucket); ++i) {
+			if (*(person_t**)vector_get(bucket, i) == person) {
+				vector_remove(bucket, i);
+				break;
+			}
+		}
+		return;
+	}
+	for (y = span.y1; y <= span.y2; ++y) for (x = span.x1; x <= span.x2; ++x) {
+		hash = hash_cell(x, y, person->bucket_layer) & (PERSON_HASH_SIZE - 1);
+		bucket = s_person_buckets[hash];
+		for (i = 0; i < vector_len(bucket); ++i) {
+			if (*(person_t**)vector_get(bucket, i) == person) {
+				vector_remove(bucket, i);
+				break;
+			}
+		}
+	}
 }
 
 static void
 update_map_engine(bool in_main_loop)
 {
+	struct chunk*       chunk;
 	bool                has_moved;
 	int                 index;
 	bool                is_sort_needed = false;
+	iter_t              iter;
 	int                 last_trigger;
 	int                 last_zone;
 	int                 layer;
+	struct map_layer*   layer_data;
 	int                 map_w, map_h;
 	int                 num_zone_steps;
+	int*                p_tile;
 	script_t*           script_to_run;
 	int                 script_type;
 	double              start_x[PLAYER_MAX];
@@ -2791,7 +3448,28 @@ update_map_engine(bool in_main_loop)
 	map_w = s_map->width * tile_w;
 	map_h = s_map->height * tile_h;
 
-	tileset_update(s_map->tileset);
+	if (tileset_update(s_map->tileset)) {
+		// one or more tiles changed frames, rebuild only the chunks showing them.  if any
+		// tiles were restarted, the chunks don't know about them yet, so rebuild all of
+		// them.
+		for (i = 0; i < s_map->num_layers; ++i) {
+			layer_data = &s_map->layers[i];
+			for (j = 0; j < layer_data->num_chunks_x * layer_data->num_chunks_y; ++j) {
+				chunk = &layer_data->chunks[j];
+				if (tileset_rescheduled(s_map->tileset))
+					chunk->is_dirty = true;
+				if (chunk->is_dirty || chunk->anim_tiles == NULL)
+					continue;
+				iter = vector_enum(chunk->anim_tiles);
+				while ((p_tile = iter_next(&iter))) {
+					if (tileset_changed(s_map->tileset, *p_tile)) {
+						chunk->is_dirty = true;
+						break;
+					}
+				}
+			}
+		}
+	}
 
 	for (i = 0; i < PLAYER_MAX; ++i) if (s_players[i].person != NULL)
 		person_get_xy(s_players[i].person, &start_x[i], &start_y[i], false);
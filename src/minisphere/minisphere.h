@@ -57,6 +57,7 @@
 #include <allegro5/allegro_image.h>
 #include <allegro5/allegro_memfile.h>
 #include <allegro5/allegro_native_dialog.h>
+#include <allegro5/allegro_opengl.h>
 #include <allegro5/allegro_primitives.h>
 
 #include "lstring.h"
@@ -79,10 +80,12 @@ extern double    g_idle_time;
 extern screen_t* g_screen;
 extern uint32_t  g_tick_count;
 
-void sphere_abort       (const char* message);
-void sphere_change_game (const char* pathname);
-void sphere_exit        (bool shutting_down);
-void sphere_heartbeat   (bool in_event_loop, int api_version);
-void sphere_restart     (void);
-void sphere_sleep       (double time);
-void sphere_tick        (int api_version, bool clear_screen, int framerate);
+void   sphere_abort         (const char* message);
+void   sphere_advance_clock (double time);
+void   sphere_change_game   (const char* pathname);
+void   sphere_exit          (bool shutting_down);
+void   sphere_heartbeat     (bool in_event_loop, int api_version);
+double sphere_now           (void);
+void   sphere_restart       (void);
+void   sphere_sleep         (double time);
+void   sphere_tick          (int api_version, bool clear_screen, int framerate);
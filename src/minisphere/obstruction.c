@@ -33,14 +33,40 @@
 #include "minisphere.h"
 #include "obstruction.h"
 
+// obstruction maps with more segments than this get a spatial index.  for small maps
+// (e.g. per-tile obstruction) a linear scan is faster than consulting the grid.
+#define MIN_INDEXED_LINES 16
+
+// log2 of the smallest grid cell size in pixels.  a segment is filed under every cell its
+// bounding box touches, so this is a tradeoff between index size and the number of
+// candidates to check per query.  cells are made larger for maps with extreme bounds to
+// keep the grid from getting out of hand.
+#define MIN_CELL_SHIFT 6
+#define MAX_CELLS      65536
+
 struct obsmap
 {
 	unsigned int id;
 	rect_t*      lines;
 	int          max_lines;
 	int          num_lines;
+
+	// uniform grid over the segments, built lazily on the first test after a change.
+	// cells[] holds, for each cell, an offset into cell_lines[] which lists the indices
+	// of all segments whose bounding box overlaps that cell.
+	bool         grid_dirty;
+	rect_t       grid_bounds;
+	int          grid_shift;
+	int          grid_width;
+	int          grid_height;
+	int*         cells;
+	int*         cell_lines;
 };
 
+static rect_t bounding_box   (rect_t line);
+static void   build_grid     (obsmap_t* obsmap);
+static bool   test_rect_bbox (const obsmap_t* obsmap, rect_t bbox, const rect_t lines[], int num_lines);
+
 static unsigned int s_next_obsmap_id = 0;
 
 obsmap_t*
@@ -64,6 +90,8 @@ obsmap_free(obsmap_t* obsmap)
 	if (obsmap == NULL)
 		return;
 	console_log(4, "disposing obstruction map #%u no longer in use", obsmap->id);
+	free(obsmap->cells);
+	free(obsmap->cell_lines);
 	free(obsmap->lines);
 	free(obsmap);
 }
@@ -86,28 +114,179 @@ obsmap_add_line(obsmap_t* obsmap, rect_t line)
 	}
 	obsmap->lines[obsmap->num_lines] = line;
 	++obsmap->num_lines;
+	obsmap->grid_dirty = true;
 	return true;
 }
 
 bool
 obsmap_test_line(const obsmap_t* obsmap, rect_t line)
 {
-	int i;
-
-	for (i = 0; i < obsmap->num_lines; ++i) {
-		if (do_lines_overlap(line, obsmap->lines[i]))
-			return true;
-	}
-	return false;
+	return test_rect_bbox(obsmap, line, &line, 1);
 }
 
 bool
 obsmap_test_rect(const obsmap_t* obsmap, rect_t rectangle)
 {
+	rect_t edges[4];
+
 	// this treats 'rect' as hollow, which differs from the usual treatment of rectangles
 	// in the engine but matches the behavior of Sphere 1.x.
-	return obsmap_test_line(obsmap, mk_rect(rectangle.x1, rectangle.y1, rectangle.x2, rectangle.y1))
-		|| obsmap_test_line(obsmap, mk_rect(rectangle.x2, rectangle.y1, rectangle.x2, rectangle.y2))
-		|| obsmap_test_line(obsmap, mk_rect(rectangle.x1, rectangle.y2, rectangle.x2, rectangle.y2))
-		|| obsmap_test_line(obsmap, mk_rect(rectangle.x1, rectangle.y1, rectangle.x1, rectangle.y2));
+	edges[0] = mk_rect(rectangle.x1, rectangle.y1, rectangle.x2, rectangle.y1);
+	edges[1] = mk_rect(rectangle.x2, rectangle.y1, rectangle.x2, rectangle.y2);
+	edges[2] = mk_rect(rectangle.x1, rectangle.y2, rectangle.x2, rectangle.y2);
+	edges[3] = mk_rect(rectangle.x1, rectangle.y1, rectangle.x1, rectangle.y2);
+	return test_rect_bbox(obsmap, rectangle, edges, 4);
+}
+
+static rect_t
+bounding_box(rect_t line)
+{
+	rect_normalize(&line);
+	return line;
+}
+
+static void
+build_grid(obsmap_t* obsmap)
+{
+	rect_t bbox;
+	rect_t bounds;
+	int    count;
+	int*   counts;
+	int    cx1, cy1, cx2, cy2;
+	int    num_cells;
+	int    num_entries = 0;
+	int    offset;
+	int    shift;
+	int    x, y;
+
+	int i;
+
+	obsmap->grid_dirty = false;
+	free(obsmap->cells);
+	free(obsmap->cell_lines);
+	obsmap->cells = NULL;
+	obsmap->cell_lines = NULL;
+	if (obsmap->num_lines < MIN_INDEXED_LINES)
+		return;
+
+	bounds = bounding_box(obsmap->lines[0]);
+	for (i = 1; i < obsmap->num_lines; ++i) {
+		bbox = bounding_box(obsmap->lines[i]);
+		bounds.x1 = bbox.x1 < bounds.x1 ? bbox.x1 : bounds.x1;
+		bounds.y1 = bbox.y1 < bounds.y1 ? bbox.y1 : bounds.y1;
+		bounds.x2 = bbox.x2 > bounds.x2 ? bbox.x2 : bounds.x2;
+		bounds.y2 = bbox.y2 > bounds.y2 ? bbox.y2 : bounds.y2;
+	}
+	shift = MIN_CELL_SHIFT;
+	while ((double)(((bounds.x2 - bounds.x1) >> shift) + 1) * (((bounds.y2 - bounds.y1) >> shift) + 1) > MAX_CELLS)
+		++shift;
+	obsmap->grid_bounds = bounds;
+	obsmap->grid_shift = shift;
+	obsmap->grid_width = ((bounds.x2 - bounds.x1) >> shift) + 1;
+	obsmap->grid_height = ((bounds.y2 - bounds.y1) >> shift) + 1;
+	num_cells = obsmap->grid_width * obsmap->grid_height;
+
+	// two passes: count the segments in each cell, then fill them in.  this keeps the
+	// whole index in two flat arrays, which is kind to the cache when testing.
+	if (!(counts = calloc(num_cells + 1, sizeof(int))))
+		return;
+	for (i = 0; i < obsmap->num_lines; ++i) {
+		bbox = bounding_box(obsmap->lines[i]);
+		cx1 = (bbox.x1 - bounds.x1) >> shift;
+		cy1 = (bbox.y1 - bounds.y1) >> shift;
+		cx2 = (bbox.x2 - bounds.x1) >> shift;
+		cy2 = (bbox.y2 - bounds.y1) >> shift;
+		for (y = cy1; y <= cy2; ++y) for (x = cx1; x <= cx2; ++x)
+			++counts[x + y * obsmap->grid_width];
+		num_entries += (cx2 - cx1 + 1) * (cy2 - cy1 + 1);
+	}
+	if (!(obsmap->cell_lines = malloc(num_entries * sizeof(int))))
+		goto on_error;
+	offset = 0;
+	for (i = 0; i <= num_cells; ++i) {
+		count = counts[i];
+		counts[i] = offset;
+		offset += count;
+	}
+	obsmap->cells = counts;
+	counts = malloc((num_cells + 1) * sizeof(int));
+	if (counts == NULL)
+		goto on_error;
+	memcpy(counts, obsmap->cells, (num_cells + 1) * sizeof(int));
+	for (i = 0; i < obsmap->num_lines; ++i) {
+		bbox = bounding_box(obsmap->lines[i]);
+		cx1 = (bbox.x1 - bounds.x1) >> shift;
+		cy1 = (bbox.y1 - bounds.y1) >> shift;
+		cx2 = (bbox.x2 - bounds.x1) >> shift;
+		cy2 = (bbox.y2 - bounds.y1) >> shift;
+		for (y = cy1; y <= cy2; ++y) for (x = cx1; x <= cx2; ++x)
+			obsmap->cell_lines[counts[x + y * obsmap->grid_width]++] = i;
+	}
+	free(counts);
+	console_log(4, "indexed obstruction map #%u, %d segments in %dx%d grid",
+		obsmap->id, obsmap->num_lines, obsmap->grid_width, obsmap->grid_height);
+	return;
+
+on_error:
+	// if we can't build the index, we can still fall back on a linear scan
+	free(counts);
+	free(obsmap->cells);
+	free(obsmap->cell_lines);
+	obsmap->cells = NULL;
+	obsmap->cell_lines = NULL;
+}
+
+static bool
+test_rect_bbox(const obsmap_t* obsmap, rect_t bbox, const rect_t lines[], int num_lines)
+{
+	rect_t bounds;
+	int    cx1, cy1, cx2, cy2;
+	int    end;
+	int    line_index;
+	int    shift;
+	int    x, y;
+
+	int i, j;
+
+	// the index is a cache and doesn't change the observable state of the map, so it's
+	// safe to (re)build it here even though we were given a const pointer.
+	if (obsmap->grid_dirty)
+		build_grid((obsmap_t*)obsmap);
+
+	if (obsmap->cells == NULL) {
+		for (i = 0; i < obsmap->num_lines; ++i) {
+			for (j = 0; j < num_lines; ++j) {
+				if (do_lines_overlap(lines[j], obsmap->lines[i]))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// two segments can only intersect if their bounding boxes overlap, so we only need
+	// to look at the cells covered by the query.  the box is padded by a pixel to stay on
+	// the safe side of float rounding in do_lines_overlap().
+	rect_normalize(&bbox);
+	bounds = obsmap->grid_bounds;
+	shift = obsmap->grid_shift;
+	if (bbox.x2 + 1 < bounds.x1 || bbox.x1 - 1 > bounds.x2
+		|| bbox.y2 + 1 < bounds.y1 || bbox.y1 - 1 > bounds.y2)
+	{
+		return false;
+	}
+	cx1 = bbox.x1 - 1 > bounds.x1 ? (bbox.x1 - 1 - bounds.x1) >> shift : 0;
+	cy1 = bbox.y1 - 1 > bounds.y1 ? (bbox.y1 - 1 - bounds.y1) >> shift : 0;
+	cx2 = bbox.x2 + 1 < bounds.x2 ? (bbox.x2 + 1 - bounds.x1) >> shift : obsmap->grid_width - 1;
+	cy2 = bbox.y2 + 1 < bounds.y2 ? (bbox.y2 + 1 - bounds.y1) >> shift : obsmap->grid_height - 1;
+	for (y = cy1; y <= cy2; ++y) for (x = cx1; x <= cx2; ++x) {
+		end = obsmap->cells[x + y * obsmap->grid_width + 1];
+		for (i = obsmap->cells[x + y * obsmap->grid_width]; i < end; ++i) {
+			line_index = obsmap->cell_lines[i];
+			for (j = 0; j < num_lines; ++j) {
+				if (do_lines_overlap(lines[j], obsmap->lines[line_index]))
+					return true;
+			}
+		}
+	}
+	return false;
 }
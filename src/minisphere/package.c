@@ -36,29 +36,88 @@
 #include "compress.h"
 #include "vector.h"
 
+#include <zlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 struct asset
 {
 	package_t*    package;
-	uint8_t*      buffer;
 	char*         filename;
 	ALLEGRO_FILE* handle;
 };
 
 struct package
 {
-	unsigned int  refcount;
-	unsigned int  id;
-	path_t*       path;
-	ALLEGRO_FILE* file;
-	vector_t*     index;
+	unsigned int   refcount;
+	unsigned int   id;
+	path_t*        path;
+	size_t         block_size;
+	const uint8_t* data;
+	size_t         data_size;
+	int*           dir_table;
+	vector_t*      dirs;
+	ALLEGRO_FILE*  file;
+	int*           file_table;
+	vector_t*      index;
+	size_t         max_names;
+	char*          names;
+	size_t         names_size;
+	int            table_size;
+	int            version;
+};
+
+struct stream
+{
+	uint8_t*                block_data;
+	int64_t                 block_index;
+	uint64_t*               block_table;
+	int64_t                 checked_size;
+	uint32_t                crc;
+	const struct spk_entry* entry;
+	bool                    has_error;
+	uint8_t*                in_buffer;
+	size_t                  in_offset;
+	int64_t                 inflate_pos;
+	bool                    is_eof;
+	package_t*              package;
+	int64_t                 position;
+	z_stream                z_stream;
+};
+
+struct spk_dir
+{
+	const char* path;
+	size_t      path_len;
+	vector_t*   files;
+	vector_t*   subdirs;
 };
 
 struct spk_entry
 {
-	char   file_path[SPHERE_PATH_MAX];
-	size_t pack_size;
-	size_t file_size;
-	long   offset;
+	uint32_t    crc;
+	const char* file_path;
+	bool        has_crc;
+	bool        has_hash;
+	bool        is_stored;
+	uint32_t    name_hash;
+	size_t      name_offset;
+	uint32_t    num_blocks;
+	size_t      pack_size;
+	size_t      file_size;
+	uint64_t    offset;
+};
+
+struct spk_name
+{
+	const char* text;
+	size_t      length;
 };
 
 #pragma pack(push, 1)
@@ -79,18 +138,107 @@ struct spk_entry_hdr
 	uint32_t file_size;
 	uint32_t compress_size;
 };
+
+// SPK v2:
+//   * offsets and sizes are 64-bit and file data starts on a page boundary.
+//   * compressed files are split into blocks which are compressed separately, with a
+//     table of compressed block sizes in front, so any part of a file can be read
+//     without inflating everything before it.  a block whose compressed size matches
+//     its real size is stored as-is.
+//   * each index entry includes a CRC-32 of the file and the hash of its filename.
+struct spk2_header
+{
+	char     signature[4];
+	uint16_t version;
+	uint16_t reserved_1;
+	uint32_t num_files;
+	uint32_t block_size;
+	uint64_t index_offset;
+	uint8_t  reserved[40];
+};
+
+struct spk2_entry_hdr
+{
+	uint16_t filename_size;
+	uint16_t flags;
+	uint32_t name_hash;
+	uint32_t crc;
+	uint32_t num_blocks;
+	uint64_t offset;
+	uint64_t file_size;
+	uint64_t pack_size;
+};
 #pragma pack(pop)
 
+#define SPK_ENTRY_BLOCKS    0x0001
+#define SPK_MAX_BLOCK_SIZE  (16 * 1024 * 1024)
+
+static int                     add_dir          (package_t* package, const char* path, size_t length);
+static bool                    build_index      (package_t* package);
+static bool                    check_crc        (struct stream* stream, int64_t offset, const void* data, size_t size);
+static uint32_t                checksum         (uint32_t crc, const uint8_t* data, size_t size);
+static int                     compare_names    (const void* in_a, const void* in_b);
+static int                     compare_strings  (const void* in_a, const void* in_b);
+static bool                    decode_block     (package_t* package, const struct spk_entry* entry, const uint64_t* block_table, int64_t index, uint8_t* out_data, uint8_t* scratch);
+static int                     find_dir         (const package_t* package, const char* path, size_t length);
+static const struct spk_entry* find_file        (const package_t* package, const char* path, bool ignore_case);
+static uint32_t                hash_name        (const char* name, size_t length, bool ignore_case);
+static size_t                  inflate_entry    (struct stream* stream, void* buffer, size_t size);
+static bool                    map_package      (package_t* package, const char* filename);
+static ALLEGRO_FILE*           open_entry       (package_t* package, const struct spk_entry* entry, const char* mode);
+static uint64_t*               read_block_table (package_t* package, const struct spk_entry* entry);
+static bool                    read_data        (package_t* package, uint64_t offset, void* buffer, size_t size);
+static bool                    read_name        (package_t* package, size_t length, size_t* out_offset);
+static void                    stream_clearerr  (ALLEGRO_FILE* file);
+static bool                    stream_close     (ALLEGRO_FILE* file);
+static bool                    stream_eof       (ALLEGRO_FILE* file);
+static const char*             stream_errmsg    (ALLEGRO_FILE* file);
+static int                     stream_error     (ALLEGRO_FILE* file);
+static bool                    stream_flush     (ALLEGRO_FILE* file);
+static void*                   stream_open      (const char* path, const char* mode);
+static size_t                  stream_read      (ALLEGRO_FILE* file, void* buffer, size_t size);
+static bool                    stream_seek      (ALLEGRO_FILE* file, int64_t offset, int whence);
+static off_t                   stream_size      (ALLEGRO_FILE* file);
+static int64_t                 stream_tell      (ALLEGRO_FILE* file);
+static int                     stream_ungetc    (ALLEGRO_FILE* file, int c);
+static size_t                  stream_write     (ALLEGRO_FILE* file, const void* buffer, size_t size);
+static void                    unmap_package    (package_t* package);
+
+// compressed assets are inflated on the fly as they are read, rather than unpacking
+// the whole thing into memory up front.
+static const ALLEGRO_FILE_INTERFACE STREAM_INTERFACE =
+{
+	stream_open,
+	stream_close,
+	stream_read,
+	stream_write,
+	stream_flush,
+	stream_tell,
+	stream_seek,
+	stream_eof,
+	stream_error,
+	stream_errmsg,
+	stream_clearerr,
+	stream_ungetc,
+	stream_size,
+};
+
 static unsigned int s_next_package_id = 1;
 
 package_t*
 package_open(const char* path)
 {
-	package_t*           package;
-	struct spk_entry     spk_entry;
-	struct spk_entry_hdr spk_entry_hdr;
-	struct spk_header    spk_hdr;
+	uint64_t              index_offset;
+	uint32_t              num_files;
+	struct spk_dir*       dir;
+	package_t*            package;
+	struct spk_entry      spk_entry;
+	struct spk_entry_hdr  spk_entry_hdr;
+	struct spk2_entry_hdr spk2_entry_hdr;
+	struct spk_header     spk_hdr;
+	struct spk2_header    spk2_hdr;
 
+	iter_t   iter;
 	uint32_t i;
 
 	console_log(2, "opening package #%u '%s'", s_next_package_id, path);
@@ -101,25 +249,83 @@ package_open(const char* path)
 	if (al_fread(package->file, &spk_hdr, sizeof(struct spk_header)) != sizeof(struct spk_header))
 		goto on_error;
 	if (memcmp(spk_hdr.signature, ".spk", 4) != 0) goto on_error;
-	if (spk_hdr.version != 1) goto on_error;
+	if (spk_hdr.version == 1) {
+		num_files = spk_hdr.num_files;
+		index_offset = spk_hdr.index_offset;
+	}
+	else if (spk_hdr.version == 2) {
+		al_fseek(package->file, 0, ALLEGRO_SEEK_SET);
+		if (al_fread(package->file, &spk2_hdr, sizeof(struct spk2_header)) != sizeof(struct spk2_header))
+			goto on_error;
+		if (spk2_hdr.block_size == 0 || spk2_hdr.block_size > SPK_MAX_BLOCK_SIZE)
+			goto on_error;
+		num_files = spk2_hdr.num_files;
+		index_offset = spk2_hdr.index_offset;
+		package->block_size = spk2_hdr.block_size;
+	}
+	else {
+		goto on_error;
+	}
+	package->version = spk_hdr.version;
 
 	package->path = path_new(path);
 
 	// load the package index
 	console_log(4, "reading package index for package #%u", s_next_package_id);
 	package->index = vector_new(sizeof(struct spk_entry));
-	al_fseek(package->file, spk_hdr.index_offset, ALLEGRO_SEEK_SET);
-	for (i = 0; i < spk_hdr.num_files; ++i) {
-		if (al_fread(package->file, &spk_entry_hdr, sizeof(struct spk_entry_hdr)) != sizeof(struct spk_entry_hdr))
-			goto on_error;
-		if (spk_entry_hdr.version != 1) goto on_error;
-		spk_entry.pack_size = spk_entry_hdr.compress_size;
-		spk_entry.file_size = spk_entry_hdr.file_size;
-		spk_entry.offset = spk_entry_hdr.offset;
-		al_fread(package->file, spk_entry.file_path, spk_entry_hdr.filename_size);
-		spk_entry.file_path[spk_entry_hdr.filename_size] = '\0';
+	package->max_names = 1024;
+	if (!(package->names = malloc(package->max_names)))
+		goto on_error;
+	al_fseek(package->file, index_offset, ALLEGRO_SEEK_SET);
+	for (i = 0; i < num_files; ++i) {
+		memset(&spk_entry, 0, sizeof(struct spk_entry));
+		if (package->version == 1) {
+			if (al_fread(package->file, &spk_entry_hdr, sizeof(struct spk_entry_hdr)) != sizeof(struct spk_entry_hdr))
+				goto on_error;
+			if (spk_entry_hdr.version != 1) goto on_error;
+
+			// note: SPK v1 has no flag for this.  Cell stores a file uncompressed when
+			//       that's no larger than compressing it, so a file whose packed size is
+			//       the same as its real size can't be compressed.
+			spk_entry.is_stored = spk_entry_hdr.compress_size == spk_entry_hdr.file_size;
+			spk_entry.pack_size = spk_entry_hdr.compress_size;
+			spk_entry.file_size = spk_entry_hdr.file_size;
+			spk_entry.offset = spk_entry_hdr.offset;
+			if (!read_name(package, spk_entry_hdr.filename_size, &spk_entry.name_offset))
+				goto on_error;
+		}
+		else {
+			if (al_fread(package->file, &spk2_entry_hdr, sizeof(struct spk2_entry_hdr)) != sizeof(struct spk2_entry_hdr))
+				goto on_error;
+			if (spk2_entry_hdr.file_size > SIZE_MAX || spk2_entry_hdr.pack_size > SIZE_MAX)
+				goto on_error;
+			spk_entry.crc = spk2_entry_hdr.crc;
+			spk_entry.has_crc = true;
+			spk_entry.has_hash = true;
+			spk_entry.is_stored = !(spk2_entry_hdr.flags & SPK_ENTRY_BLOCKS);
+			spk_entry.name_hash = spk2_entry_hdr.name_hash;
+			spk_entry.num_blocks = spk_entry.is_stored ? 0 : spk2_entry_hdr.num_blocks;
+			spk_entry.pack_size = (size_t)spk2_entry_hdr.pack_size;
+			spk_entry.file_size = (size_t)spk2_entry_hdr.file_size;
+			spk_entry.offset = spk2_entry_hdr.offset;
+			if (!spk_entry.is_stored && spk_entry.num_blocks
+				!= (spk_entry.file_size + package->block_size - 1) / package->block_size)
+			{
+				goto on_error;
+			}
+			if (!read_name(package, spk2_entry_hdr.filename_size, &spk_entry.name_offset))
+				goto on_error;
+		}
 		if (!vector_push(package->index, &spk_entry)) goto on_error;
 	}
+	if (!build_index(package))
+		goto on_error;
+
+	// if possible, map the whole package into memory.  this lets assets stored without
+	// compression be read in place without copying them, and saves a seek and read for
+	// everything else.
+	if (!map_package(package, path))
+		console_log(4, "couldn't map package #%u into memory", s_next_package_id);
 
 	package->id = s_next_package_id++;
 	return package_ref(package);
@@ -130,7 +336,18 @@ on_error:
 		path_free(package->path);
 		if (package->file != NULL)
 			al_fclose(package->file);
+		if (package->dirs != NULL) {
+			iter = vector_enum(package->dirs);
+			while ((dir = iter_next(&iter))) {
+				vector_free(dir->files);
+				vector_free(dir->subdirs);
+			}
+			vector_free(package->dirs);
+		}
+		free(package->dir_table);
+		free(package->file_table);
 		vector_free(package->index);
+		free(package->names);
 		free(package);
 	}
 	return NULL;
@@ -146,11 +363,26 @@ package_ref(package_t* it)
 void
 package_unref(package_t* it)
 {
+	struct spk_dir* dir;
+
+	iter_t iter;
+
 	if (it == NULL || --it->refcount > 0)
 		return;
 
 	console_log(4, "disposing package #%u no longer in use", it->id);
+	iter = vector_enum(it->dirs);
+	while ((dir = iter_next(&iter))) {
+		vector_free(dir->files);
+		vector_free(dir->subdirs);
+	}
+	vector_free(it->dirs);
+	unmap_package(it);
+	free(it->dir_table);
+	free(it->file_table);
 	vector_free(it->index);
+	free(it->names);
+	path_free(it->path);
 	al_fclose(it->file);
 	free(it);
 }
@@ -158,122 +390,71 @@ package_unref(package_t* it)
 bool
 package_dir_exists(const package_t* it, const char* dirname)
 {
-	struct spk_entry* entry;
-	path_t*           path;
-	const char*       pathname;
-
-	iter_t iter;
+	bool        is_found;
+	size_t      length;
+	path_t*     path;
+	const char* pathname;
 
+	// SPK doesn't really have directories, but the index includes every directory
+	// leading up to a stored file, so a directory exists if anything is stored under it.
 	path = path_new_dir(dirname);
 	pathname = path_cstr(path);
-	iter = vector_enum(it->index);
-	while ((entry = iter_next(&iter))) {
-		// SPK doesn't really have directories, so we fake it by checking
-		// if any of the stored filenames begin with the directory path as a
-		// prefix.
-		if (strstr(entry->file_path, pathname) == entry->file_path) {
-			path_free(path);
-			return true;
-		}
-	}
+	if (strcmp(pathname, "./") == 0)
+		pathname = "";
+	length = strlen(pathname);
+	if (length > 0 && pathname[length - 1] == '/')
+		--length;
+	is_found = find_dir(it, pathname, length) >= 0;
 	path_free(path);
-	return false;
+	return is_found;
 }
 
 bool
 package_file_exists(const package_t* it, const char* filename)
 {
-	struct spk_entry* entry;
-	path_t*           path;
-	const char*       pathname;
-
-	iter_t iter;
+	bool    is_found;
+	path_t* path;
 
 	path = path_new(filename);
-	pathname = path_cstr(path);
-	iter = vector_enum(it->index);
-	while ((entry = iter_next(&iter))) {
-		// SPK doesn't really have directories, so we fake it by checking
-		// if any of the stored filenames begin with the directory path as a
-		// prefix.
-		if (strcmp(entry->file_path, pathname) == 0) {
-			path_free(path);
-			return true;
-		}
-	}
+	is_found = find_file(it, path_cstr(path), false) != NULL;
 	path_free(path);
-	return false;
+	return is_found;
 }
 
 vector_t*
 package_list_dir(package_t* package, const char* dirname, bool want_dirs)
 {
-	// HERE BE DRAGONS!
-	// this function is kind of a monstrosity because the SPK format doesn't have
-	// any real concept of a directory - each asset is stored with its full path
-	// as its filename.  as such we have to do some ugly parsing and de-duplication,
-	// particularly in the case of directories.
+	struct spk_dir*  dir;
+	int              dir_index;
+	lstring_t*       filename;
+	size_t           length;
+	vector_t*        list;
+	struct spk_name* name;
+	const char**     p_filename;
 
-	struct spk_entry* file_info;
-	lstring_t*        filename;
-	char*             found_dirname;
-	bool              is_in_set;
-	vector_t*         list;
-	const char*       maybe_dirname;
-	const char*       maybe_filename;
-	const char*       match;
-
-	iter_t iter, iter2;
-	lstring_t** item;
+	iter_t iter;
 
 	list = vector_new(sizeof(lstring_t*));
-	iter = vector_enum(package->index);
-	while ((file_info = iter_next(&iter))) {
-		if (!want_dirs) {  // list files
-			if (!(match = strstr(file_info->file_path, dirname)))
-				continue;
-			if (match != file_info->file_path)
-				continue;
-			maybe_filename = match + strlen(dirname);
-			if (dirname[strlen(dirname) - 1] != '/') {
-				if (maybe_filename[0] != '/')
-					continue;  // oops, matched a partial file name
-				++maybe_filename;  // account for directory separator
-			}
-			if (strchr(maybe_filename, '/'))
-				continue;  // ignore files in subdirectories
-
-						   // if we got to this point, we have a valid filename
-			filename = lstr_newf("%s", maybe_filename);
+	if (strcmp(dirname, ".") == 0 || strcmp(dirname, "./") == 0)
+		dirname = "";
+	length = strlen(dirname);
+	if (length > 0 && dirname[length - 1] == '/')
+		--length;
+	if ((dir_index = find_dir(package, dirname, length)) < 0)
+		return list;
+	dir = vector_get(package->dirs, dir_index);
+	if (!want_dirs) {
+		iter = vector_enum(dir->files);
+		while ((p_filename = iter_next(&iter))) {
+			filename = lstr_newf("%s", *p_filename);
 			vector_push(list, &filename);
 		}
-		else {  // list directories
-			if (!(match = strstr(file_info->file_path, dirname)))
-				continue;
-			if (match != file_info->file_path)
-				continue;
-			maybe_dirname = match + strlen(dirname);
-			if (dirname[strlen(dirname) - 1] != '/') {
-				if (maybe_dirname[0] != '/')
-					continue;  // oops, matched a partial file name
-				++maybe_dirname;  // account for directory separator
-			}
-			if (!(maybe_filename = strchr(maybe_dirname, '/')))
-				continue;  // ignore files
-			if (strchr(++maybe_filename, '/'))
-				continue;  // ignore subdirectories
-
-						   // if we got to this point, we have a valid directory name
-			found_dirname = strdup(maybe_dirname);
-			*strchr(found_dirname, '/') = '\0';
-			filename = lstr_newf("%s", found_dirname);
-			iter2 = vector_enum(list);
-			is_in_set = false;
-			while ((item = iter_next(&iter2)))
-				is_in_set |= lstr_cmp(filename, *item) == 0;
-			if (!is_in_set)  // avoid duplicate listings
-				vector_push(list, &filename);
-			free(found_dirname);
+	}
+	else {
+		iter = vector_enum(dir->subdirs);
+		while ((name = iter_next(&iter))) {
+			filename = lstr_newf("%.*s", (int)name->length, name->text);
+			vector_push(list, &filename);
 		}
 	}
 	return list;
@@ -282,13 +463,14 @@ package_list_dir(package_t* package, const char* dirname, bool want_dirs)
 asset_t*
 asset_fopen(package_t* package, const char* path, const char* mode)
 {
-	ALLEGRO_FILE* al_file = NULL;
-	asset_t*      asset = NULL;
-	void*         buffer = NULL;
-	path_t*       cache_path;
-	size_t        file_size;
-	const char*   local_filename;
-	path_t*       local_path;
+	ALLEGRO_FILE*           al_file = NULL;
+	asset_t*                asset = NULL;
+	void*                   buffer = NULL;
+	path_t*                 cache_path;
+	const struct spk_entry* entry;
+	size_t                  file_size;
+	const char*             local_filename;
+	path_t*                 local_path;
 
 	console_log(4, "opening '%s' (%s) from package #%u", path, mode, package->id);
 
@@ -312,34 +494,34 @@ asset_fopen(package_t* package, const char* path, const char* mode)
 		if (!(al_file = al_fopen(local_filename, mode)))
 			goto on_error;
 	}
+	else if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) {
+		// read-only: read the file straight out of the package.  nothing gets unpacked
+		// up front, compressed files are inflated as they are read.
+		if (!(entry = find_file(package, path, true)))
+			goto on_error;
+		if (!(al_file = open_entry(package, entry, mode)))
+			goto on_error;
+	}
 	else {
 		if (!(buffer = asset_fslurp(package, path, &file_size)) && mode[0] == 'r')
 			goto on_error;
-		if (strcmp(mode, "r") != 0 && strcmp(mode, "rb") != 0) {
-			if (buffer != NULL && mode[0] != 'w') {
-				// if a game requests write access to an existing file,
-				// we extract it. this ensures file operations originating from
-				// inside an SPK are transparent to the game.
-				console_log(4, "extracting #%u:'%s', write access requested", package->id, path);
-				if (!(al_file = al_fopen(local_filename, "w")))
-					goto on_error;
-				al_fwrite(al_file, buffer, file_size);
-				al_fclose(al_file);
-			}
-			free(buffer); buffer = NULL;
-			if (!(al_file = al_fopen(local_filename, mode)))
-				goto on_error;
-		}
-		else {
-			// read-only: access unpacked file from memory (performance)
-			if (!(al_file = al_open_memfile(buffer, file_size, mode)))
+		if (buffer != NULL && mode[0] != 'w') {
+			// if a game requests write access to an existing file,
+			// we extract it. this ensures file operations originating from
+			// inside an SPK are transparent to the game.
+			console_log(4, "extracting #%u:'%s', write access requested", package->id, path);
+			if (!(al_file = al_fopen(local_filename, "w")))
 				goto on_error;
+			al_fwrite(al_file, buffer, file_size);
+			al_fclose(al_file);
 		}
+		free(buffer); buffer = NULL;
+		if (!(al_file = al_fopen(local_filename, mode)))
+			goto on_error;
 	}
 
 	path_free(local_path);
 
-	asset->buffer = buffer;
 	asset->filename = strdup(path);
 	asset->handle = al_file;
 	asset->package = package_ref(package);
@@ -362,7 +544,6 @@ asset_fclose(asset_t* file)
 		return;
 	console_log(4, "closing '%s' from package #%u", file->filename, file->package->id);
 	al_fclose(file->handle);
-	free(file->buffer);
 	free(file->filename);
 	package_unref(file->package);
 	free(file);
@@ -395,37 +576,75 @@ asset_fseek(asset_t* file, long long offset, spk_seek_origin_t origin)
 void*
 asset_fslurp(package_t* package, const char* path, size_t *out_size)
 {
-	struct spk_entry* entry;
-	void*             packdata = NULL;
-	void*             unpacked = NULL;
-	size_t            unpack_size;
+	uint64_t*               block_table = NULL;
+	const struct spk_entry* entry;
+	void*                   packdata = NULL;
+	uint8_t*                scratch = NULL;
+	uint8_t*                unpacked = NULL;
+	size_t                  unpack_size;
 
-	iter_t iter;
+	uint32_t i;
 
 	console_log(3, "unpacking '%s' from package #%u", path, package->id);
 
-	iter = vector_enum(package->index);
-	while ((entry = iter_next(&iter))) {
-		if (strcasecmp(path, entry->file_path) == 0)
-			break;
-	}
-	if (entry == NULL)
-		goto on_error;
-	if (!(packdata = malloc(entry->pack_size)))
+	if (!(entry = find_file(package, path, true)))
 		goto on_error;
-	al_fseek(package->file, entry->offset, ALLEGRO_SEEK_SET);
-	if (al_fread(package->file, packdata, entry->pack_size) < entry->pack_size)
+	if (package->data != NULL && entry->offset + entry->pack_size > package->data_size)
 		goto on_error;
-	if (!(unpacked = z_inflate(packdata, entry->pack_size, entry->file_size, &unpack_size)))
+	if (entry->is_stored) {
+		// stored without compression, only one copy needed
+		if (!(unpacked = malloc(entry->file_size + 1)))
+			goto on_error;
+		if (!read_data(package, entry->offset, unpacked, entry->file_size))
+			goto on_error;
+		unpacked[entry->file_size] = '\0';
+		unpack_size = entry->file_size;
+	}
+	else if (entry->num_blocks > 0) {
+		// SPK v2 block-compressed file, inflate the blocks one after another
+		if (!(block_table = read_block_table(package, entry)))
+			goto on_error;
+		if (package->data == NULL && !(scratch = malloc(compressBound(package->block_size))))
+			goto on_error;
+		if (!(unpacked = malloc(entry->file_size + 1)))
+			goto on_error;
+		for (i = 0; i < entry->num_blocks; ++i) {
+			if (!decode_block(package, entry, block_table, i, unpacked + i * package->block_size, scratch))
+				goto on_error;
+		}
+		unpacked[entry->file_size] = '\0';
+		unpack_size = entry->file_size;
+		free(block_table);
+		free(scratch);
+	}
+	else if (package->data != NULL) {
+		// inflate directly from the mapped package
+		if (!(unpacked = z_inflate(package->data + entry->offset, entry->pack_size, entry->file_size, &unpack_size)))
+			goto on_error;
+	}
+	else {
+		if (!(packdata = malloc(entry->pack_size)))
+			goto on_error;
+		al_fseek(package->file, entry->offset, ALLEGRO_SEEK_SET);
+		if (al_fread(package->file, packdata, entry->pack_size) < entry->pack_size)
+			goto on_error;
+		if (!(unpacked = z_inflate(packdata, entry->pack_size, entry->file_size, &unpack_size)))
+			goto on_error;
+		free(packdata);
+	}
+	if (entry->has_crc && checksum(0, unpacked, unpack_size) != entry->crc) {
+		console_log(3, "checksum mismatch for '%s' in package #%u", path, package->id);
 		goto on_error;
-	free(packdata);
+	}
 
 	*out_size = unpack_size;
 	return unpacked;
 
 on_error:
 	console_log(3, "couldn't unpack '%s' from package #%u", path, package->id);
+	free(block_table);
 	free(packdata);
+	free(scratch);
 	free(unpacked);
 	return NULL;
 }
@@ -441,3 +660,720 @@ asset_fwrite(const void* buf, size_t size, size_t count, asset_t* file)
 {
 	return al_fwrite(file->handle, buf, size * count) / size;
 }
+
+static int
+add_dir(package_t* package, const char* path, size_t length)
+{
+	// adds the directory 'path' (without a trailing slash) to the tree, along with any
+	// parent directories that aren't there yet, and returns its index.
+
+	struct spk_dir  dir;
+	int             dir_index;
+	struct spk_name name;
+	const char*     p;
+	int             parent_index;
+	uint32_t        slot;
+
+	if ((dir_index = find_dir(package, path, length)) >= 0)
+		return dir_index;
+
+	// make sure the parent directory exists first
+	p = path + length;
+	while (p > path && p[-1] != '/')
+		--p;
+	if (length > 0) {
+		parent_index = add_dir(package, path, p > path ? p - path - 1 : 0);
+		if (parent_index < 0)
+			return -1;
+	}
+
+	dir.path = path;
+	dir.path_len = length;
+	dir.files = vector_new(sizeof(const char*));
+	dir.subdirs = vector_new(sizeof(struct spk_name));
+	if (dir.files == NULL || dir.subdirs == NULL || !vector_push(package->dirs, &dir)) {
+		vector_free(dir.files);
+		vector_free(dir.subdirs);
+		return -1;
+	}
+	dir_index = vector_len(package->dirs) - 1;
+	if (length > 0) {
+		name.text = p;
+		name.length = length - (p - path);
+		if (!vector_push(((struct spk_dir*)vector_get(package->dirs, parent_index))->subdirs, &name))
+			return -1;
+	}
+
+	slot = hash_name(path, length, false) & (package->table_size - 1);
+	while (package->dir_table[slot] >= 0)
+		slot = (slot + 1) & (package->table_size - 1);
+	package->dir_table[slot] = dir_index;
+	return dir_index;
+}
+
+static bool
+build_index(package_t* package)
+{
+	// sets up the hash tables used to look up files and directories by name, along with
+	// the directory tree used for listings.  every directory in a file's path gets an
+	// entry, so the number of directories can't exceed the number of path components.
+
+	struct spk_dir*   dir;
+	int               dir_index;
+	struct spk_entry* entry;
+	const char*       filename;
+	size_t            num_slots;
+	const char*       p;
+	const char*       path;
+	uint32_t          slot;
+
+	iter_t iter;
+
+	num_slots = 16;
+	iter = vector_enum(package->index);
+	while ((entry = iter_next(&iter))) {
+		entry->file_path = package->names + entry->name_offset;
+		for (p = entry->file_path; *p != '\0'; ++p) {
+			if (*p == '/')
+				++num_slots;
+		}
+		++num_slots;
+	}
+	package->table_size = 16;
+	while ((size_t)package->table_size < num_slots * 2)
+		package->table_size *= 2;
+	if (!(package->file_table = malloc(package->table_size * sizeof(int))))
+		return false;
+	if (!(package->dir_table = malloc(package->table_size * sizeof(int))))
+		return false;
+	memset(package->file_table, 0xFF, package->table_size * sizeof(int));
+	memset(package->dir_table, 0xFF, package->table_size * sizeof(int));
+	if (!(package->dirs = vector_new(sizeof(struct spk_dir))))
+		return false;
+	if (add_dir(package, "", 0) < 0)
+		return false;
+
+	iter = vector_enum(package->index);
+	while ((entry = iter_next(&iter))) {
+		// note: entries with the same name are hashed the same way and linear probing
+		//       keeps them in insertion order, so the first one in the package still wins
+		//       on lookup, just like it did with a linear search.
+		path = entry->file_path;
+		slot = (entry->has_hash ? entry->name_hash : hash_name(path, strlen(path), true))
+			& (package->table_size - 1);
+		while (package->file_table[slot] >= 0)
+			slot = (slot + 1) & (package->table_size - 1);
+		package->file_table[slot] = iter.index;
+
+		if ((filename = strrchr(path, '/')))
+			++filename;
+		else
+			filename = path;
+		if ((dir_index = add_dir(package, path, filename > path ? filename - path - 1 : 0)) < 0)
+			return false;
+		dir = vector_get(package->dirs, dir_index);
+		if (!vector_push(dir->files, &filename))
+			return false;
+	}
+
+	// sort directory listings by name
+	iter = vector_enum(package->dirs);
+	while ((dir = iter_next(&iter))) {
+		vector_sort(dir->files, compare_strings);
+		vector_sort(dir->subdirs, compare_names);
+	}
+	return true;
+}
+
+static int
+compare_names(const void* in_a, const void* in_b)
+{
+	const struct spk_name* a = in_a;
+	const struct spk_name* b = in_b;
+
+	int result;
+
+	result = strncmp(a->text, b->text, a->length < b->length ? a->length : b->length);
+	if (result != 0)
+		return result;
+	return a->length < b->length ? -1 : a->length > b->length ? 1 : 0;
+}
+
+static int
+compare_strings(const void* in_a, const void* in_b)
+{
+	return strcmp(*(const char**)in_a, *(const char**)in_b);
+}
+
+static bool
+check_crc(struct stream* stream, int64_t offset, const void* data, size_t size)
+{
+	// note: a CRC can only be computed from the start of the file onward, so data read
+	//       out of order isn't checked.  once everything up to the end has gone through,
+	//       the result is compared against the one in the package.
+
+	const struct spk_entry* entry;
+
+	entry = stream->entry;
+	if (!entry->has_crc || offset != stream->checked_size || size == 0)
+		return true;
+	stream->crc = checksum(stream->crc, data, size);
+	stream->checked_size += size;
+	if (stream->checked_size < (int64_t)entry->file_size || stream->crc == entry->crc)
+		return true;
+	console_log(3, "checksum mismatch for '%s' in package #%u", entry->file_path, stream->package->id);
+	return false;
+}
+
+static uint32_t
+checksum(uint32_t crc, const uint8_t* data, size_t size)
+{
+	size_t chunk_size;
+
+	while (size > 0) {
+		chunk_size = size < 0x40000000 ? size : 0x40000000;
+		crc = (uint32_t)crc32(crc, data, (uInt)chunk_size);
+		data += chunk_size;
+		size -= chunk_size;
+	}
+	return crc;
+}
+
+static bool
+decode_block(package_t* package, const struct spk_entry* entry, const uint64_t* block_table, int64_t index, uint8_t* out_data, uint8_t* scratch)
+{
+	// note: 'scratch' is only needed when the package isn't memory-mapped.  it must be at
+	//       least compressBound(block_size) bytes.
+
+	uLongf         out_size;
+	const uint8_t* pack_data;
+	size_t         pack_size;
+	size_t         size;
+
+	size = entry->file_size - index * package->block_size;
+	if (size > package->block_size)
+		size = package->block_size;
+	pack_size = (size_t)(block_table[index + 1] - block_table[index]);
+	if (package->data != NULL) {
+		pack_data = package->data + block_table[index];
+	}
+	else {
+		if (!read_data(package, block_table[index], scratch, pack_size))
+			return false;
+		pack_data = scratch;
+	}
+	if (pack_size == size) {
+		// block didn't compress, it's stored as-is
+		memcpy(out_data, pack_data, size);
+		return true;
+	}
+	out_size = (uLongf)size;
+	return uncompress(out_data, &out_size, pack_data, (uLong)pack_size) == Z_OK
+		&& out_size == size;
+}
+
+static int
+find_dir(const package_t* package, const char* path, size_t length)
+{
+	struct spk_dir* dir;
+	int             dir_index;
+	uint32_t        slot;
+
+	slot = hash_name(path, length, false) & (package->table_size - 1);
+	while ((dir_index = package->dir_table[slot]) >= 0) {
+		dir = vector_get(package->dirs, dir_index);
+		if (dir->path_len == length && memcmp(dir->path, path, length) == 0)
+			return dir_index;
+		slot = (slot + 1) & (package->table_size - 1);
+	}
+	return -1;
+}
+
+static const struct spk_entry*
+find_file(const package_t* package, const char* path, bool ignore_case)
+{
+	// note: the file table is always hashed case-insensitively so that the same table
+	//       can serve both kinds of lookups.
+
+	struct spk_entry* entry;
+	int               index;
+	uint32_t          slot;
+
+	slot = hash_name(path, strlen(path), true) & (package->table_size - 1);
+	while ((index = package->file_table[slot]) >= 0) {
+		entry = vector_get(package->index, index);
+		if (ignore_case ? strcasecmp(entry->file_path, path) == 0
+			: strcmp(entry->file_path, path) == 0)
+		{
+			return entry;
+		}
+		slot = (slot + 1) & (package->table_size - 1);
+	}
+	return NULL;
+}
+
+static uint32_t
+hash_name(const char* name, size_t length, bool ignore_case)
+{
+	// FNV-1a
+	uint8_t  ch;
+	uint32_t hash = 2166136261u;
+
+	size_t i;
+
+	for (i = 0; i < length; ++i) {
+		ch = (uint8_t)name[i];
+		if (ignore_case && ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		hash ^= ch;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t
+inflate_entry(struct stream* stream, void* buffer, size_t size)
+{
+	const struct spk_entry* entry;
+	size_t                  in_size;
+	package_t*              package;
+	int                     result;
+
+	package = stream->package;
+	entry = stream->entry;
+	stream->z_stream.next_out = buffer;
+	stream->z_stream.avail_out = (uInt)size;
+	while (stream->z_stream.avail_out > 0) {
+		if (stream->z_stream.avail_in == 0 && stream->in_offset < entry->pack_size) {
+			// feed the inflater more compressed data.  for a mapped package it gets
+			// everything that's left in one go.
+			in_size = entry->pack_size - stream->in_offset;
+			if (package->data != NULL) {
+				stream->z_stream.next_in = (Bytef*)package->data + entry->offset + stream->in_offset;
+			}
+			else {
+				if (in_size > 65536)
+					in_size = 65536;
+				al_fseek(package->file, entry->offset + stream->in_offset, ALLEGRO_SEEK_SET);
+				in_size = al_fread(package->file, stream->in_buffer, in_size);
+				stream->z_stream.next_in = stream->in_buffer;
+			}
+			if (in_size > UINT_MAX)
+				in_size = UINT_MAX;
+			stream->z_stream.avail_in = (uInt)in_size;
+			stream->in_offset += in_size;
+		}
+		result = inflate(&stream->z_stream, Z_NO_FLUSH);
+		if (result == Z_STREAM_END)
+			break;
+		if (result != Z_OK) {
+			stream->has_error = true;
+			break;
+		}
+	}
+	size -= stream->z_stream.avail_out;
+	stream->inflate_pos += size;
+	if (!check_crc(stream, stream->inflate_pos - size, buffer, size)) {
+		stream->has_error = true;
+		return 0;
+	}
+	return size;
+}
+
+static bool
+map_package(package_t* package, const char* filename)
+{
+#if defined(_WIN32)
+	void*         data;
+	HANDLE        file;
+	LARGE_INTEGER file_size;
+	HANDLE        mapping;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0 || (uint64_t)file_size.QuadPart > SIZE_MAX) {
+		CloseHandle(file);
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+		return false;
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);  // the view keeps the mapping alive
+	if (data == NULL)
+		return false;
+	package->data = data;
+	package->data_size = (size_t)file_size.QuadPart;
+	return true;
+#else
+	void*       data;
+	int         fd;
+	struct stat stats;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return false;
+	if (fstat(fd, &stats) != 0 || stats.st_size == 0 || (uint64_t)stats.st_size > SIZE_MAX) {
+		close(fd);
+		return false;
+	}
+	data = mmap(NULL, (size_t)stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  // the mapping stays valid after the file is closed
+	if (data == MAP_FAILED)
+		return false;
+	package->data = data;
+	package->data_size = (size_t)stats.st_size;
+	return true;
+#endif
+}
+
+static ALLEGRO_FILE*
+open_entry(package_t* package, const struct spk_entry* entry, const char* mode)
+{
+	ALLEGRO_FILE*  file;
+	struct stream* stream;
+
+	if (package->data != NULL && entry->offset + entry->pack_size > package->data_size)
+		return NULL;
+
+	// uncompressed file in a mapped package: no copy needed, read it in place.  it's all
+	// right there, so the checksum can be verified up front.
+	if (package->data != NULL && entry->is_stored) {
+		if (entry->has_crc && checksum(0, package->data + entry->offset, entry->file_size) != entry->crc) {
+			console_log(3, "checksum mismatch for '%s' in package #%u", entry->file_path, package->id);
+			return NULL;
+		}
+		return al_open_memfile((void*)(package->data + entry->offset), entry->file_size, mode);
+	}
+
+	if (!(stream = calloc(1, sizeof(struct stream))))
+		return NULL;
+	stream->package = package;
+	stream->entry = entry;
+	if (entry->num_blocks > 0) {
+		stream->block_index = -1;
+		if (!(stream->block_table = read_block_table(package, entry)))
+			goto on_error;
+		if (!(stream->block_data = malloc(package->block_size)))
+			goto on_error;
+		if (package->data == NULL && !(stream->in_buffer = malloc(compressBound(package->block_size))))
+			goto on_error;
+	}
+	else if (!entry->is_stored) {
+		if (package->data == NULL && !(stream->in_buffer = malloc(65536)))
+			goto on_error;
+		if (inflateInit(&stream->z_stream) != Z_OK)
+			goto on_error;
+	}
+	if (!(file = al_create_file_handle(&STREAM_INTERFACE, stream))) {
+		if (!entry->is_stored && entry->num_blocks == 0)
+			inflateEnd(&stream->z_stream);
+		goto on_error;
+	}
+	return file;
+
+on_error:
+	free(stream->block_data);
+	free(stream->block_table);
+	free(stream->in_buffer);
+	free(stream);
+	return NULL;
+}
+
+static uint64_t*
+read_block_table(package_t* package, const struct spk_entry* entry)
+{
+	// returns the offset of each block within the package, plus one past the end of the
+	// last block, so the packed size of block i is table[i + 1] - table[i].
+
+	uint32_t* block_sizes;
+	uint64_t  end_offset;
+	uint64_t* table;
+
+	uint32_t i;
+
+	if (!(block_sizes = malloc(entry->num_blocks * sizeof(uint32_t))))
+		return NULL;
+	if (!(table = malloc((entry->num_blocks + 1) * sizeof(uint64_t))))
+		goto on_error;
+	if (!read_data(package, entry->offset, block_sizes, entry->num_blocks * sizeof(uint32_t)))
+		goto on_error;
+	end_offset = entry->offset + entry->pack_size;
+	table[0] = entry->offset + entry->num_blocks * sizeof(uint32_t);
+	for (i = 0; i < entry->num_blocks; ++i) {
+		if (block_sizes[i] > compressBound(package->block_size))
+			goto on_error;
+		table[i + 1] = table[i] + block_sizes[i];
+	}
+	if (table[entry->num_blocks] > end_offset)
+		goto on_error;
+	free(block_sizes);
+	return table;
+
+on_error:
+	free(block_sizes);
+	free(table);
+	return NULL;
+}
+
+static bool
+read_data(package_t* package, uint64_t offset, void* buffer, size_t size)
+{
+	if (package->data != NULL) {
+		if (offset > package->data_size || size > package->data_size - offset)
+			return false;
+		memcpy(buffer, package->data + offset, size);
+		return true;
+	}
+	else {
+		if (!al_fseek(package->file, (int64_t)offset, ALLEGRO_SEEK_SET))
+			return false;
+		return al_fread(package->file, buffer, size) == size;
+	}
+}
+
+static bool
+read_name(package_t* package, size_t length, size_t* out_offset)
+{
+	// filenames are all stored back to back in a single string pool rather than in a
+	// separate buffer for each entry, since a large package can have tens of thousands
+	// of them.
+
+	char* new_names;
+
+	while (package->names_size + length + 1 > package->max_names) {
+		package->max_names *= 2;
+		if (!(new_names = realloc(package->names, package->max_names)))
+			return false;
+		package->names = new_names;
+	}
+	if (al_fread(package->file, package->names + package->names_size, length) != length)
+		return false;
+	*out_offset = package->names_size;
+	package->names_size += length;
+	package->names[package->names_size++] = '\0';
+	return true;
+}
+
+static void
+stream_clearerr(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	stream->has_error = false;
+	stream->is_eof = false;
+}
+
+static bool
+stream_close(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	if (!stream->entry->is_stored && stream->entry->num_blocks == 0)
+		inflateEnd(&stream->z_stream);
+	free(stream->block_data);
+	free(stream->block_table);
+	free(stream->in_buffer);
+	free(stream);
+	return true;
+}
+
+static bool
+stream_eof(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	return stream->is_eof;
+}
+
+static int
+stream_error(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	return stream->has_error ? 1 : 0;
+}
+
+static const char*
+stream_errmsg(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	return stream->has_error ? "corrupt package data" : "";
+}
+
+static bool
+stream_flush(ALLEGRO_FILE* file)
+{
+	return true;
+}
+
+static void*
+stream_open(const char* path, const char* mode)
+{
+	// package streams are only ever created by open_entry()
+	return NULL;
+}
+
+static size_t
+stream_read(ALLEGRO_FILE* file, void* buffer, size_t size)
+{
+	size_t                  block_offset;
+	int64_t                 block_index;
+	size_t                  block_size;
+	size_t                  chunk_size;
+	const struct spk_entry* entry;
+	size_t                  num_read = 0;
+	package_t*              package;
+	uint8_t                 scratch[4096];
+	size_t                  skip_size;
+	int64_t                 start;
+	struct stream*          stream;
+
+	stream = al_get_file_userdata(file);
+	package = stream->package;
+	entry = stream->entry;
+	if ((int64_t)size > (int64_t)entry->file_size - stream->position) {
+		size = (size_t)(entry->file_size - stream->position);
+		stream->is_eof = true;
+	}
+	if (size == 0)
+		return 0;
+
+	if (entry->is_stored) {
+		if (!read_data(package, entry->offset + stream->position, buffer, size)
+			|| !check_crc(stream, stream->position, buffer, size))
+		{
+			stream->has_error = true;
+			return 0;
+		}
+		stream->position += size;
+		return size;
+	}
+
+	if (entry->num_blocks > 0) {
+		// only the blocks that are actually read from get inflated, and the last one is
+		// kept around since reads tend to be small and sequential.
+		start = stream->position;
+		while (num_read < size) {
+			block_index = stream->position / package->block_size;
+			if (block_index != stream->block_index) {
+				if (!decode_block(package, entry, stream->block_table, block_index, stream->block_data, stream->in_buffer)) {
+					stream->has_error = true;
+					break;
+				}
+				stream->block_index = block_index;
+			}
+			block_offset = stream->position % package->block_size;
+			block_size = entry->file_size - block_index * package->block_size;
+			if (block_size > package->block_size)
+				block_size = package->block_size;
+			chunk_size = block_size - block_offset;
+			if (chunk_size > size - num_read)
+				chunk_size = size - num_read;
+			memcpy((uint8_t*)buffer + num_read, stream->block_data + block_offset, chunk_size);
+			num_read += chunk_size;
+			stream->position += chunk_size;
+		}
+		if (!check_crc(stream, start, buffer, num_read)) {
+			stream->has_error = true;
+			return 0;
+		}
+		return num_read;
+	}
+
+	// seeks in a deflate stream are only carried out here, when there's something to
+	// read.  deflate streams can't be read backwards, so seeking backwards means
+	// starting over from the beginning.  either way we then inflate our way forward.
+	if (stream->position < stream->inflate_pos) {
+		inflateReset(&stream->z_stream);
+		stream->z_stream.avail_in = 0;
+		stream->in_offset = 0;
+		stream->inflate_pos = 0;
+	}
+	while (stream->inflate_pos < stream->position) {
+		skip_size = stream->position - stream->inflate_pos < (int64_t)sizeof scratch
+			? (size_t)(stream->position - stream->inflate_pos) : sizeof scratch;
+		if (inflate_entry(stream, scratch, skip_size) < skip_size) {
+			stream->has_error = true;
+			return 0;
+		}
+	}
+	size = inflate_entry(stream, buffer, size);
+	stream->position += size;
+	return size;
+}
+
+static bool
+stream_seek(ALLEGRO_FILE* file, int64_t offset, int whence)
+{
+	// note: this only moves the file position.  for a deflate stream, the inflating
+	//       needed to get there is put off until the next read (see stream_read()), so
+	//       seeking to the end to get the size and back again costs nothing.
+
+	struct stream* stream;
+	int64_t        target;
+
+	stream = al_get_file_userdata(file);
+	target = whence == ALLEGRO_SEEK_CUR ? stream->position + offset
+		: whence == ALLEGRO_SEEK_END ? (int64_t)stream->entry->file_size + offset
+		: offset;
+	if (target < 0 || target > (int64_t)stream->entry->file_size)
+		return false;
+	stream->is_eof = false;
+	stream->position = target;
+	return true;
+}
+
+static off_t
+stream_size(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	return (off_t)stream->entry->file_size;
+}
+
+static int64_t
+stream_tell(ALLEGRO_FILE* file)
+{
+	struct stream* stream;
+
+	stream = al_get_file_userdata(file);
+	return stream->position;
+}
+
+static int
+stream_ungetc(ALLEGRO_FILE* file, int c)
+{
+	// note: Allegro handles al_fungetc() itself, so this should never be called.
+	return EOF;
+}
+
+static size_t
+stream_write(ALLEGRO_FILE* file, const void* buffer, size_t size)
+{
+	// package streams are read-only
+	return 0;
+}
+
+static void
+unmap_package(package_t* package)
+{
+	if (package->data == NULL)
+		return;
+#if defined(_WIN32)
+	UnmapViewOfFile(package->data);
+#else
+	munmap((void*)package->data, package->data_size);
+#endif
+	package->data = NULL;
+	package->data_size = 0;
+}
@@ -47,6 +47,8 @@
 #include "input.h"
 #include "jsal.h"
 #include "profiler.h"
+#include "replay.h"
+#include "script.h"
 #include "sockets.h"
 #include "unicode.h"
 #include "xoroshiro.h"
@@ -360,6 +362,7 @@ static bool js_Shader_setInt                 (int num_args, bool is_ctor, intptr
 static bool js_Shader_setIntArray            (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Shader_setIntVector           (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Shader_setMatrix              (int num_args, bool is_ctor, intptr_t magic);
+static bool js_Shader_setUniforms            (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Shape_drawImmediate           (int num_args, bool is_ctor, intptr_t magic);
 static bool js_new_Shape                     (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Shape_get_indexList           (int num_args, bool is_ctor, intptr_t magic);
@@ -435,6 +438,8 @@ static bool js_Transform_rotate              (int num_args, bool is_ctor, intptr
 static bool js_Transform_scale               (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Transform_translate           (int num_args, bool is_ctor, intptr_t magic);
 static bool js_new_VertexList                (int num_args, bool is_ctor, intptr_t magic);
+static bool js_VertexList_get_usage          (int num_args, bool is_ctor, intptr_t magic);
+static bool js_VertexList_update             (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Z_deflate                     (int num_args, bool is_ctor, intptr_t magic);
 static bool js_Z_inflate                     (int num_args, bool is_ctor, intptr_t magic);
 
@@ -471,6 +476,7 @@ static void      jsal_pegasus_push_job_token (int64_t token);
 static void      jsal_pegasus_push_require   (const char* module_id);
 static color_t   jsal_pegasus_require_color  (int index);
 static script_t* jsal_pegasus_require_script (int index);
+static float*    jsal_pegasus_require_vertices (int index, int layout_index, vertex_layout_t *out_layout, int *out_num_vertices);
 static path_t*   load_package_json           (const char* filename);
 
 static int       s_api_level;
@@ -666,6 +672,7 @@ pegasus_init(int api_level)
 	api_define_method("Shader", "setIntArray", js_Shader_setIntArray, 0);
 	api_define_method("Shader", "setIntVector", js_Shader_setIntVector, 0);
 	api_define_method("Shader", "setMatrix", js_Shader_setMatrix, 0);
+	api_define_method("Shader", "setUniforms", js_Shader_setUniforms, 0);
 	api_define_class("Shape", PEGASUS_SHAPE, js_new_Shape, js_Shape_finalize, 0);
 	api_define_property("Shape", "indexList", false, js_Shape_get_indexList, js_Shape_set_indexList);
 	api_define_property("Shape", "texture", false, js_Shape_get_texture, js_Shape_set_texture);
@@ -720,6 +727,8 @@ pegasus_init(int api_level)
 	api_define_method("Transform", "scale", js_Transform_scale, 0);
 	api_define_method("Transform", "translate", js_Transform_translate, 0);
 	api_define_class("VertexList", PEGASUS_VERTEX_LIST, js_new_VertexList, js_VertexList_finalize, 0);
+	api_define_property("VertexList", "usage", false, js_VertexList_get_usage, NULL);
+	api_define_method("VertexList", "update", js_VertexList_update, 0);
 
 	api_define_subclass("Surface", PEGASUS_SURFACE, api_level >= 2 ? PEGASUS_TEXTURE : -1, js_new_Texture, js_Texture_finalize, PEGASUS_SURFACE);
 	api_define_static_prop("Surface", "Screen", js_Surface_get_Screen, NULL);
@@ -1004,7 +1013,7 @@ pegasus_eval_module(const char* filename)
 			strncmp(lstr_cstr(code_string), "#!", 2) == 0 ? "//" : "",  // shebang?
 			lstr_cstr(code_string));
 		lstr_free(code_string);
-		if (!jsal_try_compile(debugger_source_name(filename)))
+		if (!script_compile(debugger_source_name(filename)))
 			goto on_error;
 		jsal_call(0);
 		jsal_push_new_object();
@@ -1112,6 +1121,98 @@ jsal_pegasus_require_script(int index)
 	return script_new_function(index);
 }
 
+static float*
+jsal_pegasus_require_vertices(int index, int layout_index, vertex_layout_t *out_layout, int *out_num_vertices)
+{
+	// note: this accepts either a Float32Array/ArrayBuffer of packed vertex data (with an
+	//       optional layout at 'layout_index', or -1 for none) or an array of vertex
+	//       objects.  in the latter case the vertices are converted to the default layout
+	//       in a new Float32Array which is left on top of the stack.
+
+	const char*     attribute;
+	float*          data;
+	vertex_layout_t layout = { 9, 0, 1, 2, 3, 4, 5 };
+	color_t         color;
+	int             num_attributes;
+	int             num_vertices;
+	int*            p_offset;
+	float*          p_vertex;
+	size_t          size;
+	int             stack_idx;
+
+	int i;
+
+	index = jsal_normalize_index(index);
+	if (jsal_is_buffer(index)) {
+		// fast path: vertices are packed floats, read directly out of the buffer.  the
+		// default layout is [ x, y, z, u, v, r, g, b, a ] which lets us upload the whole
+		// thing in one go.
+		if (!jsal_is_buffer_type(index, JS_FLOAT32ARRAY) && !jsal_is_buffer_type(index, JS_ARRAYBUFFER))
+			jsal_error(JS_TYPE_ERROR, "Expected a Float32Array or ArrayBuffer");
+		if (layout_index >= 0) {
+			jsal_require_array(layout_index);
+			layout.stride = 0;
+			layout.x = layout.y = layout.z = -1;
+			layout.u = layout.v = -1;
+			layout.color = -1;
+			num_attributes = jsal_get_length(layout_index);
+			for (i = 0; i < num_attributes; ++i) {
+				jsal_get_prop_index(layout_index, i);
+				attribute = jsal_require_string(-1);
+				p_offset = strcmp(attribute, "x") == 0 ? &layout.x
+					: strcmp(attribute, "y") == 0 ? &layout.y
+					: strcmp(attribute, "z") == 0 ? &layout.z
+					: strcmp(attribute, "u") == 0 ? &layout.u
+					: strcmp(attribute, "v") == 0 ? &layout.v
+					: strcmp(attribute, "color") == 0 ? &layout.color
+					: NULL;
+				if (p_offset == NULL)
+					jsal_error(JS_RANGE_ERROR, "Invalid vertex attribute '%s'", attribute);
+				if (*p_offset >= 0)
+					jsal_error(JS_RANGE_ERROR, "Duplicate vertex attribute '%s'", attribute);
+				*p_offset = layout.stride;
+				layout.stride += p_offset == &layout.color ? 4 : 1;
+				jsal_pop(1);
+			}
+			if (layout.stride == 0)
+				jsal_error(JS_RANGE_ERROR, "Vertex layout has no attributes");
+		}
+		data = jsal_get_buffer_ptr(index, &size);
+		if (size % (layout.stride * sizeof(float)) != 0)
+			jsal_error(JS_RANGE_ERROR, "Buffer size isn't a multiple of the vertex size");
+		*out_layout = layout;
+		*out_num_vertices = (int)(size / (layout.stride * sizeof(float)));
+		return data;
+	}
+
+	jsal_require_array(index);
+	num_vertices = jsal_get_length(index);
+	jsal_push_new_buffer(JS_FLOAT32ARRAY, num_vertices * layout.stride, (void**)&data);
+	p_vertex = data;
+	for (i = 0; i < num_vertices; ++i) {
+		jsal_get_prop_index(index, i);
+		jsal_require_object_coercible(-1);
+		stack_idx = jsal_normalize_index(-1);
+		p_vertex[0] = jsal_get_prop_key(stack_idx, s_key_x) ? jsal_require_number(-1) : 0.0;
+		p_vertex[1] = jsal_get_prop_key(stack_idx, s_key_y) ? jsal_require_number(-1) : 0.0;
+		p_vertex[2] = jsal_get_prop_key(stack_idx, s_key_z) ? jsal_require_number(-1) : 0.0;
+		p_vertex[3] = jsal_get_prop_key(stack_idx, s_key_u) ? jsal_require_number(-1) : 0.0;
+		p_vertex[4] = jsal_get_prop_key(stack_idx, s_key_v) ? jsal_require_number(-1) : 0.0;
+		color = jsal_get_prop_key(stack_idx, s_key_color)
+			? jsal_pegasus_require_color(-1)
+			: mk_color(255, 255, 255, 255);
+		p_vertex[5] = color.r / 255.0f;
+		p_vertex[6] = color.g / 255.0f;
+		p_vertex[7] = color.b / 255.0f;
+		p_vertex[8] = color.a / 255.0f;
+		jsal_pop(7);
+		p_vertex += layout.stride;
+	}
+	*out_layout = layout;
+	*out_num_vertices = num_vertices;
+	return data;
+}
+
 static void
 cache_value_to_this(const char* key)
 {
@@ -2566,12 +2667,36 @@ js_Font_wordWrap(int num_args, bool is_ctor, intptr_t magic)
 static bool
 js_new_IndexList(int num_args, bool is_ctor, intptr_t magic)
 {
+	void*  data;
 	ibo_t* ibo;
 	int    index;
+	int    index_size;
 	int    num_entries;
+	size_t size;
 
 	int i;
 
+	if (jsal_is_buffer(0)) {
+		// fast path: indices are uploaded directly from the typed array
+		if (jsal_is_buffer_type(0, JS_UINT16ARRAY))
+			index_size = 2;
+		else if (jsal_is_buffer_type(0, JS_UINT32ARRAY))
+			index_size = 4;
+		else
+			jsal_error(JS_TYPE_ERROR, "Expected a Uint16Array or Uint32Array");
+		data = jsal_get_buffer_ptr(0, &size);
+		num_entries = (int)(size / index_size);
+		if (num_entries == 0)
+			jsal_error(JS_RANGE_ERROR, "Empty list is not allowed");
+		ibo = ibo_new();
+		if (!ibo_upload_array(ibo, data, num_entries, index_size)) {
+			ibo_unref(ibo);
+			jsal_error(JS_ERROR, "Couldn't upload IndexList to GPU");
+		}
+		jsal_push_class_obj(PEGASUS_INDEX_LIST, ibo, true);
+		return true;
+	}
+
 	if (!jsal_is_array(0))
 		jsal_error(JS_TYPE_ERROR, "Expected an array as first argument");
 
@@ -3267,6 +3392,71 @@ js_Shader_setMatrix(int num_args, bool is_ctor, intptr_t magic)
 	return false;
 }
 
+static bool
+js_Shader_setUniforms(int num_args, bool is_ctor, intptr_t magic)
+{
+	size_t       buffer_size;
+	color_t*     color;
+	const char*  name;
+	shader_t*    shader;
+	int          size;
+	transform_t* transform;
+	void*        values_ptr;
+	float        values[4];
+
+	int i;
+
+	jsal_push_this();
+	shader = jsal_require_class_obj(-1, PEGASUS_SHADER);
+	jsal_require_object(0);
+
+	jsal_push_new_iterator(0);
+	while (jsal_next(-1)) {
+		name = jsal_get_string(-1);
+		jsal_get_prop_string(0, name);
+		if (jsal_is_boolean(-1)) {
+			shader_put_bool(shader, name, jsal_get_boolean(-1));
+		}
+		else if (jsal_is_number(-1)) {
+			shader_put_float(shader, name, jsal_get_number(-1));
+		}
+		else if ((color = jsal_get_class_obj(-1, PEGASUS_COLOR))) {
+			values[0] = color->r / 255.0;
+			values[1] = color->g / 255.0;
+			values[2] = color->b / 255.0;
+			values[3] = color->a / 255.0;
+			shader_put_float_vector(shader, name, values, 4);
+		}
+		else if ((transform = jsal_get_class_obj(-1, PEGASUS_TRANSFORM))) {
+			shader_put_matrix(shader, name, transform);
+		}
+		else if (jsal_is_buffer_type(-1, JS_FLOAT32ARRAY)) {
+			values_ptr = jsal_get_buffer_ptr(-1, &buffer_size);
+			shader_put_float_array(shader, name, values_ptr, (int)(buffer_size / sizeof(float)));
+		}
+		else if (jsal_is_buffer_type(-1, JS_INT32ARRAY)) {
+			values_ptr = jsal_get_buffer_ptr(-1, &buffer_size);
+			shader_put_int_array(shader, name, values_ptr, (int)(buffer_size / sizeof(int)));
+		}
+		else if (jsal_is_array(-1)) {
+			size = jsal_get_length(-1);
+			if (size < 2 || size > 4)
+				jsal_error(JS_RANGE_ERROR, "Invalid number of components '%d' for uniform '%s'", size, name);
+			for (i = 0; i < size; ++i) {
+				jsal_get_prop_index(-1, i);
+				values[i] = jsal_require_number(-1);
+				jsal_pop(1);
+			}
+			shader_put_float_vector(shader, name, values, size);
+		}
+		else {
+			jsal_error(JS_TYPE_ERROR, "Invalid value for uniform '%s'", name);
+		}
+		jsal_pop(2);
+	}
+	return false;
+}
+
 static bool
 js_Mouse_get_Default(int num_args, bool is_ctor, intptr_t magic)
 {
@@ -3387,7 +3577,7 @@ js_new_RNG(int num_args, bool is_ctor, intptr_t magic)
 {
 	xoro_t* xoro;
 
-	xoro = xoro_new((uint64_t)(al_get_time() * 1000000));
+	xoro = xoro_new(replay_seed((uint64_t)(al_get_time() * 1000000)));
 	jsal_push_class_obj(PEGASUS_RNG, xoro, true);
 	return true;
 }
@@ -3848,7 +4038,7 @@ js_Shape_drawImmediate(int num_args, bool is_ctor, intptr_t magic)
 		bitmap = image_bitmap(texture);
 	image_render_to(surface, NULL);
 	shader_use(galileo_shader(), false);
-	al_draw_prim(vertices, NULL, bitmap, 0, num_entries, draw_mode);
+	galileo_draw_prim(bitmap, vertices, num_entries, draw_mode);
 	return false;
 }
 
@@ -3875,6 +4065,8 @@ js_new_Shape(int num_args, bool is_ctor, intptr_t magic)
 
 	if (type < 0 || type >= SHAPE_MAX)
 		jsal_error(JS_RANGE_ERROR, "Invalid ShapeType constant");
+	if (ibo != NULL && ibo_max_index(ibo) >= vbo_len(vbo))
+		jsal_error(JS_RANGE_ERROR, "Vertex index '%d' out of range for VertexList", ibo_max_index(ibo));
 
 	shape = shape_new(vbo, ibo, type, texture);
 	jsal_push_class_obj(PEGASUS_SHAPE, shape, true);
@@ -3938,12 +4130,17 @@ js_Shape_set_indexList(int num_args, bool is_ctor, intptr_t magic)
 {
 	ibo_t*   ibo = NULL;
 	shape_t* shape;
+	vbo_t*   vbo;
 
 	jsal_push_this();
 	shape = jsal_require_class_obj(-1, PEGASUS_SHAPE);
 	if (!jsal_is_null(0))
 		ibo = jsal_require_class_obj(0, PEGASUS_INDEX_LIST);
 
+	vbo = shape_get_vbo(shape);
+	if (ibo != NULL && ibo_max_index(ibo) >= vbo_len(vbo))
+		jsal_error(JS_RANGE_ERROR, "Vertex index '%d' out of range for VertexList", ibo_max_index(ibo));
+
 	shape_set_ibo(shape, ibo);
 	return false;
 }
@@ -3966,6 +4163,7 @@ js_Shape_set_texture(int num_args, bool is_ctor, intptr_t magic)
 static bool
 js_Shape_set_vertexList(int num_args, bool is_ctor, intptr_t magic)
 {
+	ibo_t*   ibo;
 	shape_t* shape;
 	vbo_t*   vbo;
 
@@ -3973,6 +4171,10 @@ js_Shape_set_vertexList(int num_args, bool is_ctor, intptr_t magic)
 	shape = jsal_require_class_obj(-1, PEGASUS_SHAPE);
 	vbo = jsal_require_class_obj(0, PEGASUS_VERTEX_LIST);
 
+	ibo = shape_get_ibo(shape);
+	if (ibo != NULL && ibo_max_index(ibo) >= vbo_len(vbo))
+		jsal_error(JS_RANGE_ERROR, "Vertex index '%d' out of range for VertexList", ibo_max_index(ibo));
+
 	shape_set_vbo(shape, vbo);
 	return false;
 }
@@ -5151,42 +5353,41 @@ js_Transform_translate(int num_args, bool is_ctor, intptr_t magic)
 static bool
 js_new_VertexList(int num_args, bool is_ctor, intptr_t magic)
 {
-	int      num_entries;
-	int      stack_idx;
-	vbo_t*   vbo;
-	vertex_t vertex;
-
-	int i;
-
-	jsal_require_array(0);
+	float*          data;
+	vertex_layout_t layout;
+	int             layout_index = -1;
+	int             num_entries;
+	int             options_index = 1;
+	vbo_usage_t     usage = VBO_STATIC;
+	const char*     usage_name;
+	vbo_t*          vbo;
+
+	if (jsal_is_buffer(0) && num_args >= 2 && jsal_is_array(1)) {
+		layout_index = 1;
+		options_index = 2;
+	}
+	if (num_args > options_index) {
+		jsal_require_object_coercible(options_index);
+		if (jsal_get_prop_string(options_index, "usage")) {
+			usage_name = jsal_require_string(-1);
+			if (strcmp(usage_name, "static") == 0)
+				usage = VBO_STATIC;
+			else if (strcmp(usage_name, "dynamic") == 0)
+				usage = VBO_DYNAMIC;
+			else if (strcmp(usage_name, "stream") == 0)
+				usage = VBO_STREAM;
+			else
+				jsal_error(JS_RANGE_ERROR, "Invalid VertexList usage '%s'", usage_name);
+		}
+		jsal_pop(1);
+	}
 
-	num_entries = jsal_get_length(0);
+	data = jsal_pegasus_require_vertices(0, layout_index, &layout, &num_entries);
 	if (num_entries == 0)
 		jsal_error(JS_RANGE_ERROR, "Empty list is not allowed");
 
-	vbo = vbo_new();
-	for (i = 0; i < num_entries; ++i) {
-		jsal_get_prop_index(0, i);
-		jsal_require_object_coercible(-1);
-		stack_idx = jsal_normalize_index(-1);
-		vertex.x = jsal_get_prop_key(stack_idx, s_key_x) ? jsal_require_number(-1) : 0.0;
-		vertex.y = jsal_get_prop_key(stack_idx, s_key_y) ? jsal_require_number(-1) : 0.0;
-		vertex.z = jsal_get_prop_key(stack_idx, s_key_z) ? jsal_require_number(-1) : 0.0;
-		if (jsal_get_prop_key(stack_idx, s_key_u))
-			vertex.u = jsal_require_number(-1);
-		else
-			vertex.u = 0;
-		if (jsal_get_prop_key(stack_idx, s_key_v))
-			vertex.v = jsal_require_number(-1);
-		else
-			vertex.v = 0;
-		vertex.color = jsal_get_prop_key(stack_idx, s_key_color)
-			? jsal_pegasus_require_color(-1)
-			: mk_color(255, 255, 255, 255);
-		vbo_add_vertex(vbo, vertex);
-		jsal_pop(7);
-	}
-	if (!vbo_upload(vbo)) {
+	vbo = vbo_new(usage);
+	if (!vbo_upload_array(vbo, data, num_entries, &layout)) {
 		vbo_unref(vbo);
 		jsal_error(JS_ERROR, "Couldn't upload VertexList to GPU");
 	}
@@ -5201,6 +5402,45 @@ js_VertexList_finalize(void* host_ptr)
 	vbo_unref(host_ptr);
 }
 
+static bool
+js_VertexList_get_usage(int num_args, bool is_ctor, intptr_t magic)
+{
+	vbo_usage_t usage;
+	vbo_t*      vbo;
+
+	jsal_push_this();
+	vbo = jsal_require_class_obj(-1, PEGASUS_VERTEX_LIST);
+
+	usage = vbo_usage(vbo);
+	jsal_push_string(usage == VBO_STREAM ? "stream"
+		: usage == VBO_DYNAMIC ? "dynamic"
+		: "static");
+	return true;
+}
+
+static bool
+js_VertexList_update(int num_args, bool is_ctor, intptr_t magic)
+{
+	float*          data;
+	vertex_layout_t layout;
+	int             num_vertices;
+	int             offset;
+	vbo_t*          vbo;
+
+	jsal_push_this();
+	vbo = jsal_require_class_obj(-1, PEGASUS_VERTEX_LIST);
+	offset = jsal_require_int(0);
+	data = jsal_pegasus_require_vertices(1, num_args >= 3 ? 2 : -1, &layout, &num_vertices);
+
+	if (vbo_usage(vbo) == VBO_STATIC)
+		jsal_error(JS_TYPE_ERROR, "VertexList was not created with 'dynamic' or 'stream' usage");
+	if (offset < 0 || offset + num_vertices > vbo_len(vbo))
+		jsal_error(JS_RANGE_ERROR, "Update is out of bounds for VertexList");
+	if (!vbo_update(vbo, offset, data, num_vertices, &layout))
+		jsal_error(JS_ERROR, "Couldn't update VertexList on GPU");
+	return false;
+}
+
 static bool
 js_Z_deflate(int num_args, bool is_ctor, intptr_t magic)
 {
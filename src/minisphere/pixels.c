@@ -0,0 +1,231 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "minisphere.h"
+#include "pixels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXELS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(PIXELS_USE_SSE2)
+struct fx_sse2
+{
+	__m128  col_r;
+	__m128  col_g;
+	__m128  col_b;
+	__m128  col_a;
+	__m128  divisor;
+	__m128i offset;
+};
+
+static bool    fx_is_exact_in_float (color_fx_t matrix);
+static void    fx_row_sse2          (color_t* row, int width, const struct fx_sse2* fx, color_fx_t matrix);
+static __m128i fx_pixel_sse2        (__m128i pixel, const struct fx_sse2* fx);
+#endif
+
+void
+pixels_apply_color_fx(color_t* pixels, ptrdiff_t pitch, int width, int height, color_fx_t matrix)
+{
+#if defined(PIXELS_USE_SSE2)
+	struct fx_sse2 fx;
+#endif
+	color_t* pixel;
+	color_t* row;
+
+	int x, y;
+
+#if defined(PIXELS_USE_SSE2)
+	if (fx_is_exact_in_float(matrix)) {
+		fx.col_r = _mm_setr_ps(matrix.rr, matrix.gr, matrix.br, 0.0f);
+		fx.col_g = _mm_setr_ps(matrix.rg, matrix.gg, matrix.bg, 0.0f);
+		fx.col_b = _mm_setr_ps(matrix.rb, matrix.gb, matrix.bb, 0.0f);
+		fx.col_a = _mm_setr_ps(0.0f, 0.0f, 0.0f, 255.0f);
+		fx.divisor = _mm_set1_ps(255.0f);
+		fx.offset = _mm_setr_epi32(matrix.rn, matrix.gn, matrix.bn, 0);
+		for (y = 0, row = pixels; y < height; ++y, row += pitch)
+			fx_row_sse2(row, width, &fx, matrix);
+		return;
+	}
+#endif
+
+	for (y = 0, row = pixels; y < height; ++y, row += pitch) {
+		for (x = 0, pixel = row; x < width; ++x, ++pixel)
+			*pixel = color_transform(*pixel, matrix);
+	}
+}
+
+void
+pixels_apply_color_fx_4(color_t* pixels, ptrdiff_t pitch, int width, int height, color_fx_t ul_mat, color_fx_t ur_mat, color_fx_t ll_mat, color_fx_t lr_mat)
+{
+	// this is bilinear interpolation, but with matrices.  two thirds of the work
+	// is done once per row, giving us two color matrices which are then blended
+	// for each pixel in the row.
+
+	color_fx_t mat_1, mat_2, mat_3;
+	color_t*   pixel;
+	color_t*   row;
+
+	int x, y;
+
+	for (y = 0, row = pixels; y < height; ++y, row += pitch) {
+		mat_1 = color_fx_mix(ul_mat, ll_mat, height - 1 - y, y);
+		mat_2 = color_fx_mix(ur_mat, lr_mat, height - 1 - y, y);
+		for (x = 0, pixel = row; x < width; ++x, ++pixel) {
+			mat_3 = color_fx_mix(mat_1, mat_2, width - 1 - x, x);
+			*pixel = color_transform(*pixel, mat_3);
+		}
+	}
+}
+
+void
+pixels_apply_lookup(color_t* pixels, ptrdiff_t pitch, int width, int height, const uint8_t red_lu[256], const uint8_t green_lu[256], const uint8_t blue_lu[256], const uint8_t alpha_lu[256])
+{
+	color_t* pixel;
+	color_t* row;
+
+	int x, y;
+
+	// note: there's no gather instruction before AVX2, so table lookups don't
+	//       vectorize.  walking the pixels in memory order is the big win here.
+	for (y = 0, row = pixels; y < height; ++y, row += pitch) {
+		for (x = 0, pixel = row; x < width; ++x, ++pixel) {
+			pixel->r = red_lu[pixel->r];
+			pixel->g = green_lu[pixel->g];
+			pixel->b = blue_lu[pixel->b];
+			pixel->a = alpha_lu[pixel->a];
+		}
+	}
+}
+
+void
+pixels_replace_color(color_t* pixels, ptrdiff_t pitch, int width, int height, color_t color, color_t new_color)
+{
+#if defined(PIXELS_USE_SSE2)
+	__m128i  in_pixels;
+	__m128i  key;
+	__m128i  mask;
+	__m128i  replacement;
+	uint32_t value;
+#endif
+	color_t* pixel;
+	color_t* row;
+
+	int x, y;
+
+#if defined(PIXELS_USE_SSE2)
+	memcpy(&value, &color, sizeof(uint32_t));
+	key = _mm_set1_epi32((int)value);
+	memcpy(&value, &new_color, sizeof(uint32_t));
+	replacement = _mm_set1_epi32((int)value);
+#endif
+
+	for (y = 0, row = pixels; y < height; ++y, row += pitch) {
+		x = 0;
+#if defined(PIXELS_USE_SSE2)
+		for (; x + 4 <= width; x += 4) {
+			in_pixels = _mm_loadu_si128((const __m128i*)&row[x]);
+			mask = _mm_cmpeq_epi32(in_pixels, key);
+			in_pixels = _mm_or_si128(_mm_and_si128(mask, replacement), _mm_andnot_si128(mask, in_pixels));
+			_mm_storeu_si128((__m128i*)&row[x], in_pixels);
+		}
+#endif
+		for (pixel = &row[x]; x < width; ++x, ++pixel) {
+			if (pixel->r == color.r && pixel->g == color.g && pixel->b == color.b && pixel->a == color.a)
+				*pixel = new_color;
+		}
+	}
+}
+
+#if defined(PIXELS_USE_SSE2)
+static bool
+fx_is_exact_in_float(color_fx_t matrix)
+{
+	// the SSE2 kernel does the matrix multiply in single precision, which only
+	// gives the same result as color_transform() as long as the intermediate
+	// sums are exactly representable.  that holds when no row of the matrix can
+	// produce a sum larger than 255 * 32768 (< 2^23), which covers any sane
+	// color matrix.
+	return abs(matrix.rr) + abs(matrix.rg) + abs(matrix.rb) <= 32768
+		&& abs(matrix.gr) + abs(matrix.gg) + abs(matrix.gb) <= 32768
+		&& abs(matrix.br) + abs(matrix.bg) + abs(matrix.bb) <= 32768;
+}
+
+static void
+fx_row_sse2(color_t* row, int width, const struct fx_sse2* fx, color_fx_t matrix)
+{
+	__m128i hi_pixels;
+	__m128i in_pixels;
+	__m128i lo_pixels;
+	__m128i out_pixels[4];
+	__m128i zero;
+
+	int x;
+
+	zero = _mm_setzero_si128();
+	for (x = 0; x + 4 <= width; x += 4) {
+		// widen four RGBA8 pixels to four vectors of 32-bit channels, transform
+		// each one, then narrow back down.  the saturating packs take care of
+		// clamping to [0,255] for us.
+		in_pixels = _mm_loadu_si128((const __m128i*)&row[x]);
+		lo_pixels = _mm_unpacklo_epi8(in_pixels, zero);
+		hi_pixels = _mm_unpackhi_epi8(in_pixels, zero);
+		out_pixels[0] = fx_pixel_sse2(_mm_unpacklo_epi16(lo_pixels, zero), fx);
+		out_pixels[1] = fx_pixel_sse2(_mm_unpackhi_epi16(lo_pixels, zero), fx);
+		out_pixels[2] = fx_pixel_sse2(_mm_unpacklo_epi16(hi_pixels, zero), fx);
+		out_pixels[3] = fx_pixel_sse2(_mm_unpackhi_epi16(hi_pixels, zero), fx);
+		lo_pixels = _mm_packs_epi32(out_pixels[0], out_pixels[1]);
+		hi_pixels = _mm_packs_epi32(out_pixels[2], out_pixels[3]);
+		_mm_storeu_si128((__m128i*)&row[x], _mm_packus_epi16(lo_pixels, hi_pixels));
+	}
+	for (; x < width; ++x)
+		row[x] = color_transform(row[x], matrix);
+}
+
+static __m128i
+fx_pixel_sse2(__m128i pixel, const struct fx_sse2* fx)
+{
+	__m128 sum;
+	__m128 value;
+
+	value = _mm_cvtepi32_ps(pixel);
+	sum = _mm_mul_ps(_mm_shuffle_ps(value, value, _MM_SHUFFLE(0, 0, 0, 0)), fx->col_r);
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 1, 1, 1)), fx->col_g));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 2, 2, 2)), fx->col_b));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3)), fx->col_a));
+
+	// note: a true division (rather than multiplying by 1/255) plus truncation
+	//       matches the integer division done by color_transform() exactly.
+	return _mm_add_epi32(_mm_cvttps_epi32(_mm_div_ps(sum, fx->divisor)), fx->offset);
+}
+#endif
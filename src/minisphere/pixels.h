@@ -0,0 +1,47 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef SPHERE__PIXELS_H__INCLUDED
+#define SPHERE__PIXELS_H__INCLUDED
+
+#include "color.h"
+
+// note: these kernels operate on a rectangular region of 32-bit RGBA pixels.
+//       `pixels` points to the upper-left pixel of the region and `pitch` is the
+//       distance between rows, in pixels (it may be negative).
+
+void pixels_apply_color_fx   (color_t* pixels, ptrdiff_t pitch, int width, int height, color_fx_t matrix);
+void pixels_apply_color_fx_4 (color_t* pixels, ptrdiff_t pitch, int width, int height, color_fx_t ul_mat, color_fx_t ur_mat, color_fx_t ll_mat, color_fx_t lr_mat);
+void pixels_apply_lookup     (color_t* pixels, ptrdiff_t pitch, int width, int height, const uint8_t red_lu[256], const uint8_t green_lu[256], const uint8_t blue_lu[256], const uint8_t alpha_lu[256]);
+void pixels_replace_color    (color_t* pixels, ptrdiff_t pitch, int width, int height, color_t color, color_t new_color);
+
+#endif // SPHERE__PIXELS_H__INCLUDED
@@ -35,9 +35,21 @@
 
 #include "jsal.h"
 #include "table.h"
+#include "thread.h"
 
-#define TIME_PRECISION 1.0e6    // microseconds
-#define UNIT_NAME      "us"
+#define MAX_PHASES      16
+#define SAMPLE_INTERVAL 0.001  // 1 ms
+#define TIME_PRECISION  1.0e6  // microseconds
+#define UNIT_NAME       "us"
+
+#define FOLDED_FILENAME "profile.folded"
+#define TRACE_FILENAME  "profile.json"
+
+struct phase
+{
+	const char* name;
+	bool        runs_js;
+};
 
 struct record
 {
@@ -48,22 +60,68 @@ struct record
 	double    total_cost;
 };
 
+struct sample
+{
+	int    stack_id;
+	double time;
+};
+
+struct stack
+{
+	int   num_samples;
+	char* text;
+};
+
 static bool js_instrumentedWrapper (int num_args, bool is_ctor, intptr_t magic);
 
-static int  order_records (const void* a_ptr, const void* b_ptr);
-static void print_results (double running_time);
+static void      add_sample        (const char* text, double time, int weight);
+static js_step_t on_sample_break   (void);
+static int       order_records     (const void* a_ptr, const void* b_ptr);
+static int       order_samples     (const void* a_ptr, const void* b_ptr);
+static char*     phase_path        (void);
+static void      print_results     (double running_time);
+static void      run_sampler       (void* udata);
+static vector_t* split_stack       (const char* text);
+static void      write_folded      (const char* filename);
+static void      write_json_string (FILE* file, const char* string);
+static void      write_trace       (const char* filename);
 
 bool      s_initialized = false;
 vector_t* s_records;
 double    s_startup_time;
 
+static mutex_t*     s_mutex;
+static int          s_num_pending = 0;
+static int          s_num_phases = 0;
+static struct phase s_phases[MAX_PHASES];
+static vector_t*    s_samples;
+static bool         s_sampling = false;
+static thread_t*    s_sampler_thread;
+static vector_t*    s_stacks;
+
 void
 profiler_init(void)
 {
 	s_records = vector_new(sizeof(struct record));
+	s_samples = vector_new(sizeof(struct sample));
+	s_stacks = vector_new(sizeof(struct stack));
+	s_mutex = mutex_new();
+	s_num_pending = 0;
+	s_num_phases = 0;
 	s_initialized = true;
 
 	s_startup_time = al_get_time();
+
+	// note: ChakraCore will only hand over a stack trace while the debugger is
+	//       stopped, so each sample is taken by asking the runtime to break at the
+	//       next statement and walking the stack from the break callback.  this
+	//       means running with debugging enabled, which turns off the JIT, so the
+	//       absolute numbers will be inflated.  the relative costs are still good.
+	s_sampling = jsal_debug_init(on_sample_break);
+	if (s_sampling)
+		s_sampler_thread = thread_new(run_sampler, NULL);
+	else
+		fprintf(stderr, "couldn't start the sampling profiler, only instrumented functions will be profiled\n");
 }
 
 void
@@ -72,11 +130,23 @@ profiler_uninit(void)
 	struct record* record;
 	struct record  record_obj;
 	double         runtime;
+	struct stack*  stack;
+	bool           was_sampling;
 
 	iter_t iter;
 
 	runtime = al_get_time() - s_startup_time;
 
+	mutex_lock(s_mutex);
+	was_sampling = s_sampling;
+	s_sampling = false;
+	mutex_unlock(s_mutex);
+	if (was_sampling) {
+		thread_join(s_sampler_thread);
+		jsal_debug_uninit();
+	}
+	s_initialized = false;
+
 	record_obj.name = strdup("[event loop - idle]");
 	record_obj.num_hits = g_tick_count;
 	record_obj.total_cost = g_idle_time;
@@ -84,13 +154,26 @@ profiler_uninit(void)
 	vector_push(s_records, &record_obj);
 
 	print_results(runtime);
+	if (was_sampling && vector_len(s_samples) > 0) {
+		vector_sort(s_samples, order_samples);
+		write_folded(FOLDED_FILENAME);
+		write_trace(TRACE_FILENAME);
+		printf("%d samples written to '%s' (flame graph) and '%s' (trace)\n",
+			vector_len(s_samples), FOLDED_FILENAME, TRACE_FILENAME);
+	}
 
 	iter = vector_enum(s_records);
 	while ((record = iter_next(&iter))) {
 		jsal_unref(record->function);
 		free(record->name);
 	}
+	iter = vector_enum(s_stacks);
+	while ((stack = iter_next(&iter)))
+		free(stack->text);
 	vector_free(s_records);
+	vector_free(s_samples);
+	vector_free(s_stacks);
+	mutex_free(s_mutex);
 }
 
 bool
@@ -119,6 +202,148 @@ profiler_attach_to(js_ref_t* function, const char* description)
 	return shim_ref;
 }
 
+void
+profiler_enter_phase(const char* name, bool runs_js)
+{
+	if (!s_initialized)
+		return;
+
+	mutex_lock(s_mutex);
+	if (s_num_phases < MAX_PHASES) {
+		s_phases[s_num_phases].name = name;
+		s_phases[s_num_phases].runs_js = runs_js;
+	}
+	++s_num_phases;
+	mutex_unlock(s_mutex);
+}
+
+void
+profiler_leave_phase(void)
+{
+	char* path;
+
+	if (!s_initialized)
+		return;
+
+	mutex_lock(s_mutex);
+
+	// if the phase ended before the runtime got around to breaking, there's no
+	// JS stack to go with the pending samples.  charge them to the phase itself.
+	if (s_num_pending > 0) {
+		path = phase_path();
+		add_sample(path, al_get_time(), s_num_pending);
+		s_num_pending = 0;
+		free(path);
+	}
+	if (s_num_phases > 0)
+		--s_num_phases;
+	mutex_unlock(s_mutex);
+}
+
+static void
+add_sample(const char* text, double time, int weight)
+{
+	// note: the caller must be holding `s_mutex`.
+
+	struct sample sample;
+	struct stack* stack;
+	struct stack  stack_obj;
+	int           i;
+
+	// the same stack tends to be sampled many times in a row, so search backwards
+	// from the most recently added one.
+	sample.stack_id = -1;
+	for (i = vector_len(s_stacks) - 1; i >= 0; --i) {
+		stack = vector_get(s_stacks, i);
+		if (strcmp(stack->text, text) == 0) {
+			sample.stack_id = i;
+			break;
+		}
+	}
+	if (sample.stack_id < 0) {
+		stack_obj.num_samples = 0;
+		stack_obj.text = strdup(text);
+		vector_push(s_stacks, &stack_obj);
+		sample.stack_id = vector_len(s_stacks) - 1;
+	}
+	stack = vector_get(s_stacks, sample.stack_id);
+	stack->num_samples += weight;
+	sample.time = time;
+	vector_push(s_samples, &sample);
+}
+
+static js_step_t
+on_sample_break(void)
+{
+	char*       frame;
+	const char* function_name;
+	int         num_frames;
+	char*       p;
+	char*       path;
+	char*       text;
+	double      time;
+	int         weight;
+
+	int i;
+
+	time = al_get_time();
+
+	mutex_lock(s_mutex);
+	weight = s_num_pending;
+	s_num_pending = 0;
+	path = weight > 0 ? phase_path() : NULL;
+	mutex_unlock(s_mutex);
+
+	// breaks we didn't ask for (`debugger` statements, uncaught exceptions) don't
+	// count as samples.
+	if (weight <= 0)
+		return JS_STEP_CONTINUE;
+
+	// the innermost call comes first in the backtrace but collapsed stacks are
+	// written outermost first, so each frame gets prepended to the ones before it.
+	// the whole backtrace is fetched at once; inspecting each call separately would
+	// ask the debugger for the full stack every time.
+	text = NULL;
+	num_frames = jsal_debug_inspect_backtrace();
+	for (i = 0; i < num_frames; ++i) {
+		jsal_get_prop_index(-1, i);
+		jsal_get_prop_string(-1, "name");
+		jsal_get_prop_string(-2, "filename");
+		function_name = jsal_get_string(-2);
+		if (function_name == NULL || function_name[0] == '\0')
+			function_name = "(anonymous)";
+		frame = strnewf("%s (%s)", function_name, jsal_get_string(-1));
+		jsal_pop(3);
+		for (p = frame; *p != '\0'; ++p) {
+			if (*p == ';')  // reserved as the frame separator
+				*p = ',';
+		}
+		if (text != NULL) {
+			p = strnewf("%s;%s", frame, text);
+			free(text);
+			text = p;
+			free(frame);
+		}
+		else {
+			text = frame;
+		}
+	}
+	if (num_frames >= 0)
+		jsal_pop(1);
+	if (text != NULL) {
+		p = strnewf("%s;%s", path, text);
+		free(text);
+		text = p;
+	}
+
+	mutex_lock(s_mutex);
+	add_sample(text != NULL ? text : path, time, weight);
+	mutex_unlock(s_mutex);
+	free(path);
+	free(text);
+	return JS_STEP_CONTINUE;
+}
+
 static int
 order_records(const void* a_ptr, const void* b_ptr)
 {
@@ -132,6 +357,41 @@ order_records(const void* a_ptr, const void* b_ptr)
 		: 0;
 }
 
+static int
+order_samples(const void* a_ptr, const void* b_ptr)
+{
+	const struct sample* a;
+	const struct sample* b;
+
+	a = a_ptr;
+	b = b_ptr;
+	return a->time > b->time ? 1
+		: a->time < b->time ? -1
+		: 0;
+}
+
+static char*
+phase_path(void)
+{
+	// note: the caller must be holding `s_mutex`.
+
+	int   depth;
+	char* path;
+	char* new_path;
+	int   i;
+
+	depth = s_num_phases < MAX_PHASES ? s_num_phases : MAX_PHASES;
+	if (depth == 0)
+		return strdup("[engine]");
+	path = strnewf("[%s]", s_phases[0].name);
+	for (i = 1; i < depth; ++i) {
+		new_path = strnewf("%s;[%s]", path, s_phases[i].name);
+		free(path);
+		path = new_path;
+	}
+	return path;
+}
+
 static void
 print_results(double running_time)
 {
@@ -188,6 +448,171 @@ print_results(double running_time)
 	free(heading);
 }
 
+static void
+run_sampler(void* udata)
+{
+	char*         path;
+	struct phase* phase;
+
+	while (true) {
+		thread_sleep(SAMPLE_INTERVAL);
+		mutex_lock(s_mutex);
+		if (!s_sampling) {
+			mutex_unlock(s_mutex);
+			break;
+		}
+		phase = s_num_phases > 0 && s_num_phases <= MAX_PHASES
+			? &s_phases[s_num_phases - 1] : NULL;
+		if (phase != NULL && phase->runs_js) {
+			// JavaScript might be running, so the stack has to be captured on the
+			// main thread.  only one break needs to be in flight at a time; if the
+			// runtime is slow to respond, the sample is weighted to make up for it.
+			if (s_num_pending++ == 0)
+				jsal_debug_breakpoint_inject();
+		}
+		else {
+			path = phase_path();
+			add_sample(path, al_get_time(), 1);
+			free(path);
+		}
+		mutex_unlock(s_mutex);
+	}
+}
+
+static vector_t*
+split_stack(const char* text)
+{
+	char*       frame;
+	vector_t*   frames;
+	const char* next;
+	size_t      length;
+
+	frames = vector_new(sizeof(char*));
+	while (true) {
+		next = strchr(text, ';');
+		length = next != NULL ? next - text : strlen(text);
+		frame = malloc(length + 1);
+		memcpy(frame, text, length);
+		frame[length] = '\0';
+		vector_push(frames, &frame);
+		if (next == NULL)
+			break;
+		text = next + 1;
+	}
+	return frames;
+}
+
+static void
+write_folded(const char* filename)
+{
+	// the collapsed stack format is one line per unique stack: frames from
+	// outermost to innermost, separated by semicolons, followed by a sample count.
+	// this is what flamegraph.pl and speedscope expect.
+
+	FILE*         file;
+	struct stack* stack;
+
+	iter_t iter;
+
+	if (!(file = fopen(filename, "w"))) {
+		fprintf(stderr, "couldn't write profiler output to '%s'\n", filename);
+		return;
+	}
+	iter = vector_enum(s_stacks);
+	while ((stack = iter_next(&iter))) {
+		if (stack->num_samples > 0)
+			fprintf(file, "%s %d\n", stack->text, stack->num_samples);
+	}
+	fclose(file);
+}
+
+static void
+write_json_string(FILE* file, const char* string)
+{
+	const char* p;
+
+	fputc('"', file);
+	for (p = string; *p != '\0'; ++p) {
+		if (*p == '"' || *p == '\\')
+			fprintf(file, "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			fprintf(file, "\\u%04x", (unsigned char)*p);
+		else
+			fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+static void
+write_trace(const char* filename)
+{
+	// samples are converted to Chrome trace events (the format understood by
+	// about:tracing, Perfetto and speedscope) by treating each sampled stack as
+	// lasting until the next sample.  frames shared with the previous stack stay
+	// open; the rest are closed and reopened.
+
+	FILE*          file;
+	char**         frame;
+	vector_t*      frames;
+	bool           is_first = true;
+	int            num_common;
+	vector_t*      open_frames;
+	struct sample* sample;
+	struct stack*  stack;
+	double         time = 0.0;
+	int            i;
+
+	iter_t frame_iter;
+	iter_t iter;
+
+	if (!(file = fopen(filename, "w"))) {
+		fprintf(stderr, "couldn't write profiler output to '%s'\n", filename);
+		return;
+	}
+	fprintf(file, "{\"traceEvents\":[");
+	open_frames = vector_new(sizeof(char*));
+	iter = vector_enum(s_samples);
+	while ((sample = iter_next(&iter))) {
+		stack = vector_get(s_stacks, sample->stack_id);
+		frames = split_stack(stack->text);
+		time = (sample->time - s_startup_time) * TIME_PRECISION;
+		num_common = 0;
+		while (num_common < vector_len(frames) && num_common < vector_len(open_frames)
+			&& strcmp(*(char**)vector_get(frames, num_common), *(char**)vector_get(open_frames, num_common)) == 0)
+		{
+			++num_common;
+		}
+		for (i = vector_len(open_frames) - 1; i >= num_common; --i) {
+			fprintf(file, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":%.1f}", is_first ? "" : ",", time);
+			is_first = false;
+		}
+		for (i = num_common; i < vector_len(frames); ++i) {
+			frame = vector_get(frames, i);
+			fprintf(file, "%s\n{\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":%.1f,\"name\":", is_first ? "" : ",", time);
+			write_json_string(file, *frame);
+			fprintf(file, "}");
+			is_first = false;
+		}
+		frame_iter = vector_enum(open_frames);
+		while ((frame = iter_next(&frame_iter)))
+			free(*frame);
+		vector_free(open_frames);
+		open_frames = frames;
+	}
+
+	// the last sample accounts for one sampling interval.
+	time += SAMPLE_INTERVAL * TIME_PRECISION;
+	for (i = vector_len(open_frames) - 1; i >= 0; --i) {
+		frame = vector_get(open_frames, i);
+		free(*frame);
+		fprintf(file, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":%.1f}", is_first ? "" : ",", time);
+		is_first = false;
+	}
+	vector_free(open_frames);
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(file);
+}
+
 static bool
 js_instrumentedWrapper(int num_args, bool is_ctor, intptr_t magic)
 {
@@ -0,0 +1,522 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "minisphere.h"
+#include "replay.h"
+
+#include "vector.h"
+
+#define REPLAY_SIGNATURE "miniSphere replay v2"
+
+enum key_type
+{
+	KEY_EVENT_DOWN,
+	KEY_EVENT_UP,
+	KEY_EVENT_CHAR,
+	KEY_EVENT_SWITCH_OUT,
+};
+
+struct key_event
+{
+	int           frame;
+	int           poll;
+	enum key_type type;
+	int           keycode;
+	int           modifiers;
+};
+
+struct mouse_sample
+{
+	int  frame;
+	int  poll;
+	int  x;
+	int  y;
+	int  z;
+	int  buttons;
+	bool in_window;
+};
+
+struct run_stats
+{
+	int    num_frames;
+	double p50;
+	double p95;
+	double p99;
+	double wall_time;
+};
+
+static void   finish_run     (void);
+static bool   is_due         (int frame, int poll);
+static int    order_times    (const void* in_a, const void* in_b);
+static double percentile     (const vector_t* sorted_times, double fraction);
+static void   print_results  (void);
+static bool   read_recording (const char* filename);
+static void   start_run      (void);
+
+static vector_t*           s_all_times = NULL;
+static int                 s_end_frame;
+static bool                s_ended;
+static FILE*               s_file = NULL;
+static char*               s_filename = NULL;
+static int                 s_frame = 0;
+static vector_t*           s_frame_times = NULL;
+static vector_t*           s_key_events = NULL;
+static double              s_last_frame_time;
+static struct mouse_sample s_last_mouse;
+static replay_mode_t       s_mode = REPLAY_OFF;
+static vector_t*           s_mouse_samples = NULL;
+static int                 s_next_key;
+static int                 s_next_mouse;
+static int                 s_next_seed;
+static int                 s_num_runs;
+static int                 s_poll = 0;
+static int                 s_run_index;
+static vector_t*           s_run_stats = NULL;
+static double              s_run_start_time;
+static vector_t*           s_seeds = NULL;
+
+bool
+replay_init(replay_mode_t mode, const char* filename, int num_runs)
+{
+	s_mode = mode;
+	if (mode == REPLAY_OFF)
+		return true;
+
+	console_log(1, "initializing session %s", mode == REPLAY_RECORD ? "recorder" : "replay");
+	console_log(1, "    file: %s", filename);
+	s_filename = strdup(filename);
+	if (mode == REPLAY_RECORD) {
+		if (!(s_file = fopen(filename, "w"))) {
+			fprintf(stderr, "ERROR: couldn't open '%s' for recording\n", filename);
+			goto on_error;
+		}
+		fprintf(s_file, "%s\n", REPLAY_SIGNATURE);
+	}
+	else {
+		if (!read_recording(filename))
+			goto on_error;
+		console_log(1, "    length: %d frames", s_end_frame);
+		console_log(1, "    runs: %d", num_runs);
+		s_num_runs = num_runs;
+		s_run_stats = vector_new(sizeof(struct run_stats));
+		s_all_times = vector_new(sizeof(double));
+		s_frame_times = vector_new(sizeof(double));
+	}
+	start_run();
+	return true;
+
+on_error:
+	free(s_filename);
+	s_filename = NULL;
+	s_mode = REPLAY_OFF;
+	return false;
+}
+
+void
+replay_uninit(void)
+{
+	if (s_mode == REPLAY_OFF)
+		return;
+
+	console_log(1, "shutting down session %s", s_mode == REPLAY_RECORD ? "recorder" : "replay");
+	if (s_mode == REPLAY_RECORD) {
+		fprintf(s_file, "end %d\n", s_frame);
+		fclose(s_file);
+		printf("recorded %d frames to '%s'\n", s_frame, s_filename);
+	}
+	else {
+		print_results();
+	}
+	vector_free(s_all_times);
+	vector_free(s_frame_times);
+	vector_free(s_key_events);
+	vector_free(s_mouse_samples);
+	vector_free(s_run_stats);
+	vector_free(s_seeds);
+	free(s_filename);
+	s_mode = REPLAY_OFF;
+}
+
+int
+replay_frame(void)
+{
+	return s_frame;
+}
+
+int
+replay_poll(void)
+{
+	return s_poll;
+}
+
+void
+replay_next_poll(void)
+{
+	// note: called every time the engine waits, so that blocking calls like GetKey(),
+	//       which spin on sphere_sleep() without ever flipping a frame, still take
+	//       input.  events are tagged with the frame and the number of waits into it.
+	if (s_mode != REPLAY_OFF)
+		++s_poll;
+}
+
+replay_mode_t
+replay_mode(void)
+{
+	return s_mode;
+}
+
+bool
+replay_next_run(void)
+{
+	// note: called whenever the game exits.  while benchmarking, this wraps up the run
+	//       that just finished and says whether the session should be played again.
+	if (s_mode != REPLAY_PLAY)
+		return false;
+	finish_run();
+	if (++s_run_index >= s_num_runs)
+		return false;
+	start_run();
+	return true;
+}
+
+void
+replay_end_frame(void)
+{
+	double frame_time;
+	double time_now;
+
+	if (s_mode == REPLAY_OFF)
+		return;
+
+	// note: timing starts at the end of the first frame, since that one includes
+	//       engine startup and game loading which would only skew the numbers.
+	time_now = al_get_time();
+	if (s_frame == 0) {
+		s_run_start_time = time_now;
+	}
+	else if (s_mode == REPLAY_PLAY) {
+		frame_time = time_now - s_last_frame_time;
+		vector_push(s_frame_times, &frame_time);
+	}
+	s_last_frame_time = time_now;
+	++s_frame;
+	s_poll = 0;
+
+	if (s_mode == REPLAY_PLAY && s_frame >= s_end_frame && !s_ended) {
+		console_log(1, "end of replay reached at frame %d", s_frame);
+		s_ended = true;
+		sphere_exit(false);
+	}
+}
+
+bool
+replay_get_event(ALLEGRO_EVENT* out_event)
+{
+	struct key_event* event;
+
+	if (s_next_key >= vector_len(s_key_events))
+		return false;
+	event = vector_get(s_key_events, s_next_key);
+	if (!is_due(event->frame, event->poll))
+		return false;
+	++s_next_key;
+
+	memset(out_event, 0, sizeof(ALLEGRO_EVENT));
+	out_event->type = event->type == KEY_EVENT_DOWN ? ALLEGRO_EVENT_KEY_DOWN
+		: event->type == KEY_EVENT_UP ? ALLEGRO_EVENT_KEY_UP
+		: event->type == KEY_EVENT_CHAR ? ALLEGRO_EVENT_KEY_CHAR
+		: ALLEGRO_EVENT_DISPLAY_SWITCH_OUT;
+	out_event->keyboard.keycode = event->keycode;
+	out_event->keyboard.modifiers = event->modifiers;
+	return true;
+}
+
+bool
+replay_get_mouse(ALLEGRO_MOUSE_STATE* out_state)
+{
+	struct mouse_sample* sample;
+
+	while (s_next_mouse < vector_len(s_mouse_samples)) {
+		sample = vector_get(s_mouse_samples, s_next_mouse);
+		if (!is_due(sample->frame, sample->poll))
+			break;
+		s_last_mouse = *sample;
+		++s_next_mouse;
+	}
+	memset(out_state, 0, sizeof(ALLEGRO_MOUSE_STATE));
+	out_state->x = s_last_mouse.x;
+	out_state->y = s_last_mouse.y;
+	out_state->z = s_last_mouse.z;
+	out_state->buttons = s_last_mouse.buttons;
+	return s_last_mouse.in_window;
+}
+
+void
+replay_put_event(const ALLEGRO_EVENT* event)
+{
+	const char* type_name;
+
+	if (s_mode != REPLAY_RECORD)
+		return;
+
+	// only events that feed the game's input state are worth saving.  anything else
+	// doesn't affect how the game plays out.
+	type_name = event->type == ALLEGRO_EVENT_KEY_DOWN ? "down"
+		: event->type == ALLEGRO_EVENT_KEY_UP ? "up"
+		: event->type == ALLEGRO_EVENT_KEY_CHAR ? "char"
+		: event->type == ALLEGRO_EVENT_DISPLAY_SWITCH_OUT ? "switch-out"
+		: NULL;
+	if (type_name == NULL)
+		return;
+	if (event->type == ALLEGRO_EVENT_DISPLAY_SWITCH_OUT)
+		fprintf(s_file, "key %d %d %s 0 0\n", s_frame, s_poll, type_name);
+	else
+		fprintf(s_file, "key %d %d %s %d %d\n", s_frame, s_poll, type_name,
+			event->keyboard.keycode, event->keyboard.modifiers);
+}
+
+void
+replay_put_mouse(const ALLEGRO_MOUSE_STATE* state, bool in_window)
+{
+	if (s_mode != REPLAY_RECORD)
+		return;
+
+	// mouse state is polled every frame, so only write it out when it changes.  the
+	// position is already in game coordinates (see read_mouse() in input.c).
+	if (s_last_mouse.frame >= 0
+		&& state->x == s_last_mouse.x && state->y == s_last_mouse.y
+		&& state->z == s_last_mouse.z && state->buttons == s_last_mouse.buttons
+		&& in_window == s_last_mouse.in_window)
+	{
+		return;
+	}
+	s_last_mouse.frame = s_frame;
+	s_last_mouse.poll = s_poll;
+	s_last_mouse.x = state->x;
+	s_last_mouse.y = state->y;
+	s_last_mouse.z = state->z;
+	s_last_mouse.buttons = state->buttons;
+	s_last_mouse.in_window = in_window;
+	fprintf(s_file, "mouse %d %d %d %d %d %d %d\n", s_frame, s_poll,
+		state->x, state->y, state->z, state->buttons, in_window ? 1 : 0);
+}
+
+uint64_t
+replay_seed(uint64_t seed)
+{
+	// note: while recording, this saves the seed being used; on playback it's swapped out
+	//       for the recorded one.  seeds are handed out in the order they were recorded.
+	if (s_mode == REPLAY_RECORD) {
+		fprintf(s_file, "seed %d %llu\n", s_frame, (unsigned long long)seed);
+	}
+	else if (s_mode == REPLAY_PLAY && s_next_seed < vector_len(s_seeds)) {
+		seed = *(uint64_t*)vector_get(s_seeds, s_next_seed);
+		++s_next_seed;
+	}
+	return seed;
+}
+
+static void
+finish_run(void)
+{
+	double*          frame_time;
+	struct run_stats stats;
+
+	iter_t iter;
+
+	iter = vector_enum(s_frame_times);
+	while ((frame_time = iter_next(&iter)))
+		vector_push(s_all_times, frame_time);
+	vector_sort(s_frame_times, order_times);
+	stats.num_frames = s_frame;
+	stats.wall_time = s_frame > 0 ? s_last_frame_time - s_run_start_time : 0.0;
+	stats.p50 = percentile(s_frame_times, 0.50);
+	stats.p95 = percentile(s_frame_times, 0.95);
+	stats.p99 = percentile(s_frame_times, 0.99);
+	vector_push(s_run_stats, &stats);
+}
+
+static bool
+is_due(int frame, int poll)
+{
+	return frame < s_frame || (frame == s_frame && poll <= s_poll);
+}
+
+static int
+order_times(const void* in_a, const void* in_b)
+{
+	double a;
+	double b;
+
+	a = *(const double*)in_a;
+	b = *(const double*)in_b;
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static double
+percentile(const vector_t* sorted_times, double fraction)
+{
+	int index;
+	int num_times;
+
+	// nearest-rank percentile
+	num_times = vector_len(sorted_times);
+	if (num_times == 0)
+		return 0.0;
+	index = (int)ceil(fraction * num_times) - 1;
+	if (index < 0)
+		index = 0;
+	return *(double*)vector_get(sorted_times, index) * 1000.0;
+}
+
+static void
+print_results(void)
+{
+	struct run_stats* stats;
+
+	iter_t iter;
+
+	vector_sort(s_all_times, order_times);
+	printf("replay results for '%s'\n", s_filename);
+	iter = vector_enum(s_run_stats);
+	while ((stats = iter_next(&iter))) {
+		printf("    run %d: %d frames in %.3f s, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+			iter.index + 1, stats->num_frames, stats->wall_time,
+			stats->p50, stats->p95, stats->p99);
+	}
+	printf("    overall: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+		percentile(s_all_times, 0.50),
+		percentile(s_all_times, 0.95),
+		percentile(s_all_times, 0.99));
+	fflush(stdout);
+}
+
+static bool
+read_recording(const char* filename)
+{
+	FILE*               file;
+	int                 frame;
+	int                 in_window;
+	int                 last_frame = 0;
+	struct key_event    key_event;
+	char                line[256];
+	int                 line_num = 0;
+	struct mouse_sample mouse_sample;
+	unsigned long long  seed;
+	char                type_name[16];
+	uint64_t            value;
+
+	if (!(file = fopen(filename, "r"))) {
+		fprintf(stderr, "ERROR: couldn't open replay file '%s'\n", filename);
+		return false;
+	}
+	if (!fgets(line, sizeof line, file) || strncmp(line, REPLAY_SIGNATURE, strlen(REPLAY_SIGNATURE)) != 0) {
+		fprintf(stderr, "ERROR: '%s' is not a miniSphere replay file\n", filename);
+		goto on_error;
+	}
+	++line_num;
+
+	s_key_events = vector_new(sizeof(struct key_event));
+	s_mouse_samples = vector_new(sizeof(struct mouse_sample));
+	s_seeds = vector_new(sizeof(uint64_t));
+	s_end_frame = INT_MAX;
+	while (fgets(line, sizeof line, file)) {
+		++line_num;
+		if (sscanf(line, "key %d %d %15s %d %d", &key_event.frame, &key_event.poll,
+			type_name, &key_event.keycode, &key_event.modifiers) == 5)
+		{
+			key_event.type = strcmp(type_name, "down") == 0 ? KEY_EVENT_DOWN
+				: strcmp(type_name, "up") == 0 ? KEY_EVENT_UP
+				: strcmp(type_name, "char") == 0 ? KEY_EVENT_CHAR
+				: KEY_EVENT_SWITCH_OUT;
+			vector_push(s_key_events, &key_event);
+			frame = key_event.frame;
+		}
+		else if (sscanf(line, "mouse %d %d %d %d %d %d %d", &mouse_sample.frame,
+			&mouse_sample.poll, &mouse_sample.x, &mouse_sample.y, &mouse_sample.z,
+			&mouse_sample.buttons, &in_window) == 7)
+		{
+			mouse_sample.in_window = in_window != 0;
+			vector_push(s_mouse_samples, &mouse_sample);
+			frame = mouse_sample.frame;
+		}
+		else if (sscanf(line, "seed %d %llu", &frame, &seed) == 2) {
+			value = seed;
+			vector_push(s_seeds, &value);
+		}
+		else if (sscanf(line, "end %d", &frame) == 1) {
+			s_end_frame = frame;
+		}
+		else {
+			fprintf(stderr, "ERROR: malformed replay data at '%s':%d\n", filename, line_num);
+			goto on_error;
+		}
+		if (frame > last_frame)
+			last_frame = frame;
+	}
+	fclose(file);
+
+	// a recording without an end marker (e.g. the engine crashed while recording) would
+	// otherwise play forever if the game idles, so stop after the last recorded input.
+	if (s_end_frame == INT_MAX) {
+		fprintf(stderr, "WARNING: replay '%s' is incomplete, ending it at frame %d\n",
+			filename, last_frame + 1);
+		s_end_frame = last_frame + 1;
+	}
+	return true;
+
+on_error:
+	fclose(file);
+	vector_free(s_key_events);
+	vector_free(s_mouse_samples);
+	vector_free(s_seeds);
+	s_key_events = NULL;
+	s_mouse_samples = NULL;
+	s_seeds = NULL;
+	return false;
+}
+
+static void
+start_run(void)
+{
+	s_ended = false;
+	s_frame = 0;
+	s_poll = 0;
+	s_next_key = 0;
+	s_next_mouse = 0;
+	s_next_seed = 0;
+	memset(&s_last_mouse, 0, sizeof(struct mouse_sample));
+	if (s_mode == REPLAY_RECORD)
+		s_last_mouse.frame = -1;
+	if (s_frame_times != NULL)
+		vector_clear(s_frame_times);
+}
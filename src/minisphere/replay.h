@@ -0,0 +1,58 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef SPHERE__REPLAY_H__INCLUDED
+#define SPHERE__REPLAY_H__INCLUDED
+
+typedef
+enum replay_mode
+{
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY,
+} replay_mode_t;
+
+bool          replay_init      (replay_mode_t mode, const char* filename, int num_runs);
+void          replay_uninit    (void);
+int           replay_frame     (void);
+int           replay_poll      (void);
+void          replay_next_poll (void);
+replay_mode_t replay_mode      (void);
+bool          replay_next_run  (void);
+void          replay_end_frame (void);
+bool          replay_get_event (ALLEGRO_EVENT* out_event);
+bool          replay_get_mouse (ALLEGRO_MOUSE_STATE* out_state);
+void          replay_put_event (const ALLEGRO_EVENT* event);
+void          replay_put_mouse (const ALLEGRO_MOUSE_STATE* state, bool in_window);
+uint64_t      replay_seed      (uint64_t seed);
+
+#endif // SPHERE__REPLAY_H__INCLUDED
@@ -38,21 +38,36 @@
 #include "minisphere.h"
 #include "screen.h"
 
+#include "capture.h"
 #include "debugger.h"
 #include "font.h"
+#include "galileo.h"
 #include "image.h"
+#include "input.h"
+#include "profiler.h"
+#include "replay.h"
+#include "vector.h"
+
+#define MAX_RECORDED_FRAMES    600
+#define UNTHROTTLED_FRAME_TIME (1.0 / 60.0)
 
 struct screen
 {
 	image_t*         backbuffer;
+	capture_t*       capture;
 	rect_t           clip_rect;
 	ALLEGRO_DISPLAY* display;
 	font_t*          font;
 	int              fps_flips;
 	int              fps_frames;
 	double           fps_poll_time;
+	int              frame_batches;
+	int              frame_draws;
+	vector_t*        frame_times;
 	bool             fullscreen;
+	bool             headless;
 	double           last_flip_time;
+	double           last_wall_time;
 	int              max_skips;
 	double           next_frame_time;
 	int              num_flips;
@@ -60,6 +75,7 @@ struct screen
 	int              num_skips;
 	bool             show_fps;
 	bool             skipping_frame;
+	double           start_time;
 	bool             take_screenshot;
 	int              x_offset;
 	float            x_scale;
@@ -69,14 +85,15 @@ struct screen
 	int              y_size;
 };
 
-static void refresh_display (screen_t* screen);
+static void print_frame_stats (const screen_t* screen);
+static void refresh_display   (screen_t* screen);
 
 screen_t*
-screen_new(const char* title, image_t* icon, size2_t resolution, int frameskip, font_t* font)
+screen_new(const char* title, image_t* icon, size2_t resolution, int frameskip, font_t* font, bool headless)
 {
 	image_t*             backbuffer = NULL;
 	int                  bitmap_flags;
-	ALLEGRO_DISPLAY*     display;
+	ALLEGRO_DISPLAY*     display = NULL;
 	ALLEGRO_BITMAP*      icon_bitmap;
 	ALLEGRO_MONITOR_INFO desktop_info;
 	ALLEGRO_STATE        old_state;
@@ -86,22 +103,31 @@ screen_new(const char* title, image_t* icon, size2_t resolution, int frameskip,
 
 	console_log(1, "initializing render context at %dx%d", resolution.width, resolution.height);
 
-	al_set_new_window_title(title);
-	al_set_new_display_flags(ALLEGRO_OPENGL | ALLEGRO_PROGRAMMABLE_PIPELINE);
-	if (al_get_monitor_info(0, &desktop_info)) {
-		x_scale = ((desktop_info.x2 - desktop_info.x1) / 1.5) / resolution.width;
-		y_scale = ((desktop_info.y2 - desktop_info.y1) / 1.5) / resolution.height;
-		x_scale = y_scale = fmax(fmin(x_scale, y_scale), 1.0);
+	if (!headless) {
+		al_set_new_window_title(title);
+		al_set_new_display_flags(ALLEGRO_OPENGL | ALLEGRO_PROGRAMMABLE_PIPELINE);
+		if (al_get_monitor_info(0, &desktop_info)) {
+			x_scale = ((desktop_info.x2 - desktop_info.x1) / 1.5) / resolution.width;
+			y_scale = ((desktop_info.y2 - desktop_info.y1) / 1.5) / resolution.height;
+			x_scale = y_scale = fmax(fmin(x_scale, y_scale), 1.0);
+		}
+		display = al_create_display(resolution.width * x_scale, resolution.height * y_scale);
+	}
+	else {
+		// note: without a display, Allegro falls back on memory bitmaps for everything,
+		//       so the game still renders--just in software, and nobody gets to see it.
+		console_log(1, "  running headless, no display will be created");
 	}
-	display = al_create_display(resolution.width * x_scale, resolution.height * y_scale);
 
 	// using a custom backbuffer allows pixel-perfect rendering regardless of
 	// actual viewport size.
-	if (display != NULL) {
+	if (display != NULL || headless) {
 		// no alpha channel.  this sidesteps a few edge cases involving alpha blending
 		// and the screen-grab functions.
 		al_store_state(&old_state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
 		al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_24_NO_ALPHA);
+		if (headless)
+			al_set_new_bitmap_flags(al_get_new_bitmap_flags() | ALLEGRO_MEMORY_BITMAP);
 		backbuffer = image_new(resolution.width, resolution.height, NULL);
 		al_restore_state(&old_state);
 	}
@@ -110,7 +136,7 @@ screen_new(const char* title, image_t* icon, size2_t resolution, int frameskip,
 		return NULL;
 	}
 
-	if (icon != NULL) {
+	if (icon != NULL && display != NULL) {
 		bitmap_flags = al_get_new_bitmap_flags() | ALLEGRO_NO_PRESERVE_TEXTURE;
 		al_set_new_bitmap_flags(
 			ALLEGRO_NO_PREMULTIPLIED_ALPHA | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR
@@ -125,13 +151,19 @@ screen_new(const char* title, image_t* icon, size2_t resolution, int frameskip,
 	screen = calloc(1, sizeof(screen_t));
 	screen->display = display;
 	screen->backbuffer = backbuffer;
+	screen->capture = capture_new();
 	screen->font = font;
+	screen->headless = headless;
 	screen->x_size = resolution.width;
 	screen->y_size = resolution.height;
+	screen->x_scale = 1.0f;
+	screen->y_scale = 1.0f;
 	screen->max_skips = frameskip;
+	if (headless)
+		screen->frame_times = vector_new(sizeof(double));
 
-	screen->fps_poll_time = al_get_time() + 1.0;
-	screen->next_frame_time = al_get_time();
+	screen->fps_poll_time = sphere_now() + 1.0;
+	screen->next_frame_time = sphere_now();
 	screen->last_flip_time = screen->next_frame_time;
 
 #ifdef MINISPHERE_SPHERUN
@@ -149,8 +181,13 @@ screen_free(screen_t* it)
 		return;
 
 	console_log(1, "shutting down render context");
+	if (it->headless)
+		print_frame_stats(it);
+	capture_free(it->capture);
 	image_unref(it->backbuffer);
-	al_destroy_display(it->display);
+	if (it->display != NULL)
+		al_destroy_display(it->display);
+	vector_free(it->frame_times);
 	free(it);
 }
 
@@ -201,9 +238,17 @@ screen_get_mouse_xy(const screen_t* it, int* o_x, int* o_y)
 {
 	ALLEGRO_MOUSE_STATE mouse_state;
 
-	al_get_mouse_state(&mouse_state);
-	*o_x = (mouse_state.x - it->x_offset) / it->x_scale;
-	*o_y = (mouse_state.y - it->y_offset) / it->y_scale;
+	// note: the input module already reports the mouse position in game
+	//       coordinates, see screen_to_game_xy().
+	mouse_get_state(&mouse_state);
+	*o_x = mouse_state.x;
+	*o_y = mouse_state.y;
+}
+
+bool
+screen_get_recording(const screen_t* it)
+{
+	return capture_recording(it->capture);
 }
 
 void
@@ -232,7 +277,17 @@ screen_set_mouse_xy(screen_t* it, int x, int y)
 {
 	x = x * it->x_scale + it->x_offset;
 	y = y * it->y_scale + it->y_offset;
-	al_set_mouse_xy(it->display, x, y);
+	if (it->display != NULL)
+		al_set_mouse_xy(it->display, x, y);
+}
+
+void
+screen_set_recording(screen_t* it, bool recording)
+{
+	if (recording)
+		capture_start(it->capture, MAX_RECORDED_FRAMES, it->x_size, it->y_size);
+	else
+		capture_stop(it->capture);
 }
 
 void
@@ -245,7 +300,7 @@ screen_draw_status(screen_t* it, const char* text, color_t color)
 	int               width;
 	int               height;
 
-	if (it->font == NULL)
+	if (it->font == NULL || it->display == NULL)
 		return;
 
 	screen_cx = al_get_display_width(it->display);
@@ -256,6 +311,7 @@ screen_draw_status(screen_t* it, const char* text, color_t color)
 	bounds.y1 = screen_cy - it->y_offset - height - 8;
 	bounds.x2 = bounds.x1 + width;
 	bounds.y2 = bounds.y1 + height;
+	galileo_flush();
 	old_target = al_get_target_bitmap();
 	al_set_target_backbuffer(it->display);
 	al_draw_filled_rounded_rectangle(bounds.x1, bounds.y1, bounds.x2, bounds.y2, 4, 4,
@@ -266,28 +322,23 @@ screen_draw_status(screen_t* it, const char* text, color_t color)
 	font_set_mask(it->font, color);
 	font_draw_text(it->font, (bounds.x2 + bounds.x1) / 2,
 		bounds.y1 + 5, TEXT_ALIGN_CENTER, text);
+	galileo_flush();
 	al_set_target_bitmap(old_target);
 }
 
 void
 screen_flip(screen_t* it, int framerate, bool need_clear)
 {
-	time_t            datetime;
-	char*             filename;
 	char              fps_text[20];
-	const char*       game_filename;
-	const path_t*     game_root;
+	double            frame_time;
+	int               overlay_w;
 	bool              is_backbuffer_valid;
-	ALLEGRO_STATE     old_state;
 	ALLEGRO_BITMAP*   old_target;
-	path_t*           path;
-	const char*       pathname;
 	rect_t            scissor;
 	int               screen_cx;
 	int               screen_cy;
-	int               serial = 1;
-	ALLEGRO_BITMAP*   snapshot;
-	char              timestamp[100];
+	char              stats_text[40];
+	double            wall_time;
 	int               x, y;
 #if defined(MINISPHERE_SPHERUN)
 	double            start_time;
@@ -297,68 +348,83 @@ screen_flip(screen_t* it, int framerate, bool need_clear)
 	start_time = al_get_time();
 #endif
 
+	profiler_enter_phase("flip", false);
+
+	// in headless mode, keep track of how long each frame actually took so we can
+	// report on it later.  this is real time, not the virtual game clock.  as with
+	// replays, timing starts at the end of the first frame, since that one includes
+	// engine startup and game loading which would only skew the numbers.
+	if (it->headless) {
+		wall_time = al_get_time();
+		if (it->start_time == 0.0) {
+			it->start_time = wall_time;
+		}
+		else {
+			frame_time = wall_time - it->last_wall_time;
+			vector_push(it->frame_times, &frame_time);
+		}
+		it->last_wall_time = wall_time;
+	}
+
+	// anything still batched has to make it into this frame.  the draw counts are
+	// sampled now so that the FPS overlay doesn't count itself.
+	galileo_flush();
+	galileo_get_stats(&it->frame_draws, &it->frame_batches);
+
 	// update FPS with 1s granularity
-	if (al_get_time() >= it->fps_poll_time) {
+	if (sphere_now() >= it->fps_poll_time) {
 		it->fps_flips = it->num_flips;
 		it->fps_frames = it->num_frames;
 		it->num_frames = it->num_flips = 0;
-		it->fps_poll_time = al_get_time() + 1.0;
+		it->fps_poll_time = sphere_now() + 1.0;
 	}
 
 	// flip the backbuffer, unless the preceeding frame was skipped
 	is_backbuffer_valid = !it->skipping_frame;
-	screen_cx = al_get_display_width(it->display);
-	screen_cy = al_get_display_height(it->display);
 	if (is_backbuffer_valid) {
 		if (it->take_screenshot) {
-			al_store_state(&old_state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
-			al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_24_NO_ALPHA);
-			snapshot = al_clone_bitmap(image_bitmap(it->backbuffer));
-			al_restore_state(&old_state);
-			game_root = game_path(g_game);
-			game_filename = path_is_file(game_root)
-				? path_filename(game_root)
-				: path_hop(game_root, path_num_hops(game_root) - 1);
-			path = path_rebase(path_new("miniSphere/Screenshots/"), home_path());
-			path_mkdir(path);
-			time(&datetime);
-			strftime(timestamp, 100, "%Y%m%d", localtime(&datetime));
-			do {
-				filename = strnewf("%s-%s-%d.png", game_filename, timestamp, serial++);
-				path_strip(path);
-				path_append(path, filename);
-				pathname = path_cstr(path);
-				free(filename);
-			} while (al_filename_exists(pathname));
-			al_save_bitmap(pathname, snapshot);
-			al_destroy_bitmap(snapshot);
-			path_free(path);
+			capture_screenshot(it->capture, it->backbuffer);
 			it->take_screenshot = false;
 		}
-		old_target = al_get_target_bitmap();
-		al_set_target_backbuffer(it->display);
-		al_clear_to_color(al_map_rgba(0, 0, 0, 255));
-		al_draw_scaled_bitmap(image_bitmap(it->backbuffer), 0, 0, it->x_size, it->y_size,
-			it->x_offset, it->y_offset, it->x_size * it->x_scale, it->y_size * it->y_scale,
-			0x0);
-		if (debugger_attached())
-			screen_draw_status(it, debugger_name(), debugger_color());
-		if (it->show_fps && it->font != NULL) {
-			if (framerate > 0)
-				sprintf(fps_text, "%d/%d fps", it->fps_flips, it->fps_frames);
-			else
-				sprintf(fps_text, "%d fps", it->fps_flips);
-			x = screen_cx - it->x_offset - 108;
-			y = screen_cy - it->y_offset - 24;
-			al_draw_filled_rounded_rectangle(x, y, x + 100, y + 16, 4, 4, al_map_rgba(16, 16, 16, 192));
-			font_set_mask(it->font, mk_color(0, 0, 0, 255));
-			font_draw_text(it->font, x + 51, y + 3, TEXT_ALIGN_CENTER, fps_text);
-			font_set_mask(it->font, mk_color(255, 255, 255, 255));
-			font_draw_text(it->font, x + 50, y + 2, TEXT_ALIGN_CENTER, fps_text);
+		if (capture_recording(it->capture))
+			capture_add_frame(it->capture, it->backbuffer);
+		if (it->display != NULL) {
+			screen_cx = al_get_display_width(it->display);
+			screen_cy = al_get_display_height(it->display);
+			old_target = al_get_target_bitmap();
+			al_set_target_backbuffer(it->display);
+			al_clear_to_color(al_map_rgba(0, 0, 0, 255));
+			al_draw_scaled_bitmap(image_bitmap(it->backbuffer), 0, 0, it->x_size, it->y_size,
+				it->x_offset, it->y_offset, it->x_size * it->x_scale, it->y_size * it->y_scale,
+				0x0);
+			if (debugger_attached())
+				screen_draw_status(it, debugger_name(), debugger_color());
+			else if (capture_recording(it->capture))
+				screen_draw_status(it, "recording (Shift+F12 to save)", mk_color(255, 64, 64, 255));
+			if (it->show_fps && it->font != NULL) {
+				if (framerate > 0)
+					sprintf(fps_text, "%d/%d fps", it->fps_flips, it->fps_frames);
+				else
+					sprintf(fps_text, "%d fps", it->fps_flips);
+				sprintf(stats_text, "%d draws/%d batches", it->frame_draws, it->frame_batches);
+				overlay_w = font_get_width(it->font, stats_text) + 16;
+				if (overlay_w < 100)
+					overlay_w = 100;
+				x = screen_cx - it->x_offset - overlay_w - 8;
+				y = screen_cy - it->y_offset - 38;
+				al_draw_filled_rounded_rectangle(x, y, x + overlay_w, y + 30, 4, 4, al_map_rgba(16, 16, 16, 192));
+				font_set_mask(it->font, mk_color(0, 0, 0, 255));
+				font_draw_text(it->font, x + overlay_w / 2 + 1, y + 3, TEXT_ALIGN_CENTER, fps_text);
+				font_draw_text(it->font, x + overlay_w / 2 + 1, y + 17, TEXT_ALIGN_CENTER, stats_text);
+				font_set_mask(it->font, mk_color(255, 255, 255, 255));
+				font_draw_text(it->font, x + overlay_w / 2, y + 2, TEXT_ALIGN_CENTER, fps_text);
+				font_draw_text(it->font, x + overlay_w / 2, y + 16, TEXT_ALIGN_CENTER, stats_text);
+			}
+			galileo_flush();
+			al_set_target_bitmap(old_target);
+			al_flip_display();
 		}
-		al_set_target_bitmap(old_target);
-		al_flip_display();
-		it->last_flip_time = al_get_time();
+		it->last_flip_time = sphere_now();
 		it->num_skips = 0;
 		++it->num_flips;
 	}
@@ -372,17 +438,22 @@ screen_flip(screen_t* it, int framerate, bool need_clear)
 	// that we lag instead of never rendering anything at all.
 	if (framerate > 0) {
 		it->skipping_frame = it->last_flip_time > it->next_frame_time && it->num_skips < it->max_skips;
-		sphere_sleep(it->next_frame_time - al_get_time());
+		sphere_sleep(it->next_frame_time - sphere_now());
 		if (it->num_skips >= it->max_skips)  // did we skip too many frames?
-			it->next_frame_time = al_get_time() + 1.0 / framerate;
+			it->next_frame_time = sphere_now() + 1.0 / framerate;
 		else
 			it->next_frame_time += 1.0 / framerate;
 	}
 	else {
+		// with no frame limit the virtual clock would never move, so GetTime() and
+		// animations would freeze.  a fixed step keeps replays deterministic.
+		sphere_advance_clock(UNTHROTTLED_FRAME_TIME);
 		it->skipping_frame = false;
-		it->next_frame_time = al_get_time();
+		it->next_frame_time = sphere_now();
 	}
 	++it->num_frames;
+	replay_end_frame();
+	galileo_reset_stats();
 	if (!it->skipping_frame && need_clear) {
 		// disable clipping so we can clear the whole backbuffer.
 		scissor = image_get_scissor(it->backbuffer);
@@ -392,6 +463,8 @@ screen_flip(screen_t* it, int framerate, bool need_clear)
 		image_set_scissor(it->backbuffer, scissor);
 	}
 
+	profiler_leave_phase();
+
 #if defined(MINISPHERE_SPHERUN)
 	g_idle_time += al_get_time() - start_time;
 #endif
@@ -431,12 +504,23 @@ screen_resize(screen_t* it, int x_size, int y_size)
 void
 screen_show_mouse(screen_t* it, bool visible)
 {
+	if (it->display == NULL)
+		return;
 	if (visible)
 		al_show_mouse_cursor(it->display);
 	else
 		al_hide_mouse_cursor(it->display);
 }
 
+void
+screen_to_game_xy(const screen_t* it, int* inout_x, int* inout_y)
+{
+	// converts a point in window pixels to game resolution, undoing the scaling
+	// and letterboxing applied when the backbuffer is drawn to the display.
+	*inout_x = (*inout_x - it->x_offset) / it->x_scale;
+	*inout_y = (*inout_y - it->y_offset) / it->y_scale;
+}
+
 void
 screen_toggle_fps(screen_t* it)
 {
@@ -453,9 +537,46 @@ void
 screen_unskip_frame(screen_t* it)
 {
 	it->skipping_frame = false;
+	galileo_flush();
 	al_clear_to_color(al_map_rgba(0, 0, 0, 255));
 }
 
+static void
+print_frame_stats(const screen_t* screen)
+{
+	double  frame_time;
+	iter_t  iter;
+	double  max_time = 0.0;
+	double  min_time = 0.0;
+	int     num_frames;
+	double  total_time = 0.0;
+	double  wall_time;
+	double* time_ptr;
+
+	num_frames = vector_len(screen->frame_times);
+	wall_time = num_frames > 0 ? screen->last_wall_time - screen->start_time : 0.0;
+	iter = vector_enum(screen->frame_times);
+	while ((time_ptr = iter_next(&iter))) {
+		frame_time = *time_ptr * 1000.0;
+		if (iter.index == 0 || frame_time < min_time)
+			min_time = frame_time;
+		if (frame_time > max_time)
+			max_time = frame_time;
+		total_time += frame_time;
+	}
+	printf("headless run statistics\n");
+	printf("    frames: %d\n", num_frames);
+	printf("    ticks: %u\n", g_tick_count);
+	printf("    wall time: %.3f s\n", wall_time);
+	printf("    virtual time: %.3f s\n", sphere_now());
+	if (num_frames > 0 && wall_time > 0.0) {
+		printf("    average rate: %.1f fps\n", num_frames / wall_time);
+		printf("    frame time: %.3f ms avg, %.3f ms min, %.3f ms max\n",
+			total_time / num_frames, min_time, max_time);
+	}
+	fflush(stdout);
+}
+
 static void
 refresh_display(screen_t* screen)
 {
@@ -463,6 +584,11 @@ refresh_display(screen_t* screen)
 	int                  real_width;
 	int                  real_height;
 
+	if (screen->display == NULL) {
+		image_render_to(screen->backbuffer, NULL);
+		return;
+	}
+
 	al_set_display_flag(screen->display, ALLEGRO_FULLSCREEN_WINDOW, screen->fullscreen);
 	if (screen->fullscreen) {
 		real_width = al_get_display_width(screen->display);
@@ -39,7 +39,7 @@
 
 typedef struct screen screen_t;
 
-screen_t*        screen_new               (const char* title, image_t* icon, size2_t resolution, int frameskip, font_t* font);
+screen_t*        screen_new               (const char* title, image_t* icon, size2_t resolution, int frameskip, font_t* font, bool headless);
 void             screen_free              (screen_t* it);
 image_t*         screen_backbuffer        (const screen_t* it);
 rect_t           screen_bounds            (const screen_t* it);
@@ -49,15 +49,18 @@ bool             screen_skipping_frame    (const screen_t* it);
 int              screen_get_frameskip     (const screen_t* it);
 bool             screen_get_fullscreen    (const screen_t* it);
 void             screen_get_mouse_xy      (const screen_t* it, int* o_x, int* o_y);
+bool             screen_get_recording     (const screen_t* it);
 void             screen_set_frameskip     (screen_t* it, int max_skips);
 void             screen_set_fullscreen    (screen_t* it, bool fullscreen);
 void             screen_set_mouse_xy      (screen_t* it, int x, int y);
+void             screen_set_recording     (screen_t* it, bool recording);
 void             screen_draw_status       (screen_t* it, const char* text, color_t color);
 void             screen_flip              (screen_t* it, int framerate, bool need_clear);
 image_t*         screen_grab              (screen_t* it, int x, int y, int width, int height);
 void             screen_queue_screenshot  (screen_t* it);
 void             screen_resize            (screen_t* it, int x_size, int y_size);
 void             screen_show_mouse        (screen_t* it, bool visible);
+void             screen_to_game_xy        (const screen_t* it, int* inout_x, int* inout_y);
 void             screen_toggle_fps        (screen_t* it);
 void             screen_toggle_fullscreen (screen_t* it);
 void             screen_unskip_frame      (screen_t* it);
@@ -36,9 +36,23 @@
 #include "api.h"
 #include "debugger.h"
 #include "jsal.h"
+#include "md5.h"
 #include "pegasus.h"
 #include "utility.h"
 
+#include <zlib.h>
+#if defined(_WIN32)
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#define BYTECODE_SIGNATURE ".jsc"
+#define CACHE_DIR_NAME     "miniSphere/.jsCache/"
+#define MAX_CACHE_SIZE     (64 * 1024 * 1024)
+
 struct script
 {
 	unsigned int  refcount;
@@ -47,7 +61,33 @@ struct script
 	bool          in_use;
 };
 
-static int s_next_script_id = 1;
+struct cache_entry
+{
+	char*   filename;
+	time_t  mtime;
+	int64_t size;
+};
+
+#pragma pack(push, 1)
+struct bytecode_header
+{
+	char     signature[4];
+	char     version[32];
+	uint32_t size;
+	uint32_t crc;
+	uint8_t  reserved[24];
+};
+#pragma pack(pop)
+
+static path_t* bytecode_path       (int source_index);
+static int     compare_cache_entry (const void* in_a, const void* in_b);
+static void    prune_bytecode      (const path_t* dir_path);
+static void*   read_bytecode       (const path_t* path, size_t *out_size);
+static void    write_bytecode      (const path_t* path, const void* bytecode, size_t size);
+
+static bool         s_cache_changed = false;
+static int          s_next_script_id = 1;
+static unsigned int s_next_temp_id = 1;
 
 void
 scripts_init(void)
@@ -58,7 +98,62 @@ scripts_init(void)
 void
 scripts_uninit(void)
 {
+	path_t* cache_path;
+
 	console_log(1, "shutting down JS script manager");
+
+	// the bytecode cache is only trimmed once, at shutdown.  doing it after every
+	// write would mean rescanning the whole cache for each script compiled.
+	if (s_cache_changed) {
+		cache_path = path_rebase(path_new(CACHE_DIR_NAME), home_path());
+		prune_bytecode(cache_path);
+		path_free(cache_path);
+	}
+}
+
+bool
+script_compile(const char* source_name)
+{
+	/* [ ... source ] -> [ ... function ] */
+
+	// note: compiled bytecode is cached in the user's home directory, keyed on the
+	//       source text and the engine version, so that a script which hasn't changed
+	//       since the last run doesn't need to be parsed again.  if the cached copy
+	//       can't be used for any reason, this falls back on compiling from source.
+
+	void*   bytecode;
+	path_t* cache_path;
+	size_t  size;
+
+	// don't use the cache while SSj is attached; the debugger needs to see everything
+	// get compiled
+	if (debugger_attached())
+		return jsal_try_compile(source_name);
+
+	cache_path = bytecode_path(-1);
+	if ((bytecode = read_bytecode(cache_path, &size))) {
+		if (jsal_compile_bytecode(source_name, bytecode, size)) {
+			console_log(4, "using cached bytecode for '%s'", source_name);
+			free(bytecode);
+			path_free(cache_path);
+			return true;
+		}
+		console_log(4, "cached bytecode for '%s' is stale", source_name);
+		free(bytecode);
+	}
+	jsal_dup(-1);
+	if (!jsal_try_compile(source_name)) {
+		jsal_remove(-2);
+		path_free(cache_path);
+		return false;
+	}
+	if ((bytecode = jsal_serialize(-2, &size))) {
+		write_bytecode(cache_path, bytecode, size);
+		free(bytecode);
+	}
+	jsal_remove(-2);
+	path_free(cache_path);
+	return true;
 }
 
 bool
@@ -85,7 +180,7 @@ script_eval(const char* filename)
 
 	// ready for launch in T-10...9...*munch*
 	jsal_push_lstring_t(source_text);
-	if (!jsal_try_compile(source_name))
+	if (!script_compile(source_name))
 		goto on_error;
 	if (!jsal_try_call(0))
 		goto on_error;
@@ -198,3 +293,176 @@ script_run(script_t* script, bool allow_reentry)
 
 	script_unref(script);
 }
+
+static path_t*
+bytecode_path(int source_index)
+{
+	MD5_CTX     ctx;
+	uint8_t     hash_bytes[16];
+	char        filename[37];
+	path_t*     path;
+	size_t      size;
+	const char* source;
+
+	int i;
+
+	// note: the engine version is hashed in along with the source.  bytecode is only
+	//       valid for the exact version of ChakraCore it was made by.
+	source = jsal_get_lstring(source_index, &size);
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, SPHERE_VERSION, (unsigned long)strlen(SPHERE_VERSION));
+	MD5_Update(&ctx, source, (unsigned long)size);
+	MD5_Final(hash_bytes, &ctx);
+	for (i = 0; i < 16; ++i)
+		sprintf(&filename[i * 2], "%.2x", (int)hash_bytes[i]);
+	strcpy(&filename[32], ".jsc");
+	path = path_rebase(path_new(CACHE_DIR_NAME), home_path());
+	path_append(path, filename);
+	return path;
+}
+
+static int
+compare_cache_entry(const void* in_a, const void* in_b)
+{
+	const struct cache_entry* a = in_a;
+	const struct cache_entry* b = in_b;
+
+	// most recently used first
+	return a->mtime < b->mtime ? 1
+		: a->mtime > b->mtime ? -1
+		: strcmp(a->filename, b->filename);
+}
+
+static void
+prune_bytecode(const path_t* dir_path)
+{
+	// note: the cache would otherwise grow without bound as scripts are edited, since
+	//       every version of a file gets its own entry.  the most recently used entries
+	//       are kept until MAX_CACHE_SIZE is reached and everything else is deleted.
+	//       entries are touched whenever they're used, so mtime works as an LRU stamp.
+
+	struct cache_entry* entries;
+	struct cache_entry  entry;
+	ALLEGRO_FS_ENTRY*   fse;
+	ALLEGRO_FS_ENTRY*   file_info;
+	const char*         filename;
+	vector_t*           list;
+	int                 num_entries;
+	int64_t             total_size = 0;
+
+	int i;
+
+	list = vector_new(sizeof(struct cache_entry));
+	fse = al_create_fs_entry(path_cstr(dir_path));
+	if (al_get_fs_entry_mode(fse) & ALLEGRO_FILEMODE_ISDIR && al_open_directory(fse)) {
+		while ((file_info = al_read_directory(fse))) {
+			filename = al_get_fs_entry_name(file_info);
+			if (al_get_fs_entry_mode(file_info) & ALLEGRO_FILEMODE_ISFILE
+				&& strlen(filename) > 4 && strcmp(&filename[strlen(filename) - 4], ".jsc") == 0)
+			{
+				entry.filename = strdup(filename);
+				entry.mtime = al_get_fs_entry_mtime(file_info);
+				entry.size = (int64_t)al_get_fs_entry_size(file_info);
+				vector_push(list, &entry);
+			}
+			al_destroy_fs_entry(file_info);
+		}
+	}
+	al_destroy_fs_entry(fse);
+
+	num_entries = vector_len(list);
+	entries = num_entries > 0 ? vector_get(list, 0) : NULL;
+	if (num_entries > 0)
+		qsort(entries, num_entries, sizeof(struct cache_entry), compare_cache_entry);
+	for (i = 0; i < num_entries; ++i) {
+		total_size += entries[i].size;
+		if (total_size > MAX_CACHE_SIZE && i > 0)
+			unlink(entries[i].filename);
+		free(entries[i].filename);
+	}
+	vector_free(list);
+}
+
+static void*
+read_bytecode(const path_t* path, size_t *out_size)
+{
+	// note: a cache file is only trusted if its header matches this engine and the
+	//       bytecode is intact.  ChakraCore doesn't validate serialized scripts itself,
+	//       so a truncated or corrupt file passed to JsParseSerialized() may crash.
+
+	void*                  bytecode = NULL;
+	ALLEGRO_FILE*          file;
+	int64_t                file_size;
+	struct bytecode_header header;
+	char                   version[32] = "";
+
+	if (!(file = al_fopen(path_cstr(path), "rb")))
+		return NULL;
+	file_size = al_fsize(file);
+	if (file_size <= (int64_t)sizeof(struct bytecode_header) || file_size > INT_MAX)
+		goto finished;
+	if (al_fread(file, &header, sizeof(struct bytecode_header)) != sizeof(struct bytecode_header))
+		goto finished;
+	strncpy(version, SPHERE_VERSION, sizeof version - 1);
+	if (memcmp(header.signature, BYTECODE_SIGNATURE, 4) != 0
+		|| memcmp(header.version, version, sizeof version) != 0
+		|| header.size != (uint32_t)(file_size - sizeof(struct bytecode_header)))
+	{
+		goto finished;
+	}
+	if (!(bytecode = malloc(header.size)))
+		goto finished;
+	if (al_fread(file, bytecode, header.size) != header.size
+		|| crc32(crc32(0L, Z_NULL, 0), bytecode, header.size) != header.crc)
+	{
+		free(bytecode);
+		bytecode = NULL;
+		goto finished;
+	}
+	*out_size = header.size;
+
+	// bump the timestamp so that entries which are still in use survive pruning
+	utime(path_cstr(path), NULL);
+
+finished:
+	al_fclose(file);
+	return bytecode;
+}
+
+static void
+write_bytecode(const path_t* path, const void* bytecode, size_t size)
+{
+	// note: the bytecode is written to a temporary file first and then renamed into
+	//       place.  that way another instance of the engine never sees a partially
+	//       written file, as loading a corrupt one would likely crash ChakraCore.
+
+	ALLEGRO_FILE*          file;
+	struct bytecode_header header;
+	bool                   is_ok;
+	char*                  temp_filename;
+
+	if (size > UINT32_MAX)
+		return;
+	memset(&header, 0, sizeof(struct bytecode_header));
+	memcpy(header.signature, BYTECODE_SIGNATURE, 4);
+	strncpy(header.version, SPHERE_VERSION, sizeof header.version - 1);
+	header.size = (uint32_t)size;
+	header.crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), bytecode, (uInt)size);
+
+	// note: the temporary name includes the process ID as well as a counter, so two
+	//       engine instances compiling the same script can't collide.
+	path_mkdir(path);
+	temp_filename = strnewf("%s.%d.%u", path_cstr(path), (int)getpid(), s_next_temp_id++);
+	if (!(file = al_fopen(temp_filename, "wb"))) {
+		free(temp_filename);
+		return;
+	}
+	is_ok = al_fwrite(file, &header, sizeof(struct bytecode_header)) == sizeof(struct bytecode_header);
+	is_ok = is_ok && al_fwrite(file, bytecode, size) == size;
+	is_ok = al_fclose(file) && is_ok;
+	if (!is_ok || rename(temp_filename, path_cstr(path)) != 0)
+		unlink(temp_filename);
+	else
+		s_cache_changed = true;
+	free(temp_filename);
+}
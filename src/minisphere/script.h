@@ -37,6 +37,7 @@ typedef struct script script_t;
 
 void      scripts_init        (void);
 void      scripts_uninit      (void);
+bool      script_compile      (const char* source_name);
 bool      script_eval         (const char* filename);
 script_t* script_new          (const lstring_t* script, const char* fmt_name, ...);
 script_t* script_new_function (int stack_index);
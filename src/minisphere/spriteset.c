@@ -34,6 +34,7 @@
 #include "spriteset.h"
 
 #include "atlas.h"
+#include "galileo.h"
 #include "image.h"
 #include "vector.h"
 
@@ -537,13 +538,19 @@ void
 spriteset_draw(const spriteset_t* it, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, const char* pose_name, float x, float y, int frame_index)
 {
 	rect_t             base;
+	float              center_x, center_y;
+	float              corners[8];
+	float              cos_theta, sin_theta;
 	struct frame*      frame;
 	image_t*           image;
 	int                image_index;
 	int                image_w, image_h;
+	float              local_x, local_y;
 	const struct pose* pose;
 	float              scale_w, scale_h;
 
+	int i;
+
 	if ((pose = find_pose_by_name(it, pose_name)) == NULL)
 		return;
 	frame_index = frame_index % vector_len(pose->frames);
@@ -558,9 +565,20 @@ spriteset_draw(const spriteset_t* it, color_t mask, bool is_flipped, double thet
 	image_h = image_height(image);
 	scale_w = image_w * scale_x;
 	scale_h = image_h * scale_y;
-	al_draw_tinted_scaled_rotated_bitmap(image_bitmap(image), nativecolor(mask),
-		(float)image_w / 2, (float)image_h / 2, x + scale_w / 2, y + scale_h / 2,
-		scale_x, scale_y, theta, is_flipped ? ALLEGRO_FLIP_VERTICAL : 0x0);
+	center_x = x + scale_w / 2;
+	center_y = y + scale_h / 2;
+	cos_theta = cos(theta);
+	sin_theta = sin(theta);
+
+	// the sprite is scaled and rotated about its center.  corners go top-left, top-right,
+	// bottom-right, bottom-left; a flipped sprite has its top and bottom swapped.
+	for (i = 0; i < 4; ++i) {
+		local_x = ((i == 1 || i == 2) ? image_w / 2.0f : -image_w / 2.0f) * scale_x;
+		local_y = ((i >= 2) != is_flipped ? image_h / 2.0f : -image_h / 2.0f) * scale_y;
+		corners[i * 2] = center_x + local_x * cos_theta - local_y * sin_theta;
+		corners[i * 2 + 1] = center_y + local_x * sin_theta + local_y * cos_theta;
+	}
+	galileo_draw_quad(image_bitmap(image), nativecolor(mask), 0, 0, image_w, image_h, corners);
 }
 
 bool
@@ -42,22 +42,28 @@ struct tileset
 	unsigned int id;
 	atlas_t*     atlas;
 	int          atlas_pitch;
+	uint32_t     frames;
 	int          height;
+	int          num_scheduled;
 	int          num_tiles;
+	int*         schedule;
 	struct tile* tiles;
+	uint32_t     wake_frame;
 	int          width;
 };
 
 struct tile
 {
+	uint32_t   changed_frame;
 	int        delay;
-	int        frames_left;
+	uint32_t   due_frame;
 	image_t*   image;
 	int        image_index;
 	lstring_t* name;
 	int        next_index;
 	int        num_obs_lines;
 	obsmap_t*  obsmap;
+	int        schedule_slot;
 };
 
 #pragma pack(push, 1)
@@ -89,6 +95,12 @@ struct rts_tile_header
 };
 #pragma pack(pop)
 
+static bool is_due_before   (const tileset_t* tileset, int tile_a, int tile_b);
+static void schedule_pop    (tileset_t* tileset);
+static void schedule_push   (tileset_t* tileset, int tile_index, int num_frames);
+static void sift_down       (tileset_t* tileset, int slot);
+static void sift_up         (tileset_t* tileset, int slot);
+
 static unsigned int s_next_tileset_id = 0;
 
 tileset_t*
@@ -135,7 +147,10 @@ tileset_read(file_t* file)
 	if (memcmp(rts.signature, ".rts", 4) != 0 || rts.version < 1 || rts.version > 1)
 		goto on_error;
 	if (rts.tile_bpp != 32) goto on_error;
-	if (!(tiles = calloc(rts.num_tiles, sizeof(struct tile)))) goto on_error;
+	if (rts.num_tiles > 0) {
+		if (!(tiles = calloc(rts.num_tiles, sizeof(struct tile)))) goto on_error;
+		if (!(tileset->schedule = malloc(rts.num_tiles * sizeof(int)))) goto on_error;
+	}
 
 	// read in all the tile bitmaps (use atlasing)
 	if (!(atlas = atlas_new(rts.num_tiles, rts.tile_width, rts.tile_height)))
@@ -155,7 +170,7 @@ tileset_read(file_t* file)
 		tiles[i].next_index = tilehdr.animated ? tilehdr.next_tile : i;
 		tiles[i].delay = tilehdr.animated ? tilehdr.delay : 0;
 		tiles[i].image_index = i;
-		tiles[i].frames_left = tiles[i].delay;
+		tiles[i].schedule_slot = -1;
 		if (rts.has_obstructions) {
 			switch (tilehdr.obsmap_type) {
 			case 1:  // pixel-perfect obstruction (no longer supported)
@@ -182,6 +197,10 @@ tileset_read(file_t* file)
 	tileset->height = rts.tile_height;
 	tileset->num_tiles = rts.num_tiles;
 	tileset->tiles = tiles;
+	for (i = 0; i < rts.num_tiles; ++i) {
+		if (tiles[i].delay > 0)
+			schedule_push(tileset, i, tiles[i].delay);
+	}
 	return tileset;
 
 on_error:  // oh no!
@@ -194,9 +213,11 @@ on_error:  // oh no!
 			obsmap_free(tiles[i].obsmap);
 			image_unref(tiles[i].image);
 		}
-		free(tileset->tiles);
+		free(tiles);
 	}
 	atlas_free(atlas);
+	if (tileset != NULL)
+		free(tileset->schedule);
 	free(tileset);
 	return NULL;
 }
@@ -214,6 +235,7 @@ tileset_free(tileset_t* tileset)
 		obsmap_free(tileset->tiles[i].obsmap);
 	}
 	atlas_free(tileset->atlas);
+	free(tileset->schedule);
 	free(tileset->tiles);
 	free(tileset);
 }
@@ -261,6 +283,47 @@ tileset_obsmap(const tileset_t* tileset, int tile_index)
 		return NULL;
 }
 
+image_t*
+tileset_texture(const tileset_t* tileset)
+{
+	return atlas_image(tileset->atlas);
+}
+
+rect_t
+tileset_uv(const tileset_t* tileset, int tile_index)
+{
+	// note: this returns the pixel coordinates, within the tileset texture, of the
+	//       image currently being shown for the tile.  for animated tiles this changes
+	//       as the animation runs.
+	return atlas_xy(tileset->atlas, tileset->tiles[tile_index].image_index);
+}
+
+bool
+tileset_animated(const tileset_t* tileset, int tile_index)
+{
+	// a tile whose countdown has run out stays on its current frame until its delay is
+	// changed, so only tiles in the schedule can still change on their own.
+	return tileset->tiles[tile_index].schedule_slot >= 0;
+}
+
+bool
+tileset_rescheduled(const tileset_t* tileset)
+{
+	// note: this is true after a tileset_update() if, since the update before it,
+	//       tileset_set_delay() restarted tiles which had stopped animating.  those
+	//       tiles weren't reported by tileset_animated() before, so anything caching
+	//       tile geometry needs to look at the whole map again.
+	return tileset->frames > 0 && tileset->wake_frame == tileset->frames;
+}
+
+bool
+tileset_changed(const tileset_t* tileset, int tile_index)
+{
+	// note: this only covers the most recent call to tileset_update().
+	return tileset->frames > 0
+		&& tileset->tiles[tile_index].changed_frame == tileset->frames;
+}
+
 void
 tileset_get_size(const tileset_t* tileset, int* out_w, int* out_h)
 {
@@ -277,7 +340,24 @@ tileset_set_next(tileset_t* tileset, int tile_index, int next_index)
 void
 tileset_set_delay(tileset_t* tileset, int tile_index, int delay)
 {
+	struct tile* tile;
+
+	int i;
+
 	tileset->tiles[tile_index].delay = delay;
+
+	// tiles already counting down pick up the new delay the next time they land on this
+	// frame.  tiles stopped on it (because it used to have no delay) have to be woken up
+	// here, otherwise they would never be looked at again.
+	if (delay <= 0)
+		return;
+	for (i = 0; i < tileset->num_tiles; ++i) {
+		tile = &tileset->tiles[i];
+		if (tile->image_index == tile_index && tile->schedule_slot < 0) {
+			schedule_push(tileset, i, delay);
+			tileset->wake_frame = tileset->frames + 1;
+		}
+	}
 }
 
 void
@@ -310,20 +390,36 @@ tileset_set_name(tileset_t* tileset, int tile_index, const lstring_t* name)
 	return true;
 }
 
-void
+bool
 tileset_update(tileset_t* tileset)
 {
-	struct tile* tile;
+	// returns true if any tile changed its image or was restarted.  callers caching
+	// tile geometry can use tileset_changed() and tileset_rescheduled() to find out
+	// what to update.
 
-	int i;
-
-	for (i = 0; i < tileset->num_tiles; ++i) {
-		tile = &tileset->tiles[i];
-		if (tile->frames_left > 0 && --tile->frames_left == 0) {
-			tile->image_index = tileset_get_next(tileset, tile->image_index);
-			tile->frames_left = tileset_get_delay(tileset, tile->image_index);
-		}
+	int          delay;
+	bool         has_changed;
+	struct tile* tile;
+	int          tile_index;
+
+	++tileset->frames;
+	has_changed = tileset->wake_frame == tileset->frames;
+
+	// only tiles due this frame are visited; everything else in the schedule stays put.
+	while (tileset->num_scheduled > 0) {
+		tile_index = tileset->schedule[0];
+		tile = &tileset->tiles[tile_index];
+		if ((int32_t)(tile->due_frame - tileset->frames) > 0)
+			break;
+		schedule_pop(tileset);
+		tile->image_index = tileset_get_next(tileset, tile->image_index);
+		tile->changed_frame = tileset->frames;
+		delay = tileset_get_delay(tileset, tile->image_index);
+		if (delay > 0)
+			schedule_push(tileset, tile_index, delay);
+		has_changed = true;
 	}
+	return has_changed;
 }
 
 void
@@ -335,3 +431,81 @@ tileset_draw(const tileset_t* tileset, color_t mask, float x, float y, int tile_
 	al_draw_tinted_bitmap(image_bitmap(tileset->tiles[tile_index].image),
 		nativecolor(mask), x, y, 0x0);
 }
+
+static bool
+is_due_before(const tileset_t* tileset, int tile_a, int tile_b)
+{
+	// note: frame numbers are compared as a signed difference so the schedule keeps
+	//       working after the frame counter wraps around.
+	return (int32_t)(tileset->tiles[tile_a].due_frame - tileset->tiles[tile_b].due_frame) < 0;
+}
+
+static void
+schedule_pop(tileset_t* tileset)
+{
+	int tile_index;
+
+	tile_index = tileset->schedule[0];
+	tileset->tiles[tile_index].schedule_slot = -1;
+	if (--tileset->num_scheduled == 0)
+		return;
+	tileset->schedule[0] = tileset->schedule[tileset->num_scheduled];
+	tileset->tiles[tileset->schedule[0]].schedule_slot = 0;
+	sift_down(tileset, 0);
+}
+
+static void
+schedule_push(tileset_t* tileset, int tile_index, int num_frames)
+{
+	struct tile* tile;
+	int          slot;
+
+	tile = &tileset->tiles[tile_index];
+	tile->due_frame = tileset->frames + (uint32_t)num_frames;
+	slot = tileset->num_scheduled++;
+	tileset->schedule[slot] = tile_index;
+	tile->schedule_slot = slot;
+	sift_up(tileset, slot);
+}
+
+static void
+sift_down(tileset_t* tileset, int slot)
+{
+	int child;
+	int tile_index;
+
+	tile_index = tileset->schedule[slot];
+	while ((child = slot * 2 + 1) < tileset->num_scheduled) {
+		if (child + 1 < tileset->num_scheduled
+			&& is_due_before(tileset, tileset->schedule[child + 1], tileset->schedule[child]))
+		{
+			++child;
+		}
+		if (!is_due_before(tileset, tileset->schedule[child], tile_index))
+			break;
+		tileset->schedule[slot] = tileset->schedule[child];
+		tileset->tiles[tileset->schedule[slot]].schedule_slot = slot;
+		slot = child;
+	}
+	tileset->schedule[slot] = tile_index;
+	tileset->tiles[tile_index].schedule_slot = slot;
+}
+
+static void
+sift_up(tileset_t* tileset, int slot)
+{
+	int parent;
+	int tile_index;
+
+	tile_index = tileset->schedule[slot];
+	while (slot > 0) {
+		parent = (slot - 1) / 2;
+		if (!is_due_before(tileset, tile_index, tileset->schedule[parent]))
+			break;
+		tileset->schedule[slot] = tileset->schedule[parent];
+		tileset->tiles[tileset->schedule[slot]].schedule_slot = slot;
+		slot = parent;
+	}
+	tileset->schedule[slot] = tile_index;
+	tileset->tiles[tile_index].schedule_slot = slot;
+}
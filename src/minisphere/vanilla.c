@@ -3694,7 +3694,7 @@ js_GetTileWidth(int num_args, bool is_ctor, intptr_t magic)
 static bool
 js_GetTime(int num_args, bool is_ctor, intptr_t magic)
 {
-	jsal_push_number(floor(al_get_time() * 1000));
+	jsal_push_number(floor(sphere_now() * 1000));
 	return true;
 }
 
@@ -4345,16 +4345,15 @@ js_IsMouseButtonPressed(int num_args, bool is_ctor, intptr_t magic)
 {
 	int                 button;
 	int                 button_id;
-	ALLEGRO_DISPLAY*    display;
+	bool                in_window;
 	ALLEGRO_MOUSE_STATE mouse_state;
 
 	button = jsal_to_int(0);
 	button_id = button == MOUSE_BUTTON_RIGHT ? 2
 		: button == MOUSE_BUTTON_MIDDLE ? 3
 		: 1;
-	al_get_mouse_state(&mouse_state);
-	display = screen_display(g_screen);
-	jsal_push_boolean(mouse_state.display == display && al_mouse_button_down(&mouse_state, button_id));
+	in_window = mouse_get_state(&mouse_state);
+	jsal_push_boolean(in_window && al_mouse_button_down(&mouse_state, button_id));
 	return true;
 }
 
@@ -6873,9 +6872,11 @@ js_Font_drawZoomedText(int num_args, bool is_ctor, intptr_t magic)
 	width = font_get_width(font, text);
 	height = font_height(font);
 	bitmap = al_create_bitmap(width, height);
+	galileo_flush();
 	old_target = al_get_target_bitmap();
 	al_set_target_bitmap(bitmap);
 	font_draw_text(font, 0, 0, TEXT_ALIGN_LEFT, text);
+	galileo_flush();
 	al_set_target_bitmap(old_target);
 
 	galileo_reset();
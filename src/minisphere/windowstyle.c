@@ -34,6 +34,7 @@
 #include "windowstyle.h"
 
 #include "color.h"
+#include "galileo.h"
 #include "image.h"
 
 enum back_mode
@@ -200,15 +201,15 @@ winstyle_draw(windowstyle_t* it, int x, int y, int width, int height)
 		image_draw_scaled_masked(it->images[8], mask, x, y, width, height);
 		break;
 	case BG_GRADIENT:
-		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
+		galileo_draw_prim(NULL, verts, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	case BG_TILE_GRADIENT:
 		image_draw_tiled_masked(it->images[8], mask, x, y, width, height);
-		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
+		galileo_draw_prim(NULL, verts, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	case BG_STRETCH_GRADIENT:
 		image_draw_scaled_masked(it->images[8], mask, x, y, width, height);
-		al_draw_prim(verts, NULL, NULL, 0, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
+		galileo_draw_prim(NULL, verts, 4, ALLEGRO_PRIM_TRIANGLE_STRIP);
 		break;
 	}
 	image_draw_masked(it->images[0], mask, x - w[0], y - h[0]);
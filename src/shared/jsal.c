@@ -45,6 +45,7 @@
 #include <limits.h>
 #include <math.h>
 #include <setjmp.h>
+#include <string.h>
 #if !defined(_WIN32)
 #include <alloca.h>
 #else
@@ -64,6 +65,8 @@
 #define jsal_jmpbuf               jmp_buf
 #endif
 
+#define MAX_PROPERTY_NAMES 4096
+
 struct js_ref
 {
 	bool  weak_ref;
@@ -86,9 +89,23 @@ struct function
 	int           min_args;
 };
 
+struct hash_slot
+{
+	uint32_t hash;
+	int      value;
+};
+
+struct hash_table
+{
+	int               num_slots;
+	int               num_used;
+	struct hash_slot* slots;
+};
+
 struct module
 {
 	char*          filename;
+	uint32_t       hash;
 	JsModuleRecord record;
 };
 
@@ -107,6 +124,14 @@ struct object
 	JsValueRef     object;
 };
 
+struct property_name
+{
+	uint32_t        hash;
+	JsPropertyIdRef key;
+	size_t          length;
+	char*           name;
+};
+
 struct rejection
 {
 	bool       handled;
@@ -114,20 +139,45 @@ struct rejection
 	JsValueRef value;
 };
 
+struct script_info
+{
+	char*        filename;
+	unsigned int script_id;
+};
+
+struct serialized_script
+{
+	JsValueRef      bytecode;
+	JsSourceContext source_context;
+	JsValueRef      source;
+};
+
 static void CHAKRA_CALLBACK        on_debugger_event           (JsDiagDebugEvent event_type, JsValueRef data, void* userdata);
 static JsErrorCode CHAKRA_CALLBACK on_fetch_dynamic_import     (JsSourceContext importer, JsValueRef specifier, JsModuleRecord *out_module);
 static JsErrorCode CHAKRA_CALLBACK on_fetch_imported_module    (JsModuleRecord importer, JsValueRef specifier, JsModuleRecord *out_module);
 static void CHAKRA_CALLBACK        on_finalize_host_object     (void* userdata);
 static JsValueRef CHAKRA_CALLBACK  on_js_to_native_call        (JsValueRef callee, JsValueRef argv[], unsigned short argc, JsNativeFunctionInfo* env, void* userdata);
+static bool CHAKRA_CALLBACK        on_load_serialized_source   (JsSourceContext source_context, JsValueRef *out_source, JsParseScriptAttributes *out_attributes);
 static JsErrorCode CHAKRA_CALLBACK on_notify_module_ready      (JsModuleRecord module, JsValueRef exception);
 static void CHAKRA_CALLBACK        on_reject_promise_unhandled (JsValueRef promise, JsValueRef reason, bool handled, void* userdata);
 static void CHAKRA_CALLBACK        on_resolve_reject_promise   (JsValueRef function, void* userdata);
+static void                        add_script                  (unsigned int script_id, const char* filename);
 static void                        decode_debugger_value       (void);
 static const char*                 filename_from_script_id     (unsigned int script_id);
+static struct script_info*         find_script_by_id           (unsigned int script_id);
+static struct script_info*         find_script_by_name         (const char* filename);
 static void                        free_ref                    (js_ref_t* ref);
 static JsModuleRecord              get_module_record           (const char* specifier, JsModuleRecord parent, const char* url, bool *out_is_new);
+static JsPropertyIdRef             get_property_id             (const char* name);
 static js_ref_t*                   get_ref                     (int stack_index);
 static JsValueRef                  get_value                   (int stack_index);
+static uint32_t                    hash_string                 (const char* string, size_t length);
+static void                        hash_table_add              (struct hash_table* table, uint32_t hash, int value);
+static void                        hash_table_free             (struct hash_table* table);
+static int                         hash_table_next             (const struct hash_table* table, uint32_t hash, int *inout_slot);
+static void                        inspect_frame               (void);
+static JsPropertyIdRef             intern_property_id          (const char* name, size_t length, uint32_t hash);
+static void                        load_script_list            (void);
 static JsPropertyIdRef             make_property_id            (JsValueRef key_value);
 static js_ref_t*                   make_ref                    (JsRef value, bool weak_ref);
 static JsValueRef                  pop_value                   (void);
@@ -143,33 +193,40 @@ static int asprintf  (char* *out, const char* format, ...);
 static int vasprintf (char* *out, const char* format, va_list ap);
 #endif
 
-static js_break_callback_t  s_break_callback = NULL;
-static vector_t*            s_breakpoints;
-static JsValueRef           s_callee_value = JS_INVALID_REFERENCE;
-static jsal_jmpbuf*         s_catch_label = NULL;
-static js_import_callback_t s_import_callback = NULL;
-static js_job_callback_t    s_job_callback = NULL;
-static JsContextRef         s_js_context;
-static JsValueRef           s_js_false;
-static JsValueRef           s_js_null;
-static JsRuntimeHandle      s_js_runtime = NULL;
-static JsValueRef           s_js_true;
-static JsValueRef           s_js_undefined;
-static js_ref_t*            s_key_done;
-static js_ref_t*            s_key_length;
-static js_ref_t*            s_key_next;
-static js_ref_t*            s_key_value;
-static vector_t*            s_module_cache;
-static vector_t*            s_module_jobs;
-static JsValueRef           s_newtarget_value = JS_INVALID_REFERENCE;
-static JsSourceContext      s_next_source_context = 1;
-static js_reject_callback_t s_reject_callback = NULL;
-static vector_t*            s_rejections;
-static int                  s_stack_base;
-static JsValueRef           s_stash;
-static JsValueRef           s_this_value = JS_INVALID_REFERENCE;
-static vector_t*            s_value_stack;
-static js_throw_callback_t  s_throw_callback = NULL;
+static js_break_callback_t   s_break_callback = NULL;
+static vector_t*             s_breakpoints;
+static JsValueRef            s_callee_value = JS_INVALID_REFERENCE;
+static jsal_jmpbuf*          s_catch_label = NULL;
+static js_import_callback_t  s_import_callback = NULL;
+static js_job_callback_t     s_job_callback = NULL;
+static JsContextRef          s_js_context;
+static JsValueRef            s_js_false;
+static JsValueRef            s_js_null;
+static JsRuntimeHandle       s_js_runtime = NULL;
+static JsValueRef            s_js_true;
+static JsValueRef            s_js_undefined;
+static js_ref_t*             s_key_done;
+static js_ref_t*             s_key_length;
+static js_ref_t*             s_key_next;
+static js_ref_t*             s_key_value;
+static vector_t*             s_module_cache;
+static struct hash_table     s_module_index;
+static vector_t*             s_module_jobs;
+static JsValueRef            s_newtarget_value = JS_INVALID_REFERENCE;
+static JsSourceContext       s_next_source_context = 1;
+static int                   s_num_property_names;
+static struct property_name* s_property_names;
+static js_reject_callback_t  s_reject_callback = NULL;
+static vector_t*             s_rejections;
+static struct hash_table     s_script_ids;
+static vector_t*             s_script_list;
+static struct hash_table     s_script_names;
+static vector_t*             s_serialized_scripts;
+static int                   s_stack_base;
+static JsValueRef            s_stash;
+static JsValueRef            s_this_value = JS_INVALID_REFERENCE;
+static vector_t*             s_value_stack;
+static js_throw_callback_t   s_throw_callback = NULL;
 
 bool
 jsal_init(void)
@@ -209,8 +266,12 @@ jsal_init(void)
 	s_stack_base = 0;
 	s_breakpoints = vector_new(sizeof(struct breakpoint));
 	s_module_cache = vector_new(sizeof(struct module));
+	s_script_list = vector_new(sizeof(struct script_info));
 	s_module_jobs = vector_new(sizeof(struct module_job));
 	s_rejections = vector_new(sizeof(struct rejection));
+	s_serialized_scripts = vector_new(sizeof(struct serialized_script));
+	s_property_names = calloc(MAX_PROPERTY_NAMES, sizeof(struct property_name));
+	s_num_property_names = 0;
 
 	vector_reserve(s_value_stack, 128);
 
@@ -231,10 +292,13 @@ on_error:
 void
 jsal_uninit(void)
 {
-	struct breakpoint* breakpoint;
-	struct module*     module;
+	struct breakpoint*        breakpoint;
+	struct module*            module;
+	struct script_info*       info;
+	struct serialized_script* script;
 
 	iter_t iter;
+	int    i;
 
 	jsal_unref(s_key_done);
 	jsal_unref(s_key_length);
@@ -252,15 +316,37 @@ jsal_uninit(void)
 		JsRelease(module->record, NULL);
 		free(module->filename);
 	}
+	iter = vector_enum(s_script_list);
+	while ((info = iter_next(&iter)))
+		free(info->filename);
+
+	for (i = 0; i < MAX_PROPERTY_NAMES; ++i) {
+		if (s_property_names[i].name == NULL)
+			continue;
+		JsRelease(s_property_names[i].key, NULL);
+		free(s_property_names[i].name);
+	}
+
+	iter = vector_enum(s_serialized_scripts);
+	while ((script = iter_next(&iter))) {
+		JsRelease(script->bytecode, NULL);
+		JsRelease(script->source, NULL);
+	}
 
 	// clear value stack, releasing all references
 	resize_stack(0);
 
 	vector_free(s_breakpoints);
 	vector_free(s_module_cache);
+	vector_free(s_script_list);
+	hash_table_free(&s_module_index);
+	hash_table_free(&s_script_ids);
+	hash_table_free(&s_script_names);
 	vector_free(s_module_jobs);
 	vector_free(s_value_stack);
 	vector_free(s_rejections);
+	vector_free(s_serialized_scripts);
+	free(s_property_names);
 	JsRelease(s_stash, NULL);
 	JsSetCurrentContext(JS_INVALID_REFERENCE);
 	JsDisposeRuntime(s_js_runtime);
@@ -442,6 +528,60 @@ jsal_compile(const char* filename)
 	return (unsigned int)s_next_source_context++;
 }
 
+bool
+jsal_compile_bytecode(const char* filename, const void* bytecode, size_t size)
+{
+	/* [ ... source ] -> [ ... function ] */
+
+	// note: the source is still needed as ChakraCore loads it lazily, e.g. for
+	//       Function#toString() and the debugger.  if the bytecode can't be used, for
+	//       instance because it came from a different version of ChakraCore, this
+	//       returns false and leaves the source on the stack to be compiled normally.
+
+	JsValueRef               buffer;
+	ChakraBytePtr            buffer_ptr;
+	unsigned int             buffer_size;
+	JsValueRef               exception;
+	JsValueRef               function;
+	bool                     has_exception;
+	JsValueRef               name_string;
+	JsErrorCode              result;
+	struct serialized_script script;
+
+	if (size > UINT_MAX)
+		return false;
+	if (JsCreateArrayBuffer((unsigned int)size, &buffer) != JsNoError)
+		return false;
+	JsGetArrayBufferStorage(buffer, &buffer_ptr, &buffer_size);
+	memcpy(buffer_ptr, bytecode, size);
+
+	// the source has to be available before parsing in case ChakraCore asks for it
+	// right away
+	script.bytecode = buffer;
+	script.source_context = s_next_source_context;
+	script.source = get_value(-1);
+	JsAddRef(script.bytecode, NULL);
+	JsAddRef(script.source, NULL);
+	vector_push(s_serialized_scripts, &script);
+
+	JsCreateString(filename, strlen(filename), &name_string);
+	result = JsParseSerialized(buffer, on_load_serialized_source, s_next_source_context,
+		name_string, &function);
+	if (result != JsNoError) {
+		JsHasException(&has_exception);
+		if (has_exception)
+			JsGetAndClearException(&exception);
+		vector_pop(s_serialized_scripts, 1);
+		JsRelease(script.bytecode, NULL);
+		JsRelease(script.source, NULL);
+		return false;
+	}
+	jsal_pop(1);
+	push_value(function, false);
+	++s_next_source_context;
+	return true;
+}
+
 void
 jsal_construct(int num_args)
 {
@@ -499,10 +639,16 @@ jsal_def_prop_string(int object_index, const char* name)
 {
 	/* [ ... descriptor ] -> [ ... ] */
 
-	object_index = jsal_normalize_index(object_index);
-	jsal_push_string(name);
-	jsal_insert(-2);
-	jsal_def_prop(object_index);
+	JsValueRef      descriptor;
+	JsPropertyIdRef key;
+	JsValueRef      object;
+	bool            result;
+
+	object = get_value(object_index);
+	key = get_property_id(name);
+	descriptor = pop_value();
+	JsDefineProperty(object, key, descriptor, &result);
+	throw_on_error();
 }
 
 bool
@@ -559,9 +705,17 @@ jsal_del_prop_index(int object_index, int name)
 bool
 jsal_del_prop_string(int object_index, const char* name)
 {
-	object_index = jsal_normalize_index(object_index);
-	jsal_push_string(name);
-	return jsal_del_prop(object_index);
+	JsPropertyIdRef key;
+	JsValueRef      object;
+	JsValueRef      result;
+	bool            retval;
+
+	object = get_value(object_index);
+	key = get_property_id(name);
+	JsDeleteProperty(object, key, true, &result);
+	throw_on_error();
+	JsBooleanToBool(result, &retval);
+	return retval;
 }
 
 int
@@ -696,8 +850,16 @@ jsal_get_global_string(const char* name)
 {
 	/* [ ... ] -> [ ... value ] */
 
-	jsal_push_string(name);
-	return jsal_get_global();
+	JsPropertyIdRef key;
+	JsValueRef      object;
+	JsValueRef      value;
+
+	key = get_property_id(name);
+	JsGetGlobalObject(&object);
+	JsGetProperty(object, key, &value);
+	throw_on_error();
+	push_value(value, true);
+	return value != s_js_undefined;
 }
 
 void*
@@ -847,7 +1009,7 @@ jsal_get_prop_string(int object_index, const char* name)
 	JsValueRef      value;
 
 	object_ref = get_ref(object_index);
-	JsCreatePropertyId(name, strlen(name), &key);
+	key = get_property_id(name);
 	JsGetProperty(object_ref->value, key, &value);
 	throw_on_error();
 	push_value(value, object_ref->weak_ref);
@@ -918,9 +1080,14 @@ jsal_has_own_prop_index(int object_index, int name)
 bool
 jsal_has_own_prop_string(int object_index, const char* name)
 {
-	object_index = jsal_normalize_index(object_index);
-	jsal_push_string(name);
-	return jsal_has_own_prop(object_index);
+	bool            has_property;
+	JsPropertyIdRef key;
+	JsValueRef      object;
+
+	object = get_value(object_index);
+	key = get_property_id(name);
+	JsHasOwnProperty(object, key, &has_property);
+	return has_property;
 }
 
 bool
@@ -949,9 +1116,14 @@ jsal_has_prop_index(int object_index, int name)
 bool
 jsal_has_prop_string(int object_index, const char* name)
 {
-	object_index = jsal_normalize_index(object_index);
-	jsal_push_string(name);
-	return jsal_has_prop(object_index);
+	bool            has_property;
+	JsPropertyIdRef key;
+	JsValueRef      object;
+
+	object = get_value(object_index);
+	key = get_property_id(name);
+	JsHasProperty(object, key, &has_property);
+	return has_property;
 }
 
 void
@@ -1024,6 +1196,32 @@ jsal_is_buffer(int stack_index)
 		|| type == JsTypedArray;
 }
 
+bool
+jsal_is_buffer_type(int stack_index, js_buffer_type_t type)
+{
+	JsTypedArrayType array_type;
+	JsValueRef       ref;
+	JsValueType      value_type;
+
+	ref = get_value(stack_index);
+	JsGetValueType(ref, &value_type);
+	if (value_type == JsArrayBuffer)
+		return type == JS_ARRAYBUFFER;
+	if (value_type != JsTypedArray)
+		return false;
+	JsGetTypedArrayInfo(ref, &array_type, NULL, NULL, NULL);
+	return type == JS_INT8ARRAY ? array_type == JsArrayTypeInt8
+		: type == JS_INT16ARRAY ? array_type == JsArrayTypeInt16
+		: type == JS_INT32ARRAY ? array_type == JsArrayTypeInt32
+		: type == JS_UINT8ARRAY ? array_type == JsArrayTypeUint8
+		: type == JS_UINT8ARRAY_CLAMPED ? array_type == JsArrayTypeUint8Clamped
+		: type == JS_UINT16ARRAY ? array_type == JsArrayTypeUint16
+		: type == JS_UINT32ARRAY ? array_type == JsArrayTypeUint32
+		: type == JS_FLOAT32ARRAY ? array_type == JsArrayTypeFloat32
+		: type == JS_FLOAT64ARRAY ? array_type == JsArrayTypeFloat64
+		: false;
+}
+
 bool
 jsal_is_error(int stack_index)
 {
@@ -1660,7 +1858,7 @@ jsal_put_prop_string(int object_index, const char* name)
 
 	object = get_value(object_index);
 	value = pop_value();
-	JsCreatePropertyId(name, strlen(name), &key);
+	key = get_property_id(name);
 	JsSetProperty(object, key, value, true);
 	throw_on_error();
 }
@@ -1874,6 +2072,33 @@ jsal_require_undefined(int at_index)
 	}
 }
 
+void*
+jsal_serialize(int at_index, size_t *out_size)
+{
+	// note: the value at 'at_index' should be the source code of a script, not a compiled
+	//       function.  returns NULL if the script can't be compiled.
+
+	JsValueRef    buffer;
+	ChakraBytePtr buffer_ptr;
+	unsigned int  buffer_size;
+	void*         bytecode;
+	JsValueRef    exception;
+	bool          has_exception;
+
+	if (JsSerialize(get_value(at_index), &buffer, JsParseScriptAttributeNone) != JsNoError) {
+		JsHasException(&has_exception);
+		if (has_exception)
+			JsGetAndClearException(&exception);
+		return NULL;
+	}
+	JsGetArrayBufferStorage(buffer, &buffer_ptr, &buffer_size);
+	if (!(bytecode = malloc(buffer_size)))
+		return NULL;
+	memcpy(bytecode, buffer_ptr, buffer_size);
+	*out_size = buffer_size;
+	return bytecode;
+}
+
 void
 jsal_set_finalizer(int at_index, js_finalizer_t callback)
 {
@@ -2260,37 +2485,51 @@ jsal_debug_breakpoint_remove(int index)
 	vector_remove(s_breakpoints, index);
 }
 
+int
+jsal_debug_inspect_backtrace(void)
+{
+	/* [ ... ] -> [ ... backtrace ] */
+
+	// note: the backtrace is fetched from the debugger only once, so this is much
+	//       cheaper than calling jsal_debug_inspect_call() for every frame.  each
+	//       entry is an object { filename, name, line, column }, innermost first.
+
+	JsValueRef backtrace;
+	int        num_frames;
+
+	int i;
+
+	if (JsDiagGetStackTrace(&backtrace) != JsNoError)
+		return -1;
+	push_value(backtrace, true);
+	num_frames = jsal_get_length(-1);
+	jsal_push_new_array();
+	for (i = 0; i < num_frames; ++i) {
+		jsal_push_new_object();
+		jsal_get_prop_index(-3, i);
+		inspect_frame();
+		jsal_put_prop_string(-5, "column");
+		jsal_put_prop_string(-4, "line");
+		jsal_put_prop_string(-3, "name");
+		jsal_put_prop_string(-2, "filename");
+		jsal_put_prop_index(-2, i);
+	}
+	jsal_remove(-2);
+	return num_frames;
+}
+
 bool
 jsal_debug_inspect_call(int call_index)
 {
 	/* [ ... ] -> [ ... filename function_name line column ] */
 
-	JsValueRef   backtrace;
-	unsigned int handle;
-	JsValueRef   function_data;
+	JsValueRef backtrace;
 
 	if (JsDiagGetStackTrace(&backtrace) != JsNoError)
 		return false;
 	push_value(backtrace, true);
 	if (jsal_get_prop_index(-1, call_index)) {
-		jsal_get_prop_string(-1, "scriptId");
-		jsal_push_string(filename_from_script_id(jsal_get_uint(-1)));
-		jsal_replace(-2);
-
-		jsal_get_prop_string(-2, "functionHandle");
-		handle = jsal_get_uint(-1);
-		JsDiagGetObjectFromHandle(handle, &function_data);
-		push_value(function_data, true);
-		if (!jsal_get_prop_string(-1, "name")) {
-			jsal_pop(1);
-			jsal_push_string("");
-		}
-		jsal_remove(-2);
-		jsal_remove(-2);
-
-		jsal_get_prop_string(-3, "line");
-		jsal_get_prop_string(-4, "column");
-		jsal_remove(-5);
+		inspect_frame();
 		jsal_remove(-5);
 		return true;
 	}
@@ -2381,6 +2620,22 @@ jsal_debug_inspect_var(int call_index, int var_index)
 	}
 }
 
+static void
+add_script(unsigned int script_id, const char* filename)
+{
+	struct script_info info;
+	int                index;
+
+	if (filename == NULL || find_script_by_id(script_id) != NULL)
+		return;
+	info.filename = strdup(filename);
+	info.script_id = script_id;
+	index = vector_len(s_script_list);
+	vector_push(s_script_list, &info);
+	hash_table_add(&s_script_ids, script_id * 2654435761u, index);
+	hash_table_add(&s_script_names, hash_string(filename, strlen(filename)), index);
+}
+
 static void
 decode_debugger_value(void)
 {
@@ -2427,6 +2682,15 @@ free_ref(js_ref_t* ref)
 	free(ref);
 }
 
+static JsPropertyIdRef
+get_property_id(const char* name)
+{
+	size_t length;
+
+	length = strlen(name);
+	return intern_property_id(name, length, hash_string(name, length));
+}
+
 static js_ref_t*
 get_ref(int stack_index)
 {
@@ -2447,6 +2711,168 @@ get_value(int stack_index)
 	return ref->value;
 }
 
+static uint32_t
+hash_string(const char* string, size_t length)
+{
+	uint32_t hash = 2166136261u;
+
+	size_t i;
+
+	// 32-bit FNV-1a
+	for (i = 0; i < length; ++i) {
+		hash ^= (uint8_t)string[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void
+hash_table_add(struct hash_table* table, uint32_t hash, int value)
+{
+	struct hash_slot* old_slots;
+	int               old_size;
+	int               slot;
+
+	int i;
+
+	// keep the table at most 3/4 full so probe sequences stay short.  the table only
+	// ever grows; nothing is ever removed from it.
+	if ((table->num_used + 1) * 4 > table->num_slots * 3) {
+		old_slots = table->slots;
+		old_size = table->num_slots;
+		table->num_slots = old_size > 0 ? old_size * 2 : 64;
+		table->slots = malloc(table->num_slots * sizeof(struct hash_slot));
+		for (i = 0; i < table->num_slots; ++i)
+			table->slots[i].value = -1;
+		table->num_used = 0;
+		for (i = 0; i < old_size; ++i) {
+			if (old_slots[i].value >= 0)
+				hash_table_add(table, old_slots[i].hash, old_slots[i].value);
+		}
+		free(old_slots);
+	}
+	slot = hash & (table->num_slots - 1);
+	while (table->slots[slot].value >= 0)
+		slot = (slot + 1) & (table->num_slots - 1);
+	table->slots[slot].hash = hash;
+	table->slots[slot].value = value;
+	++table->num_used;
+}
+
+static void
+hash_table_free(struct hash_table* table)
+{
+	free(table->slots);
+	table->slots = NULL;
+	table->num_slots = 0;
+	table->num_used = 0;
+}
+
+static int
+hash_table_next(const struct hash_table* table, uint32_t hash, int *inout_slot)
+{
+	// note: returns the value of the next entry with the given hash, or -1 if there are
+	//       no more.  '*inout_slot' should be -1 to begin a new lookup.  different keys
+	//       can have the same hash, so the caller still needs to compare the keys.
+
+	int slot;
+
+	if (table->num_slots == 0)
+		return -1;
+	slot = *inout_slot < 0 ? (int)(hash & (table->num_slots - 1))
+		: (*inout_slot + 1) & (table->num_slots - 1);
+	while (table->slots[slot].value >= 0) {
+		if (table->slots[slot].hash == hash) {
+			*inout_slot = slot;
+			return table->slots[slot].value;
+		}
+		slot = (slot + 1) & (table->num_slots - 1);
+	}
+	return -1;
+}
+
+static void
+inspect_frame(void)
+{
+	/* [ ... frame ] -> [ ... filename function_name line column ] */
+
+	unsigned int handle;
+	JsValueRef   function_data;
+
+	jsal_get_prop_string(-1, "scriptId");
+	jsal_push_string(filename_from_script_id(jsal_get_uint(-1)));
+	jsal_replace(-2);
+
+	jsal_get_prop_string(-2, "functionHandle");
+	handle = jsal_get_uint(-1);
+	JsDiagGetObjectFromHandle(handle, &function_data);
+	push_value(function_data, true);
+	if (!jsal_get_prop_string(-1, "name")) {
+		jsal_pop(1);
+		jsal_push_string("");
+	}
+	jsal_remove(-2);
+	jsal_remove(-2);
+
+	jsal_get_prop_string(-3, "line");
+	jsal_get_prop_string(-4, "column");
+	jsal_remove(-5);
+}
+
+static JsPropertyIdRef
+intern_property_id(const char* name, size_t length, uint32_t hash)
+{
+	// note: property IDs are interned in a hash table and kept alive for the life of
+	//       the runtime, so looking up the same name again doesn't have to go through
+	//       ChakraCore.  only names passed in from C (the *_prop_string() calls) are
+	//       interned; those come from a fixed set of string literals, while keys taken
+	//       from JS values are unbounded and would fill the table with one-off names.
+	//       the table has a fixed size; once it's 3/4 full, additional names are looked
+	//       up every time as before.
+
+	JsPropertyIdRef       key;
+	struct property_name* slot;
+	size_t                index;
+
+	index = hash & (MAX_PROPERTY_NAMES - 1);
+	while ((slot = &s_property_names[index])->name != NULL) {
+		if (slot->hash == hash && slot->length == length && memcmp(slot->name, name, length) == 0)
+			return slot->key;
+		index = (index + 1) & (MAX_PROPERTY_NAMES - 1);
+	}
+	JsCreatePropertyId(name, length, &key);
+	if (s_num_property_names < MAX_PROPERTY_NAMES * 3 / 4) {
+		if (!(slot->name = malloc(length + 1)))
+			return key;
+		memcpy(slot->name, name, length);
+		slot->name[length] = '\0';
+		slot->hash = hash;
+		slot->key = key;
+		slot->length = length;
+		JsAddRef(key, NULL);
+		++s_num_property_names;
+	}
+	return key;
+}
+
+static void
+load_script_list(void)
+{
+	JsValueRef script_list;
+
+	if (JsDiagGetScripts(&script_list) != JsNoError)
+		return;
+	push_value(script_list, true);
+	jsal_push_new_iterator(-1);
+	while (jsal_next(-1)) {
+		jsal_get_prop_string(-1, "scriptId");
+		if (jsal_get_prop_string(-2, "fileName"))
+			add_script(jsal_get_uint(-2), jsal_get_string(-1));
+		jsal_pop(3);
+	}
+	jsal_pop(2);
+}
+
 static JsPropertyIdRef
 make_property_id(JsValueRef key)
 {
@@ -2460,6 +2886,7 @@ make_property_id(JsValueRef key)
 		JsGetPropertyIdFromSymbol(key, &property_id);
 	}
 	else {
+		// note: dynamic keys aren't interned, see intern_property_id().
 		JsCopyString(key, NULL, 0, &key_length);
 		key_name = alloca(key_length);
 		JsCopyString(key, key_name, key_length, NULL);
@@ -2513,69 +2940,78 @@ push_debug_callback_args(JsValueRef event_data)
 static unsigned int
 script_id_from_filename(const char* filename)
 {
-	bool         have_name;
-	unsigned int script_id = UINT_MAX;
-	JsValueRef   script_list;
+	struct script_info* info;
 
-	JsDiagGetScripts(&script_list);
-	push_value(script_list, true);
-	jsal_push_new_iterator(-1);
-	while (jsal_next(-1)) {
-		have_name = jsal_get_prop_string(-1, "fileName");
-		if (have_name && strcmp(filename, jsal_get_string(-1)) == 0) {
-			jsal_get_prop_string(-2, "scriptId");
-			script_id = jsal_get_uint(-1);
-			jsal_pop(3);
-			break;
-		}
-		else {
-			jsal_pop(2);
-		}
+	// note: scripts compiled before the debugger was started are only known to
+	//       ChakraCore, so if the script isn't found, refresh the list and try again.
+	if (!(info = find_script_by_name(filename))) {
+		load_script_list();
+		info = find_script_by_name(filename);
 	}
-	jsal_pop(2);
-	return script_id;
+	return info != NULL ? info->script_id : UINT_MAX;
 }
 
 static const char*
 filename_from_script_id(unsigned int script_id)
 {
-	const char* filename = NULL;
-	JsValueRef  script_list;
+	struct script_info* info;
 
-	JsDiagGetScripts(&script_list);
-	push_value(script_list, true);
-	jsal_push_new_iterator(-1);
-	while (jsal_next(-1)) {
-		jsal_get_prop_string(-1, "scriptId");
-		if (script_id == jsal_get_uint(-1)) {
-			jsal_get_prop_string(-2, "fileName");
-			filename = jsal_get_string(-1);
-			jsal_pop(3);
-			break;
-		}
-		else {
-			jsal_pop(2);
-		}
+	if (!(info = find_script_by_id(script_id))) {
+		load_script_list();
+		info = find_script_by_id(script_id);
 	}
-	jsal_pop(2);
-	return filename;
+	return info != NULL ? info->filename : NULL;
+}
+
+static struct script_info*
+find_script_by_id(unsigned int script_id)
+{
+	struct script_info* info;
+	int                 index;
+	int                 slot = -1;
+
+	while ((index = hash_table_next(&s_script_ids, script_id * 2654435761u, &slot)) >= 0) {
+		info = vector_get(s_script_list, index);
+		if (info->script_id == script_id)
+			return info;
+	}
+	return NULL;
+}
+
+static struct script_info*
+find_script_by_name(const char* filename)
+{
+	uint32_t            hash;
+	struct script_info* info;
+	int                 index;
+	int                 slot = -1;
+
+	hash = hash_string(filename, strlen(filename));
+	while ((index = hash_table_next(&s_script_names, hash, &slot)) >= 0) {
+		info = vector_get(s_script_list, index);
+		if (strcmp(info->filename, filename) == 0)
+			return info;
+	}
+	return NULL;
 }
 
 static JsModuleRecord
 get_module_record(const char* specifier, JsModuleRecord parent_record, const char* url, bool *out_is_new)
 {
 	struct module* cached;
+	uint32_t       hash;
+	int            index;
 	struct module  module;
 	JsModuleRecord module_record;
+	int            slot = -1;
 	JsValueRef     specifier_ref;
 	JsValueRef     url_ref;
 
-	iter_t iter;
-
 	*out_is_new = false;
-	iter = vector_enum(s_module_cache);
-	while ((cached = iter_next(&iter))) {
-		if (strcmp(specifier, cached->filename) == 0)
+	hash = hash_string(specifier, strlen(specifier));
+	while ((index = hash_table_next(&s_module_index, hash, &slot)) >= 0) {
+		cached = vector_get(s_module_cache, index);
+		if (cached->hash == hash && strcmp(specifier, cached->filename) == 0)
 			return cached->record;
 	}
 
@@ -2590,7 +3026,9 @@ get_module_record(const char* specifier, JsModuleRecord parent_record, const cha
 	JsSetModuleHostInfo(module_record, JsModuleHostInfo_Url, url_ref);
 	JsAddRef(module_record, NULL);
 	module.filename = strdup(specifier);
+	module.hash = hash;
 	module.record = module_record;
+	hash_table_add(&s_module_index, hash, vector_len(s_module_cache));
 	vector_push(s_module_cache, &module);
 	return module_record;
 }
@@ -2688,6 +3126,7 @@ on_debugger_event(JsDiagDebugEvent event_type, JsValueRef data, void* userdata)
 			jsal_get_prop_string(-2, "fileName");
 			script_id = jsal_get_uint(-2);
 			filename = jsal_get_string(-1);
+			add_script(script_id, filename);
 			jsal_pop(3);
 			iter = vector_enum(s_breakpoints);
 			while (iter_next(&iter)) {
@@ -2917,6 +3356,24 @@ on_js_to_native_call(JsValueRef callee, JsValueRef argv[], unsigned short argc,
 	return retval;
 }
 
+static bool CHAKRA_CALLBACK
+on_load_serialized_source(JsSourceContext source_context, JsValueRef *out_source, JsParseScriptAttributes *out_attributes)
+{
+	struct serialized_script* script;
+
+	iter_t iter;
+
+	iter = vector_enum(s_serialized_scripts);
+	while ((script = iter_next(&iter))) {
+		if (script->source_context == source_context) {
+			*out_source = script->source;
+			*out_attributes = JsParseScriptAttributeNone;
+			return true;
+		}
+	}
+	return false;
+}
+
 static JsErrorCode CHAKRA_CALLBACK
 on_notify_module_ready(JsModuleRecord module, JsValueRef exception)
 {
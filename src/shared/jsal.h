@@ -101,6 +101,7 @@ void         jsal_on_reject_promise        (js_reject_callback_t callback);
 void         jsal_call                     (int num_args);
 void         jsal_call_method              (int num_args);
 unsigned int jsal_compile                  (const char* filename);
+bool         jsal_compile_bytecode         (const char* filename, const void* bytecode, size_t size);
 void         jsal_construct                (int num_args);
 void         jsal_def_prop                 (int object_index);
 void         jsal_def_prop_index           (int object_index, int name);
@@ -144,6 +145,7 @@ bool         jsal_is_array                 (int stack_index);
 bool         jsal_is_async_function        (int stack_index);
 bool         jsal_is_boolean               (int stack_index);
 bool         jsal_is_buffer                (int stack_index);
+bool         jsal_is_buffer_type           (int stack_index, js_buffer_type_t type);
 bool         jsal_is_error                 (int stack_index);
 bool         jsal_is_function              (int stack_index);
 bool         jsal_is_null                  (int stack_index);
@@ -214,6 +216,7 @@ const char*  jsal_require_string           (int at_index);
 void         jsal_require_symbol           (int at_index);
 unsigned int jsal_require_uint             (int at_index);
 void         jsal_require_undefined        (int at_index);
+void*        jsal_serialize                (int at_index, size_t *out_size);
 void         jsal_set_finalizer            (int at_index, js_finalizer_t callback);
 void         jsal_set_host_data            (int at_index, void* ptr);
 void         jsal_set_prototype            (int object_index);
@@ -241,6 +244,7 @@ void jsal_debug_on_throw           (js_throw_callback_t callback);
 int  jsal_debug_breakpoint_add     (const char* filename, unsigned int line, unsigned int column);
 void jsal_debug_breakpoint_inject  (void);
 void jsal_debug_breakpoint_remove  (int index);
+int  jsal_debug_inspect_backtrace  (void);
 bool jsal_debug_inspect_breakpoint (int index);
 bool jsal_debug_inspect_call       (int call_index);
 bool jsal_debug_inspect_eval       (int call_index, const char* source, bool *out_errored);
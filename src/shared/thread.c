@@ -0,0 +1,271 @@
+/**
+ *  miniSphere JavaScript game engine
+ *  Copyright (c) 2015-2018, Fat Cerberus
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of miniSphere nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include "thread.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+struct cond
+{
+#if defined(_WIN32)
+	CONDITION_VARIABLE handle;
+#else
+	pthread_cond_t handle;
+#endif
+};
+
+struct mutex
+{
+#if defined(_WIN32)
+	CRITICAL_SECTION handle;
+#else
+	pthread_mutex_t handle;
+#endif
+};
+
+struct thread
+{
+	thread_fn_t fn;
+	void*       udata;
+#if defined(_WIN32)
+	HANDLE      handle;
+#else
+	pthread_t   handle;
+#endif
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI thread_main (void* arg);
+#else
+static void*        thread_main (void* arg);
+#endif
+
+int
+thread_num_cpus(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+#else
+	long num_cpus;
+#endif
+
+#if defined(_WIN32)
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return num_cpus > 0 ? (int)num_cpus : 1;
+#else
+	return 1;
+#endif
+}
+
+thread_t*
+thread_new(thread_fn_t fn, void* udata)
+{
+	thread_t* thread;
+
+	if (!(thread = calloc(1, sizeof(thread_t))))
+		return NULL;
+	thread->fn = fn;
+	thread->udata = udata;
+#if defined(_WIN32)
+	if (!(thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL)))
+		goto on_error;
+#else
+	if (pthread_create(&thread->handle, NULL, thread_main, thread) != 0)
+		goto on_error;
+#endif
+	return thread;
+
+on_error:
+	free(thread);
+	return NULL;
+}
+
+void
+thread_join(thread_t* thread)
+{
+	if (thread == NULL)
+		return;
+#if defined(_WIN32)
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	free(thread);
+}
+
+void
+thread_sleep(double time)
+{
+#if defined(_WIN32)
+	Sleep((DWORD)(time * 1000.0));
+#else
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)time;
+	ts.tv_nsec = (long)((time - (double)ts.tv_sec) * 1000000000.0);
+	nanosleep(&ts, NULL);
+#endif
+}
+
+cond_t*
+cond_new(void)
+{
+	cond_t* cond;
+
+	if (!(cond = calloc(1, sizeof(cond_t))))
+		return NULL;
+#if defined(_WIN32)
+	InitializeConditionVariable(&cond->handle);
+#else
+	pthread_cond_init(&cond->handle, NULL);
+#endif
+	return cond;
+}
+
+void
+cond_free(cond_t* it)
+{
+	if (it == NULL)
+		return;
+#if !defined(_WIN32)
+	pthread_cond_destroy(&it->handle);
+#endif
+	free(it);
+}
+
+void
+cond_broadcast(cond_t* it)
+{
+#if defined(_WIN32)
+	WakeAllConditionVariable(&it->handle);
+#else
+	pthread_cond_broadcast(&it->handle);
+#endif
+}
+
+void
+cond_signal(cond_t* it)
+{
+#if defined(_WIN32)
+	WakeConditionVariable(&it->handle);
+#else
+	pthread_cond_signal(&it->handle);
+#endif
+}
+
+void
+cond_wait(cond_t* it, mutex_t* mutex)
+{
+#if defined(_WIN32)
+	SleepConditionVariableCS(&it->handle, &mutex->handle, INFINITE);
+#else
+	pthread_cond_wait(&it->handle, &mutex->handle);
+#endif
+}
+
+mutex_t*
+mutex_new(void)
+{
+	mutex_t* mutex;
+
+	if (!(mutex = calloc(1, sizeof(mutex_t))))
+		return NULL;
+#if defined(_WIN32)
+	InitializeCriticalSection(&mutex->handle);
+#else
+	pthread_mutex_init(&mutex->handle, NULL);
+#endif
+	return mutex;
+}
+
+void
+mutex_free(mutex_t* it)
+{
+	if (it == NULL)
+		return;
+#if defined(_WIN32)
+	DeleteCriticalSection(&it->handle);
+#else
+	pthread_mutex_destroy(&it->handle);
+#endif
+	free(it);
+}
+
+void
+mutex_lock(mutex_t* it)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(&it->handle);
+#else
+	pthread_mutex_lock(&it->handle);
+#endif
+}
+
+void
+mutex_unlock(mutex_t* it)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(&it->handle);
+#else
+	pthread_mutex_unlock(&it->handle);
+#endif
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI
+#else
+static void*
+#endif
+thread_main(void* arg)
+{
+	thread_t* thread = arg;
+
+	thread->fn(thread->udata);
+#if defined(_WIN32)
+	return 0;
+#else
+	return NULL;
+#endif
+}